@@ -0,0 +1,326 @@
+#include "PNGAnimation.h"
+#include "PNGThreads.h"
+#include "PNGReader.h"
+#include "PNGBudget.h"
+
+static int addFrame( AnimationIndex *Index, const Chunk *chunk ) {
+	AnimationFrame *frame;
+	if (Index->framesUsed == Index->framesAllocated) {
+		size_t allocated = Index->framesAllocated ? Index->framesAllocated * 2 : 8;
+		AnimationFrame *frames = (AnimationFrame*) realloc( Index->frames, allocated * sizeof(AnimationFrame) );
+		if (!frames)
+			return FALSE;
+		Index->frames = frames;
+		Index->framesAllocated = allocated;
+	}
+	frame = &Index->frames[Index->framesUsed++];
+	frame->sequence = getLastByte( chunk->Data );
+	frame->width = getLastByte( chunk->Data + 4 );
+	frame->height = getLastByte( chunk->Data + 8 );
+	frame->xOffset = getLastByte( chunk->Data + 12 );
+	frame->yOffset = getLastByte( chunk->Data + 16 );
+	frame->delayNum = getLastWord( chunk->Data + 20 );
+	frame->delayDen = getLastWord( chunk->Data + 22 );
+	frame->disposeOp = chunk->Data[24];
+	frame->blendOp = chunk->Data[25];
+	frame->firstSpan = Index->spansUsed;
+	frame->spanCount = 0;
+	return TRUE;
+}
+
+static int addSpan( AnimationIndex *Index, uint64_t Offset, size_t Length ) {
+	if (Index->spansUsed == Index->spansAllocated) {
+		size_t allocated = Index->spansAllocated ? Index->spansAllocated * 2 : 16;
+		AnimationSpan *spans = (AnimationSpan*) realloc( Index->spans, allocated * sizeof(AnimationSpan) );
+		if (!spans)
+			return FALSE;
+		Index->spans = spans;
+		Index->spansAllocated = allocated;
+	}
+	Index->spans[Index->spansUsed].offset = Offset;
+	Index->spans[Index->spansUsed].length = Length;
+	Index->spansUsed++;
+	Index->frames[Index->framesUsed - 1].spanCount++;
+	return TRUE;
+}
+
+/*
+ * fcTL and fdAT share one sequence that starts at 0
+ */
+static int isNextSequence( AnimationIndex *Index, const Chunk *chunk ) {
+	if (getLastByte( chunk->Data ) != Index->nextSequence)
+		return FALSE;
+	Index->nextSequence++;
+	return TRUE;
+}
+
+/*
+ * Add a validated chunk to the frame index of an APNG. Only the file offsets
+ * of the frame data are kept, the frames are decoded later from the file
+ */
+int indexAnimationChunk( PNGData *PNG, const Chunk *chunk ) {
+	AnimationIndex *index = PNG->animation;
+	/*offset of the chunk data, the CRC has just been read*/
+	uint64_t offset = PNG->fileOffset - sizeof(PNG->chunkCRC) - chunk->dataSize;
+
+	if (isChunkType( chunk->chunkType, "acTL" )) {
+		index = (AnimationIndex*) calloc( 1, sizeof(AnimationIndex) );
+		if (!index) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return FALSE;
+		}
+		index->frameCount = getLastByte( chunk->Data );
+		index->plays = getLastByte( chunk->Data + 4 );
+		PNG->animation = index;
+		return TRUE;
+	}
+	/*without acTL the file is a still image and frame chunks are ignored*/
+	if (!index)
+		return TRUE;
+
+	if (isChunkType( chunk->chunkType, "fcTL" )) {
+		if (!isNextSequence( index, chunk )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_ANIMATION, "INVALID ANIMATION SEQUENCE NUMBER\n" );
+			return FALSE;
+		}
+		if (index->framesUsed && !index->frames[index->framesUsed - 1].spanCount) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_ANIMATION, "ANIMATION FRAME WITHOUT DATA\n" );
+			return FALSE;
+		}
+		if (index->framesUsed == index->frameCount) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_ANIMATION, "TOO MANY ANIMATION FRAMES\n" );
+			return FALSE;
+		}
+		if (!PNG->chunkInfo.IDAT) {
+			/*fcTL before IDAT makes the default image the first frame*/
+			if (getLastByte( chunk->Data + 4 ) != PNG->chunkInfo.width ||
+					getLastByte( chunk->Data + 8 ) != PNG->chunkInfo.height ||
+					getLastByte( chunk->Data + 12 ) || getLastByte( chunk->Data + 16 )) {
+				reportError( &PNG->chunkInfo, PNG_ERROR_ANIMATION, "FIRST ANIMATION FRAME NOT THE FULL IMAGE\n" );
+				return FALSE;
+			}
+			index->defaultImageIsFrame = TRUE;
+		}
+		if (!addFrame( index, chunk )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return FALSE;
+		}
+	}
+	else if (isChunkType( chunk->chunkType, "IDAT" )) {
+		if (index->defaultImageIsFrame && !addSpan( index, offset, chunk->dataSize )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return FALSE;
+		}
+	}
+	else if (isChunkType( chunk->chunkType, "fdAT" )) {
+		if (!isNextSequence( index, chunk )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_ANIMATION, "INVALID ANIMATION SEQUENCE NUMBER\n" );
+			return FALSE;
+		}
+		/*the frame of the default image takes its data from IDAT only*/
+		if (!index->framesUsed || ( index->defaultImageIsFrame && index->framesUsed == 1 )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_ANIMATION, "fdAT WITHOUT FRAME CONTROL\n" );
+			return FALSE;
+		}
+		if (!addSpan( index, offset + FDAT_SEQUENCE_LENGTH, chunk->dataSize - FDAT_SEQUENCE_LENGTH )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Check that the file held every frame announced by acTL
+ */
+int finishAnimationIndex( PNGData *PNG ) {
+	AnimationIndex *index = PNG->animation;
+	if (!index)
+		return TRUE;
+	if (index->framesUsed != index->frameCount ||
+			!index->frames[index->framesUsed - 1].spanCount) {
+		reportError( &PNG->chunkInfo, PNG_ERROR_ANIMATION, "ANIMATION FRAME COUNT MISMATCH\n" );
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void freeAnimationIndex( AnimationIndex *Index ) {
+	if (!Index)
+		return;
+	free( Index->frames );
+	free( Index->spans );
+	free( Index );
+}
+
+/*
+ * Work shared by the frame decoding threads
+ */
+struct frameDecodeTask {
+	const AnimationIndex	*index;
+	const ChunkInfo			*chunkInfo;
+	const unsigned char		*fileData;
+	size_t					fileSize;
+	DecodedFrame			*frames;
+	int						keepPixels; //FALSE when the frames are only checked
+	int						memoryMode; //BUDGET_* of the buffers of the decoders
+};
+
+typedef struct frameDecodeTask FrameDecodeTask;
+
+static int storeFrameRow( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	DecodedFrame *frame = (DecodedFrame*) Context;
+	memcpy( frame->pixels + (size_t) Row * frame->header.rowBytes, Data, Length );
+	return TRUE;
+}
+
+static int unfilterFrameData( void *Context, const unsigned char *Data, size_t DataLength ) {
+	return unfilterData( (PNGUnfilter*) Context, Data, DataLength );
+}
+
+/*
+ * Every frame is a complete zlib stream, so the frames decode independently.
+ * Kept pixels are reserved without waiting: the frames decoded before hold
+ * theirs until the caller frees them, so a wait could only time out
+ */
+static void decodeFrame( void *Context, size_t Frame ) {
+	FrameDecodeTask *task = (FrameDecodeTask*) Context;
+	const AnimationFrame *control = &task->index->frames[Frame];
+	DecodedFrame *frame = &task->frames[Frame];
+	PNGInflater inflater;
+	PNGUnfilter unfilter;
+	RowSink sink = discardRow;
+	size_t span;
+
+	frame->pixels = NULL;
+	frame->errorCode = PNG_ERROR_NONE;
+	if (!setImageHeader( &frame->header, control->width, control->height, task->chunkInfo->bitDepth,
+			task->chunkInfo->colorType, task->chunkInfo->interlace ) ||
+			frame->header.rowBytes > SIZE_MAX / frame->header.height) {
+		frame->errorCode = PNG_ERROR_IMAGE_SIZE;
+		return;
+	}
+	if (task->keepPixels) {
+		size_t size = frame->header.rowBytes * frame->header.height;
+		if (!reserveMemory( size, BUDGET_FAIL )) {
+			frame->errorCode = PNG_ERROR_BUDGET;
+			return;
+		}
+		frame->pixels = (unsigned char*) malloc( size );
+		if (!frame->pixels) {
+			releaseMemory( size );
+			frame->errorCode = PNG_ERROR_MEMORY;
+			return;
+		}
+		sink = storeFrameRow;
+	}
+	memset( &inflater, 0, sizeof(inflater) );
+	memset( &unfilter, 0, sizeof(unfilter) );
+	if (!initInflater( &inflater, task->memoryMode ) ||
+			!initUnfilter( &unfilter, &frame->header, sink, frame, task->memoryMode )) {
+		if (inflater.errorCode == PNG_ERROR_BUDGET || unfilter.errorCode == PNG_ERROR_BUDGET)
+			frame->errorCode = PNG_ERROR_BUDGET;
+		else
+			frame->errorCode = PNG_ERROR_MEMORY;
+	}
+	for (span = control->firstSpan; !frame->errorCode && span < control->firstSpan + control->spanCount; span++) {
+		const AnimationSpan *data = &task->index->spans[span];
+		if (data->offset > task->fileSize || data->length > task->fileSize - data->offset) {
+			frame->errorCode = PNG_ERROR_TRUNCATED;
+		}
+		else if (!inflateData( &inflater, task->fileData + data->offset, data->length, unfilterFrameData, &unfilter )) {
+			frame->errorCode = unfilter.errorCode ? unfilter.errorCode : inflater.errorCode;
+		}
+	}
+	if (!frame->errorCode && !inflater.finished)
+		frame->errorCode = PNG_ERROR_DECODE;
+	if (!frame->errorCode && !unfilter.finished)
+		frame->errorCode = PNG_ERROR_IMAGE_SIZE;
+	freeInflater( &inflater );
+	freeUnfilter( &unfilter );
+}
+
+static int decodeFrames( const PNGData *PNG, const unsigned char *FileData, size_t FileSize,
+		DecodedFrame *Frames, unsigned int Threads, int KeepPixels ) {
+	FrameDecodeTask task;
+	size_t i;
+	if (!PNG->animation)
+		return FALSE;
+	task.index = PNG->animation;
+	task.chunkInfo = &PNG->chunkInfo;
+	task.fileData = FileData;
+	task.fileSize = FileSize;
+	task.frames = Frames;
+	task.keepPixels = KeepPixels;
+	task.memoryMode = getMemoryMode( PNG );
+	parallelFor( PNG->animation->framesUsed, Threads, decodeFrame, &task );
+	for (i = 0; i < PNG->animation->framesUsed; i++) {
+		if (Frames[i].errorCode)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Decode every frame of an indexed APNG from the whole file in memory, one
+ * frame per task. Frames holds framesUsed entries, the pixels are the raw
+ * frame regions before dispose and blend are applied. They count against
+ * the memory budget until freeDecodedFrames()
+ */
+int decodeAnimationFrames( const PNGData *PNG, const unsigned char *FileData, size_t FileSize,
+		DecodedFrame *Frames, unsigned int Threads ) {
+	return decodeFrames( PNG, FileData, FileSize, Frames, Threads, TRUE );
+}
+
+void freeDecodedFrames( DecodedFrame *Frames, size_t Count ) {
+	size_t i;
+	for (i = 0; i < Count; i++) {
+		if (!Frames[i].pixels)
+			continue;
+		free( Frames[i].pixels );
+		releaseMemory( Frames[i].header.rowBytes * Frames[i].header.height );
+		Frames[i].pixels = NULL;
+	}
+}
+
+/*
+ * Map a parsed APNG and decode its frames in parallel, printing one line
+ * per frame unless Quiet. The rows are dropped as they come out, so only
+ * the frames being decoded hold memory. Returns the PNG_ERROR_* of the
+ * first bad frame
+ */
+int decodeFileFrames( const char *FileName, const PNGData *PNG, int Quiet ) {
+	const AnimationIndex *index = PNG->animation;
+	DecodedFrame *frames;
+	const unsigned char *fileData;
+	size_t fileSize;
+	int errorCode = PNG_ERROR_NONE;
+	size_t i;
+
+	if (!index)
+		return PNG_ERROR_NONE;
+	fileData = mapFile( FileName, &fileSize );
+	if (!fileData)
+		return PNG_ERROR_IO;
+	frames = (DecodedFrame*) calloc( index->framesUsed, sizeof(DecodedFrame) );
+	if (frames) {
+		decodeFrames( PNG, fileData, fileSize, frames, getThreadCount(), FALSE );
+		for (i = 0; i < index->framesUsed; i++) {
+			if (!errorCode)
+				errorCode = frames[i].errorCode;
+			if (Quiet)
+				continue;
+			if (frames[i].errorCode)
+				printf( "FRAME %lu: %s\n", (unsigned long) i, pngErrorString( frames[i].errorCode ) );
+			else
+				printf( "FRAME %lu: %u x %u DECODED\n", (unsigned long) i,
+						frames[i].header.width, frames[i].header.height );
+		}
+		free( frames );
+	}
+	else {
+		errorCode = PNG_ERROR_MEMORY;
+	}
+	unmapFile( fileData, fileSize );
+	return errorCode;
+}
@@ -0,0 +1,77 @@
+/*
+ * PNGAnimation.h
+ *
+ *  Animated PNG (acTL, fcTL, fdAT) frame index and frame decoding
+ */
+
+#ifndef PNGANIMATION_H_
+#define PNGANIMATION_H_
+
+#include "PNGDecode.h"
+
+/*
+ * Piece of compressed frame data in the file
+ */
+struct animationSpan {
+	uint64_t	offset; //file offset of the zlib data
+	size_t		length;
+};
+
+typedef struct animationSpan AnimationSpan;
+
+/*
+ * Frame control of one frame and where its data is
+ */
+struct animationFrame {
+	uint32_t		sequence;
+	uint32_t		width;
+	uint32_t		height;
+	uint32_t		xOffset;
+	uint32_t		yOffset;
+	uint16_t		delayNum;
+	uint16_t		delayDen;
+	unsigned char	disposeOp;
+	unsigned char	blendOp;
+	size_t			firstSpan; //index into the spans of the AnimationIndex
+	size_t			spanCount;
+};
+
+typedef struct animationFrame AnimationFrame;
+
+/*
+ * Frames of an APNG, built while the file is parsed
+ */
+struct animationIndex {
+	uint32_t		frameCount; //announced by acTL
+	uint32_t		plays;
+	uint32_t		nextSequence; //expected fcTL/fdAT sequence number
+	int				defaultImageIsFrame; //IDAT holds the first frame
+	AnimationFrame	*frames;
+	size_t			framesUsed;
+	size_t			framesAllocated;
+	AnimationSpan	*spans;
+	size_t			spansUsed;
+	size_t			spansAllocated;
+};
+
+typedef struct animationIndex AnimationIndex;
+
+/*
+ * One decoded frame, in the packed PNG sample format
+ */
+struct decodedFrame {
+	ImageHeader		header;
+	unsigned char	*pixels; //header.height rows of header.rowBytes
+	int				errorCode;
+};
+
+typedef struct decodedFrame DecodedFrame;
+
+int indexAnimationChunk(PNGData*, const Chunk*);
+int finishAnimationIndex(PNGData*);
+void freeAnimationIndex(AnimationIndex*);
+int decodeAnimationFrames(const PNGData*, const unsigned char*, size_t, DecodedFrame*, unsigned int);
+void freeDecodedFrames(DecodedFrame*, size_t);
+int decodeFileFrames(const char*, const PNGData*, int);
+
+#endif /* PNGANIMATION_H_ */
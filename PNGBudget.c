@@ -0,0 +1,93 @@
+#include "PNGBudget.h"
+#include "PNGParser.h"
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * The budget, every field is guarded by lock
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t released = PTHREAD_COND_INITIALIZER;
+static MemoryBudgetStats budget;
+static double waitLimit = BUDGET_WAIT_SECONDS;
+static unsigned int waiters = 0;
+
+/*
+ * Limit the memory of all the parses to Limit bytes, 0 lifts the limit.
+ * A reservation waits up to WaitSeconds for others to release memory
+ */
+void setMemoryBudget( size_t Limit, double WaitSeconds ) {
+	pthread_mutex_lock( &lock );
+	budget.limit = Limit;
+	waitLimit = WaitSeconds;
+	pthread_cond_broadcast( &released );
+	pthread_mutex_unlock( &lock );
+}
+
+static double getSeconds( void ) {
+	struct timespec now;
+	clock_gettime( CLOCK_REALTIME, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Reserve Bytes of the budget before allocating them. With BUDGET_WAIT the
+ * call blocks while the budget is used up by others, at most for the wait
+ * limit; a reservation larger than the whole budget fails at once.
+ * Returns FALSE when the memory must not be allocated
+ */
+int reserveMemory( size_t Bytes, int Mode ) {
+	int reserved = TRUE;
+	pthread_mutex_lock( &lock );
+	budget.reservations++;
+	if (budget.limit && budget.used + Bytes > budget.limit) {
+		if (Mode == BUDGET_WAIT && Bytes <= budget.limit && waitLimit > 0) {
+			double start = getSeconds();
+			struct timespec deadline;
+			deadline.tv_sec = (time_t) ( start + waitLimit );
+			deadline.tv_nsec = (long) ( ( start + waitLimit - deadline.tv_sec ) * 1e9 );
+			budget.waits++;
+			waiters++;
+			while (budget.limit && budget.used + Bytes > budget.limit) {
+				if (pthread_cond_timedwait( &released, &lock, &deadline ))
+					break;
+			}
+			waiters--;
+			budget.waitSeconds += getSeconds() - start;
+		}
+		reserved = !budget.limit || budget.used + Bytes <= budget.limit;
+	}
+	if (reserved) {
+		budget.used += Bytes;
+		if (budget.used > budget.peak)
+			budget.peak = budget.used;
+	}
+	else if (Mode != BUDGET_PROBE) {
+		budget.refused++;
+	}
+	pthread_mutex_unlock( &lock );
+	return reserved;
+}
+
+/*
+ * Give back Bytes reserved by reserveMemory() once they are freed
+ */
+void releaseMemory( size_t Bytes ) {
+	pthread_mutex_lock( &lock );
+	budget.used -= Bytes;
+	if (waiters)
+		pthread_cond_broadcast( &released );
+	pthread_mutex_unlock( &lock );
+}
+
+void countStreamedChunk( void ) {
+	pthread_mutex_lock( &lock );
+	budget.streamed++;
+	pthread_mutex_unlock( &lock );
+}
+
+void getMemoryBudgetStats( MemoryBudgetStats *Stats ) {
+	pthread_mutex_lock( &lock );
+	memcpy( Stats, &budget, sizeof(*Stats) );
+	pthread_mutex_unlock( &lock );
+}
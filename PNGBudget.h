@@ -0,0 +1,42 @@
+/*
+ * PNGBudget.h
+ *
+ *  Memory budget shared by all the parses of the process
+ */
+
+#ifndef PNGBUDGET_H_
+#define PNGBUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUDGET_WAIT_SECONDS	5.0 //longest wait for memory before a reservation gives up
+
+/*How reserveMemory() treats a reservation over the budget*/
+#define BUDGET_FAIL		0 //fail at once
+#define BUDGET_WAIT		1 //wait for memory, at most the wait limit
+#define BUDGET_PROBE	2 //fail at once, the caller has another way so it isn't counted as refused
+
+/*
+ * Use of the budget since the start of the process
+ */
+struct memoryBudgetStats {
+	size_t		limit; //0 when the memory isn't limited
+	size_t		used; //reserved right now
+	size_t		peak; //most ever reserved at once
+	uint64_t	reservations;
+	uint64_t	waits; //reservations that had to wait for memory
+	double		waitSeconds; //time spent waiting
+	uint64_t	refused; //reservations that failed, probes aside
+	uint64_t	streamed; //chunks validated without holding their data
+};
+
+typedef struct memoryBudgetStats MemoryBudgetStats;
+
+void setMemoryBudget(size_t, double);
+int reserveMemory(size_t, int);
+void releaseMemory(size_t);
+void countStreamedChunk(void);
+void getMemoryBudgetStats(MemoryBudgetStats*);
+
+#endif /* PNGBUDGET_H_ */
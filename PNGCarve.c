@@ -0,0 +1,207 @@
+#include "PNGCarve.h"
+#include "PNGReader.h"
+#include "PNGThreads.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CARVE_SIMD 1
+#endif
+
+#define CHUNK_OVERHEAD	12 //length, type and CRC
+
+/*
+ * First offset in [From, To) where the PNG signature starts, the signature
+ * itself may reach past To. Returns To when there is none
+ */
+size_t findSignature( const unsigned char *Data, size_t Size, size_t From, size_t To ) {
+	size_t i = From;
+	size_t last = To; //last offset a whole signature fits after, plus one
+	if (Size < sizeof(pngHeader))
+		return To;
+	if (last > Size - sizeof(pngHeader) + 1)
+		last = Size - sizeof(pngHeader) + 1;
+#ifdef CARVE_SIMD
+	{
+		/*the first two signature bytes filter 16 offsets at a time*/
+		const __m128i first = _mm_set1_epi8( (char) pngHeader[0] );
+		const __m128i second = _mm_set1_epi8( (char) pngHeader[1] );
+		for (; i + 16 <= last; i += 16) {
+			unsigned int candidates = (unsigned int) _mm_movemask_epi8( _mm_and_si128(
+					_mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*) ( Data + i ) ), first ),
+					_mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*) ( Data + i + 1 ) ), second ) ) );
+			while (candidates) {
+				size_t hit = i + (size_t) __builtin_ctz( candidates );
+				if (!memcmp( Data + hit, pngHeader, sizeof(pngHeader) ))
+					return hit;
+				candidates &= candidates - 1;
+			}
+		}
+	}
+#endif
+	for (; i < last; i++) {
+		if (Data[i] == pngHeader[0] && !memcmp( Data + i, pngHeader, sizeof(pngHeader) ))
+			return i;
+	}
+	return To;
+}
+
+/*
+ * Bytes from a signature to the end of IEND, following only the chunk
+ * lengths. 0 when the chain leaves the blob or meets a bad chunk type,
+ * so the validator never allocates chunks the blob can't hold
+ */
+uint64_t getCarvedLength( const unsigned char *Data, size_t Size ) {
+	size_t offset = sizeof(pngHeader);
+	while (Size - offset >= CHUNK_OVERHEAD) {
+		size_t length = getLastByte( Data + offset );
+		if (length > PNG_MAX_VALUE || length > Size - offset - CHUNK_OVERHEAD ||
+				!isChunkTypeValid( Data + offset + 4 ))
+			return 0;
+		offset += CHUNK_OVERHEAD + length;
+		if (isChunkType( Data + offset - CHUNK_OVERHEAD - length + 4, "IEND" ))
+			return offset;
+	}
+	return 0;
+}
+
+/*
+ * Run the parser over a candidate in place, it has to reach IEND valid
+ */
+static int isValidImage( const unsigned char *Data, size_t Length ) {
+	PNGData PNG;
+	size_t consumed;
+	int status;
+	initPNGProcess( &PNG );
+	PNG.chunkInfo.quiet = TRUE;
+	status = pngPush( &PNG, Data, Length, &consumed );
+	freePNGData( &PNG );
+	return status == PNG_STATUS_DONE && consumed == Length;
+}
+
+/*
+ * Hits of one region, a task of parallelFor()
+ */
+struct carveRegion {
+	size_t			start;
+	size_t			end;
+	CarvedImage		*images;
+	size_t			count;
+	size_t			allocated;
+	size_t			hits;
+	int				failed; //out of memory
+};
+
+typedef struct carveRegion CarveRegion;
+
+struct carveTask {
+	const unsigned char	*data;
+	size_t				size;
+	CarveRegion			*regions;
+};
+
+typedef struct carveTask CarveTask;
+
+static void carveRegion( void *Context, size_t Index ) {
+	CarveTask *task = (CarveTask*) Context;
+	CarveRegion *region = &task->regions[Index];
+	size_t offset = region->start;
+	/*a hit belongs to the region it starts in, its image may go far past the end*/
+	while (( offset = findSignature( task->data, task->size, offset, region->end ) ) < region->end) {
+		uint64_t length = getCarvedLength( task->data + offset, task->size - offset );
+		region->hits++;
+		if (length && isValidImage( task->data + offset, (size_t) length )) {
+			if (region->count == region->allocated) {
+				size_t allocated = region->allocated ? region->allocated * 2 : 16;
+				CarvedImage *images = (CarvedImage*) realloc( region->images, allocated * sizeof(CarvedImage) );
+				if (!images) {
+					region->failed = TRUE;
+					return;
+				}
+				region->images = images;
+				region->allocated = allocated;
+			}
+			region->images[region->count].offset = offset;
+			region->images[region->count].length = length;
+			region->count++;
+		}
+		offset++;
+	}
+}
+
+/*
+ * Search a blob in memory on Threads threads. The images are reported in
+ * the order of their offsets, nested ones included
+ */
+int carveBuffer( const unsigned char *Data, size_t Size, unsigned int Threads, CarveResult *Result ) {
+	CarveTask task;
+	size_t regionCount = (size_t) ( Threads ? Threads : 1 ) * CARVE_REGIONS_PER_THREAD;
+	size_t regionSize;
+	size_t i;
+	int carved = TRUE;
+
+	memset( Result, 0, sizeof(*Result) );
+	if (Size / regionCount < CARVE_MIN_REGION)
+		regionCount = Size / CARVE_MIN_REGION + 1;
+	regionSize = Size / regionCount + 1;
+	task.data = Data;
+	task.size = Size;
+	task.regions = (CarveRegion*) calloc( regionCount, sizeof(CarveRegion) );
+	if (!task.regions)
+		return FALSE;
+	for (i = 0; i < regionCount; i++) {
+		task.regions[i].start = i * regionSize;
+		task.regions[i].end = ( i + 1 ) * regionSize < Size ? ( i + 1 ) * regionSize : Size;
+	}
+	parallelFor( regionCount, Threads, carveRegion, &task );
+
+	for (i = 0; i < regionCount; i++) {
+		Result->count += task.regions[i].count;
+		Result->hits += task.regions[i].hits;
+		carved = carved && !task.regions[i].failed;
+	}
+	if (carved && Result->count) {
+		Result->images = (CarvedImage*) malloc( Result->count * sizeof(CarvedImage) );
+		carved = Result->images != NULL;
+	}
+	Result->count = 0;
+	for (i = 0; i < regionCount; i++) {
+		if (carved) {
+			memcpy( Result->images + Result->count, task.regions[i].images, task.regions[i].count * sizeof(CarvedImage) );
+			Result->count += task.regions[i].count;
+		}
+		free( task.regions[i].images );
+	}
+	free( task.regions );
+	if (!carved)
+		freeCarveResult( Result );
+	return carved;
+}
+
+void freeCarveResult( CarveResult *Result ) {
+	free( Result->images );
+	Result->images = NULL;
+	Result->count = 0;
+}
+
+/*
+ * Map a blob, carve it and print the images found unless Quiet. Returns a
+ * PNG_ERROR_* code
+ */
+int carveFile( const char *FileName, int Quiet, CarveResult *Result ) {
+	size_t size;
+	size_t i;
+	const unsigned char *data = mapFile( FileName, &size );
+	memset( Result, 0, sizeof(*Result) );
+	if (!data)
+		return PNG_ERROR_IO;
+	if (!carveBuffer( data, size, getThreadCount(), Result )) {
+		unmapFile( data, size );
+		return PNG_ERROR_MEMORY;
+	}
+	Result->bytes = size;
+	unmapFile( data, size );
+	for (i = 0; !Quiet && i < Result->count; i++)
+		printf( "PNG AT %lu: %lu BYTES\n", (unsigned long) Result->images[i].offset,
+				(unsigned long) Result->images[i].length );
+	return PNG_ERROR_NONE;
+}
@@ -0,0 +1,44 @@
+/*
+ * PNGCarve.h
+ *
+ *  Find the PNG files embedded in a large blob, such as an archive or a
+ *  disk image
+ */
+
+#ifndef PNGCARVE_H_
+#define PNGCARVE_H_
+
+#include "PNGParser.h"
+
+#define CARVE_MIN_REGION	( 4 * 1024 * 1024 ) //bytes searched by one task at least
+#define CARVE_REGIONS_PER_THREAD	4
+
+/*
+ * PNG file found in the blob
+ */
+struct carvedImage {
+	uint64_t	offset;
+	uint64_t	length;
+};
+
+typedef struct carvedImage CarvedImage;
+
+/*
+ * Images of a blob in the order of their offsets
+ */
+struct carveResult {
+	CarvedImage	*images;
+	size_t		count;
+	size_t		hits; //signatures found, valid or not
+	uint64_t	bytes; //size of the blob
+};
+
+typedef struct carveResult CarveResult;
+
+size_t findSignature(const unsigned char*, size_t, size_t, size_t);
+uint64_t getCarvedLength(const unsigned char*, size_t);
+int carveBuffer(const unsigned char*, size_t, unsigned int, CarveResult*);
+void freeCarveResult(CarveResult*);
+int carveFile(const char*, int, CarveResult*);
+
+#endif /* PNGCARVE_H_ */
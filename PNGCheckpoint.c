@@ -0,0 +1,613 @@
+#include "PNGCheckpoint.h"
+#include "PNGAnimation.h"
+#include "PNGMetadata.h"
+#include "crc.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DECODER_NONE		0 //no decoder or no IHDR yet
+#define DECODER_HEADER		1 //IHDR seen, no image data yet
+#define DECODER_FINISHED	2 //the whole image has been decoded
+
+#define CHECKPOINT_FRAME_LENGTH	34 //bytes of one frame in the blob
+
+/*
+ * Blob being written, grown as needed; failed is set once memory runs out
+ */
+struct checkpointWriter {
+	unsigned char	*data;
+	size_t			length;
+	size_t			capacity;
+	int				failed;
+};
+
+typedef struct checkpointWriter CheckpointWriter;
+
+/*
+ * Blob being read; failed is set once a read runs past the end
+ */
+struct checkpointReader {
+	const unsigned char	*data;
+	size_t				length;
+	size_t				position;
+	int					failed;
+};
+
+typedef struct checkpointReader CheckpointReader;
+
+static void putBytes( CheckpointWriter *Writer, const void *Data, size_t Length ) {
+	if (Writer->failed)
+		return;
+	if (Writer->length + Length > Writer->capacity) {
+		size_t capacity = Writer->capacity ? Writer->capacity * 2 : 256;
+		unsigned char *data;
+		while (capacity < Writer->length + Length)
+			capacity *= 2;
+		data = (unsigned char*) realloc( Writer->data, capacity );
+		if (!data) {
+			Writer->failed = TRUE;
+			return;
+		}
+		Writer->data = data;
+		Writer->capacity = capacity;
+	}
+	memcpy( Writer->data + Writer->length, Data, Length );
+	Writer->length += Length;
+}
+
+static void putValue( CheckpointWriter *Writer, uint64_t Value, unsigned int Bytes ) {
+	unsigned char bytes[8];
+	unsigned int i;
+	for (i = 0; i < Bytes; i++)
+		bytes[i] = (unsigned char) ( Value >> ( 8 * ( Bytes - 1 - i ) ) );
+	putBytes( Writer, bytes, Bytes );
+}
+
+static const unsigned char *getBytes( CheckpointReader *Reader, size_t Length ) {
+	const unsigned char *data = Reader->data + Reader->position;
+	if (Reader->failed || Length > Reader->length - Reader->position) {
+		Reader->failed = TRUE;
+		return NULL;
+	}
+	Reader->position += Length;
+	return data;
+}
+
+static uint64_t getValue( CheckpointReader *Reader, unsigned int Bytes ) {
+	const unsigned char *bytes = getBytes( Reader, Bytes );
+	uint64_t value = 0;
+	unsigned int i;
+	if (!bytes)
+		return 0;
+	for (i = 0; i < Bytes; i++)
+		value = ( value << 8 ) | bytes[i];
+	return value;
+}
+
+/*
+ * The chunks seen, one bit each in the order of ChunkInfo
+ */
+static uint32_t packChunkFlags( const ChunkInfo *cInfo ) {
+	return (uint32_t) cInfo->IHDR | (uint32_t) cInfo->IDAT << 1 | (uint32_t) cInfo->PLTE << 2 |
+			(uint32_t) cInfo->IEND << 3 | (uint32_t) cInfo->TRNS << 4 | (uint32_t) cInfo->ICCP << 5 |
+			(uint32_t) cInfo->CHRM << 6 | (uint32_t) cInfo->GAMA << 7 | (uint32_t) cInfo->SRGB << 8 |
+			(uint32_t) cInfo->SBIT << 9 | (uint32_t) cInfo->tEXt << 10 | (uint32_t) cInfo->zTXt << 11 |
+			(uint32_t) cInfo->BKGD << 12 | (uint32_t) cInfo->HIST << 13 | (uint32_t) cInfo->PHYS << 14 |
+			(uint32_t) cInfo->SPLT << 15 | (uint32_t) cInfo->TIME << 16 | (uint32_t) cInfo->ACTL << 17 |
+			(uint32_t) cInfo->lastChunkIEND << 18 | (uint32_t) cInfo->lastChunkIDAT << 19;
+}
+
+static void unpackChunkFlags( ChunkInfo *cInfo, uint32_t Flags ) {
+	cInfo->IHDR = Flags & 1;
+	cInfo->IDAT = ( Flags >> 1 ) & 1;
+	cInfo->PLTE = ( Flags >> 2 ) & 1;
+	cInfo->IEND = ( Flags >> 3 ) & 1;
+	cInfo->TRNS = ( Flags >> 4 ) & 1;
+	cInfo->ICCP = ( Flags >> 5 ) & 1;
+	cInfo->CHRM = ( Flags >> 6 ) & 1;
+	cInfo->GAMA = ( Flags >> 7 ) & 1;
+	cInfo->SRGB = ( Flags >> 8 ) & 1;
+	cInfo->SBIT = ( Flags >> 9 ) & 1;
+	cInfo->tEXt = ( Flags >> 10 ) & 1;
+	cInfo->zTXt = ( Flags >> 11 ) & 1;
+	cInfo->BKGD = ( Flags >> 12 ) & 1;
+	cInfo->HIST = ( Flags >> 13 ) & 1;
+	cInfo->PHYS = ( Flags >> 14 ) & 1;
+	cInfo->SPLT = ( Flags >> 15 ) & 1;
+	cInfo->TIME = ( Flags >> 16 ) & 1;
+	cInfo->ACTL = ( Flags >> 17 ) & 1;
+	cInfo->lastChunkIEND = ( Flags >> 18 ) & 1;
+	cInfo->lastChunkIDAT = ( Flags >> 19 ) & 1;
+}
+
+/*
+ * File offset of the last chunk boundary. Nothing but the buffers changes
+ * until a chunk is complete, so the parse can always go back to it
+ */
+uint64_t getCheckpointOffset( const PNGData *PNG ) {
+	switch (PNG->State) {
+	case PROCESS_CHUNK_HEADER:
+		return PNG->fileOffset - PNG->bytesCopied;
+	case PROCESS_CHUNK_DATA:
+	case PROCESS_CHUNK_STREAM:
+		return PNG->fileOffset - sizeof(PNG->chunkHeader) - PNG->bytesCopied;
+	case PROCESS_CHUNK_CRC:
+		return PNG->fileOffset - sizeof(PNG->chunkHeader) - PNG->chunkSize - PNG->bytesCopied;
+	case PROCESS_DONE:
+		return PNG->fileOffset;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Where the decoder of VERIFY_DECODE is. The zlib stream can't be saved,
+ * so a decoder inside the image data makes the checkpoint fail
+ */
+static int getDecoderState( const PNGDecoder *Decoder ) {
+	if (!Decoder || !Decoder->hasHeader)
+		return DECODER_NONE;
+	if (Decoder->inflater.finished && Decoder->unfilter.finished)
+		return DECODER_FINISHED;
+	if (!Decoder->inflater.headerFill)
+		return DECODER_HEADER;
+	return -1;
+}
+
+static void putAnimationIndex( CheckpointWriter *Writer, const AnimationIndex *Index ) {
+	size_t i;
+	putValue( Writer, Index != NULL, 1 );
+	if (!Index)
+		return;
+	putValue( Writer, Index->frameCount, 4 );
+	putValue( Writer, Index->plays, 4 );
+	putValue( Writer, Index->nextSequence, 4 );
+	putValue( Writer, Index->defaultImageIsFrame, 1 );
+	putValue( Writer, Index->framesUsed, 4 );
+	for (i = 0; i < Index->framesUsed; i++) {
+		const AnimationFrame *frame = &Index->frames[i];
+		putValue( Writer, frame->sequence, 4 );
+		putValue( Writer, frame->width, 4 );
+		putValue( Writer, frame->height, 4 );
+		putValue( Writer, frame->xOffset, 4 );
+		putValue( Writer, frame->yOffset, 4 );
+		putValue( Writer, frame->delayNum, 2 );
+		putValue( Writer, frame->delayDen, 2 );
+		putValue( Writer, frame->disposeOp, 1 );
+		putValue( Writer, frame->blendOp, 1 );
+		putValue( Writer, frame->firstSpan, 4 );
+		putValue( Writer, frame->spanCount, 4 );
+	}
+	putValue( Writer, Index->spansUsed, 4 );
+	for (i = 0; i < Index->spansUsed; i++) {
+		putValue( Writer, Index->spans[i].offset, 8 );
+		putValue( Writer, Index->spans[i].length, 4 );
+	}
+}
+
+static void putMetadataIndex( CheckpointWriter *Writer, const MetadataIndex *Index ) {
+	size_t count = Index ? Index->used : 0;
+	size_t i;
+	putValue( Writer, count, 4 );
+	for (i = 0; i < count; i++) {
+		const MetadataEntry *entry = &Index->entries[i];
+		size_t keyLength = strlen( entry->keyword );
+		putValue( Writer, entry->kind, 1 );
+		putValue( Writer, entry->compressed, 1 );
+		putValue( Writer, keyLength, 1 );
+		putBytes( Writer, entry->keyword, keyLength );
+		putValue( Writer, entry->offset, 8 );
+		putValue( Writer, entry->length, 4 );
+	}
+}
+
+/*
+ * Serialize the parse as it was at its last chunk boundary into a blob the
+ * caller frees. A parse that failed has nothing to resume
+ */
+int savePNGCheckpoint( const PNGData *PNG, unsigned char **Blob, size_t *Length ) {
+	const ChunkInfo *cInfo = &PNG->chunkInfo;
+	CheckpointWriter writer;
+	int decoderState = getDecoderState( PNG->decoder );
+	int state;
+
+	*Blob = NULL;
+	*Length = 0;
+	if (cInfo->errorCode || decoderState < 0)
+		return PNG_ERROR_CHECKPOINT;
+	if (PNG->State == PROCESS_DONE)
+		state = CHECKPOINT_STATE_DONE;
+	else if (PNG->State == PROCESS_PNG_HEADER)
+		state = CHECKPOINT_STATE_SIGNATURE;
+	else
+		state = CHECKPOINT_STATE_CHUNKS;
+
+	memset( &writer, 0, sizeof(writer) );
+	putBytes( &writer, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH );
+	putValue( &writer, CHECKPOINT_VERSION, 1 );
+	putValue( &writer, getCheckpointOffset( PNG ), 8 );
+	putValue( &writer, state, 1 );
+	putValue( &writer, PNG->verifyLevel, 1 );
+	putValue( &writer, packChunkFlags( cInfo ), 4 );
+	putValue( &writer, cInfo->width, 4 );
+	putValue( &writer, cInfo->height, 4 );
+	putValue( &writer, cInfo->bitDepth, 1 );
+	putValue( &writer, cInfo->colorType, 1 );
+	putValue( &writer, cInfo->interlace, 1 );
+	putValue( &writer, decoderState, 1 );
+	putValue( &writer, decoderState ? PNG->decoder->unfilter.paletteEntries : 0, 2 );
+	putAnimationIndex( &writer, PNG->animation );
+	putMetadataIndex( &writer, PNG->metadata );
+	if (!writer.failed)
+		putValue( &writer, crc( writer.data, (int) writer.length ), 4 );
+	if (writer.failed) {
+		free( writer.data );
+		return PNG_ERROR_MEMORY;
+	}
+	*Blob = writer.data;
+	*Length = writer.length;
+	return PNG_ERROR_NONE;
+}
+
+static int getAnimationIndex( CheckpointReader *Reader, PNGData *PNG ) {
+	AnimationIndex *index;
+	size_t i;
+	if (!getValue( Reader, 1 ))
+		return !Reader->failed;
+	index = (AnimationIndex*) calloc( 1, sizeof(AnimationIndex) );
+	if (!index)
+		return FALSE;
+	PNG->animation = index;
+	index->frameCount = (uint32_t) getValue( Reader, 4 );
+	index->plays = (uint32_t) getValue( Reader, 4 );
+	index->nextSequence = (uint32_t) getValue( Reader, 4 );
+	index->defaultImageIsFrame = (int) getValue( Reader, 1 );
+	index->framesUsed = (size_t) getValue( Reader, 4 );
+	/*every frame takes its bytes of the blob, which bounds the allocation*/
+	if (index->framesUsed > ( Reader->length - Reader->position ) / CHECKPOINT_FRAME_LENGTH)
+		return FALSE;
+	if (index->framesUsed) {
+		index->frames = (AnimationFrame*) malloc( index->framesUsed * sizeof(AnimationFrame) );
+		if (!index->frames)
+			return FALSE;
+		index->framesAllocated = index->framesUsed;
+	}
+	for (i = 0; i < index->framesUsed; i++) {
+		AnimationFrame *frame = &index->frames[i];
+		frame->sequence = (uint32_t) getValue( Reader, 4 );
+		frame->width = (uint32_t) getValue( Reader, 4 );
+		frame->height = (uint32_t) getValue( Reader, 4 );
+		frame->xOffset = (uint32_t) getValue( Reader, 4 );
+		frame->yOffset = (uint32_t) getValue( Reader, 4 );
+		frame->delayNum = (uint16_t) getValue( Reader, 2 );
+		frame->delayDen = (uint16_t) getValue( Reader, 2 );
+		frame->disposeOp = (unsigned char) getValue( Reader, 1 );
+		frame->blendOp = (unsigned char) getValue( Reader, 1 );
+		frame->firstSpan = (size_t) getValue( Reader, 4 );
+		frame->spanCount = (size_t) getValue( Reader, 4 );
+	}
+	index->spansUsed = (size_t) getValue( Reader, 4 );
+	if (index->spansUsed > ( Reader->length - Reader->position ) / 12)
+		return FALSE;
+	if (index->spansUsed) {
+		index->spans = (AnimationSpan*) malloc( index->spansUsed * sizeof(AnimationSpan) );
+		if (!index->spans)
+			return FALSE;
+		index->spansAllocated = index->spansUsed;
+	}
+	for (i = 0; i < index->spansUsed; i++) {
+		index->spans[i].offset = getValue( Reader, 8 );
+		index->spans[i].length = (size_t) getValue( Reader, 4 );
+	}
+	for (i = 0; i < index->framesUsed; i++) {
+		const AnimationFrame *frame = &index->frames[i];
+		if (frame->firstSpan > index->spansUsed || frame->spanCount > index->spansUsed - frame->firstSpan)
+			return FALSE;
+	}
+	return !Reader->failed;
+}
+
+static int getMetadataIndex( CheckpointReader *Reader, PNGData *PNG ) {
+	size_t count = (size_t) getValue( Reader, 4 );
+	MetadataIndex *index;
+	size_t i;
+	if (!count)
+		return !Reader->failed;
+	if (count > Reader->length - Reader->position)
+		return FALSE;
+	index = (MetadataIndex*) calloc( 1, sizeof(MetadataIndex) );
+	if (!index)
+		return FALSE;
+	PNG->metadata = index;
+	index->entries = (MetadataEntry*) malloc( count * sizeof(MetadataEntry) );
+	if (!index->entries)
+		return FALSE;
+	index->allocated = count;
+	for (i = 0; i < count; i++) {
+		MetadataEntry *entry = &index->entries[index->used++];
+		size_t keyLength;
+		const unsigned char *keyword;
+		entry->kind = (unsigned char) getValue( Reader, 1 );
+		entry->compressed = (unsigned char) getValue( Reader, 1 );
+		keyLength = (size_t) getValue( Reader, 1 );
+		if (keyLength > TEXT_DATA_KEY_LENGTH_MAX)
+			return FALSE;
+		keyword = getBytes( Reader, keyLength );
+		if (!keyword)
+			return FALSE;
+		memcpy( entry->keyword, keyword, keyLength );
+		entry->keyword[keyLength] = 0;
+		entry->offset = getValue( Reader, 8 );
+		entry->length = (size_t) getValue( Reader, 4 );
+	}
+	return !Reader->failed;
+}
+
+/*
+ * Decoder of VERIFY_DECODE as it was at the checkpoint, rebuilt from the
+ * image header kept in ChunkInfo and the size of the palette already read
+ */
+static int restoreDecoder( PNGData *PNG, int DecoderState, unsigned int PaletteEntries ) {
+	const ChunkInfo *cInfo = &PNG->chunkInfo;
+	unsigned char header[IHDR_DATA_LENGTH];
+	Chunk chunk;
+	if (DecoderState == DECODER_NONE)
+		return TRUE;
+	if (DecoderState > DECODER_FINISHED || !cInfo->IHDR)
+		return FALSE;
+	PNG->decoder = (PNGDecoder*) malloc( sizeof(PNGDecoder) );
+	if (!PNG->decoder)
+		return FALSE;
+	initDecoder( PNG->decoder, discardRow, NULL );
+	PNG->decoder->memoryMode = getMemoryMode( PNG );
+	if (DecoderState == DECODER_FINISHED) {
+		PNG->decoder->hasHeader = TRUE;
+		PNG->decoder->inflater.finished = TRUE;
+		PNG->decoder->unfilter.finished = TRUE;
+		return setImageHeader( &PNG->decoder->header, cInfo->width, cInfo->height, cInfo->bitDepth,
+				cInfo->colorType, cInfo->interlace );
+	}
+	memset( header, 0, sizeof(header) );
+	header[0] = (unsigned char) ( cInfo->width >> 24 );
+	header[1] = (unsigned char) ( cInfo->width >> 16 );
+	header[2] = (unsigned char) ( cInfo->width >> 8 );
+	header[3] = (unsigned char) cInfo->width;
+	header[4] = (unsigned char) ( cInfo->height >> 24 );
+	header[5] = (unsigned char) ( cInfo->height >> 16 );
+	header[6] = (unsigned char) ( cInfo->height >> 8 );
+	header[7] = (unsigned char) cInfo->height;
+	header[8] = cInfo->bitDepth;
+	header[9] = cInfo->colorType;
+	header[12] = cInfo->interlace;
+	memcpy( chunk.chunkType, "IHDR", CHUNK_TYPE_LENGTH );
+	chunk.dataSize = sizeof(header);
+	chunk.Data = header;
+	if (!decodeChunk( PNG->decoder, &chunk ))
+		return FALSE;
+	PNG->decoder->unfilter.paletteEntries = PaletteEntries;
+	return TRUE;
+}
+
+/*
+ * Put a freshly initialised PNG back at the chunk boundary of the blob,
+ * the file is then fed from getCheckpointOffset() on. chunkHook and quiet
+ * are left to the caller
+ */
+int loadPNGCheckpoint( PNGData *PNG, const unsigned char *Blob, size_t Length ) {
+	ChunkInfo *cInfo = &PNG->chunkInfo;
+	CheckpointReader reader;
+	uint64_t offset;
+	int state;
+	int verifyLevel;
+	int decoderState;
+	unsigned int paletteEntries;
+
+	if (Length < CHECKPOINT_MAGIC_LENGTH + 1 + 4 || memcmp( Blob, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH ) ||
+			Blob[CHECKPOINT_MAGIC_LENGTH] != CHECKPOINT_VERSION ||
+			crc( Blob, (int) ( Length - 4 ) ) != getLastByte( Blob + Length - 4 ))
+		return PNG_ERROR_CHECKPOINT;
+	reader.data = Blob;
+	reader.length = Length - 4;
+	reader.position = CHECKPOINT_MAGIC_LENGTH + 1;
+	reader.failed = FALSE;
+
+	offset = getValue( &reader, 8 );
+	state = (int) getValue( &reader, 1 );
+	verifyLevel = (int) getValue( &reader, 1 );
+	if (state > CHECKPOINT_STATE_DONE || verifyLevel > VERIFY_DECODE ||
+			( state == CHECKPOINT_STATE_SIGNATURE ) != ( offset == 0 ))
+		return PNG_ERROR_CHECKPOINT;
+	unpackChunkFlags( cInfo, (uint32_t) getValue( &reader, 4 ) );
+	cInfo->width = (uint32_t) getValue( &reader, 4 );
+	cInfo->height = (uint32_t) getValue( &reader, 4 );
+	cInfo->bitDepth = (unsigned char) getValue( &reader, 1 );
+	cInfo->colorType = (unsigned char) getValue( &reader, 1 );
+	cInfo->interlace = (unsigned char) getValue( &reader, 1 );
+	decoderState = (int) getValue( &reader, 1 );
+	paletteEntries = (unsigned int) getValue( &reader, 2 );
+	PNG->verifyLevel = verifyLevel;
+	if (!restoreDecoder( PNG, decoderState, paletteEntries ) || !getAnimationIndex( &reader, PNG ) ||
+			!getMetadataIndex( &reader, PNG ) || reader.failed || reader.position != reader.length) {
+		freePNGData( PNG );
+		return PNG_ERROR_CHECKPOINT;
+	}
+
+	PNG->fileOffset = offset;
+	PNG->bytesToCopy = sizeof(PNG->chunkHeader);
+	PNG->bytesCopied = 0;
+	PNG->bufferData = PNG->chunkHeader;
+	if (state == CHECKPOINT_STATE_DONE)
+		PNG->State = PROCESS_DONE;
+	else if (state == CHECKPOINT_STATE_CHUNKS)
+		PNG->State = PROCESS_CHUNK_HEADER;
+	return PNG_ERROR_NONE;
+}
+
+/*
+ * Save the checkpoint to FileName, through a temporary file so a crash
+ * never leaves half a checkpoint behind
+ */
+int writeCheckpointFile( const char *FileName, const PNGData *PNG ) {
+	unsigned char *blob;
+	size_t length;
+	char *temporary;
+	FILE *file;
+	int errorCode = savePNGCheckpoint( PNG, &blob, &length );
+	if (errorCode)
+		return errorCode;
+	temporary = (char*) malloc( strlen( FileName ) + 5 );
+	if (!temporary) {
+		free( blob );
+		return PNG_ERROR_MEMORY;
+	}
+	strcpy( temporary, FileName );
+	strcat( temporary, ".tmp" );
+	file = fopen( temporary, "wb" );
+	if (!file) {
+		errorCode = PNG_ERROR_IO;
+	}
+	else {
+		if (fwrite( blob, 1, length, file ) != length)
+			errorCode = PNG_ERROR_IO;
+		if (fclose( file ) || ( !errorCode && rename( temporary, FileName ) ))
+			errorCode = PNG_ERROR_IO;
+		if (errorCode)
+			remove( temporary );
+	}
+	free( temporary );
+	free( blob );
+	return errorCode;
+}
+
+/*
+ * Load the checkpoint in FileName into a freshly initialised PNG. Returns
+ * PNG_ERROR_IO with errno ENOENT, and PNG untouched, when there is no
+ * checkpoint yet
+ */
+int readCheckpointFile( const char *FileName, PNGData *PNG ) {
+	unsigned char *blob;
+	long length;
+	int errorCode;
+	FILE *file = fopen( FileName, "rb" );
+	if (!file)
+		return PNG_ERROR_IO;
+	if (fseek( file, 0, SEEK_END ) || ( length = ftell( file ) ) < 0 || length > CHECKPOINT_MAX_SIZE ||
+			fseek( file, 0, SEEK_SET )) {
+		fclose( file );
+		return PNG_ERROR_CHECKPOINT;
+	}
+	blob = (unsigned char*) malloc( length ? (size_t) length : 1 );
+	if (!blob) {
+		fclose( file );
+		return PNG_ERROR_MEMORY;
+	}
+	if (fread( blob, 1, (size_t) length, file ) != (size_t) length)
+		errorCode = PNG_ERROR_IO;
+	else
+		errorCode = loadPNGCheckpoint( PNG, blob, (size_t) length );
+	free( blob );
+	fclose( file );
+	return errorCode;
+}
+
+static void sleepSeconds( double Seconds ) {
+	struct timespec delay;
+	delay.tv_sec = (time_t) Seconds;
+	delay.tv_nsec = (long) ( ( Seconds - delay.tv_sec ) * 1e9 );
+	nanosleep( &delay, NULL );
+}
+
+/*
+ * Parse FileName from the checkpoint in CheckpointName, when there is one,
+ * up to IEND or the end of the file. With IdleSeconds the end of the file
+ * is waited on for appended bytes until it stops growing for that long.
+ * A parse that stops before IEND is saved to CheckpointName as it was at
+ * its last chunk boundary and the next call picks up from there, at the
+ * verify level it was started with, so the bytes of a chunk that was cut
+ * off are read again on resume; the bytes before it are read once.
+ * Returns PNG_STATUS_DONE, PNG_STATUS_NEED_MORE when the file ended early,
+ * or PNG_STATUS_ERROR with the reason in Result->errorCode. Offset is set
+ * to where the parse stands
+ */
+int followFile( const char *FileName, const char *CheckpointName, int VerifyLevel, double IdleSeconds, int Quiet,
+		FileResult *Result, uint64_t *Offset ) {
+	unsigned char *readBuffer;
+	PNGData PNG;
+	double idle = 0;
+	int status = PNG_STATUS_NEED_MORE;
+	int file;
+
+	Result->fileName = FileName;
+	Result->trace = NULL;
+	Result->parsed = FALSE;
+	Result->errorCode = PNG_ERROR_NONE;
+	Result->bytesRead = 0;
+	*Offset = 0;
+	initPNGProcess( &PNG );
+	PNG.verifyLevel = VerifyLevel;
+	if (CheckpointName) {
+		int errorCode = readCheckpointFile( CheckpointName, &PNG );
+		if (errorCode && ( errorCode != PNG_ERROR_IO || errno != ENOENT )) {
+			Result->errorCode = errorCode;
+			return PNG_STATUS_ERROR;
+		}
+	}
+	PNG.chunkInfo.quiet = Quiet;
+
+	file = open( FileName, O_RDONLY );
+	readBuffer = (unsigned char*) malloc( READ_BUFFER_SIZE );
+	if (file < 0 || !readBuffer || lseek( file, (off_t) PNG.fileOffset, SEEK_SET ) < 0) {
+		Result->errorCode = file < 0 ? PNG_ERROR_IO : PNG_ERROR_MEMORY;
+		status = PNG_STATUS_ERROR;
+	}
+	else if (PNG.State == PROCESS_DONE) {
+		status = PNG_STATUS_DONE;
+	}
+	while (status == PNG_STATUS_NEED_MORE) {
+		size_t consumed;
+		ssize_t bytesRead = read( file, readBuffer, READ_BUFFER_SIZE );
+		if (bytesRead < 0) {
+			if (errno == EINTR)
+				continue;
+			Result->errorCode = PNG_ERROR_IO;
+			status = PNG_STATUS_ERROR;
+			break;
+		}
+		if (!bytesRead) {
+			if (idle >= IdleSeconds)
+				break;
+			sleepSeconds( FOLLOW_POLL_INTERVAL );
+			idle += FOLLOW_POLL_INTERVAL;
+			continue;
+		}
+		idle = 0;
+		Result->bytesRead += (size_t) bytesRead;
+		status = pngPush( &PNG, readBuffer, (size_t) bytesRead, &consumed );
+		if (status == PNG_STATUS_ERROR)
+			Result->errorCode = pngGetError( &PNG );
+	}
+	*Offset = getCheckpointOffset( &PNG );
+
+	if (status == PNG_STATUS_DONE) {
+		Result->parsed = TRUE;
+		if (CheckpointName)
+			remove( CheckpointName );
+	}
+	else if (status == PNG_STATUS_NEED_MORE && CheckpointName) {
+		Result->errorCode = writeCheckpointFile( CheckpointName, &PNG );
+		if (Result->errorCode)
+			status = PNG_STATUS_ERROR;
+	}
+	else if (status == PNG_STATUS_NEED_MORE) {
+		Result->errorCode = PNG_ERROR_TRUNCATED;
+	}
+	if (file >= 0)
+		close( file );
+	free( readBuffer );
+	freePNGData( &PNG );
+	return status;
+}
@@ -0,0 +1,42 @@
+/*
+ * PNGCheckpoint.h
+ *
+ *  Save the state of a parse at a chunk boundary and resume it later, and
+ *  follow files that are still being written
+ */
+
+#ifndef PNGCHECKPOINT_H_
+#define PNGCHECKPOINT_H_
+
+#include "PNGParser.h"
+
+#define CHECKPOINT_MAGIC	"PNGCKPT"
+#define CHECKPOINT_MAGIC_LENGTH	7
+#define CHECKPOINT_VERSION	1
+#define CHECKPOINT_MAX_SIZE	( 64 * 1024 * 1024 ) //larger files are not checkpoints
+#define FOLLOW_POLL_INTERVAL	0.2 //seconds between looks for appended bytes
+
+/*
+ * Checkpoint blob, all numbers with the most significant byte first:
+ *	magic, version
+ *	offset (64) of the chunk boundary, state, verify level
+ *	chunks seen (32, one bit each), width, height, bit depth, colour type,
+ *	interlace, decoder state, palette entries (16) the decoder checks
+ *	animation index: present, then frame count, plays, next sequence,
+ *	default image is frame, the frames and the spans
+ *	metadata index: entry count, then kind, compressed, keyword length,
+ *	keyword, offset (64), length of each
+ *	CRC-32 of everything before it
+ */
+#define CHECKPOINT_STATE_SIGNATURE	0 //nothing consumed yet
+#define CHECKPOINT_STATE_CHUNKS		1 //between two chunks
+#define CHECKPOINT_STATE_DONE		2 //IEND has been processed
+
+uint64_t getCheckpointOffset(const PNGData*);
+int savePNGCheckpoint(const PNGData*, unsigned char**, size_t*);
+int loadPNGCheckpoint(PNGData*, const unsigned char*, size_t);
+int writeCheckpointFile(const char*, const PNGData*);
+int readCheckpointFile(const char*, PNGData*);
+int followFile(const char*, const char*, int, double, int, FileResult*, uint64_t*);
+
+#endif /* PNGCHECKPOINT_H_ */
@@ -0,0 +1,506 @@
+#include "PNGDecode.h"
+#include "adler32.h"
+#include "PNGBudget.h"
+
+/*Adam7 pass origin and spacing*/
+static const unsigned char adam7StartX[ADAM7_PASSES] = { 0, 4, 0, 2, 0, 1, 0 };
+static const unsigned char adam7StartY[ADAM7_PASSES] = { 0, 0, 4, 0, 2, 0, 1 };
+static const unsigned char adam7StepX[ADAM7_PASSES] = { 8, 8, 4, 4, 2, 2, 1 };
+static const unsigned char adam7StepY[ADAM7_PASSES] = { 8, 8, 8, 4, 4, 2, 2 };
+
+/*
+ * Fill the image layout of an image of the given size and sample format
+ */
+int setImageHeader( ImageHeader *Header, uint32_t Width, uint32_t Height, unsigned int BitDepth,
+		unsigned int ColorType, unsigned int Interlace ) {
+	uint64_t rowBytes;
+	Header->width = Width;
+	Header->height = Height;
+	Header->bitDepth = (unsigned char) BitDepth;
+	Header->colorType = (unsigned char) ColorType;
+	Header->interlace = (unsigned char) Interlace;
+	switch (Header->colorType) {
+	case 0:
+	case 3:
+		Header->channels = 1;
+		break;
+	case 2:
+		Header->channels = 3;
+		break;
+	case 4:
+		Header->channels = 2;
+		break;
+	case 6:
+		Header->channels = 4;
+		break;
+	default:
+		return FALSE;
+	}
+	Header->bitsPerPixel = Header->channels * Header->bitDepth;
+	Header->bytesPerPixel = ( Header->bitsPerPixel + 7 ) / 8;
+	rowBytes = ( (uint64_t) Header->width * Header->bitsPerPixel + 7 ) / 8;
+	if (rowBytes >= SIZE_MAX)
+		return FALSE;
+	Header->rowBytes = (size_t) rowBytes;
+	return TRUE;
+}
+
+/*
+ * Fill the image layout from an IHDR chunk that has already been validated
+ */
+int readImageHeader( ImageHeader *Header, const Chunk *chunk ) {
+	if (chunk->dataSize != IHDR_DATA_LENGTH)
+		return FALSE;
+	return setImageHeader( Header, getLastByte( chunk->Data ), getLastByte( chunk->Data + 4 ),
+			chunk->Data[8], chunk->Data[9], chunk->Data[12] );
+}
+
+/*
+ * Bytes of a row of the given width, without the filter byte
+ */
+size_t getRowBytes( const ImageHeader *Header, uint32_t Width ) {
+	return (size_t) ( ( (uint64_t) Width * Header->bitsPerPixel + 7 ) / 8 );
+}
+
+/*
+ * Size of an Adam7 pass, returns FALSE when the pass is empty
+ */
+int getAdam7Pass( const ImageHeader *Header, unsigned int Pass, uint32_t *Width, uint32_t *Height ) {
+	*Width = 0;
+	*Height = 0;
+	if (Header->width > adam7StartX[Pass])
+		*Width = ( Header->width - adam7StartX[Pass] + adam7StepX[Pass] - 1 ) / adam7StepX[Pass];
+	if (Header->height > adam7StartY[Pass])
+		*Height = ( Header->height - adam7StartY[Pass] + adam7StepY[Pass] - 1 ) / adam7StepY[Pass];
+	return *Width && *Height;
+}
+
+int initInflater( PNGInflater *Inflater, int MemoryMode ) {
+	memset( &Inflater->stream, 0, sizeof(Inflater->stream) );
+	Inflater->initialised = FALSE;
+	Inflater->streamEnded = FALSE;
+	Inflater->finished = FALSE;
+	Inflater->errorCode = PNG_ERROR_NONE;
+	Inflater->adler = 1;
+	Inflater->headerFill = 0;
+	Inflater->trailerFill = 0;
+	Inflater->outBufferSize = INFLATE_BUFFER_SIZE;
+	Inflater->outBuffer = NULL;
+	Inflater->reserved = 0;
+	if (!reserveMemory( Inflater->outBufferSize, MemoryMode )) {
+		Inflater->errorCode = PNG_ERROR_BUDGET;
+		return FALSE;
+	}
+	Inflater->reserved = Inflater->outBufferSize;
+	Inflater->outBuffer = (unsigned char*) malloc( Inflater->outBufferSize );
+	if (!Inflater->outBuffer)
+		return FALSE;
+	Inflater->initialised = ( inflateInit2( &Inflater->stream, -MAX_WBITS ) == Z_OK );
+	return Inflater->initialised;
+}
+
+/*
+ * zlib header of a PNG: deflate, window up to 32K, no preset dictionary
+ */
+static int isValidZlibHeader( const unsigned char *Header ) {
+	unsigned int cmf = Header[0];
+	unsigned int flg = Header[1];
+	if (( ( cmf << 8 ) | flg ) % 31)
+		return FALSE;
+	return ( ( cmf & 0x0f ) == Z_DEFLATED ) && ( ( cmf >> 4 ) <= 7 ) && !( flg & 0x20 );
+}
+
+/*
+ * Inflate the next piece of the zlib stream and pass the output on,
+ * data following the Adler-32 trailer is ignored
+ */
+int inflateData( PNGInflater *Inflater, const unsigned char *Data, size_t DataLength, InflateSink Sink, void *Context ) {
+	z_stream *stream = &Inflater->stream;
+	while (DataLength && !Inflater->finished) {
+		uInt chunkLength;
+		if (Inflater->headerFill < ZLIB_HEADER_LENGTH) {
+			Inflater->zlibHeader[Inflater->headerFill++] = *Data++;
+			DataLength--;
+			if (Inflater->headerFill == ZLIB_HEADER_LENGTH && !isValidZlibHeader( Inflater->zlibHeader )) {
+				Inflater->errorCode = PNG_ERROR_DECODE;
+				return FALSE;
+			}
+			continue;
+		}
+		if (Inflater->streamEnded) {
+			Inflater->trailer[Inflater->trailerFill++] = *Data++;
+			DataLength--;
+			if (Inflater->trailerFill == ZLIB_TRAILER_LENGTH) {
+				if (getLastByte( Inflater->trailer ) != Inflater->adler) {
+					Inflater->errorCode = PNG_ERROR_ADLER;
+					return FALSE;
+				}
+				Inflater->finished = TRUE;
+			}
+			continue;
+		}
+
+		chunkLength = ( DataLength > UINT_MAX ) ? UINT_MAX : (uInt) DataLength;
+		stream->next_in = (Bytef*) Data;
+		stream->avail_in = chunkLength;
+		do {
+			int ret;
+			size_t produced;
+			stream->next_out = Inflater->outBuffer;
+			stream->avail_out = (uInt) Inflater->outBufferSize;
+			ret = inflate( stream, Z_NO_FLUSH );
+			if (ret == Z_STREAM_END) {
+				Inflater->streamEnded = TRUE;
+			}
+			else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				Inflater->errorCode = PNG_ERROR_DECODE;
+				return FALSE;
+			}
+			produced = Inflater->outBufferSize - stream->avail_out;
+			if (!produced)
+				continue;
+			/*Checksum the output while it is still in the cache*/
+			Inflater->adler = update_adler32( Inflater->adler, Inflater->outBuffer, produced );
+			if (!Sink( Context, Inflater->outBuffer, produced )) {
+				Inflater->errorCode = PNG_ERROR_OUTPUT;
+				return FALSE;
+			}
+		} while (!Inflater->streamEnded && ( stream->avail_out == 0 || stream->avail_in ));
+		Data += chunkLength - stream->avail_in;
+		DataLength -= chunkLength - stream->avail_in;
+	}
+	return TRUE;
+}
+
+void freeInflater( PNGInflater *Inflater ) {
+	if (Inflater->initialised)
+		inflateEnd( &Inflater->stream );
+	Inflater->initialised = FALSE;
+	free( Inflater->outBuffer );
+	Inflater->outBuffer = NULL;
+	releaseMemory( Inflater->reserved );
+	Inflater->reserved = 0;
+}
+
+static int paethPredictor( int a, int b, int c ) {
+	int p = a + b - c;
+	int pa = abs( p - a );
+	int pb = abs( p - b );
+	int pc = abs( p - c );
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+/*
+ * Reverse the filter of one row in place, Row and Previous start with the
+ * filter byte
+ */
+static int unfilterRow( unsigned char *Row, const unsigned char *Previous, size_t Length, unsigned int Bpp ) {
+	unsigned char *x = Row + 1;
+	const unsigned char *b = Previous + 1;
+	size_t i;
+	switch (Row[0]) {
+	case 0:
+		break;
+	case 1:
+		for (i = Bpp; i < Length; i++)
+			x[i] = (unsigned char) ( x[i] + x[i - Bpp] );
+		break;
+	case 2:
+		for (i = 0; i < Length; i++)
+			x[i] = (unsigned char) ( x[i] + b[i] );
+		break;
+	case 3:
+		for (i = 0; i < Bpp && i < Length; i++)
+			x[i] = (unsigned char) ( x[i] + ( b[i] >> 1 ) );
+		for (; i < Length; i++)
+			x[i] = (unsigned char) ( x[i] + ( ( x[i - Bpp] + b[i] ) >> 1 ) );
+		break;
+	case 4:
+		for (i = 0; i < Bpp && i < Length; i++)
+			x[i] = (unsigned char) ( x[i] + b[i] );
+		for (; i < Length; i++)
+			x[i] = (unsigned char) ( x[i] + paethPredictor( x[i - Bpp], b[i], b[i - Bpp] ) );
+		break;
+	default:
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Whether every index of a full row of an indexed image is below the
+ * number of palette entries
+ */
+static int arePaletteIndicesValid( const PNGUnfilter *Unfilter, const unsigned char *Row ) {
+	const ImageHeader *header = &Unfilter->header;
+	unsigned int bits = header->bitDepth;
+	unsigned int mask = ( 1u << bits ) - 1;
+	uint32_t x;
+	if (header->colorType != 3 || !Unfilter->paletteEntries || Unfilter->paletteEntries > mask)
+		return TRUE;
+	for (x = 0; x < header->width; x++) {
+		size_t bit = (size_t) x * bits;
+		if (( ( Row[bit / 8] >> ( 8 - bits - bit % 8 ) ) & mask ) >= Unfilter->paletteEntries)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Hand a full row to the sink once its palette indices are checked
+ */
+static int deliverRow( PNGUnfilter *Unfilter, uint32_t Row, const unsigned char *Data ) {
+	if (!arePaletteIndicesValid( Unfilter, Data )) {
+		Unfilter->errorCode = PNG_ERROR_PALETTE_INDEX;
+		return FALSE;
+	}
+	if (!Unfilter->sink( Unfilter->sinkContext, Row, Data, Unfilter->header.rowBytes )) {
+		Unfilter->errorCode = PNG_ERROR_OUTPUT;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Move on to the next non empty pass, the image is complete when there is none
+ */
+static int startPass( PNGUnfilter *Unfilter, unsigned int Pass ) {
+	const ImageHeader *header = &Unfilter->header;
+	uint32_t y;
+	if (!header->interlace) {
+		if (Pass) {
+			Unfilter->finished = TRUE;
+			return TRUE;
+		}
+		Unfilter->passWidth = header->width;
+		Unfilter->passHeight = header->height;
+	}
+	else {
+		while (Pass < ADAM7_PASSES && !getAdam7Pass( header, Pass, &Unfilter->passWidth, &Unfilter->passHeight ))
+			Pass++;
+		if (Pass == ADAM7_PASSES) {
+			/*All passes are in, hand the image out row by row*/
+			Unfilter->finished = TRUE;
+			for (y = 0; y < header->height; y++) {
+				if (!deliverRow( Unfilter, y, Unfilter->image + (size_t) y * header->rowBytes ))
+					return FALSE;
+			}
+			return TRUE;
+		}
+	}
+	Unfilter->pass = Pass;
+	Unfilter->passRow = 0;
+	Unfilter->passRowBytes = getRowBytes( header, Unfilter->passWidth );
+	Unfilter->rowFill = 0;
+	memset( Unfilter->previousRow, 0, Unfilter->passRowBytes + 1 );
+	return TRUE;
+}
+
+/*
+ * Copy the pixels of a reduced Adam7 row to their place in the image
+ */
+static void scatterPassRow( PNGUnfilter *Unfilter, const unsigned char *Row ) {
+	const ImageHeader *header = &Unfilter->header;
+	unsigned int pass = Unfilter->pass;
+	uint32_t y = adam7StartY[pass] + Unfilter->passRow * adam7StepY[pass];
+	unsigned char *target = Unfilter->image + (size_t) y * header->rowBytes;
+	uint32_t i;
+	if (header->bitsPerPixel >= 8) {
+		size_t bpp = header->bytesPerPixel;
+		for (i = 0; i < Unfilter->passWidth; i++) {
+			size_t x = adam7StartX[pass] + (size_t) i * adam7StepX[pass];
+			memcpy( target + x * bpp, Row + i * bpp, bpp );
+		}
+	}
+	else {
+		unsigned int bits = header->bitsPerPixel;
+		unsigned int mask = ( 1u << bits ) - 1;
+		for (i = 0; i < Unfilter->passWidth; i++) {
+			size_t x = adam7StartX[pass] + (size_t) i * adam7StepX[pass];
+			size_t sourceBit = (size_t) i * bits;
+			size_t targetBit = x * bits;
+			unsigned int value = ( Row[sourceBit / 8] >> ( 8 - bits - sourceBit % 8 ) ) & mask;
+			target[targetBit / 8] |= (unsigned char) ( value << ( 8 - bits - targetBit % 8 ) );
+		}
+	}
+}
+
+int initUnfilter( PNGUnfilter *Unfilter, const ImageHeader *Header, RowSink Sink, void *Context, int MemoryMode ) {
+	size_t reserved;
+	memset( Unfilter, 0, sizeof(*Unfilter) );
+	Unfilter->header = *Header;
+	Unfilter->sink = Sink;
+	Unfilter->sinkContext = Context;
+	if (Header->rowBytes >= SIZE_MAX / 4)
+		return FALSE;
+	if (Header->interlace && Header->rowBytes && Header->height > ( SIZE_MAX / 2 ) / Header->rowBytes)
+		return FALSE;
+	/*two rows, and the whole image when it is interlaced*/
+	reserved = 2 * ( Header->rowBytes + 1 ) + ( Header->interlace ? Header->height * Header->rowBytes : 0 );
+	if (!reserveMemory( reserved, MemoryMode )) {
+		Unfilter->errorCode = PNG_ERROR_BUDGET;
+		return FALSE;
+	}
+	Unfilter->reserved = reserved;
+	Unfilter->previousRow = (unsigned char*) malloc( Header->rowBytes + 1 );
+	Unfilter->currentRow = (unsigned char*) malloc( Header->rowBytes + 1 );
+	if (!Unfilter->previousRow || !Unfilter->currentRow)
+		return FALSE;
+	if (Header->interlace) {
+		Unfilter->image = (unsigned char*) calloc( Header->height, Header->rowBytes );
+		if (!Unfilter->image)
+			return FALSE;
+	}
+	return startPass( Unfilter, 0 );
+}
+
+/*
+ * Consume the inflated stream: filter byte and scanline, row after row
+ */
+int unfilterData( PNGUnfilter *Unfilter, const unsigned char *Data, size_t DataLength ) {
+	while (DataLength) {
+		size_t required;
+		size_t bytesToCopy;
+		unsigned char *row;
+		if (Unfilter->finished) {
+			Unfilter->errorCode = PNG_ERROR_IMAGE_SIZE;
+			return FALSE;
+		}
+		required = Unfilter->passRowBytes + 1 - Unfilter->rowFill;
+		bytesToCopy = ( DataLength < required ) ? DataLength : required;
+		memcpy( Unfilter->currentRow + Unfilter->rowFill, Data, bytesToCopy );
+		Unfilter->rowFill += bytesToCopy;
+		Data += bytesToCopy;
+		DataLength -= bytesToCopy;
+		if (Unfilter->rowFill != Unfilter->passRowBytes + 1)
+			continue;
+
+		if (!unfilterRow( Unfilter->currentRow, Unfilter->previousRow, Unfilter->passRowBytes, Unfilter->header.bytesPerPixel )) {
+			Unfilter->errorCode = PNG_ERROR_FILTER;
+			return FALSE;
+		}
+		if (Unfilter->header.interlace)
+			scatterPassRow( Unfilter, Unfilter->currentRow + 1 );
+		else if (!deliverRow( Unfilter, Unfilter->passRow, Unfilter->currentRow + 1 ))
+			return FALSE;
+		row = Unfilter->previousRow;
+		Unfilter->previousRow = Unfilter->currentRow;
+		Unfilter->currentRow = row;
+		Unfilter->rowFill = 0;
+		if (++Unfilter->passRow == Unfilter->passHeight) {
+			if (!startPass( Unfilter, Unfilter->pass + 1 ))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+void freeUnfilter( PNGUnfilter *Unfilter ) {
+	free( Unfilter->previousRow );
+	free( Unfilter->currentRow );
+	free( Unfilter->image );
+	Unfilter->previousRow = Unfilter->currentRow = Unfilter->image = NULL;
+	releaseMemory( Unfilter->reserved );
+	Unfilter->reserved = 0;
+}
+
+static int unfilterSink( void *Context, const unsigned char *Data, size_t DataLength ) {
+	PNGDecoder *decoder = (PNGDecoder*) Context;
+	if (unfilterData( &decoder->unfilter, Data, DataLength ))
+		return TRUE;
+	decoder->errorCode = decoder->unfilter.errorCode;
+	return FALSE;
+}
+
+int initDecoder( PNGDecoder *Decoder, RowSink Sink, void *Context ) {
+	memset( Decoder, 0, sizeof(*Decoder) );
+	Decoder->sink = Sink;
+	Decoder->sinkContext = Context;
+	Decoder->memoryMode = BUDGET_WAIT;
+	return TRUE;
+}
+
+/*
+ * Feed a validated chunk to the decoder, only IHDR, PLTE, IDAT and IEND
+ * matter
+ */
+int decodeChunk( PNGDecoder *Decoder, const Chunk *chunk ) {
+	if (isChunkType( chunk->chunkType, "IHDR" )) {
+		if (!readImageHeader( &Decoder->header, chunk ) ||
+				!initInflater( &Decoder->inflater, Decoder->memoryMode ) ||
+				!initUnfilter( &Decoder->unfilter, &Decoder->header, Decoder->sink, Decoder->sinkContext,
+						Decoder->memoryMode )) {
+			if (Decoder->inflater.errorCode == PNG_ERROR_BUDGET || Decoder->unfilter.errorCode == PNG_ERROR_BUDGET)
+				Decoder->errorCode = PNG_ERROR_BUDGET;
+			else
+				Decoder->errorCode = PNG_ERROR_MEMORY;
+			return FALSE;
+		}
+		Decoder->hasHeader = TRUE;
+	}
+	else if (isChunkType( chunk->chunkType, "PLTE" )) {
+		Decoder->unfilter.paletteEntries = (unsigned int) ( chunk->dataSize / 3 );
+	}
+	else if (isChunkType( chunk->chunkType, "IDAT" )) {
+		if (!Decoder->hasHeader) {
+			Decoder->errorCode = PNG_ERROR_CHUNK_ORDER;
+			return FALSE;
+		}
+		if (!inflateData( &Decoder->inflater, chunk->Data, chunk->dataSize, unfilterSink, Decoder )) {
+			if (!Decoder->errorCode)
+				Decoder->errorCode = Decoder->inflater.errorCode;
+			return FALSE;
+		}
+	}
+	else if (isChunkType( chunk->chunkType, "IEND" )) {
+		return finishDecoder( Decoder );
+	}
+	return TRUE;
+}
+
+/*
+ * Check that the zlib stream ended and held exactly the whole image
+ */
+int finishDecoder( PNGDecoder *Decoder ) {
+	if (!Decoder->hasHeader || !Decoder->inflater.finished) {
+		Decoder->errorCode = PNG_ERROR_DECODE;
+		return FALSE;
+	}
+	if (!Decoder->unfilter.finished) {
+		Decoder->errorCode = PNG_ERROR_IMAGE_SIZE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+void freeDecoder( PNGDecoder *Decoder ) {
+	freeInflater( &Decoder->inflater );
+	freeUnfilter( &Decoder->unfilter );
+	Decoder->hasHeader = FALSE;
+}
+
+/*
+ * RowSink of a decode that is only run to verify the image data
+ */
+int discardRow( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	(void) Context;
+	(void) Row;
+	(void) Data;
+	(void) Length;
+	return TRUE;
+}
+
+/*
+ * chunkHook that decodes the image while the file is parsed
+ */
+int decoderChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	PNGDecoder *decoder = (PNGDecoder*) Context;
+	if (decodeChunk( decoder, chunk ))
+		return TRUE;
+	reportError( &PNG->chunkInfo, decoder->errorCode, "%s\n", pngErrorString( decoder->errorCode ) );
+	return FALSE;
+}
@@ -0,0 +1,129 @@
+/*
+ * PNGDecode.h
+ *
+ *  Inflate and unfilter the image data
+ */
+
+#ifndef PNGDECODE_H_
+#define PNGDECODE_H_
+
+#include "PNGParser.h"
+#include <zlib.h>
+
+#define ADAM7_PASSES	7
+#define INFLATE_BUFFER_SIZE	( 256 * 1024 )
+
+/*
+ * Image layout taken from IHDR
+ */
+struct imageHeader {
+	uint32_t		width;
+	uint32_t		height;
+	unsigned char	bitDepth;
+	unsigned char	colorType;
+	unsigned char	interlace;
+	unsigned char	channels; //samples per pixel
+	unsigned int	bitsPerPixel;
+	unsigned int	bytesPerPixel; //filter distance, at least 1
+	size_t			rowBytes; //bytes of a full row without the filter byte
+};
+
+typedef struct imageHeader ImageHeader;
+
+/*
+ * Receives the unfiltered rows of the image from top to bottom, in the
+ * packed PNG sample format
+ */
+typedef int (*RowSink)(void*, uint32_t, const unsigned char*, size_t);
+
+/*
+ * Receives the inflated image data stream
+ */
+typedef int (*InflateSink)(void*, const unsigned char*, size_t);
+
+#define ZLIB_HEADER_LENGTH	2
+#define ZLIB_TRAILER_LENGTH	4
+
+/*
+ * zlib stream spread over the IDAT chunks. The deflate data is inflated raw
+ * and the Adler-32 is computed here on the fresh output
+ */
+struct pngInflater {
+	z_stream		stream;
+	int				initialised;
+	int				streamEnded; //end of the deflate data seen
+	int				finished; //Adler-32 trailer read and verified
+	int				errorCode; //PNG_ERROR_* of a failure
+	unsigned long	adler; //running Adler-32 of the output
+	unsigned char	zlibHeader[ZLIB_HEADER_LENGTH];
+	unsigned char	trailer[ZLIB_TRAILER_LENGTH];
+	unsigned int	headerFill;
+	unsigned int	trailerFill;
+	unsigned char	*outBuffer;
+	size_t			outBufferSize;
+	size_t			reserved; //bytes of the memory budget held
+};
+
+typedef struct pngInflater PNGInflater;
+
+/*
+ * Reverses the scanline filters and deinterlaces Adam7 images
+ */
+struct pngUnfilter {
+	ImageHeader		header;
+	RowSink			sink;
+	void			*sinkContext;
+	unsigned char	*previousRow; //with one leading filter byte
+	unsigned char	*currentRow; //with one leading filter byte
+	size_t			rowFill; //bytes of the current row received
+	unsigned int	pass; //Adam7 pass, 0 when not interlaced
+	uint32_t		passRow; //row within the pass
+	uint32_t		passWidth;
+	uint32_t		passHeight;
+	size_t			passRowBytes;
+	unsigned char	*image; //whole image for interlaced files
+	int				finished; //every row has been delivered
+	int				errorCode; //PNG_ERROR_* of a failure
+	size_t			reserved; //bytes of the memory budget held
+	unsigned int	paletteEntries; //PLTE entries the indices must stay below, 0 not checked
+};
+
+typedef struct pngUnfilter PNGUnfilter;
+
+/*
+ * Complete single threaded decoder, usable as the chunkHook of a parser
+ */
+struct pngDecoder {
+	ImageHeader		header;
+	PNGInflater		inflater;
+	PNGUnfilter		unfilter;
+	RowSink			sink;
+	void			*sinkContext;
+	int				hasHeader;
+	int				errorCode;
+	int				memoryMode; //BUDGET_* of the buffers, BUDGET_WAIT unless set after initDecoder()
+};
+
+typedef struct pngDecoder PNGDecoder;
+
+int setImageHeader(ImageHeader*, uint32_t, uint32_t, unsigned int, unsigned int, unsigned int);
+int readImageHeader(ImageHeader*, const Chunk*);
+size_t getRowBytes(const ImageHeader*, uint32_t);
+int getAdam7Pass(const ImageHeader*, unsigned int, uint32_t*, uint32_t*);
+
+int initInflater(PNGInflater*, int);
+int inflateData(PNGInflater*, const unsigned char*, size_t, InflateSink, void*);
+void freeInflater(PNGInflater*);
+
+int initUnfilter(PNGUnfilter*, const ImageHeader*, RowSink, void*, int);
+int unfilterData(PNGUnfilter*, const unsigned char*, size_t);
+void freeUnfilter(PNGUnfilter*);
+
+int initDecoder(PNGDecoder*, RowSink, void*);
+int decodeChunk(PNGDecoder*, const Chunk*);
+int finishDecoder(PNGDecoder*);
+void freeDecoder(PNGDecoder*);
+int decoderChunkHook(PNGData*, const Chunk*, void*);
+int discardRow(void*, uint32_t, const unsigned char*, size_t);
+
+#endif /* PNGDECODE_H_ */
@@ -0,0 +1,535 @@
+#include "PNGEncode.h"
+#include "PNGReader.h"
+#include "PNGThreads.h"
+#include "adler32.h"
+#include "crc.h"
+
+/*
+ * Rows filtered by the tasks of the first pass
+ */
+struct filterJob {
+	const RawImage	*image;
+	unsigned char	*filtered; //every row with its filter byte in front
+	uint32_t		rowsPerTask;
+	unsigned int	filter; //FILTER_* of every row
+	int				failed;
+};
+
+typedef struct filterJob FilterJob;
+
+/*
+ * Segments deflated by the tasks of the second pass
+ */
+struct deflateJob {
+	const unsigned char	*filtered;
+	size_t			filteredLength;
+	size_t			segmentLength;
+	size_t			segmentCount;
+	int				level;
+	int				strategy;
+	DeflateSegment	*segments;
+};
+
+typedef struct deflateJob DeflateJob;
+
+void initEncodeOptions( EncodeOptions *Options ) {
+	memset( Options, 0, sizeof(*Options) );
+	Options->level = ENCODE_DEFAULT_LEVEL;
+	Options->strategy = Z_DEFAULT_STRATEGY;
+	Options->filter = FILTER_ADAPTIVE;
+}
+
+static void putUint32( unsigned char *Data, uint32_t Value ) {
+	Data[0] = (unsigned char) ( Value >> 24 );
+	Data[1] = (unsigned char) ( Value >> 16 );
+	Data[2] = (unsigned char) ( Value >> 8 );
+	Data[3] = (unsigned char) Value;
+}
+
+static int paethPredictor( int a, int b, int c ) {
+	int p = a + b - c;
+	int pa = abs( p - a );
+	int pb = abs( p - b );
+	int pc = abs( p - c );
+	if (pa <= pb && pa <= pc)
+		return a;
+	if (pb <= pc)
+		return b;
+	return c;
+}
+
+/*
+ * Filter one row into Out, Previous is NULL for the first row. Returns the
+ * sum of the outputs taken as signed bytes, the usual estimate of how well
+ * the row will compress
+ */
+static unsigned long filterRow( unsigned int Filter, const unsigned char *Row, const unsigned char *Previous,
+		size_t Length, unsigned int Bpp, unsigned char *Out ) {
+	unsigned long sum = 0;
+	size_t i;
+	for (i = 0; i < Length; i++) {
+		int left = i >= Bpp ? Row[i - Bpp] : 0;
+		int up = Previous ? Previous[i] : 0;
+		int upLeft = Previous && i >= Bpp ? Previous[i - Bpp] : 0;
+		unsigned char value;
+		switch (Filter) {
+		case FILTER_SUB:
+			value = (unsigned char) ( Row[i] - left );
+			break;
+		case FILTER_UP:
+			value = (unsigned char) ( Row[i] - up );
+			break;
+		case FILTER_AVERAGE:
+			value = (unsigned char) ( Row[i] - ( ( left + up ) >> 1 ) );
+			break;
+		case FILTER_PAETH:
+			value = (unsigned char) ( Row[i] - paethPredictor( left, up, upLeft ) );
+			break;
+		default:
+			value = Row[i];
+			break;
+		}
+		Out[i] = value;
+		sum += value < 128 ? value : 256 - value;
+	}
+	return sum;
+}
+
+/*
+ * Filter the rows of one task. With FILTER_ADAPTIVE every filter is tried
+ * on a row and the one with the smallest sum is kept
+ */
+static void filterTask( void *Context, size_t Index ) {
+	FilterJob *job = (FilterJob*) Context;
+	const ImageHeader *header = &job->image->header;
+	size_t rowLength = header->rowBytes + 1;
+	uint32_t row = (uint32_t) Index * job->rowsPerTask;
+	uint32_t end = header->height - row < job->rowsPerTask ? header->height : row + job->rowsPerTask;
+	int adaptive = job->filter == FILTER_ADAPTIVE;
+	unsigned char *scratch = NULL;
+
+	if (adaptive) {
+		scratch = (unsigned char*) malloc( header->rowBytes ? header->rowBytes : 1 );
+		if (!scratch) {
+			job->failed = TRUE;
+			return;
+		}
+	}
+	for (; row < end; row++) {
+		const unsigned char *pixels = job->image->pixels + (size_t) row * job->image->stride;
+		const unsigned char *previous = row ? pixels - job->image->stride : NULL;
+		unsigned char *out = job->filtered + (size_t) row * rowLength;
+		unsigned int filter;
+		unsigned long best;
+
+		out[0] = (unsigned char) ( adaptive ? FILTER_NONE : job->filter );
+		best = filterRow( out[0], pixels, previous, header->rowBytes, header->bytesPerPixel, out + 1 );
+		for (filter = FILTER_SUB; adaptive && filter < FILTER_TYPES; filter++) {
+			unsigned long sum = filterRow( filter, pixels, previous, header->rowBytes, header->bytesPerPixel, scratch );
+			if (sum < best) {
+				best = sum;
+				out[0] = (unsigned char) filter;
+				memcpy( out + 1, scratch, header->rowBytes );
+			}
+		}
+	}
+	free( scratch );
+}
+
+/*
+ * Deflate one segment on its own. The window of the segment before it is
+ * preset as the dictionary and a sync flush ends the segment on a byte
+ * boundary, so the segments joined are one deflate stream
+ */
+static void deflateTask( void *Context, size_t Index ) {
+	DeflateJob *job = (DeflateJob*) Context;
+	DeflateSegment *segment = &job->segments[Index];
+	size_t start = Index * job->segmentLength;
+	size_t length = job->filteredLength - start < job->segmentLength ? job->filteredLength - start : job->segmentLength;
+	int last = Index + 1 == job->segmentCount;
+	size_t capacity;
+	z_stream stream;
+	int ret;
+
+	memset( &stream, 0, sizeof(stream) );
+	if (deflateInit2( &stream, job->level, Z_DEFLATED, -MAX_WBITS, 8, job->strategy ) != Z_OK) {
+		segment->errorCode = PNG_ERROR_MEMORY;
+		return;
+	}
+	if (start) {
+		size_t window = start < ENCODE_WINDOW_SIZE ? start : ENCODE_WINDOW_SIZE;
+		deflateSetDictionary( &stream, job->filtered + start - window, (uInt) window );
+	}
+	/*the flush marker and an empty final block come on top of the bound*/
+	capacity = deflateBound( &stream, (uLong) length ) + 16;
+	segment->data = (unsigned char*) malloc( capacity );
+	if (!segment->data) {
+		deflateEnd( &stream );
+		segment->errorCode = PNG_ERROR_MEMORY;
+		return;
+	}
+	stream.next_in = (Bytef*) job->filtered + start;
+	stream.avail_in = (uInt) length;
+	do {
+		if (segment->length == capacity) {
+			unsigned char *grown = (unsigned char*) realloc( segment->data, capacity * 2 );
+			if (!grown) {
+				segment->errorCode = PNG_ERROR_MEMORY;
+				break;
+			}
+			segment->data = grown;
+			capacity *= 2;
+		}
+		stream.next_out = segment->data + segment->length;
+		stream.avail_out = (uInt) ( capacity - segment->length );
+		ret = deflate( &stream, last ? Z_FINISH : Z_SYNC_FLUSH );
+		segment->length = capacity - stream.avail_out;
+		if (ret == Z_STREAM_ERROR) {
+			segment->errorCode = PNG_ERROR_MEMORY;
+			break;
+		}
+	} while (last ? ret != Z_STREAM_END : stream.avail_out == 0);
+	deflateEnd( &stream );
+	if (segment->errorCode)
+		return;
+	segment->adler = update_adler32( 1, job->filtered + start, length );
+	segment->crc = crc( segment->data, (int) segment->length );
+}
+
+static int writeChunk( ChunkWriter Write, void *Context, const char *Type, const unsigned char *Data, size_t Length ) {
+	unsigned char field[4];
+	putUint32( field, (uint32_t) Length );
+	if (!Write( Context, field, sizeof(field) ) ||
+			!Write( Context, (const unsigned char*) Type, CHUNK_TYPE_LENGTH ) ||
+			!Write( Context, Data, Length ))
+		return FALSE;
+	putUint32( field, getChunkCrc( (const unsigned char*) Type, Data, Length ) );
+	return Write( Context, field, sizeof(field) );
+}
+
+/*
+ * IDAT holding one segment, the first one starts with the zlib header and
+ * the last one ends with the Adler-32. The CRC of the segment is combined
+ * into the CRC of the chunk
+ */
+static int writeSegment( ChunkWriter Write, void *Context, const DeflateSegment *Segment,
+		const unsigned char *Prefix, size_t PrefixLength, const unsigned char *Suffix, size_t SuffixLength ) {
+	unsigned char field[4];
+	unsigned long chunkCrc = update_crc( 0xffffffffL, (const unsigned char*) "IDAT", CHUNK_TYPE_LENGTH );
+	chunkCrc = update_crc( chunkCrc, Prefix, (int) PrefixLength ) ^ 0xffffffffL;
+	chunkCrc = crc_combine( chunkCrc, Segment->crc, Segment->length );
+	chunkCrc = update_crc( chunkCrc ^ 0xffffffffL, Suffix, (int) SuffixLength ) ^ 0xffffffffL;
+	putUint32( field, (uint32_t) ( PrefixLength + Segment->length + SuffixLength ) );
+	if (!Write( Context, field, sizeof(field) ) ||
+			!Write( Context, (const unsigned char*) "IDAT", CHUNK_TYPE_LENGTH ) ||
+			!Write( Context, Prefix, PrefixLength ) ||
+			!Write( Context, Segment->data, Segment->length ) ||
+			!Write( Context, Suffix, SuffixLength ))
+		return FALSE;
+	putUint32( field, (uint32_t) chunkCrc );
+	return Write( Context, field, sizeof(field) );
+}
+
+/*
+ * Write the compressed image as IDAT chunks, one per segment
+ */
+int writeImageChunks( const EncodedImage *Image, ChunkWriter Write, void *Context ) {
+	size_t i;
+	for (i = 0; i < Image->segmentCount; i++) {
+		int first = i == 0;
+		int last = i + 1 == Image->segmentCount;
+		if (!writeSegment( Write, Context, &Image->segments[i], Image->zlibHeader, first ? ZLIB_HEADER_LENGTH : 0,
+				Image->trailer, last ? ZLIB_TRAILER_LENGTH : 0 ))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * zlib header with the compression level hint of the deflate level
+ */
+static void getZlibHeader( unsigned char *Header, int Level ) {
+	unsigned int levelHint = Level < 2 ? 0 : Level < 6 ? 1 : Level == 6 ? 2 : 3;
+	Header[0] = 0x78; //deflate with a 32K window
+	Header[1] = (unsigned char) ( levelHint << 6 );
+	Header[1] = (unsigned char) ( Header[1] + 31 - ( ( Header[0] << 8 ) | Header[1] ) % 31 );
+}
+
+void freeEncodedImage( EncodedImage *Image ) {
+	size_t i;
+	for (i = 0; i < Image->segmentCount; i++)
+		free( Image->segments[i].data );
+	free( Image->segments );
+	Image->segments = NULL;
+	Image->segmentCount = 0;
+}
+
+/*
+ * Filter the rows of Image and deflate the filtered data in segments on
+ * the threads of Options. Returns a PNG_ERROR_* code, Encoded holds the
+ * zlib stream on success
+ */
+int compressImage( const RawImage *Image, const EncodeOptions *Options, EncodedImage *Encoded ) {
+	const ImageHeader *header = &Image->header;
+	unsigned int threads = Options->threads ? Options->threads : getThreadCount();
+	FilterJob filterJob;
+	DeflateJob deflateJob;
+	uint64_t filteredLength;
+	unsigned long adler = 1;
+	int errorCode = PNG_ERROR_NONE;
+	size_t i;
+
+	memset( Encoded, 0, sizeof(*Encoded) );
+	if (!header->width || !header->height || header->width > PNG_MAX_VALUE || header->height > PNG_MAX_VALUE ||
+			header->interlace || Options->level < 1 || Options->level > 9 || Options->filter > FILTER_ADAPTIVE)
+		return PNG_ERROR_CHUNK_DATA;
+	filteredLength = ( (uint64_t) header->rowBytes + 1 ) * header->height;
+	if (filteredLength >= SIZE_MAX)
+		return PNG_ERROR_IMAGE_SIZE;
+
+	memset( &filterJob, 0, sizeof(filterJob) );
+	filterJob.image = Image;
+	filterJob.filter = Options->filter;
+	/*palette and low bit depth images compress best unfiltered*/
+	if (filterJob.filter == FILTER_ADAPTIVE && ( header->colorType == 3 || header->bitDepth < 8 ))
+		filterJob.filter = FILTER_NONE;
+	filterJob.filtered = (unsigned char*) malloc( (size_t) filteredLength );
+	if (!filterJob.filtered)
+		return PNG_ERROR_MEMORY;
+	filterJob.rowsPerTask = (uint32_t) ( ENCODE_MIN_SEGMENT / ( header->rowBytes + 1 ) + 1 );
+	parallelFor( ( header->height + filterJob.rowsPerTask - 1 ) / filterJob.rowsPerTask, threads, filterTask, &filterJob );
+	if (filterJob.failed) {
+		free( filterJob.filtered );
+		return PNG_ERROR_MEMORY;
+	}
+
+	memset( &deflateJob, 0, sizeof(deflateJob) );
+	deflateJob.filtered = filterJob.filtered;
+	deflateJob.filteredLength = (size_t) filteredLength;
+	deflateJob.level = Options->level;
+	deflateJob.strategy = Options->strategy;
+	/*a single thread deflates in one piece, nothing is lost at the seams*/
+	deflateJob.segmentLength = deflateJob.filteredLength;
+	if (threads > 1)
+		deflateJob.segmentLength = deflateJob.filteredLength / ( (size_t) threads * ENCODE_SEGMENTS_PER_THREAD ) + 1;
+	if (deflateJob.segmentLength < ENCODE_MIN_SEGMENT)
+		deflateJob.segmentLength = ENCODE_MIN_SEGMENT;
+	if (deflateJob.segmentLength > ENCODE_MAX_SEGMENT)
+		deflateJob.segmentLength = ENCODE_MAX_SEGMENT;
+	deflateJob.segmentCount = ( deflateJob.filteredLength + deflateJob.segmentLength - 1 ) / deflateJob.segmentLength;
+	deflateJob.segments = (DeflateSegment*) calloc( deflateJob.segmentCount, sizeof(DeflateSegment) );
+	if (!deflateJob.segments) {
+		free( filterJob.filtered );
+		return PNG_ERROR_MEMORY;
+	}
+	parallelFor( deflateJob.segmentCount, threads, deflateTask, &deflateJob );
+	free( filterJob.filtered );
+
+	Encoded->segments = deflateJob.segments;
+	Encoded->segmentCount = deflateJob.segmentCount;
+	Encoded->length = ZLIB_HEADER_LENGTH + ZLIB_TRAILER_LENGTH;
+	for (i = 0; i < deflateJob.segmentCount && !errorCode; i++) {
+		size_t length = i + 1 == deflateJob.segmentCount ?
+				deflateJob.filteredLength - i * deflateJob.segmentLength : deflateJob.segmentLength;
+		errorCode = deflateJob.segments[i].errorCode;
+		adler = adler32_combine( adler, deflateJob.segments[i].adler, (z_off_t) length );
+		Encoded->length += deflateJob.segments[i].length;
+	}
+	if (errorCode) {
+		freeEncodedImage( Encoded );
+		return errorCode;
+	}
+	getZlibHeader( Encoded->zlibHeader, Options->level );
+	putUint32( Encoded->trailer, (uint32_t) adler );
+	return PNG_ERROR_NONE;
+}
+
+static int writeFile( void *Context, const unsigned char *Data, size_t Length ) {
+	return fwrite( Data, 1, Length, (FILE*) Context ) == Length;
+}
+
+/*
+ * Write Image as a non interlaced PNG file with the colour chunks, PLTE and
+ * tRNS of the options. Returns a PNG_ERROR_* code
+ */
+int encodeImage( const RawImage *Image, const EncodeOptions *Options, FILE *Output ) {
+	const ImageHeader *header = &Image->header;
+	unsigned char ihdr[IHDR_DATA_LENGTH];
+	EncodedImage encoded;
+	int errorCode;
+	size_t i;
+
+	if (header->colorType == 3 && ( !Options->palette || !Options->paletteEntries || Options->paletteEntries > 256 ))
+		return PNG_ERROR_PALETTE;
+	errorCode = compressImage( Image, Options, &encoded );
+	if (errorCode)
+		return errorCode;
+	putUint32( ihdr, header->width );
+	putUint32( ihdr + 4, header->height );
+	ihdr[8] = header->bitDepth;
+	ihdr[9] = header->colorType;
+	ihdr[10] = 0; //deflate
+	ihdr[11] = 0; //adaptive filtering
+	ihdr[12] = 0; //no interlace
+	if (!writeFile( Output, pngHeader, sizeof(pngHeader) ) ||
+			!writeChunk( writeFile, Output, "IHDR", ihdr, sizeof(ihdr) ))
+		errorCode = PNG_ERROR_OUTPUT;
+	for (i = 0; i < Options->colorChunkCount && !errorCode; i++) {
+		const Chunk *chunk = &Options->colorChunks[i];
+		if (!writeChunk( writeFile, Output, (const char*) chunk->chunkType, chunk->Data, chunk->dataSize ))
+			errorCode = PNG_ERROR_OUTPUT;
+	}
+	if (errorCode ||
+			( Options->palette && !writeChunk( writeFile, Output, "PLTE", Options->palette, Options->paletteEntries * 3 ) ) ||
+			( Options->transparency &&
+			!writeChunk( writeFile, Output, "tRNS", Options->transparency, Options->transparencyLength ) ) ||
+			!writeImageChunks( &encoded, writeFile, Output ) ||
+			!writeChunk( writeFile, Output, "IEND", (const unsigned char*) "", 0 ))
+		errorCode = PNG_ERROR_OUTPUT;
+	freeEncodedImage( &encoded );
+	return errorCode;
+}
+
+static int collectRow( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	DecodedImage *image = (DecodedImage*) Context;
+	const ImageHeader *header = &image->decoder.header;
+	if (!image->pixels) {
+		uint64_t size = (uint64_t) header->rowBytes * header->height;
+		if (size >= SIZE_MAX || !( image->pixels = (unsigned char*) malloc( (size_t) size ) )) {
+			image->errorCode = PNG_ERROR_MEMORY;
+			return FALSE;
+		}
+	}
+	memcpy( image->pixels + (size_t) Row * header->rowBytes, Data, Length );
+	return TRUE;
+}
+
+/*
+ * Whether a re-encode carries the chunk over, it describes the colours of
+ * the pixels and not how they are stored
+ */
+static int isColorChunk( const Chunk *chunk ) {
+	return isChunkType( chunk->chunkType, "gAMA" ) || isChunkType( chunk->chunkType, "cHRM" ) ||
+			isChunkType( chunk->chunkType, "sRGB" ) || isChunkType( chunk->chunkType, "iCCP" );
+}
+
+static int keepColorChunk( DecodedImage *Image, const Chunk *chunk ) {
+	Chunk *kept;
+	unsigned char *data;
+	if (Image->colorChunkCount == ENCODE_COLOR_CHUNKS)
+		return TRUE;
+	data = (unsigned char*) malloc( chunk->dataSize ? chunk->dataSize : 1 );
+	if (!data) {
+		Image->errorCode = PNG_ERROR_MEMORY;
+		return FALSE;
+	}
+	memcpy( data, chunk->Data, chunk->dataSize );
+	kept = &Image->colorChunks[Image->colorChunkCount++];
+	memcpy( kept->chunkType, chunk->chunkType, CHUNK_TYPE_LENGTH );
+	kept->dataSize = chunk->dataSize;
+	kept->Data = data;
+	return TRUE;
+}
+
+/*
+ * chunkHook of decodeImageFile(), the palette, tRNS and the colour chunks
+ * are kept along with the pixels
+ */
+static int decodeImageHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	DecodedImage *image = (DecodedImage*) Context;
+	if (isChunkType( chunk->chunkType, "PLTE" )) {
+		memcpy( image->palette, chunk->Data, chunk->dataSize );
+		image->paletteEntries = chunk->dataSize / 3;
+	}
+	else if (isChunkType( chunk->chunkType, "tRNS" ) && chunk->dataSize <= sizeof(image->transparency)) {
+		memcpy( image->transparency, chunk->Data, chunk->dataSize );
+		image->transparencyLength = chunk->dataSize;
+	}
+	else if (isColorChunk( chunk ) && !keepColorChunk( image, chunk )) {
+		reportError( &PNG->chunkInfo, image->errorCode, "%s\n", pngErrorString( image->errorCode ) );
+		return FALSE;
+	}
+	else if (isChunkType( chunk->chunkType, "IDAT" )) {
+		image->imageDataBytes += chunk->dataSize;
+	}
+	if (decodeChunk( &image->decoder, chunk ))
+		return TRUE;
+	if (!image->errorCode)
+		image->errorCode = image->decoder.errorCode;
+	reportError( &PNG->chunkInfo, image->errorCode, "%s\n", pngErrorString( image->errorCode ) );
+	return FALSE;
+}
+
+/*
+ * Parse and decode FileName into Image, interlaced images come out as
+ * plain rows. Image must be freed with freeDecodedImage() either way
+ */
+int decodeImageFile( const char *FileName, int Quiet, DecodedImage *Image, FileResult *Result ) {
+	const ImageHeader *header = &Image->decoder.header;
+
+	memset( Image, 0, sizeof(*Image) );
+	initDecoder( &Image->decoder, collectRow, Image );
+	if (!parseFileWithHook( FileName, Quiet, VERIFY_FULL, decodeImageHook, Image, Result ))
+		return FALSE;
+	setImageHeader( &Image->raw.header, header->width, header->height, header->bitDepth, header->colorType, 0 );
+	Image->raw.pixels = Image->pixels;
+	Image->raw.stride = header->rowBytes;
+	return TRUE;
+}
+
+void freeDecodedImage( DecodedImage *Image ) {
+	size_t i;
+	freeDecoder( &Image->decoder );
+	free( Image->pixels );
+	for (i = 0; i < Image->colorChunkCount; i++)
+		free( (void*) Image->colorChunks[i].Data );
+	Image->colorChunkCount = 0;
+	Image->pixels = NULL;
+	Image->raw.pixels = NULL;
+}
+
+/*
+ * Decode InName and encode the image again to OutName. The output is not
+ * interlaced, of the ancillary chunks it keeps tRNS, gAMA, cHRM, sRGB and
+ * iCCP. OutName is removed again when either step fails
+ */
+int encodeFile( const char *InName, const char *OutName, const EncodeOptions *Options, int Quiet, FileResult *Result ) {
+	DecodedImage image;
+	EncodeOptions options = *Options;
+	FILE *Output;
+
+	if (decodeImageFile( InName, Quiet, &image, Result )) {
+		if (image.raw.header.colorType == 3) {
+			options.palette = image.palette;
+			options.paletteEntries = image.paletteEntries;
+		}
+		if (image.transparencyLength) {
+			options.transparency = image.transparency;
+			options.transparencyLength = image.transparencyLength;
+		}
+		options.colorChunks = image.colorChunks;
+		options.colorChunkCount = image.colorChunkCount;
+		Output = fopen( OutName, "wb" );
+		if (!Output) {
+			if (!Quiet)
+				printf( "Cannot create file %s\n", OutName );
+			Result->errorCode = PNG_ERROR_OUTPUT;
+		}
+		else {
+			long written;
+			Result->errorCode = encodeImage( &image.raw, &options, Output );
+			written = ftell( Output );
+			if (fclose( Output ) && !Result->errorCode)
+				Result->errorCode = PNG_ERROR_OUTPUT;
+			if (Result->errorCode)
+				remove( OutName );
+			if (Result->errorCode && !Quiet)
+				printf( "%s\n", pngErrorString( Result->errorCode ) );
+			else if (!Quiet)
+				printf( "WROTE %s: %ld BYTES\n", OutName, written );
+		}
+		Result->parsed = !Result->errorCode;
+	}
+	freeDecodedImage( &image );
+	return Result->parsed;
+}
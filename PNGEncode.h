@@ -0,0 +1,118 @@
+/*
+ * PNGEncode.h
+ *
+ *  Filter and compress raw rows into a PNG file, the zlib stream is built
+ *  from segments deflated on several cores
+ */
+
+#ifndef PNGENCODE_H_
+#define PNGENCODE_H_
+
+#include "PNGDecode.h"
+
+#define ENCODE_WINDOW_SIZE	32768 //deflate window carried into the next segment
+#define ENCODE_MIN_SEGMENT	( 256 * 1024 ) //filtered bytes deflated by one task at least
+#define ENCODE_MAX_SEGMENT	( 8 * 1024 * 1024 ) //and at most, every segment becomes one IDAT
+#define ENCODE_SEGMENTS_PER_THREAD	2
+#define ENCODE_DEFAULT_LEVEL	6
+#define ENCODE_COLOR_CHUNKS	4 //gAMA, cHRM, sRGB and iCCP carried over by a re-encode
+
+#define FILTER_NONE	0
+#define FILTER_SUB	1
+#define FILTER_UP	2
+#define FILTER_AVERAGE	3
+#define FILTER_PAETH	4
+#define FILTER_TYPES	5
+#define FILTER_ADAPTIVE	FILTER_TYPES //a filter picked for every row
+
+/*
+ * Settings of an encode, initEncodeOptions() fills in the defaults
+ */
+struct encodeOptions {
+	int						level; //zlib level 1-9
+	int						strategy; //zlib strategy
+	unsigned int			filter; //FILTER_* of every row
+	unsigned int			threads; //0 for all of them
+	const unsigned char		*palette; //RGB entries of color type 3
+	size_t					paletteEntries;
+	const unsigned char		*transparency; //data of a tRNS chunk, NULL for none
+	size_t					transparencyLength;
+	const Chunk				*colorChunks; //written ahead of PLTE as they are
+	size_t					colorChunkCount;
+};
+
+typedef struct encodeOptions EncodeOptions;
+
+/*
+ * Rows of an image in the packed PNG sample format, Stride bytes apart
+ */
+struct rawImage {
+	ImageHeader				header;
+	const unsigned char		*pixels;
+	size_t					stride;
+};
+
+typedef struct rawImage RawImage;
+
+/*
+ * Piece of the zlib stream deflated by one task
+ */
+struct deflateSegment {
+	unsigned char	*data;
+	size_t			length;
+	unsigned long	adler; //Adler-32 of the input of the segment
+	unsigned long	crc; //CRC of the output of the segment
+	int				errorCode;
+};
+
+typedef struct deflateSegment DeflateSegment;
+
+/*
+ * Compressed image data, the segments in order between the zlib header
+ * and the Adler-32
+ */
+struct encodedImage {
+	DeflateSegment	*segments;
+	size_t			segmentCount;
+	unsigned char	zlibHeader[ZLIB_HEADER_LENGTH];
+	unsigned char	trailer[ZLIB_TRAILER_LENGTH];
+	uint64_t		length; //bytes of the whole zlib stream
+};
+
+typedef struct encodedImage EncodedImage;
+
+/*
+ * Image of a decoded file with what is needed to encode it again
+ */
+struct decodedImage {
+	PNGDecoder		decoder;
+	RawImage		raw; //not interlaced any more
+	unsigned char	*pixels;
+	unsigned char	palette[256 * 3];
+	size_t			paletteEntries;
+	unsigned char	transparency[256]; //tRNS data
+	size_t			transparencyLength; //0 when the file has no tRNS
+	Chunk			colorChunks[ENCODE_COLOR_CHUNKS]; //own copies of the data
+	size_t			colorChunkCount;
+	uint64_t		imageDataBytes; //IDAT data of the file
+	int				errorCode;
+};
+
+typedef struct decodedImage DecodedImage;
+
+/*
+ * Receives the bytes of the chunks written
+ */
+typedef int (*ChunkWriter)(void*, const unsigned char*, size_t);
+
+void initEncodeOptions(EncodeOptions*);
+int compressImage(const RawImage*, const EncodeOptions*, EncodedImage*);
+int writeImageChunks(const EncodedImage*, ChunkWriter, void*);
+void freeEncodedImage(EncodedImage*);
+int encodeImage(const RawImage*, const EncodeOptions*, FILE*);
+
+int decodeImageFile(const char*, int, DecodedImage*, FileResult*);
+void freeDecodedImage(DecodedImage*);
+int encodeFile(const char*, const char*, const EncodeOptions*, int, FileResult*);
+
+#endif /* PNGENCODE_H_ */
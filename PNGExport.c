@@ -0,0 +1,586 @@
+#include "PNGExport.h"
+#include "PNGThreads.h"
+#include "PNGReader.h"
+#include <sys/stat.h>
+
+/*
+ * Layout of the columns, in the order of the EXPORT_* column numbers
+ */
+static const struct {
+	const char		*name;
+	unsigned char	type;
+	unsigned char	count;
+} exportSchema[EXPORT_COLUMNS] = {
+	{ "name_offsets", EXPORT_TYPE_U32, 1 },
+	{ "name_bytes", EXPORT_TYPE_U8, 1 },
+	{ "parsed", EXPORT_TYPE_U8, 1 },
+	{ "error", EXPORT_TYPE_U8, 1 },
+	{ "file_size", EXPORT_TYPE_U64, 1 },
+	{ "width", EXPORT_TYPE_U32, 1 },
+	{ "height", EXPORT_TYPE_U32, 1 },
+	{ "bit_depth", EXPORT_TYPE_U8, 1 },
+	{ "color_type", EXPORT_TYPE_U8, 1 },
+	{ "interlace", EXPORT_TYPE_U8, 1 },
+	{ "present", EXPORT_TYPE_U32, 1 },
+	{ "gamma", EXPORT_TYPE_U32, 1 },
+	{ "chromaticities", EXPORT_TYPE_U32, 8 },
+	{ "phys_x", EXPORT_TYPE_U32, 1 },
+	{ "phys_y", EXPORT_TYPE_U32, 1 },
+	{ "phys_unit", EXPORT_TYPE_U8, 1 },
+	{ "time_year", EXPORT_TYPE_U16, 1 },
+	{ "time_fields", EXPORT_TYPE_U8, 5 },
+	{ "chunk_count", EXPORT_TYPE_U32, 1 },
+	{ "chunk_bytes", EXPORT_TYPE_U64, 1 },
+	{ "idat_count", EXPORT_TYPE_U32, 1 },
+	{ "idat_bytes", EXPORT_TYPE_U64, 1 },
+	{ "text_offsets", EXPORT_TYPE_U32, 1 },
+	{ "text_keys", EXPORT_TYPE_U32, 1 },
+};
+
+static const unsigned char exportPadding[EXPORT_ALIGNMENT];
+
+static int appendBytes( ExportBuffer *Buffer, const void *Data, size_t Length ) {
+	if (Buffer->length + Length > Buffer->capacity) {
+		size_t capacity = Buffer->capacity ? Buffer->capacity * 2 : 4096;
+		unsigned char *data;
+		while (capacity < Buffer->length + Length)
+			capacity *= 2;
+		data = (unsigned char*) realloc( Buffer->data, capacity );
+		if (!data)
+			return FALSE;
+		Buffer->data = data;
+		Buffer->capacity = capacity;
+	}
+	memcpy( Buffer->data + Buffer->length, Data, Length );
+	Buffer->length += Length;
+	return TRUE;
+}
+
+static int appendUint32( ExportBuffer *Buffer, uint32_t Value ) {
+	return appendBytes( Buffer, &Value, sizeof(Value) );
+}
+
+static void putColumn( ExportWriter *Writer, unsigned int Column, const void *Data, size_t Length ) {
+	if (!appendBytes( &Writer->columns[Column], Data, Length ))
+		Writer->failed = TRUE;
+}
+
+static void writeBytes( ExportWriter *Writer, const void *Data, size_t Length ) {
+	if (Length && fwrite( Data, 1, Length, Writer->file ) != Length)
+		Writer->failed = TRUE;
+	Writer->offset += Length;
+}
+
+static void writeAlignment( ExportWriter *Writer ) {
+	if (Writer->offset % EXPORT_ALIGNMENT)
+		writeBytes( Writer, exportPadding, EXPORT_ALIGNMENT - Writer->offset % EXPORT_ALIGNMENT );
+}
+
+/*
+ * The offsets columns of a row group start with a 0
+ */
+static void startGroup( ExportWriter *Writer ) {
+	uint32_t zero = 0;
+	putColumn( Writer, EXPORT_NAME_OFFSETS, &zero, sizeof(zero) );
+	putColumn( Writer, EXPORT_TEXT_OFFSETS, &zero, sizeof(zero) );
+}
+
+int openExportWriter( ExportWriter *Writer, const char *FileName ) {
+	ExportHeader header;
+	memset( Writer, 0, sizeof(*Writer) );
+	Writer->file = fopen( FileName, "wb" );
+	if (!Writer->file)
+		return FALSE;
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, EXPORT_MAGIC, EXPORT_MAGIC_LENGTH - 1 );
+	header.magic[EXPORT_MAGIC_LENGTH - 1] = EXPORT_VERSION;
+	header.byteOrder = EXPORT_BYTE_ORDER;
+	header.columns = EXPORT_COLUMNS;
+	writeBytes( Writer, &header, sizeof(header) );
+	if (Writer->failed) {
+		fclose( Writer->file );
+		Writer->file = NULL;
+		return FALSE;
+	}
+	startGroup( Writer );
+	return TRUE;
+}
+
+/*
+ * Write the buffered rows as one row group and empty the buffers
+ */
+static void flushGroup( ExportWriter *Writer ) {
+	ExportGroup *group;
+	unsigned int column;
+	if (!Writer->groupRows || Writer->failed)
+		return;
+	if (Writer->groupCount == Writer->groupCapacity) {
+		size_t capacity = Writer->groupCapacity ? Writer->groupCapacity * 2 : 16;
+		ExportGroup *groups = (ExportGroup*) realloc( Writer->groups, capacity * sizeof(ExportGroup) );
+		if (!groups) {
+			Writer->failed = TRUE;
+			return;
+		}
+		Writer->groups = groups;
+		Writer->groupCapacity = capacity;
+	}
+	group = &Writer->groups[Writer->groupCount++];
+	group->rows = Writer->groupRows;
+	for (column = 0; column < EXPORT_COLUMNS; column++) {
+		writeAlignment( Writer );
+		group->offset[column] = Writer->offset;
+		group->length[column] = Writer->columns[column].length;
+		writeBytes( Writer, Writer->columns[column].data, Writer->columns[column].length );
+		Writer->columns[column].length = 0;
+	}
+	Writer->groupRows = 0;
+	startGroup( Writer );
+}
+
+static uint32_t hashKeyword( const char *Keyword ) {
+	uint32_t hash = 2166136261u;
+	while (*Keyword)
+		hash = ( hash ^ (unsigned char) *Keyword++ ) * 16777619u;
+	return hash;
+}
+
+/*
+ * Dictionary id of a text keyword, added when it is new
+ */
+static int internKeyword( ExportWriter *Writer, const char *Keyword, uint32_t *Id ) {
+	size_t mask;
+	size_t slot;
+	if (2 * ( (size_t) Writer->keywordCount + 1 ) > Writer->keywordTableSize) {
+		size_t size = Writer->keywordTableSize ? Writer->keywordTableSize * 2 : 256;
+		uint32_t *table = (uint32_t*) calloc( size, sizeof(uint32_t) );
+		uint32_t id;
+		if (!table)
+			return FALSE;
+		for (id = 0; id < Writer->keywordCount; id++) {
+			const char *keyword = (const char*) Writer->keywords.data + ( (uint32_t*) Writer->keywordOffsets.data )[id];
+			for (slot = hashKeyword( keyword ) & ( size - 1 ); table[slot]; slot = ( slot + 1 ) & ( size - 1 ))
+				;
+			table[slot] = id + 1;
+		}
+		free( Writer->keywordTable );
+		Writer->keywordTable = table;
+		Writer->keywordTableSize = size;
+	}
+	mask = Writer->keywordTableSize - 1;
+	for (slot = hashKeyword( Keyword ) & mask; Writer->keywordTable[slot]; slot = ( slot + 1 ) & mask) {
+		uint32_t id = Writer->keywordTable[slot] - 1;
+		const char *keyword = (const char*) Writer->keywords.data + ( (uint32_t*) Writer->keywordOffsets.data )[id];
+		if (!strcmp( keyword, Keyword )) {
+			*Id = id;
+			return TRUE;
+		}
+	}
+	if (!appendUint32( &Writer->keywordOffsets, (uint32_t) Writer->keywords.length ) ||
+			!appendBytes( &Writer->keywords, Keyword, strlen( Keyword ) + 1 ))
+		return FALSE;
+	*Id = Writer->keywordCount++;
+	Writer->keywordTable[slot] = *Id + 1;
+	return TRUE;
+}
+
+/*
+ * Add the row of one file, the row group is written once it is full
+ */
+int appendExportRecord( ExportWriter *Writer, const ExportRecord *Record ) {
+	const char *name = Record->result.fileName;
+	const char *key = Record->keys;
+	unsigned char parsed = (unsigned char) Record->result.parsed;
+	unsigned char errorCode = (unsigned char) Record->result.errorCode;
+	uint32_t end;
+	uint32_t i;
+
+	putColumn( Writer, EXPORT_NAME_BYTES, name, strlen( name ) );
+	end = (uint32_t) Writer->columns[EXPORT_NAME_BYTES].length;
+	putColumn( Writer, EXPORT_NAME_OFFSETS, &end, sizeof(end) );
+	putColumn( Writer, EXPORT_PARSED, &parsed, 1 );
+	putColumn( Writer, EXPORT_ERROR, &errorCode, 1 );
+	putColumn( Writer, EXPORT_FILE_SIZE, &Record->fileSize, sizeof(Record->fileSize) );
+	putColumn( Writer, EXPORT_WIDTH, &Record->width, sizeof(Record->width) );
+	putColumn( Writer, EXPORT_HEIGHT, &Record->height, sizeof(Record->height) );
+	putColumn( Writer, EXPORT_BIT_DEPTH, &Record->bitDepth, 1 );
+	putColumn( Writer, EXPORT_COLOR_TYPE, &Record->colorType, 1 );
+	putColumn( Writer, EXPORT_INTERLACE, &Record->interlace, 1 );
+	putColumn( Writer, EXPORT_PRESENT, &Record->present, sizeof(Record->present) );
+	putColumn( Writer, EXPORT_GAMMA, &Record->gamma, sizeof(Record->gamma) );
+	putColumn( Writer, EXPORT_CHROMATICITIES, Record->chromaticities, sizeof(Record->chromaticities) );
+	putColumn( Writer, EXPORT_PHYS_X, &Record->physX, sizeof(Record->physX) );
+	putColumn( Writer, EXPORT_PHYS_Y, &Record->physY, sizeof(Record->physY) );
+	putColumn( Writer, EXPORT_PHYS_UNIT, &Record->physUnit, 1 );
+	putColumn( Writer, EXPORT_TIME_YEAR, &Record->timeYear, sizeof(Record->timeYear) );
+	putColumn( Writer, EXPORT_TIME_FIELDS, Record->timeFields, sizeof(Record->timeFields) );
+	putColumn( Writer, EXPORT_CHUNK_COUNT, &Record->chunkCount, sizeof(Record->chunkCount) );
+	putColumn( Writer, EXPORT_CHUNK_BYTES, &Record->chunkBytes, sizeof(Record->chunkBytes) );
+	putColumn( Writer, EXPORT_IDAT_COUNT, &Record->idatCount, sizeof(Record->idatCount) );
+	putColumn( Writer, EXPORT_IDAT_BYTES, &Record->idatBytes, sizeof(Record->idatBytes) );
+	for (i = 0; i < Record->keyCount; i++, key += strlen( key ) + 1) {
+		uint32_t id;
+		if (!internKeyword( Writer, key, &id ))
+			Writer->failed = TRUE;
+		putColumn( Writer, EXPORT_TEXT_KEYS, &id, sizeof(id) );
+	}
+	end = (uint32_t) ( Writer->columns[EXPORT_TEXT_KEYS].length / sizeof(uint32_t) );
+	putColumn( Writer, EXPORT_TEXT_OFFSETS, &end, sizeof(end) );
+
+	Writer->rows++;
+	if (++Writer->groupRows == EXPORT_ROW_GROUP)
+		flushGroup( Writer );
+	return !Writer->failed;
+}
+
+/*
+ * Write the last row group, the dictionary, the footer and the trailer.
+ * Returns FALSE when anything could not be written
+ */
+int closeExportWriter( ExportWriter *Writer ) {
+	ExportTrailer trailer;
+	unsigned int column;
+	int written;
+
+	flushGroup( Writer );
+	memset( &trailer, 0, sizeof(trailer) );
+	writeAlignment( Writer );
+	trailer.dictionaryOffset = Writer->offset;
+	trailer.dictionaryCount = Writer->keywordCount;
+	trailer.dictionaryBytes = Writer->keywords.length;
+	if (!appendUint32( &Writer->keywordOffsets, (uint32_t) Writer->keywords.length ))
+		Writer->failed = TRUE;
+	writeBytes( Writer, Writer->keywordOffsets.data, Writer->keywordOffsets.length );
+	writeBytes( Writer, Writer->keywords.data, Writer->keywords.length );
+
+	writeAlignment( Writer );
+	trailer.footerOffset = Writer->offset;
+	for (column = 0; column < EXPORT_COLUMNS; column++) {
+		ExportColumn description;
+		memset( &description, 0, sizeof(description) );
+		strncpy( description.name, exportSchema[column].name, EXPORT_COLUMN_NAME_LENGTH - 1 );
+		description.type = exportSchema[column].type;
+		description.count = exportSchema[column].count;
+		writeBytes( Writer, &description, sizeof(description) );
+	}
+	writeBytes( Writer, Writer->groups, Writer->groupCount * sizeof(ExportGroup) );
+	trailer.groups = Writer->groupCount;
+	trailer.rows = Writer->rows;
+	memcpy( trailer.magic, EXPORT_MAGIC, EXPORT_MAGIC_LENGTH - 1 );
+	trailer.magic[EXPORT_MAGIC_LENGTH - 1] = EXPORT_VERSION;
+	writeBytes( Writer, &trailer, sizeof(trailer) );
+
+	written = !Writer->failed;
+	if (fclose( Writer->file ))
+		written = FALSE;
+	for (column = 0; column < EXPORT_COLUMNS; column++)
+		free( Writer->columns[column].data );
+	free( Writer->groups );
+	free( Writer->keywords.data );
+	free( Writer->keywordOffsets.data );
+	free( Writer->keywordTable );
+	memset( Writer, 0, sizeof(*Writer) );
+	return written;
+}
+
+static int addKeyword( ExportRecord *Record, const Chunk *chunk ) {
+	const unsigned char *end = (const unsigned char*) memchr( chunk->Data, 0x00, chunk->dataSize );
+	size_t length = end ? (size_t) ( end - chunk->Data ) : 0;
+	if (Record->keysLength + length + 1 > Record->keysCapacity) {
+		size_t capacity = Record->keysCapacity ? Record->keysCapacity * 2 : 256;
+		char *keys;
+		while (capacity < Record->keysLength + length + 1)
+			capacity *= 2;
+		keys = (char*) realloc( Record->keys, capacity );
+		if (!keys)
+			return FALSE;
+		Record->keys = keys;
+		Record->keysCapacity = capacity;
+	}
+	memcpy( Record->keys + Record->keysLength, chunk->Data, length );
+	Record->keys[Record->keysLength + length] = 0;
+	Record->keysLength += length + 1;
+	Record->keyCount++;
+	return TRUE;
+}
+
+/*
+ * chunkHook of exportFile(), the chunks have been validated so only the
+ * fields are taken out of them
+ */
+static int exportChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	ExportRecord *record = (ExportRecord*) Context;
+	unsigned int i;
+	record->chunkCount++;
+	record->chunkBytes += chunk->dataSize;
+	if (isChunkType( chunk->chunkType, "IDAT" )) {
+		record->idatCount++;
+		record->idatBytes += chunk->dataSize;
+	}
+	else if (isChunkType( chunk->chunkType, "IHDR" )) {
+		record->width = PNG->chunkInfo.width;
+		record->height = PNG->chunkInfo.height;
+		record->bitDepth = PNG->chunkInfo.bitDepth;
+		record->colorType = PNG->chunkInfo.colorType;
+		record->interlace = PNG->chunkInfo.interlace;
+	}
+	else if (isChunkType( chunk->chunkType, "gAMA" )) {
+		record->present |= EXPORT_HAS_GAMA;
+		record->gamma = getLastByte( chunk->Data );
+	}
+	else if (isChunkType( chunk->chunkType, "cHRM" )) {
+		record->present |= EXPORT_HAS_CHRM;
+		for (i = 0; i < 8; i++)
+			record->chromaticities[i] = getLastByte( chunk->Data + 4 * i );
+	}
+	else if (isChunkType( chunk->chunkType, "pHYs" )) {
+		record->present |= EXPORT_HAS_PHYS;
+		record->physX = getLastByte( chunk->Data );
+		record->physY = getLastByte( chunk->Data + 4 );
+		record->physUnit = chunk->Data[8];
+	}
+	else if (isChunkType( chunk->chunkType, "tIME" )) {
+		record->present |= EXPORT_HAS_TIME;
+		record->timeYear = getLastWord( chunk->Data );
+		memcpy( record->timeFields, chunk->Data + 2, sizeof(record->timeFields) );
+	}
+	else if (isChunkType( chunk->chunkType, "tEXt" ) || isChunkType( chunk->chunkType, "zTXt" ) ||
+			isChunkType( chunk->chunkType, "iTXt" )) {
+		if (!addKeyword( record, chunk )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Validate FileName without any console output and fill Record with what
+ * was found, also of a file that turned out to be invalid
+ */
+int exportFile( const char *FileName, int VerifyLevel, ExportRecord *Record ) {
+	struct stat status;
+	memset( Record, 0, sizeof(*Record) );
+	parseFileWithHook( FileName, TRUE, VerifyLevel, exportChunkHook, Record, &Record->result );
+	/*a parse that stops early hasn't read the whole file*/
+	if (!stat( FileName, &status ))
+		Record->fileSize = (uint64_t) status.st_size;
+	else
+		Record->fileSize = Record->result.bytesRead;
+	return Record->result.parsed;
+}
+
+void freeExportRecord( ExportRecord *Record ) {
+	free( Record->keys );
+	Record->keys = NULL;
+	Record->keysLength = Record->keysCapacity = 0;
+	Record->keyCount = 0;
+}
+
+/*
+ * Files of one batch of exportFiles() and their records
+ */
+struct exportJob {
+	char			**fileNames;
+	ExportRecord	*records;
+	int				verifyLevel;
+};
+
+typedef struct exportJob ExportJob;
+
+static void exportTask( void *Context, size_t Index ) {
+	ExportJob *job = (ExportJob*) Context;
+	exportFile( job->fileNames[Index], job->verifyLevel, &job->records[Index] );
+}
+
+/*
+ * Validate Count files on Threads threads and append their rows to Writer
+ * in the order of FileNames. Callback sees the result of every file on
+ * the calling thread. Returns FALSE when the rows could not be written
+ */
+int exportFiles( char **FileNames, size_t Count, unsigned int Threads, int VerifyLevel, ExportWriter *Writer,
+		FileResultCallback Callback, void *Context ) {
+	ExportRecord *records = (ExportRecord*) calloc( EXPORT_BATCH, sizeof(ExportRecord) );
+	ExportJob job;
+	size_t first;
+	size_t i;
+
+	if (!records)
+		return FALSE;
+	job.records = records;
+	job.verifyLevel = VerifyLevel;
+	for (first = 0; first < Count && !Writer->failed; first += EXPORT_BATCH) {
+		size_t batch = Count - first < EXPORT_BATCH ? Count - first : EXPORT_BATCH;
+		job.fileNames = FileNames + first;
+		parallelFor( batch, Threads ? Threads : getThreadCount(), exportTask, &job );
+		for (i = 0; i < batch; i++) {
+			appendExportRecord( Writer, &records[i] );
+			if (Callback)
+				Callback( &records[i].result, Context );
+			freeExportRecord( &records[i] );
+		}
+	}
+	free( records );
+	return !Writer->failed;
+}
+
+/*
+ * Whether the footer of a mapped export file describes this layout and
+ * stays inside the file
+ */
+static int isValidExportTable( const ExportTable *Table ) {
+	const ExportHeader *header = (const ExportHeader*) Table->data;
+	const ExportTrailer *trailer = (const ExportTrailer*) ( Table->data + Table->size - sizeof(ExportTrailer) );
+	const ExportColumn *columns;
+	uint64_t footerEnd = Table->size - sizeof(ExportTrailer);
+	unsigned int column;
+
+	if (memcmp( header->magic, EXPORT_MAGIC, EXPORT_MAGIC_LENGTH - 1 ) ||
+			header->magic[EXPORT_MAGIC_LENGTH - 1] != EXPORT_VERSION || header->byteOrder != EXPORT_BYTE_ORDER ||
+			header->columns != EXPORT_COLUMNS || memcmp( trailer->magic, header->magic, EXPORT_MAGIC_LENGTH ))
+		return FALSE;
+	/*the footer sits right before the trailer, the dictionary before the footer*/
+	if (trailer->footerOffset % EXPORT_ALIGNMENT || trailer->footerOffset > footerEnd ||
+			trailer->groups > ( footerEnd - trailer->footerOffset ) / sizeof(ExportGroup) ||
+			trailer->footerOffset + EXPORT_COLUMNS * sizeof(ExportColumn) + trailer->groups * sizeof(ExportGroup) !=
+			footerEnd)
+		return FALSE;
+	if (trailer->dictionaryOffset % EXPORT_ALIGNMENT || trailer->dictionaryOffset > trailer->footerOffset ||
+			trailer->dictionaryCount >= ( trailer->footerOffset - trailer->dictionaryOffset ) / sizeof(uint32_t) ||
+			trailer->dictionaryBytes > trailer->footerOffset - trailer->dictionaryOffset -
+			( trailer->dictionaryCount + 1 ) * sizeof(uint32_t))
+		return FALSE;
+	columns = (const ExportColumn*) ( Table->data + trailer->footerOffset );
+	for (column = 0; column < EXPORT_COLUMNS; column++) {
+		if (columns[column].type != exportSchema[column].type || columns[column].count != exportSchema[column].count)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Map an export file for reading, the columns are then used in place
+ */
+int mapExportTable( const char *FileName, ExportTable *Table ) {
+	memset( Table, 0, sizeof(*Table) );
+	Table->data = mapFile( FileName, &Table->size );
+	if (!Table->data)
+		return FALSE;
+	if (Table->size < sizeof(ExportHeader) + sizeof(ExportTrailer) || !isValidExportTable( Table )) {
+		unmapExportTable( Table );
+		return FALSE;
+	}
+	Table->trailer = (const ExportTrailer*) ( Table->data + Table->size - sizeof(ExportTrailer) );
+	Table->columns = (const ExportColumn*) ( Table->data + Table->trailer->footerOffset );
+	Table->groups = (const ExportGroup*) ( Table->columns + EXPORT_COLUMNS );
+	Table->dictionaryOffsets = (const uint32_t*) ( Table->data + Table->trailer->dictionaryOffset );
+	Table->dictionary = (const char*) ( Table->dictionaryOffsets + Table->trailer->dictionaryCount + 1 );
+	return TRUE;
+}
+
+/*
+ * Column of a row group in place, Count is set to its number of values
+ * of the column type. NULL when the group or column doesn't exist
+ */
+const void *getExportColumn( const ExportTable *Table, size_t Group, unsigned int Column, uint64_t *Count ) {
+	const ExportGroup *group;
+	*Count = 0;
+	if (Group >= Table->trailer->groups || Column >= EXPORT_COLUMNS)
+		return NULL;
+	group = &Table->groups[Group];
+	if (group->offset[Column] % EXPORT_ALIGNMENT || group->offset[Column] > Table->trailer->dictionaryOffset ||
+			group->length[Column] > Table->trailer->dictionaryOffset - group->offset[Column])
+		return NULL;
+	*Count = group->length[Column] / Table->columns[Column].type;
+	return Table->data + group->offset[Column];
+}
+
+/*
+ * Text keyword of a dictionary id of the text_keys column
+ */
+const char *getExportKeyword( const ExportTable *Table, uint32_t Id ) {
+	uint32_t end;
+	if (Id >= Table->trailer->dictionaryCount)
+		return NULL;
+	/*every keyword ends with its null*/
+	end = Table->dictionaryOffsets[Id + 1];
+	if (Table->dictionaryOffsets[Id] >= end || end > Table->trailer->dictionaryBytes || Table->dictionary[end - 1])
+		return NULL;
+	return Table->dictionary + Table->dictionaryOffsets[Id];
+}
+
+/*
+ * Whether every id of the dictionary has its keyword without a null inside,
+ * one after the other up to the end of the keyword bytes
+ */
+int isValidExportDictionary( const ExportTable *Table ) {
+	const char *keyword;
+	uint32_t id;
+	if (Table->dictionaryOffsets[0] ||
+			Table->dictionaryOffsets[Table->trailer->dictionaryCount] != Table->trailer->dictionaryBytes)
+		return FALSE;
+	for (id = 0; id < Table->trailer->dictionaryCount; id++) {
+		keyword = getExportKeyword( Table, id );
+		if (!keyword || strlen( keyword ) + 1 != Table->dictionaryOffsets[id + 1] - Table->dictionaryOffsets[id])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Offsets column of a row group that delimits Length values, rows + 1 of
+ * them from 0 up to Length
+ */
+static int isValidOffsets( const uint32_t *Offsets, uint64_t Count, uint64_t Rows, uint64_t Length ) {
+	uint64_t row;
+	if (!Offsets || Count != Rows + 1 || Offsets[0] || Offsets[Rows] != Length)
+		return FALSE;
+	for (row = 0; row < Rows; row++) {
+		if (Offsets[row] > Offsets[row + 1])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Whether the columns of a row group hold its rows, the names and text
+ * keywords are delimited by their offsets and every keyword id is in the
+ * dictionary
+ */
+int isValidExportGroup( const ExportTable *Table, size_t Group ) {
+	const uint32_t *offsets;
+	const uint32_t *keys;
+	uint64_t rows;
+	uint64_t count;
+	uint64_t length;
+	uint64_t i;
+	unsigned int column;
+
+	if (Group >= Table->trailer->groups)
+		return FALSE;
+	rows = Table->groups[Group].rows;
+	for (column = 0; column < EXPORT_COLUMNS; column++) {
+		if (column == EXPORT_NAME_OFFSETS || column == EXPORT_NAME_BYTES || column == EXPORT_TEXT_OFFSETS ||
+				column == EXPORT_TEXT_KEYS)
+			continue;
+		if (!getExportColumn( Table, Group, column, &count ) || count != rows * Table->columns[column].count)
+			return FALSE;
+	}
+	offsets = (const uint32_t*) getExportColumn( Table, Group, EXPORT_NAME_OFFSETS, &count );
+	if (!getExportColumn( Table, Group, EXPORT_NAME_BYTES, &length ) || !isValidOffsets( offsets, count, rows, length ))
+		return FALSE;
+	offsets = (const uint32_t*) getExportColumn( Table, Group, EXPORT_TEXT_OFFSETS, &count );
+	keys = (const uint32_t*) getExportColumn( Table, Group, EXPORT_TEXT_KEYS, &length );
+	if (!keys || !isValidOffsets( offsets, count, rows, length ))
+		return FALSE;
+	for (i = 0; i < length; i++) {
+		if (keys[i] >= Table->trailer->dictionaryCount)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+void unmapExportTable( ExportTable *Table ) {
+	if (Table->data)
+		unmapFile( Table->data, Table->size );
+	memset( Table, 0, sizeof(*Table) );
+}
@@ -0,0 +1,205 @@
+/*
+ * PNGExport.h
+ *
+ *  Metadata of many files written as columns of fixed width, in the byte
+ *  order of the machine, so that a reader can map the file and use them
+ */
+
+#ifndef PNGEXPORT_H_
+#define PNGEXPORT_H_
+
+#include "PNGParser.h"
+
+#define EXPORT_MAGIC		"PNGCOLS"
+#define EXPORT_MAGIC_LENGTH	8 //with the version byte
+#define EXPORT_VERSION		1
+#define EXPORT_BYTE_ORDER	0x01020304 //reads back reversed on a machine of the other order
+#define EXPORT_ROW_GROUP	65536 //rows buffered before they are written
+#define EXPORT_BATCH		1024 //files parsed in parallel between two appends
+#define EXPORT_COLUMN_NAME_LENGTH	24
+#define EXPORT_ALIGNMENT	8 //of every column in the file
+
+/*Columns, the value is the width of one element*/
+#define EXPORT_TYPE_U8	1
+#define EXPORT_TYPE_U16	2
+#define EXPORT_TYPE_U32	4
+#define EXPORT_TYPE_U64	8
+
+/*
+ * The columns of every row group. The offsets columns hold rows + 1 entries
+ * that delimit the names, and the dictionary ids of the text keywords, of
+ * each row
+ */
+#define EXPORT_NAME_OFFSETS	0
+#define EXPORT_NAME_BYTES	1
+#define EXPORT_PARSED		2
+#define EXPORT_ERROR		3
+#define EXPORT_FILE_SIZE	4
+#define EXPORT_WIDTH		5
+#define EXPORT_HEIGHT		6
+#define EXPORT_BIT_DEPTH	7
+#define EXPORT_COLOR_TYPE	8
+#define EXPORT_INTERLACE	9
+#define EXPORT_PRESENT		10 //EXPORT_HAS_* of the optional columns
+#define EXPORT_GAMMA		11
+#define EXPORT_CHROMATICITIES	12 //white x, y, red x, y, green x, y, blue x, y
+#define EXPORT_PHYS_X		13
+#define EXPORT_PHYS_Y		14
+#define EXPORT_PHYS_UNIT	15
+#define EXPORT_TIME_YEAR	16
+#define EXPORT_TIME_FIELDS	17 //month, day, hour, minute, second
+#define EXPORT_CHUNK_COUNT	18
+#define EXPORT_CHUNK_BYTES	19
+#define EXPORT_IDAT_COUNT	20
+#define EXPORT_IDAT_BYTES	21
+#define EXPORT_TEXT_OFFSETS	22
+#define EXPORT_TEXT_KEYS	23
+#define EXPORT_COLUMNS		24
+
+#define EXPORT_HAS_GAMA	1
+#define EXPORT_HAS_CHRM	2
+#define EXPORT_HAS_PHYS	4
+#define EXPORT_HAS_TIME	8
+
+/*
+ * Start of the file
+ */
+struct exportHeader {
+	char		magic[EXPORT_MAGIC_LENGTH];
+	uint32_t	byteOrder;
+	uint32_t	columns;
+};
+
+typedef struct exportHeader ExportHeader;
+
+/*
+ * Description of a column in the footer
+ */
+struct exportColumn {
+	char			name[EXPORT_COLUMN_NAME_LENGTH];
+	unsigned char	type; //EXPORT_TYPE_*
+	unsigned char	count; //elements per row
+	unsigned char	padding[6];
+};
+
+typedef struct exportColumn ExportColumn;
+
+/*
+ * Where a row group is, one after the other in the footer
+ */
+struct exportGroup {
+	uint64_t	rows;
+	uint64_t	offset[EXPORT_COLUMNS];
+	uint64_t	length[EXPORT_COLUMNS]; //bytes
+};
+
+typedef struct exportGroup ExportGroup;
+
+/*
+ * End of the file. The footer is the columns and then the groups, the
+ * dictionary holds count + 1 offsets and then the keyword bytes
+ */
+struct exportTrailer {
+	uint64_t	footerOffset;
+	uint64_t	groups;
+	uint64_t	rows;
+	uint64_t	dictionaryOffset;
+	uint64_t	dictionaryCount;
+	uint64_t	dictionaryBytes;
+	char		magic[EXPORT_MAGIC_LENGTH];
+};
+
+typedef struct exportTrailer ExportTrailer;
+
+/*
+ * What the validation of one file found
+ */
+struct exportRecord {
+	FileResult		result;
+	uint64_t		fileSize;
+	uint32_t		width;
+	uint32_t		height;
+	unsigned char	bitDepth;
+	unsigned char	colorType;
+	unsigned char	interlace;
+	uint32_t		present; //EXPORT_HAS_*
+	uint32_t		gamma;
+	uint32_t		chromaticities[8];
+	uint32_t		physX;
+	uint32_t		physY;
+	unsigned char	physUnit;
+	uint16_t		timeYear;
+	unsigned char	timeFields[5];
+	uint32_t		chunkCount;
+	uint64_t		chunkBytes; //data of all the chunks
+	uint32_t		idatCount;
+	uint64_t		idatBytes;
+	char			*keys; //text keywords one after the other, null terminated
+	size_t			keysLength;
+	size_t			keysCapacity;
+	uint32_t		keyCount;
+};
+
+typedef struct exportRecord ExportRecord;
+
+/*
+ * Byte buffer of a column of the row group being filled
+ */
+struct exportBuffer {
+	unsigned char	*data;
+	size_t			length;
+	size_t			capacity;
+};
+
+typedef struct exportBuffer ExportBuffer;
+
+struct exportWriter {
+	FILE			*file;
+	uint64_t		offset; //bytes written so far
+	ExportBuffer	columns[EXPORT_COLUMNS];
+	uint64_t		groupRows;
+	uint64_t		rows;
+	ExportGroup		*groups;
+	size_t			groupCount;
+	size_t			groupCapacity;
+	/*dictionary of the text keywords*/
+	ExportBuffer	keywords; //null terminated, one after the other
+	ExportBuffer	keywordOffsets; //uint32_t of each keyword
+	uint32_t		*keywordTable; //id + 1 by hash, 0 for a free slot
+	size_t			keywordTableSize; //power of two
+	uint32_t		keywordCount;
+	int				failed;
+};
+
+typedef struct exportWriter ExportWriter;
+
+/*
+ * Export file mapped for reading
+ */
+struct exportTable {
+	const unsigned char		*data;
+	size_t					size;
+	const ExportTrailer		*trailer;
+	const ExportColumn		*columns;
+	const ExportGroup		*groups;
+	const uint32_t			*dictionaryOffsets;
+	const char				*dictionary;
+};
+
+typedef struct exportTable ExportTable;
+
+int openExportWriter(ExportWriter*, const char*);
+int appendExportRecord(ExportWriter*, const ExportRecord*);
+int closeExportWriter(ExportWriter*);
+int exportFile(const char*, int, ExportRecord*);
+void freeExportRecord(ExportRecord*);
+int exportFiles(char**, size_t, unsigned int, int, ExportWriter*, FileResultCallback, void*);
+
+int mapExportTable(const char*, ExportTable*);
+const void *getExportColumn(const ExportTable*, size_t, unsigned int, uint64_t*);
+const char *getExportKeyword(const ExportTable*, uint32_t);
+int isValidExportDictionary(const ExportTable*);
+int isValidExportGroup(const ExportTable*, size_t);
+void unmapExportTable(ExportTable*);
+
+#endif /* PNGEXPORT_H_ */
@@ -0,0 +1,250 @@
+#include "PNGHash.h"
+#include "PNGThreads.h"
+#include "PNGReader.h"
+#include <stdlib.h>
+
+#define MURMUR_C1	0x87c37b91114253d5ULL
+#define MURMUR_C2	0x4cf5ad432745937fULL
+
+/*
+ * Decode of hashFile(), the rows are hashed as the unfilter hands them out
+ */
+struct hashDecode {
+	PNGDecoder		decoder;
+	PixelHash		hash;
+	unsigned char	lastByteMask; //clears the padding bits at the end of a row
+};
+
+typedef struct hashDecode HashDecode;
+
+static uint64_t rotateLeft( uint64_t Value, unsigned int Bits ) {
+	return ( Value << Bits ) | ( Value >> ( 64 - Bits ) );
+}
+
+static uint64_t loadLittle64( const unsigned char *Data ) {
+	return (uint64_t) Data[0] | (uint64_t) Data[1] << 8 | (uint64_t) Data[2] << 16 | (uint64_t) Data[3] << 24 |
+			(uint64_t) Data[4] << 32 | (uint64_t) Data[5] << 40 | (uint64_t) Data[6] << 48 | (uint64_t) Data[7] << 56;
+}
+
+static uint64_t finalMix( uint64_t Value ) {
+	Value ^= Value >> 33;
+	Value *= 0xff51afd7ed558ccdULL;
+	Value ^= Value >> 33;
+	Value *= 0xc4ceb9fe1a85ec53ULL;
+	Value ^= Value >> 33;
+	return Value;
+}
+
+static void hashBlock( PixelHash *Hash, const unsigned char *Block ) {
+	uint64_t k1 = loadLittle64( Block );
+	uint64_t k2 = loadLittle64( Block + 8 );
+
+	k1 *= MURMUR_C1;
+	k1 = rotateLeft( k1, 31 );
+	k1 *= MURMUR_C2;
+	Hash->h1 ^= k1;
+	Hash->h1 = rotateLeft( Hash->h1, 27 );
+	Hash->h1 += Hash->h2;
+	Hash->h1 = Hash->h1 * 5 + 0x52dce729;
+
+	k2 *= MURMUR_C2;
+	k2 = rotateLeft( k2, 33 );
+	k2 *= MURMUR_C1;
+	Hash->h2 ^= k2;
+	Hash->h2 = rotateLeft( Hash->h2, 31 );
+	Hash->h2 += Hash->h1;
+	Hash->h2 = Hash->h2 * 5 + 0x38495ab5;
+}
+
+void initPixelHash( PixelHash *Hash ) {
+	memset( Hash, 0, sizeof(*Hash) );
+}
+
+void updatePixelHash( PixelHash *Hash, const unsigned char *Data, size_t Length ) {
+	Hash->length += Length;
+	if (Hash->tailLength) {
+		size_t bytesToCopy = PIXEL_HASH_BLOCK - Hash->tailLength;
+		if (bytesToCopy > Length)
+			bytesToCopy = Length;
+		memcpy( Hash->tail + Hash->tailLength, Data, bytesToCopy );
+		Hash->tailLength += bytesToCopy;
+		Data += bytesToCopy;
+		Length -= bytesToCopy;
+		if (Hash->tailLength < PIXEL_HASH_BLOCK)
+			return;
+		hashBlock( Hash, Hash->tail );
+		Hash->tailLength = 0;
+	}
+	for (; Length >= PIXEL_HASH_BLOCK; Data += PIXEL_HASH_BLOCK, Length -= PIXEL_HASH_BLOCK)
+		hashBlock( Hash, Data );
+	memcpy( Hash->tail, Data, Length );
+	Hash->tailLength = Length;
+}
+
+/*
+ * Hash the last partial block and store the 128 bits in Digest, h1 then h2
+ * with the most significant byte first
+ */
+void finishPixelHash( PixelHash *Hash, unsigned char *Digest ) {
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	size_t i;
+
+	for (i = Hash->tailLength; i > 8; i--)
+		k2 = ( k2 << 8 ) | Hash->tail[i - 1];
+	for (i = Hash->tailLength < 8 ? Hash->tailLength : 8; i > 0; i--)
+		k1 = ( k1 << 8 ) | Hash->tail[i - 1];
+	if (Hash->tailLength > 8) {
+		k2 *= MURMUR_C2;
+		k2 = rotateLeft( k2, 33 );
+		k2 *= MURMUR_C1;
+		Hash->h2 ^= k2;
+	}
+	if (Hash->tailLength) {
+		k1 *= MURMUR_C1;
+		k1 = rotateLeft( k1, 31 );
+		k1 *= MURMUR_C2;
+		Hash->h1 ^= k1;
+	}
+
+	Hash->h1 ^= Hash->length;
+	Hash->h2 ^= Hash->length;
+	Hash->h1 += Hash->h2;
+	Hash->h2 += Hash->h1;
+	Hash->h1 = finalMix( Hash->h1 );
+	Hash->h2 = finalMix( Hash->h2 );
+	Hash->h1 += Hash->h2;
+	Hash->h2 += Hash->h1;
+	for (i = 0; i < 8; i++) {
+		Digest[i] = (unsigned char) ( Hash->h1 >> ( 56 - 8 * i ) );
+		Digest[8 + i] = (unsigned char) ( Hash->h2 >> ( 56 - 8 * i ) );
+	}
+}
+
+/*
+ * Digest as 32 hex digits, Text has room for 33 characters
+ */
+void formatPixelHash( const unsigned char *Digest, char *Text ) {
+	static const char hexDigits[] = "0123456789abcdef";
+	size_t i;
+	for (i = 0; i < PIXEL_HASH_LENGTH; i++) {
+		Text[2 * i] = hexDigits[Digest[i] >> 4];
+		Text[2 * i + 1] = hexDigits[Digest[i] & 15];
+	}
+	Text[2 * PIXEL_HASH_LENGTH] = 0;
+}
+
+static void hashUint32( PixelHash *Hash, uint32_t Value ) {
+	unsigned char bytes[4];
+	bytes[0] = (unsigned char) ( Value >> 24 );
+	bytes[1] = (unsigned char) ( Value >> 16 );
+	bytes[2] = (unsigned char) ( Value >> 8 );
+	bytes[3] = (unsigned char) Value;
+	updatePixelHash( Hash, bytes, sizeof(bytes) );
+}
+
+/*
+ * Rows of the image in the packed PNG sample format, the bits past the last
+ * pixel of low bit depth rows may hold anything and are cleared
+ */
+static int hashRowSink( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	HashDecode *decode = (HashDecode*) Context;
+	unsigned char last;
+	(void) Row;
+	if (!Length)
+		return TRUE;
+	updatePixelHash( &decode->hash, Data, Length - 1 );
+	last = Data[Length - 1] & decode->lastByteMask;
+	updatePixelHash( &decode->hash, &last, 1 );
+	return TRUE;
+}
+
+/*
+ * chunkHook of hashFile(). Besides the rows only what changes the pixels
+ * is hashed: the size and sample format from IHDR, PLTE and tRNS. The
+ * interlace method, the filters and the zlib stream don't matter
+ */
+static int hashChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	HashDecode *decode = (HashDecode*) Context;
+	if (!decodeChunk( &decode->decoder, chunk )) {
+		reportError( &PNG->chunkInfo, decode->decoder.errorCode, "%s\n", pngErrorString( decode->decoder.errorCode ) );
+		return FALSE;
+	}
+	if (isChunkType( chunk->chunkType, "IHDR" )) {
+		const ImageHeader *header = &decode->decoder.header;
+		unsigned int paddingBits = (unsigned int) ( header->rowBytes * 8 - (uint64_t) header->width * header->bitsPerPixel );
+		hashUint32( &decode->hash, header->width );
+		hashUint32( &decode->hash, header->height );
+		updatePixelHash( &decode->hash, &header->bitDepth, 1 );
+		updatePixelHash( &decode->hash, &header->colorType, 1 );
+		decode->lastByteMask = (unsigned char) ( 0xff << paddingBits );
+	}
+	else if (isChunkType( chunk->chunkType, "PLTE" ) || isChunkType( chunk->chunkType, "tRNS" )) {
+		updatePixelHash( &decode->hash, chunk->chunkType, CHUNK_TYPE_LENGTH );
+		hashUint32( &decode->hash, (uint32_t) chunk->dataSize );
+		updatePixelHash( &decode->hash, chunk->Data, chunk->dataSize );
+	}
+	return TRUE;
+}
+
+/*
+ * Decode FileName and hash its pixels in the same pass, Hash->digest is
+ * set when the file is a valid PNG
+ */
+int hashFile( const char *FileName, int Quiet, FileHash *Hash ) {
+	HashDecode decode;
+	int parsed;
+
+	memset( Hash, 0, sizeof(*Hash) );
+	initPixelHash( &decode.hash );
+	decode.lastByteMask = 0xff;
+	initDecoder( &decode.decoder, hashRowSink, &decode );
+	parsed = parseFileWithHook( FileName, Quiet, VERIFY_FULL, hashChunkHook, &decode, &Hash->result );
+	if (parsed) {
+		finishPixelHash( &decode.hash, Hash->digest );
+		Hash->width = decode.decoder.header.width;
+		Hash->height = decode.decoder.header.height;
+	}
+	freeDecoder( &decode.decoder );
+	return parsed;
+}
+
+/*
+ * Files of hashFiles() and where their hashes go
+ */
+struct hashJob {
+	char		**fileNames;
+	FileHash	*hashes;
+};
+
+typedef struct hashJob HashJob;
+
+static void hashTask( void *Context, size_t Index ) {
+	HashJob *job = (HashJob*) Context;
+	hashFile( job->fileNames[Index], TRUE, &job->hashes[Index] );
+}
+
+/*
+ * Hash Count files on Threads threads, one file per task. Hashes has room
+ * for Count results in the order of FileNames
+ */
+void hashFiles( char **FileNames, size_t Count, unsigned int Threads, FileHash *Hashes ) {
+	HashJob job;
+	job.fileNames = FileNames;
+	job.hashes = Hashes;
+	parallelFor( Count, Threads ? Threads : getThreadCount(), hashTask, &job );
+}
+
+/*
+ * qsort() order of FileHash: the valid files by digest, then by name, and
+ * the files that failed last
+ */
+int compareFileHashes( const void *First, const void *Second ) {
+	const FileHash *first = (const FileHash*) First;
+	const FileHash *second = (const FileHash*) Second;
+	int order;
+	if (first->result.parsed != second->result.parsed)
+		return first->result.parsed ? -1 : 1;
+	order = memcmp( first->digest, second->digest, PIXEL_HASH_LENGTH );
+	return order ? order : strcmp( first->result.fileName, second->result.fileName );
+}
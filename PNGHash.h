@@ -0,0 +1,49 @@
+/*
+ * PNGHash.h
+ *
+ *  Hash of the decoded pixels, the same for files that only differ in
+ *  their metadata or in how the image data was compressed
+ */
+
+#ifndef PNGHASH_H_
+#define PNGHASH_H_
+
+#include "PNGDecode.h"
+
+#define PIXEL_HASH_LENGTH	16
+#define PIXEL_HASH_BLOCK	16
+
+/*
+ * 128-bit MurmurHash3 (x64 variant) fed piece by piece
+ */
+struct pixelHash {
+	uint64_t		h1;
+	uint64_t		h2;
+	uint64_t		length; //bytes hashed so far
+	unsigned char	tail[PIXEL_HASH_BLOCK]; //bytes of an incomplete block
+	size_t			tailLength;
+};
+
+typedef struct pixelHash PixelHash;
+
+/*
+ * Hash of one file of hashFiles()
+ */
+struct fileHash {
+	FileResult		result;
+	unsigned char	digest[PIXEL_HASH_LENGTH];
+	uint32_t		width;
+	uint32_t		height;
+};
+
+typedef struct fileHash FileHash;
+
+void initPixelHash(PixelHash*);
+void updatePixelHash(PixelHash*, const unsigned char*, size_t);
+void finishPixelHash(PixelHash*, unsigned char*);
+void formatPixelHash(const unsigned char*, char*);
+int hashFile(const char*, int, FileHash*);
+void hashFiles(char**, size_t, unsigned int, FileHash*);
+int compareFileHashes(const void*, const void*);
+
+#endif /* PNGHASH_H_ */
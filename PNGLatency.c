@@ -0,0 +1,222 @@
+#include "PNGLatency.h"
+#include <ctype.h>
+#include <time.h>
+
+/*
+ * Whether startChunkTrace() traces files, set once before the batch
+ */
+static int tracing = FALSE;
+
+void setChunkTracing( int Enabled ) {
+	tracing = Enabled;
+}
+
+static uint64_t getNanoseconds( void ) {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+/*
+ * Trace of a file about to be started, NULL when tracing is off or there
+ * is no memory for it; the file is then simply not timed
+ */
+ChunkTrace *startChunkTrace( void ) {
+	ChunkTrace *trace;
+	if (!tracing)
+		return NULL;
+	trace = (ChunkTrace*) calloc( 1, sizeof(ChunkTrace) );
+	if (trace)
+		trace->start = getNanoseconds();
+	return trace;
+}
+
+/*
+ * The result of the file is known
+ */
+void finishChunkTrace( ChunkTrace *Trace ) {
+	if (Trace)
+		Trace->end = getNanoseconds();
+}
+
+void freeChunkTrace( ChunkTrace *Trace ) {
+	if (!Trace)
+		return;
+	free( Trace->runs );
+	free( Trace );
+}
+
+/*
+ * The parser has been entered with more bytes
+ */
+void resumeChunkTrace( ChunkTrace *Trace ) {
+	Trace->mark = getNanoseconds();
+}
+
+/*
+ * The parser returns, the time since the last mark goes to the chunk in
+ * progress
+ */
+void pauseChunkTrace( ChunkTrace *Trace ) {
+	uint64_t now;
+	if (!Trace->mark)
+		return;
+	now = getNanoseconds();
+	Trace->chunkParse += now - Trace->mark;
+	Trace->parse += now - Trace->mark;
+	Trace->mark = 0;
+}
+
+/*
+ * The header of a chunk of Size bytes at Offset has been read
+ */
+void beginTracedChunk( ChunkTrace *Trace, const unsigned char *ChunkType, size_t Size, uint64_t Offset ) {
+	Trace->inChunk = TRUE;
+	memcpy( Trace->chunkType, ChunkType, CHUNK_TYPE_LENGTH );
+	Trace->chunkOffset = Offset;
+	Trace->chunkSize = Size;
+	Trace->chunkStart = Trace->mark ? Trace->mark : getNanoseconds();
+}
+
+/*
+ * The chunk in progress passed its CRC and its checks, it joins the last
+ * run when it is of the same type
+ */
+void endTracedChunk( ChunkTrace *Trace ) {
+	uint64_t now = getNanoseconds();
+	ChunkRun *run = Trace->count ? &Trace->runs[Trace->count - 1] : NULL;
+	if (Trace->mark) {
+		Trace->chunkParse += now - Trace->mark;
+		Trace->parse += now - Trace->mark;
+		Trace->mark = now;
+	}
+	Trace->chunks++;
+	Trace->inChunk = FALSE;
+	if (Trace->untraced || !run || memcmp( run->chunkType, Trace->chunkType, CHUNK_TYPE_LENGTH )) {
+		if (Trace->untraced || Trace->count == Trace->capacity) {
+			size_t capacity = Trace->capacity ? Trace->capacity * 2 : 16;
+			ChunkRun *runs = NULL;
+			if (!Trace->untraced && capacity <= TRACE_MAX_RUNS)
+				runs = (ChunkRun*) realloc( Trace->runs, capacity * sizeof(ChunkRun) );
+			/*once a chunk is left out the runs would no longer be in a row*/
+			if (!runs) {
+				Trace->untraced++;
+				Trace->untracedParse += Trace->chunkParse;
+				Trace->chunkParse = 0;
+				return;
+			}
+			Trace->runs = runs;
+			Trace->capacity = capacity;
+		}
+		run = &Trace->runs[Trace->count++];
+		memset( run, 0, sizeof(*run) );
+		memcpy( run->chunkType, Trace->chunkType, CHUNK_TYPE_LENGTH );
+		run->offset = Trace->chunkOffset;
+		run->start = Trace->chunkStart;
+	}
+	run->chunks++;
+	run->bytes += Trace->chunkSize;
+	run->parse += Trace->chunkParse;
+	if (Trace->chunkParse > run->slowest)
+		run->slowest = Trace->chunkParse;
+	run->elapsed = now - run->start;
+	Trace->chunkParse = 0;
+}
+
+static double getMilliseconds( uint64_t Nanoseconds ) {
+	return Nanoseconds / 1e6;
+}
+
+/*
+ * Chunk type for the console, damaged types are shown with '?'
+ */
+static void getTypeName( char *Name, const unsigned char *ChunkType ) {
+	int i;
+	for (i = 0; i < CHUNK_TYPE_LENGTH; i++)
+		Name[i] = isprint( ChunkType[i] ) ? (char) ChunkType[i] : '?';
+	Name[CHUNK_TYPE_LENGTH] = 0;
+}
+
+/*
+ * Print the runs of chunks of a file with the time the parser spent on
+ * each, and the chunk it was in when it stopped
+ */
+void printChunkTrace( const char *FileName, const ChunkTrace *Trace ) {
+	char name[CHUNK_TYPE_LENGTH + 1];
+	size_t i;
+	printf( "SLOW FILE: %s: %.3lf ms, %.3lf ms PARSING, %lu CHUNKS\n", FileName,
+			getMilliseconds( Trace->end - Trace->start ), getMilliseconds( Trace->parse ),
+			(unsigned long) Trace->chunks );
+	for (i = 0; i < Trace->count; i++) {
+		const ChunkRun *run = &Trace->runs[i];
+		getTypeName( name, run->chunkType );
+		printf( "\t%s x %lu AT %lu: %lu BYTES, %.3lf ms PARSING (%.1lf%%), SLOWEST %.3lf ms, %.3lf ms ELAPSED\n",
+				name, (unsigned long) run->chunks, (unsigned long) run->offset, (unsigned long) run->bytes,
+				getMilliseconds( run->parse ), Trace->parse ? 100.0 * run->parse / Trace->parse : 0.0,
+				getMilliseconds( run->slowest ), getMilliseconds( run->elapsed ) );
+	}
+	if (Trace->untraced)
+		printf( "\t%lu MORE CHUNKS NOT TRACED: %.3lf ms PARSING (%.1lf%%)\n", (unsigned long) Trace->untraced,
+				getMilliseconds( Trace->untracedParse ),
+				Trace->parse ? 100.0 * Trace->untracedParse / Trace->parse : 0.0 );
+	if (Trace->inChunk) {
+		getTypeName( name, Trace->chunkType );
+		printf( "\t%s OF %lu BYTES AT %lu NOT FINISHED: %.3lf ms PARSING\n", name,
+				(unsigned long) Trace->chunkSize, (unsigned long) Trace->chunkOffset,
+				getMilliseconds( Trace->chunkParse ) );
+	}
+}
+
+static size_t getBucket( uint64_t Value ) {
+	unsigned int shift;
+	if (Value < LATENCY_SUB_COUNT)
+		return (size_t) Value;
+	/*the top LATENCY_SUB_BITS - 1 bits below the leading one pick the step*/
+	shift = (unsigned int) ( 63 - __builtin_clzll( Value ) ) - ( LATENCY_SUB_BITS - 1 );
+	return LATENCY_SUB_COUNT + ( shift - 1 ) * LATENCY_HALF_COUNT + (size_t) ( ( Value >> shift ) - LATENCY_HALF_COUNT );
+}
+
+/*
+ * Largest value that falls into Bucket
+ */
+static uint64_t getBucketLimit( size_t Bucket ) {
+	unsigned int shift;
+	uint64_t top;
+	if (Bucket < LATENCY_SUB_COUNT)
+		return (uint64_t) Bucket;
+	shift = (unsigned int) ( ( Bucket - LATENCY_SUB_COUNT ) / LATENCY_HALF_COUNT ) + 1;
+	top = ( Bucket - LATENCY_SUB_COUNT ) % LATENCY_HALF_COUNT + LATENCY_HALF_COUNT;
+	return ( ( top + 1 ) << shift ) - 1;
+}
+
+void recordLatency( LatencyHistogram *Histogram, uint64_t Nanoseconds ) {
+	Histogram->counts[getBucket( Nanoseconds )]++;
+	if (!Histogram->total || Nanoseconds < Histogram->min)
+		Histogram->min = Nanoseconds;
+	if (Nanoseconds > Histogram->max)
+		Histogram->max = Nanoseconds;
+	Histogram->total++;
+}
+
+/*
+ * Nanoseconds that Fraction of the values recorded don't exceed, to the
+ * precision of the buckets
+ */
+uint64_t getLatencyPercentile( const LatencyHistogram *Histogram, double Fraction ) {
+	uint64_t target = (uint64_t) ( Fraction * Histogram->total );
+	uint64_t seen = 0;
+	size_t i;
+	if (!Histogram->total)
+		return 0;
+	/*rank of the value, rounded up*/
+	if (target < Fraction * Histogram->total || !target)
+		target++;
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += Histogram->counts[i];
+		if (seen >= target)
+			break;
+	}
+	if (i == LATENCY_BUCKETS || getBucketLimit( i ) > Histogram->max)
+		return Histogram->max;
+	return getBucketLimit( i ) < Histogram->min ? Histogram->min : getBucketLimit( i );
+}
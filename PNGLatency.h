@@ -0,0 +1,98 @@
+/*
+ * PNGLatency.h
+ *
+ *  Latency of the files of a batch in histograms, and the time the parser
+ *  spent on every run of chunks of a file to find out why it was slow
+ */
+
+#ifndef PNGLATENCY_H_
+#define PNGLATENCY_H_
+
+#include "PNGParser.h"
+
+/*
+ * Histogram buckets of nanoseconds: the values below LATENCY_SUB_COUNT one
+ * each, every power of two above in LATENCY_SUB_COUNT / 2 steps, so a
+ * bucket is within 1.6% of any value in it
+ */
+#define LATENCY_SUB_BITS	7
+#define LATENCY_SUB_COUNT	( 1 << LATENCY_SUB_BITS )
+#define LATENCY_HALF_COUNT	( LATENCY_SUB_COUNT / 2 )
+#define LATENCY_BUCKETS		( LATENCY_SUB_COUNT + ( 64 - LATENCY_SUB_BITS ) * LATENCY_HALF_COUNT )
+
+/*What the histograms of a batch measure*/
+#define LATENCY_STAGE_FILE	0 //from the start of the file to its result
+#define LATENCY_STAGE_PARSE	1 //inside processBuffer() and pngPush()
+#define LATENCY_STAGE_READ	2 //the rest: opening, reading and waiting for reads
+#define LATENCY_STAGES		3
+
+#define TRACE_MAX_RUNS		4096 //runs of chunks kept of one file, the chunks after are only counted
+
+struct latencyHistogram {
+	uint64_t	counts[LATENCY_BUCKETS];
+	uint64_t	total; //values recorded
+	uint64_t	min;
+	uint64_t	max;
+};
+
+typedef struct latencyHistogram LatencyHistogram;
+
+/*
+ * Chunks of one type in a row, thousands of small IDATs are one run
+ */
+struct chunkRun {
+	unsigned char	chunkType[CHUNK_TYPE_LENGTH];
+	uint64_t		offset; //of the first chunk in the file
+	uint64_t		chunks;
+	uint64_t		bytes; //chunk data
+	uint64_t		parse; //nanoseconds in the parser
+	uint64_t		slowest; //nanoseconds in the parser of the slowest chunk
+	uint64_t		elapsed; //nanoseconds from the header of the first chunk to the CRC of the last
+	uint64_t		start; //when the header of the first chunk was read
+};
+
+typedef struct chunkRun ChunkRun;
+
+/*
+ * Timings of one file, filled in by the parser when PNGData.trace is set.
+ * The parse time of a chunk counts from the end of the chunk before it, or
+ * from the parser being entered, to its CRC check; time outside the parser
+ * is not counted
+ */
+struct chunkTrace {
+	uint64_t		start; //when the file was started
+	uint64_t		end; //when its result was known
+	uint64_t		parse; //nanoseconds in the parser
+	uint64_t		mark; //of the last entry into the parser or chunk end, 0 outside the parser
+	/*chunk being parsed*/
+	int				inChunk;
+	unsigned char	chunkType[CHUNK_TYPE_LENGTH];
+	uint64_t		chunkOffset;
+	uint64_t		chunkSize;
+	uint64_t		chunkStart; //when its header was read
+	uint64_t		chunkParse; //nanoseconds in the parser so far
+	/*chunks done*/
+	ChunkRun		*runs;
+	size_t			count;
+	size_t			capacity;
+	uint64_t		chunks;
+	uint64_t		untraced; //chunks past TRACE_MAX_RUNS runs
+	uint64_t		untracedParse; //their nanoseconds in the parser
+};
+
+typedef struct chunkTrace ChunkTrace;
+
+void setChunkTracing(int);
+ChunkTrace *startChunkTrace(void);
+void finishChunkTrace(ChunkTrace*);
+void freeChunkTrace(ChunkTrace*);
+void resumeChunkTrace(ChunkTrace*);
+void pauseChunkTrace(ChunkTrace*);
+void beginTracedChunk(ChunkTrace*, const unsigned char*, size_t, uint64_t);
+void endTracedChunk(ChunkTrace*);
+void printChunkTrace(const char*, const ChunkTrace*);
+
+void recordLatency(LatencyHistogram*, uint64_t);
+uint64_t getLatencyPercentile(const LatencyHistogram*, double);
+
+#endif /* PNGLATENCY_H_ */
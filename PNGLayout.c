@@ -0,0 +1,402 @@
+#include "PNGLayout.h"
+#include "PNGReader.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LAYOUT_SIMD 1
+#endif
+
+/*
+ * Decode of decodeToLayout(), the target is set up with the first row
+ */
+struct layoutDecode {
+	PNGDecoder			decoder;
+	LayoutTarget		*target;
+	const PixelLayout	*layout;
+	void				*buffer; //of the caller, NULL to allocate one
+	size_t				bufferSize;
+	int					ready;
+	int					errorCode;
+	ImageHeader			header; //of the rows written, indexed images as RGB or RGBA
+	unsigned char		palette[4 * PLTE_DATA_LENGTH]; //RGBA of every palette entry
+	int					paletteAlpha; //tRNS seen, indexed images become RGBA
+	unsigned char		*expanded; //a row of an indexed image as RGB or RGBA
+};
+
+typedef struct layoutDecode LayoutDecode;
+
+void initPixelLayout( PixelLayout *Layout ) {
+	memset( Layout, 0, sizeof(*Layout) );
+	Layout->arrangement = LAYOUT_INTERLEAVED;
+	Layout->sampleType = SAMPLE_UINT8;
+	Layout->alignment = LAYOUT_DEFAULT_ALIGNMENT;
+}
+
+static size_t alignUp( size_t Value, size_t Alignment ) {
+	return ( Value + Alignment - 1 ) & ~( Alignment - 1 );
+}
+
+/*
+ * Fill in the channels and the strides left at zero for an image of
+ * Header, returns FALSE when the layout doesn't fit the image
+ */
+int resolveLayout( PixelLayout *Layout, const ImageHeader *Header ) {
+	size_t sampleSize = Layout->sampleType == SAMPLE_FLOAT ? sizeof(float) : 1;
+	uint64_t rowBytes;
+	unsigned int i;
+
+	if (!Layout->alignment || ( Layout->alignment & ( Layout->alignment - 1 ) ))
+		return FALSE;
+	if (!Layout->channelCount) {
+		Layout->channelCount = Header->channels;
+		for (i = 0; i < Header->channels; i++)
+			Layout->channels[i] = (unsigned char) i;
+	}
+	if (Layout->channelCount > LAYOUT_MAX_CHANNELS)
+		return FALSE;
+	for (i = 0; i < Layout->channelCount; i++) {
+		if (Layout->channels[i] >= Header->channels)
+			return FALSE;
+	}
+	rowBytes = (uint64_t) Header->width * sampleSize;
+	if (Layout->arrangement == LAYOUT_INTERLEAVED)
+		rowBytes *= Layout->channelCount;
+	if (rowBytes > SIZE_MAX / 2 / ( Header->height ? Header->height : 1 ) / LAYOUT_MAX_CHANNELS)
+		return FALSE;
+	if (!Layout->rowStride)
+		Layout->rowStride = alignUp( (size_t) rowBytes, Layout->alignment );
+	if (Layout->rowStride < rowBytes)
+		return FALSE;
+	if (Layout->arrangement == LAYOUT_PLANAR) {
+		if (!Layout->planeStride)
+			Layout->planeStride = alignUp( Layout->rowStride * Header->height, Layout->alignment );
+		if (Layout->planeStride < Layout->rowStride * Header->height)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Bytes of the buffer a resolved layout needs
+ */
+size_t getLayoutSize( const PixelLayout *Layout, const ImageHeader *Header ) {
+	if (Layout->arrangement == LAYOUT_PLANAR)
+		return Layout->planeStride * ( Layout->channelCount - 1 ) + Layout->rowStride * ( Header->height - 1 ) +
+				(size_t) Header->width * ( Layout->sampleType == SAMPLE_FLOAT ? sizeof(float) : 1 );
+	return Layout->rowStride * ( Header->height - 1 ) +
+			(size_t) Header->width * Layout->channelCount * ( Layout->sampleType == SAMPLE_FLOAT ? sizeof(float) : 1 );
+}
+
+/*
+ * High bytes of Count big endian 16-bit samples
+ */
+static void strip16To8( const unsigned char *Source, unsigned char *Target, size_t Count ) {
+	size_t i = 0;
+#ifdef LAYOUT_SIMD
+	/*the high byte of a sample is the low byte of a little endian lane*/
+	const __m128i lowBytes = _mm_set1_epi16( 0x00ff );
+	for (; i + 16 <= Count; i += 16) {
+		__m128i first = _mm_and_si128( _mm_loadu_si128( (const __m128i*) ( Source + 2 * i ) ), lowBytes );
+		__m128i second = _mm_and_si128( _mm_loadu_si128( (const __m128i*) ( Source + 2 * i + 16 ) ), lowBytes );
+		_mm_storeu_si128( (__m128i*) ( Target + i ), _mm_packus_epi16( first, second ) );
+	}
+#endif
+	for (; i < Count; i++)
+		Target[i] = Source[2 * i];
+}
+
+/*
+ * Count 8-bit samples times Scale as floats
+ */
+static void convert8ToFloat( const unsigned char *Source, float *Target, size_t Count, float Scale ) {
+	size_t i = 0;
+#ifdef LAYOUT_SIMD
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps( Scale );
+	for (; i + 16 <= Count; i += 16) {
+		__m128i bytes = _mm_loadu_si128( (const __m128i*) ( Source + i ) );
+		__m128i low = _mm_unpacklo_epi8( bytes, zero );
+		__m128i high = _mm_unpackhi_epi8( bytes, zero );
+		_mm_storeu_ps( Target + i, _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( low, zero ) ), scale ) );
+		_mm_storeu_ps( Target + i + 4, _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( low, zero ) ), scale ) );
+		_mm_storeu_ps( Target + i + 8, _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( high, zero ) ), scale ) );
+		_mm_storeu_ps( Target + i + 12, _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( high, zero ) ), scale ) );
+	}
+#endif
+	for (; i < Count; i++)
+		Target[i] = Source[i] * Scale;
+}
+
+/*
+ * Samples of 1, 2 or 4 bits one per byte scaled up to 0 to 255, the
+ * leftmost first
+ */
+static void unpackSamples( const unsigned char *Source, unsigned char *Target, size_t Count, unsigned int BitDepth ) {
+	unsigned int mask = ( 1u << BitDepth ) - 1;
+	unsigned int factor = 255 / mask;
+	size_t i;
+	for (i = 0; i < Count; i++) {
+		size_t bit = i * BitDepth;
+		Target[i] = (unsigned char) ( ( ( Source[bit / 8] >> ( 8 - BitDepth - bit % 8 ) ) & mask ) * factor );
+	}
+}
+
+/*
+ * Set up Target to receive the rows of an image of Header into Buffer,
+ * which must hold getLayoutSize() bytes of the resolved layout
+ */
+int initLayoutTarget( LayoutTarget *Target, const PixelLayout *Layout, const ImageHeader *Header, void *Buffer,
+		size_t BufferSize ) {
+	size_t samples = (size_t) Header->width * Header->channels;
+	unsigned int i;
+
+	memset( Target, 0, sizeof(*Target) );
+	Target->layout = *Layout;
+	Target->header = *Header;
+	if (!resolveLayout( &Target->layout, Header ) || !Buffer || BufferSize < getLayoutSize( &Target->layout, Header ))
+		return FALSE;
+	Target->buffer = (unsigned char*) Buffer;
+	Target->bufferSize = BufferSize;
+	Target->identity = Target->layout.channelCount == Header->channels;
+	for (i = 0; i < Target->layout.channelCount; i++)
+		Target->identity = Target->identity && Target->layout.channels[i] == i;
+	Target->samples = (unsigned char*) malloc( samples );
+	Target->gathered = (unsigned char*) malloc( samples );
+	if (Header->bitDepth == 16)
+		Target->wideSamples = (uint16_t*) malloc( samples * sizeof(uint16_t) );
+	if (!Target->samples || !Target->gathered || ( Header->bitDepth == 16 && !Target->wideSamples )) {
+		freeLayoutTarget( Target );
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Pick the channels of the layout out of an interleaved row
+ */
+static void gatherChannels( const LayoutTarget *Target, const unsigned char *Samples, unsigned char *Gathered,
+		unsigned int First, unsigned int Count ) {
+	unsigned int channels = Target->header.channels;
+	uint32_t x;
+	unsigned int c;
+	for (x = 0; x < Target->header.width; x++) {
+		for (c = 0; c < Count; c++)
+			Gathered[(size_t) x * Count + c] = Samples[(size_t) x * channels + Target->layout.channels[First + c]];
+	}
+}
+
+/*
+ * Float rows of 16-bit images keep all their bits, the samples are
+ * converted one by one
+ */
+static void writeWideRow( LayoutTarget *Target, const unsigned char *Data, unsigned char *RowBase ) {
+	const PixelLayout *layout = &Target->layout;
+	size_t samples = (size_t) Target->header.width * Target->header.channels;
+	unsigned int channels = Target->header.channels;
+	const float scale = 1.0f / 65535.0f;
+	size_t i;
+	uint32_t x;
+	unsigned int c;
+
+	for (i = 0; i < samples; i++)
+		Target->wideSamples[i] = (uint16_t) ( ( Data[2 * i] << 8 ) | Data[2 * i + 1] );
+	for (c = 0; c < layout->channelCount; c++) {
+		float *plane = (float*) ( RowBase + ( layout->arrangement == LAYOUT_PLANAR ? c * layout->planeStride : 0 ) );
+		size_t step = layout->arrangement == LAYOUT_PLANAR ? 1 : layout->channelCount;
+		size_t start = layout->arrangement == LAYOUT_PLANAR ? 0 : c;
+		for (x = 0; x < Target->header.width; x++)
+			plane[start + x * step] = Target->wideSamples[(size_t) x * channels + layout->channels[c]] * scale;
+	}
+}
+
+/*
+ * RowSink that stores each unfiltered row in the layout of the target
+ */
+int layoutRowSink( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	LayoutTarget *target = (LayoutTarget*) Context;
+	const PixelLayout *layout = &target->layout;
+	const ImageHeader *header = &target->header;
+	size_t samples = (size_t) header->width * header->channels;
+	int floats = layout->sampleType == SAMPLE_FLOAT;
+	const float scale = 1.0f / 255.0f;
+	unsigned char *rowBase = target->buffer + (size_t) Row * layout->rowStride;
+	const unsigned char *samples8 = Data;
+	unsigned int c;
+
+	if (Row >= header->height || Length != header->rowBytes)
+		return FALSE;
+	target->rows++;
+	if (header->bitDepth == 16 && floats) {
+		writeWideRow( target, Data, rowBase );
+		return TRUE;
+	}
+	if (layout->arrangement == LAYOUT_INTERLEAVED && target->identity && !floats) {
+		/*the row goes straight to its place*/
+		if (header->bitDepth == 16)
+			strip16To8( Data, rowBase, samples );
+		else if (header->bitDepth < 8)
+			unpackSamples( Data, rowBase, samples, header->bitDepth );
+		else
+			memcpy( rowBase, Data, samples );
+		return TRUE;
+	}
+	if (header->bitDepth == 16) {
+		strip16To8( Data, target->samples, samples );
+		samples8 = target->samples;
+	}
+	else if (header->bitDepth < 8) {
+		unpackSamples( Data, target->samples, samples, header->bitDepth );
+		samples8 = target->samples;
+	}
+
+	if (layout->arrangement == LAYOUT_INTERLEAVED) {
+		const unsigned char *picked = samples8;
+		if (!target->identity) {
+			gatherChannels( target, samples8, floats ? target->gathered : rowBase, 0, layout->channelCount );
+			picked = target->gathered;
+		}
+		if (floats)
+			convert8ToFloat( picked, (float*) rowBase, (size_t) header->width * layout->channelCount, scale );
+		return TRUE;
+	}
+	for (c = 0; c < layout->channelCount; c++) {
+		unsigned char *plane = rowBase + c * layout->planeStride;
+		if (header->channels == 1 && !floats)
+			memcpy( plane, samples8, header->width );
+		else if (header->channels == 1)
+			convert8ToFloat( samples8, (float*) plane, header->width, scale );
+		else if (!floats)
+			gatherChannels( target, samples8, plane, c, 1 );
+		else {
+			gatherChannels( target, samples8, target->gathered, c, 1 );
+			convert8ToFloat( target->gathered, (float*) plane, header->width, scale );
+		}
+	}
+	return TRUE;
+}
+
+void freeLayoutTarget( LayoutTarget *Target ) {
+	free( Target->samples );
+	free( Target->wideSamples );
+	free( Target->gathered );
+	if (Target->ownsBuffer)
+		free( Target->buffer );
+	Target->samples = Target->gathered = NULL;
+	Target->wideSamples = NULL;
+	Target->buffer = NULL;
+	Target->ownsBuffer = FALSE;
+}
+
+/*
+ * Replace the indices of a row of an indexed image by their palette
+ * entries, the decoder has checked that they are in the palette
+ */
+static void expandPaletteRow( LayoutDecode *Decode, const unsigned char *Data ) {
+	const ImageHeader *header = &Decode->decoder.header;
+	unsigned int bits = header->bitDepth;
+	unsigned int mask = ( 1u << bits ) - 1;
+	unsigned int channels = Decode->header.channels;
+	unsigned char *target = Decode->expanded;
+	uint32_t x;
+	for (x = 0; x < header->width; x++, target += channels) {
+		size_t bit = (size_t) x * bits;
+		unsigned int index = ( Data[bit / 8] >> ( 8 - bits - bit % 8 ) ) & mask;
+		memcpy( target, Decode->palette + 4 * index, channels );
+	}
+}
+
+static int layoutDecodeSink( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	LayoutDecode *decode = (LayoutDecode*) Context;
+	if (!decode->ready) {
+		const ImageHeader *header = &decode->header;
+		const ImageHeader *source = &decode->decoder.header;
+		PixelLayout layout = *decode->layout;
+		void *buffer = decode->buffer;
+		size_t size = decode->bufferSize;
+		decode->header = *source;
+		if (source->colorType == 3) {
+			if (!setImageHeader( &decode->header, source->width, source->height, 8, decode->paletteAlpha ? 6 : 2, 0 )) {
+				decode->errorCode = PNG_ERROR_IMAGE_SIZE;
+				return FALSE;
+			}
+			decode->expanded = (unsigned char*) malloc( decode->header.rowBytes );
+			if (!decode->expanded) {
+				decode->errorCode = PNG_ERROR_MEMORY;
+				return FALSE;
+			}
+		}
+		if (!resolveLayout( &layout, header )) {
+			decode->errorCode = PNG_ERROR_LAYOUT;
+			return FALSE;
+		}
+		if (!buffer) {
+			size = alignUp( getLayoutSize( &layout, header ), layout.alignment );
+			if (posix_memalign( &buffer, layout.alignment < sizeof(void*) ? sizeof(void*) : layout.alignment, size ))
+				buffer = NULL;
+			if (!buffer) {
+				decode->errorCode = PNG_ERROR_MEMORY;
+				return FALSE;
+			}
+		}
+		if (!initLayoutTarget( decode->target, &layout, header, buffer, size )) {
+			if (!decode->buffer)
+				free( buffer );
+			decode->errorCode = size < getLayoutSize( &layout, header ) ? PNG_ERROR_IMAGE_SIZE : PNG_ERROR_MEMORY;
+			return FALSE;
+		}
+		decode->target->ownsBuffer = !decode->buffer;
+		decode->ready = TRUE;
+	}
+	if (decode->expanded) {
+		expandPaletteRow( decode, Data );
+		return layoutRowSink( decode->target, Row, decode->expanded, decode->header.rowBytes );
+	}
+	return layoutRowSink( decode->target, Row, Data, Length );
+}
+
+/*
+ * chunkHook of decodeToLayout(), keeps the palette of indexed images
+ */
+static int layoutChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	LayoutDecode *decode = (LayoutDecode*) Context;
+	size_t i;
+	if (isChunkType( chunk->chunkType, "PLTE" )) {
+		for (i = 0; i < chunk->dataSize / 3 && i < PLTE_DATA_LENGTH; i++) {
+			memcpy( decode->palette + 4 * i, chunk->Data + 3 * i, 3 );
+			decode->palette[4 * i + 3] = 0xff;
+		}
+	}
+	else if (isChunkType( chunk->chunkType, "tRNS" ) && decode->decoder.header.colorType == 3) {
+		for (i = 0; i < chunk->dataSize && i < PLTE_DATA_LENGTH; i++)
+			decode->palette[4 * i + 3] = chunk->Data[i];
+		decode->paletteAlpha = TRUE;
+	}
+	if (decodeChunk( &decode->decoder, chunk ))
+		return TRUE;
+	if (!decode->errorCode)
+		decode->errorCode = decode->decoder.errorCode;
+	reportError( &PNG->chunkInfo, decode->errorCode, "%s\n", pngErrorString( decode->errorCode ) );
+	return FALSE;
+}
+
+/*
+ * Decode FileName into Buffer in the given layout, or into a buffer with
+ * the alignment of the layout when Buffer is NULL. Target describes the
+ * result and must be freed with freeLayoutTarget() either way
+ */
+int decodeToLayout( const char *FileName, const PixelLayout *Layout, void *Buffer, size_t BufferSize, int Quiet,
+		LayoutTarget *Target, FileResult *Result ) {
+	LayoutDecode decode;
+
+	memset( Target, 0, sizeof(*Target) );
+	memset( &decode, 0, sizeof(decode) );
+	decode.target = Target;
+	decode.layout = Layout;
+	decode.buffer = Buffer;
+	decode.bufferSize = BufferSize;
+	initDecoder( &decode.decoder, layoutDecodeSink, &decode );
+	parseFileWithHook( FileName, Quiet, VERIFY_FULL, layoutChunkHook, &decode, Result );
+	freeDecoder( &decode.decoder );
+	free( decode.expanded );
+	return Result->parsed;
+}
@@ -0,0 +1,65 @@
+/*
+ * PNGLayout.h
+ *
+ *  Write decoded rows straight into a caller's buffer in the pixel layout
+ *  it wants: interleaved or planar, 8-bit or float, any subset of the
+ *  channels in any order. Indexed images are written as RGB, or as RGBA
+ *  when they have a tRNS chunk
+ */
+
+#ifndef PNGLAYOUT_H_
+#define PNGLAYOUT_H_
+
+#include "PNGDecode.h"
+
+#define LAYOUT_INTERLEAVED	0 //HWC
+#define LAYOUT_PLANAR		1 //CHW
+
+#define SAMPLE_UINT8	0 //16-bit samples keep their high byte, 1 to 4 bits are scaled up to 0 to 255
+#define SAMPLE_FLOAT	1 //0.0 to 1.0 of the largest value of the bit depth
+
+#define LAYOUT_MAX_CHANNELS	4
+#define LAYOUT_DEFAULT_ALIGNMENT	64
+
+/*
+ * Layout of the output, zero strides are derived from the image
+ */
+struct pixelLayout {
+	int				arrangement; //LAYOUT_*
+	int				sampleType; //SAMPLE_*
+	unsigned int	channelCount; //channels written, 0 for all of them in order
+	unsigned char	channels[LAYOUT_MAX_CHANNELS]; //source channel of every channel written
+	size_t			rowStride; //bytes from a row to the next
+	size_t			planeStride; //bytes from a plane to the next
+	size_t			alignment; //of the derived strides, a power of two
+};
+
+typedef struct pixelLayout PixelLayout;
+
+/*
+ * Buffer being filled by layoutRowSink()
+ */
+struct layoutTarget {
+	PixelLayout		layout; //with the strides resolved
+	ImageHeader		header;
+	unsigned char	*buffer;
+	size_t			bufferSize;
+	int				ownsBuffer; //allocated by decodeToLayout()
+	int				identity; //all the channels in their order
+	unsigned char	*samples; //a row unpacked to 8 bits
+	uint16_t		*wideSamples; //a row of 16-bit samples
+	unsigned char	*gathered; //the channels picked from a row
+	uint32_t		rows; //rows written
+};
+
+typedef struct layoutTarget LayoutTarget;
+
+void initPixelLayout(PixelLayout*);
+int resolveLayout(PixelLayout*, const ImageHeader*);
+size_t getLayoutSize(const PixelLayout*, const ImageHeader*);
+int initLayoutTarget(LayoutTarget*, const PixelLayout*, const ImageHeader*, void*, size_t);
+int layoutRowSink(void*, uint32_t, const unsigned char*, size_t);
+void freeLayoutTarget(LayoutTarget*);
+int decodeToLayout(const char*, const PixelLayout*, void*, size_t, int, LayoutTarget*, FileResult*);
+
+#endif /* PNGLAYOUT_H_ */
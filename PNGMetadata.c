@@ -0,0 +1,269 @@
+#include "PNGMetadata.h"
+#include "PNGReader.h"
+#include "PNGBudget.h"
+#include <zlib.h>
+
+static MetadataEntry *addEntry( PNGData *PNG, int Kind, const Chunk *chunk ) {
+	MetadataIndex *index = PNG->metadata;
+	MetadataEntry *entry;
+	if (!index) {
+		index = (MetadataIndex*) calloc( 1, sizeof(MetadataIndex) );
+		if (!index)
+			return NULL;
+		PNG->metadata = index;
+	}
+	if (index->used == index->allocated) {
+		size_t allocated = index->allocated ? index->allocated * 2 : 8;
+		MetadataEntry *entries = (MetadataEntry*) realloc( index->entries, allocated * sizeof(MetadataEntry) );
+		if (!entries)
+			return NULL;
+		index->entries = entries;
+		index->allocated = allocated;
+	}
+	entry = &index->entries[index->used++];
+	entry->kind = (unsigned char) Kind;
+	/*the validators have checked the keyword is null terminated and short*/
+	strcpy( entry->keyword, (const char*) chunk->Data );
+	return entry;
+}
+
+/*
+ * Record the payload of a validated tEXt, zTXt, iTXt or iCCP chunk without
+ * inflating it
+ */
+int indexMetadataChunk( PNGData *PNG, const Chunk *chunk ) {
+	/*offset of the chunk data, the CRC has just been read*/
+	uint64_t offset = PNG->fileOffset - sizeof(PNG->chunkCRC) - chunk->dataSize;
+	const unsigned char *payload;
+	const unsigned char *end = chunk->Data + chunk->dataSize;
+	MetadataEntry *entry;
+	int kind;
+	int compressed;
+
+	if (isChunkType( chunk->chunkType, "tEXt" )) {
+		kind = METADATA_TEXT;
+		compressed = FALSE;
+		payload = (const unsigned char*) memchr( chunk->Data, 0x00, chunk->dataSize ) + 1;
+	}
+	else if (isChunkType( chunk->chunkType, "zTXt" ) || isChunkType( chunk->chunkType, "iCCP" )) {
+		kind = isChunkType( chunk->chunkType, "zTXt" ) ? METADATA_ZTXT : METADATA_ICCP;
+		compressed = TRUE;
+		/*keyword, null, compression method*/
+		payload = (const unsigned char*) memchr( chunk->Data, 0x00, chunk->dataSize ) + 1 + ZTXT_HEADER_LENGTH;
+	}
+	else if (isChunkType( chunk->chunkType, "iTXt" )) {
+		kind = METADATA_ITXT;
+		payload = (const unsigned char*) memchr( chunk->Data, 0x00, chunk->dataSize ) + 1;
+		compressed = payload[0];
+		/*skip the language tag and the translated keyword*/
+		payload += ITXT_HEADER_LENGTH;
+		payload = (const unsigned char*) memchr( payload, 0x00, end - payload ) + 1;
+		payload = (const unsigned char*) memchr( payload, 0x00, end - payload ) + 1;
+	}
+	else {
+		return TRUE;
+	}
+
+	entry = addEntry( PNG, kind, chunk );
+	if (!entry) {
+		reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+		return FALSE;
+	}
+	entry->compressed = (unsigned char) compressed;
+	entry->offset = offset + (uint64_t) ( payload - chunk->Data );
+	entry->length = (size_t) ( end - payload );
+	return TRUE;
+}
+
+void freeMetadataIndex( MetadataIndex *Index ) {
+	if (!Index)
+		return;
+	free( Index->entries );
+	free( Index );
+}
+
+/*
+ * First tEXt, zTXt or iTXt entry with the keyword
+ */
+const MetadataEntry *findText( const MetadataIndex *Index, const char *Keyword ) {
+	size_t i;
+	if (!Index)
+		return NULL;
+	for (i = 0; i < Index->used; i++) {
+		if (Index->entries[i].kind != METADATA_ICCP && !strcmp( Index->entries[i].keyword, Keyword ))
+			return &Index->entries[i];
+	}
+	return NULL;
+}
+
+const MetadataEntry *findProfile( const MetadataIndex *Index ) {
+	size_t i;
+	if (!Index)
+		return NULL;
+	for (i = 0; i < Index->used; i++) {
+		if (Index->entries[i].kind == METADATA_ICCP)
+			return &Index->entries[i];
+	}
+	return NULL;
+}
+
+/*
+ * Inflate a zlib payload, failing with PNG_ERROR_METADATA as soon as the
+ * output passes Limit. The output grows against the memory budget in
+ * MemoryMode and *Out holds its reservation until freeMetadata()
+ */
+int inflateMetadata( const unsigned char *Data, size_t Length, size_t Limit, int MemoryMode,
+		unsigned char **Out, size_t *OutLength ) {
+	z_stream stream;
+	unsigned char *output = NULL;
+	size_t allocated;
+	size_t reserved = 0;
+	int errorCode = PNG_ERROR_NONE;
+	int status = Z_OK;
+
+	memset( &stream, 0, sizeof(stream) );
+	if (inflateInit( &stream ) != Z_OK)
+		return PNG_ERROR_MEMORY;
+	allocated = Length < Limit / 4 ? Length * 4 + 64 : Limit + 1;
+	stream.next_in = (Bytef*) Data;
+	while (status != Z_STREAM_END && !errorCode) {
+		size_t used = stream.total_out;
+		unsigned char *grown;
+		if (used == allocated) {
+			if (allocated > Limit) {
+				errorCode = PNG_ERROR_METADATA;
+				break;
+			}
+			allocated = allocated < Limit / 2 ? allocated * 2 : Limit + 1;
+		}
+		if (allocated + 1 > reserved) {
+			if (!reserveMemory( allocated + 1 - reserved, MemoryMode )) {
+				errorCode = PNG_ERROR_BUDGET;
+				break;
+			}
+			reserved = allocated + 1;
+		}
+		grown = (unsigned char*) realloc( output, allocated + 1 );
+		if (!grown) {
+			errorCode = PNG_ERROR_MEMORY;
+			break;
+		}
+		output = grown;
+		stream.next_out = output + used;
+		stream.avail_out = (uInt) ( allocated - used );
+		/*zlib counts the input in uInt*/
+		if (!stream.avail_in) {
+			size_t consumed = (size_t) ( stream.next_in - Data );
+			stream.avail_in = (uInt) ( Length - consumed > UINT_MAX ? UINT_MAX : Length - consumed );
+		}
+		status = inflate( &stream, Z_NO_FLUSH );
+		if (status == Z_BUF_ERROR && stream.avail_out)
+			errorCode = PNG_ERROR_CHUNK_DATA; //the payload ended inside the stream
+		else if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+			errorCode = status == Z_MEM_ERROR ? PNG_ERROR_MEMORY : PNG_ERROR_CHUNK_DATA;
+	}
+	if (!errorCode && stream.total_out > Limit)
+		errorCode = PNG_ERROR_METADATA;
+	if (!errorCode) {
+		/*only what is returned stays reserved*/
+		unsigned char *trimmed = (unsigned char*) realloc( output, stream.total_out + 1 );
+		if (trimmed)
+			output = trimmed;
+		else
+			errorCode = PNG_ERROR_MEMORY;
+	}
+	if (errorCode) {
+		free( output );
+		releaseMemory( reserved );
+	}
+	else {
+		releaseMemory( reserved - ( stream.total_out + 1 ) );
+		output[stream.total_out] = 0;
+		*Out = output;
+		*OutLength = stream.total_out;
+	}
+	inflateEnd( &stream );
+	return errorCode;
+}
+
+/*
+ * Free a payload of inflateMetadata() or readMetadata() and give its
+ * memory back to the budget
+ */
+void freeMetadata( unsigned char *Data, size_t Length ) {
+	if (!Data)
+		return;
+	free( Data );
+	releaseMemory( Length + 1 );
+}
+
+/*
+ * Payload of an entry from the mapped file, inflated if need be and null
+ * terminated, reserved against the memory budget in MemoryMode. The caller
+ * frees *Out with freeMetadata(). Returns a PNG_ERROR_* code
+ */
+int readMetadata( const MetadataEntry *Entry, const unsigned char *FileData, size_t FileSize, size_t Limit,
+		int MemoryMode, unsigned char **Out, size_t *OutLength ) {
+	const unsigned char *payload;
+	if (Entry->offset > FileSize || Entry->length > FileSize - Entry->offset)
+		return PNG_ERROR_TRUNCATED;
+	payload = FileData + Entry->offset;
+	if (Entry->compressed)
+		return inflateMetadata( payload, Entry->length, Limit, MemoryMode, Out, OutLength );
+	if (Entry->length > Limit)
+		return PNG_ERROR_METADATA;
+	if (!reserveMemory( Entry->length + 1, MemoryMode ))
+		return PNG_ERROR_BUDGET;
+	*Out = (unsigned char*) malloc( Entry->length + 1 );
+	if (!*Out) {
+		releaseMemory( Entry->length + 1 );
+		return PNG_ERROR_MEMORY;
+	}
+	memcpy( *Out, payload, Entry->length );
+	(*Out)[Entry->length] = 0;
+	*OutLength = Entry->length;
+	return PNG_ERROR_NONE;
+}
+
+/*
+ * Map a parsed file and read one entry of it
+ */
+static int readFileMetadata( const char *FileName, const MetadataEntry *Entry, int MemoryMode,
+		unsigned char **Out, size_t *OutLength ) {
+	size_t fileSize;
+	int errorCode;
+	const unsigned char *fileData = mapFile( FileName, &fileSize );
+	if (!fileData)
+		return PNG_ERROR_IO;
+	errorCode = readMetadata( Entry, fileData, fileSize, METADATA_INFLATE_LIMIT, MemoryMode, Out, OutLength );
+	unmapFile( fileData, fileSize );
+	return errorCode;
+}
+
+/*
+ * Print the text stored under Keyword. A quiet parse shows no chunks to
+ * tell the files of a batch apart, so the lines then start with FileName.
+ * Returns a PNG_ERROR_* code
+ */
+int printFileText( const char *FileName, const PNGData *PNG, const char *Keyword, int Quiet ) {
+	const MetadataEntry *entry = findText( PNG->metadata, Keyword );
+	unsigned char *text;
+	size_t length;
+	int errorCode;
+	if (Quiet)
+		printf( "%s: ", FileName );
+	if (!entry) {
+		printf( "%s: NOT FOUND\n", Keyword );
+		return PNG_ERROR_NONE;
+	}
+	errorCode = readFileMetadata( FileName, entry, getMemoryMode( PNG ), &text, &length );
+	if (errorCode) {
+		printf( "%s: %s\n", Keyword, pngErrorString( errorCode ) );
+		return errorCode;
+	}
+	printf( "%s: ", Keyword );
+	fwrite( text, 1, length, stdout );
+	printf( "\n" );
+	freeMetadata( text, length );
+	return PNG_ERROR_NONE;
+}
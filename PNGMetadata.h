@@ -0,0 +1,51 @@
+/*
+ * PNGMetadata.h
+ *
+ *  Text and ICC profile payloads, recorded while parsing and inflated on
+ *  request
+ */
+
+#ifndef PNGMETADATA_H_
+#define PNGMETADATA_H_
+
+#include "PNGParser.h"
+
+#define METADATA_TEXT	1 //tEXt
+#define METADATA_ZTXT	2 //zTXt
+#define METADATA_ITXT	3 //iTXt
+#define METADATA_ICCP	4 //iCCP
+
+/*Most bytes a payload may inflate to, guards against decompression bombs*/
+#define METADATA_INFLATE_LIMIT	( 16 * 1024 * 1024 )
+
+/*
+ * Where the payload of one text or profile chunk is in the file
+ */
+struct metadataEntry {
+	unsigned char	kind; //METADATA_*
+	unsigned char	compressed; //zlib stream, otherwise plain Latin-1/UTF-8
+	char			keyword[TEXT_DATA_KEY_LENGTH_MAX + 1]; //or profile name
+	uint64_t		offset; //file offset of the payload
+	size_t			length;
+};
+
+typedef struct metadataEntry MetadataEntry;
+
+struct metadataIndex {
+	MetadataEntry	*entries;
+	size_t			used;
+	size_t			allocated;
+};
+
+typedef struct metadataIndex MetadataIndex;
+
+int indexMetadataChunk(PNGData*, const Chunk*);
+void freeMetadataIndex(MetadataIndex*);
+const MetadataEntry *findText(const MetadataIndex*, const char*);
+const MetadataEntry *findProfile(const MetadataIndex*);
+int inflateMetadata(const unsigned char*, size_t, size_t, int, unsigned char**, size_t*);
+void freeMetadata(unsigned char*, size_t);
+int readMetadata(const MetadataEntry*, const unsigned char*, size_t, size_t, int, unsigned char**, size_t*);
+int printFileText(const char*, const PNGData*, const char*, int);
+
+#endif /* PNGMETADATA_H_ */
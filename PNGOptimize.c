@@ -0,0 +1,207 @@
+#include "PNGOptimize.h"
+#include "PNGRewrite.h"
+#include "PNGThreads.h"
+#include "PNGReader.h"
+#include "PNGBudget.h"
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/*
+ * Settings in the order they are started, the likely winners first so a
+ * short time budget still gets to them
+ */
+static const OptimizeCandidate optimizeCandidates[] = {
+	{ FILTER_ADAPTIVE, 9, Z_DEFAULT_STRATEGY },
+	{ FILTER_NONE, 9, Z_DEFAULT_STRATEGY },
+	{ FILTER_ADAPTIVE, 9, Z_FILTERED },
+	{ FILTER_PAETH, 9, Z_DEFAULT_STRATEGY },
+	{ FILTER_UP, 9, Z_DEFAULT_STRATEGY },
+	{ FILTER_SUB, 9, Z_DEFAULT_STRATEGY },
+	{ FILTER_AVERAGE, 9, Z_DEFAULT_STRATEGY },
+	{ FILTER_PAETH, 9, Z_FILTERED },
+	{ FILTER_ADAPTIVE, 9, Z_RLE },
+	{ FILTER_NONE, 9, Z_RLE },
+};
+
+#define OPTIMIZE_CANDIDATES	( sizeof(optimizeCandidates) / sizeof(optimizeCandidates[0]) )
+
+static const char *filterNames[FILTER_TYPES + 1] = { "none", "sub", "up", "average", "paeth", "adaptive" };
+
+/*
+ * Candidates shared by the tasks, the smallest result so far is kept
+ */
+struct optimizeJob {
+	const RawImage	*image;
+	double			deadline;
+	pthread_mutex_t	lock;
+	EncodedImage	best;
+	size_t			bestIndex;
+	int				found;
+	size_t			tried;
+	int				outOfTime;
+	int				errorCode;
+};
+
+typedef struct optimizeJob OptimizeJob;
+
+void initOptimizeOptions( OptimizeOptions *Options ) {
+	memset( Options, 0, sizeof(*Options) );
+	Options->timeBudget = OPTIMIZE_DEFAULT_BUDGET;
+}
+
+static double getSeconds( void ) {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void optimizeTask( void *Context, size_t Index ) {
+	OptimizeJob *job = (OptimizeJob*) Context;
+	const OptimizeCandidate *candidate = &optimizeCandidates[Index];
+	EncodeOptions options;
+	EncodedImage encoded;
+	int errorCode;
+
+	/*the first candidate always runs, there has to be a result*/
+	if (Index && getSeconds() > job->deadline) {
+		pthread_mutex_lock( &job->lock );
+		job->outOfTime = TRUE;
+		pthread_mutex_unlock( &job->lock );
+		return;
+	}
+	initEncodeOptions( &options );
+	options.filter = candidate->filter;
+	options.level = candidate->level;
+	options.strategy = candidate->strategy;
+	/*the candidates are the parallel work, each one runs on a single thread*/
+	options.threads = 1;
+	errorCode = compressImage( job->image, &options, &encoded );
+
+	pthread_mutex_lock( &job->lock );
+	job->tried++;
+	if (errorCode) {
+		job->errorCode = errorCode;
+	}
+	else if (!job->found || encoded.length < job->best.length ||
+			( encoded.length == job->best.length && Index < job->bestIndex )) {
+		EncodedImage previous = job->best;
+		job->best = encoded;
+		job->bestIndex = Index;
+		encoded = previous;
+		job->found = TRUE;
+	}
+	pthread_mutex_unlock( &job->lock );
+	if (!errorCode)
+		freeEncodedImage( &encoded );
+}
+
+static int unfilterSink( void *Context, const unsigned char *Data, size_t DataLength ) {
+	return unfilterData( (PNGUnfilter*) Context, Data, DataLength );
+}
+
+static int compareRow( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	const RawImage *image = (const RawImage*) Context;
+	return !memcmp( image->pixels + (size_t) Row * image->stride, Data, Length );
+}
+
+/*
+ * Decode the compressed image again and compare it with the rows it was
+ * made from
+ */
+static int verifyImage( const RawImage *Image, const EncodedImage *Encoded ) {
+	PNGInflater inflater;
+	PNGUnfilter unfilter;
+	int verified;
+	size_t i;
+
+	memset( &unfilter, 0, sizeof(unfilter) );
+	verified = initInflater( &inflater, BUDGET_WAIT ) &&
+			initUnfilter( &unfilter, &Image->header, compareRow, (void*) Image, BUDGET_WAIT ) &&
+			inflateData( &inflater, Encoded->zlibHeader, ZLIB_HEADER_LENGTH, unfilterSink, &unfilter );
+	for (i = 0; verified && i < Encoded->segmentCount; i++)
+		verified = inflateData( &inflater, Encoded->segments[i].data, Encoded->segments[i].length, unfilterSink, &unfilter );
+	verified = verified && inflateData( &inflater, Encoded->trailer, ZLIB_TRAILER_LENGTH, unfilterSink, &unfilter ) &&
+			inflater.finished && unfilter.finished;
+	freeInflater( &inflater );
+	freeUnfilter( &unfilter );
+	return verified;
+}
+
+/*
+ * Compress Image with every candidate setting on the threads of Options
+ * and keep the smallest result that decodes back to the same rows.
+ * Returns a PNG_ERROR_* code, Best holds the zlib stream on success
+ */
+int optimizeImage( const RawImage *Image, const OptimizeOptions *Options, EncodedImage *Best, OptimizeReport *Report ) {
+	unsigned int threads = Options->threads ? Options->threads : getThreadCount();
+	const OptimizeCandidate *best;
+	OptimizeJob job;
+
+	memset( &job, 0, sizeof(job) );
+	job.image = Image;
+	job.deadline = getSeconds() + Options->timeBudget;
+	pthread_mutex_init( &job.lock, NULL );
+	parallelFor( OPTIMIZE_CANDIDATES, threads, optimizeTask, &job );
+	pthread_mutex_destroy( &job.lock );
+
+	Report->candidates = OPTIMIZE_CANDIDATES;
+	Report->tried = job.tried;
+	Report->outOfTime = job.outOfTime;
+	if (!job.found)
+		return job.errorCode ? job.errorCode : PNG_ERROR_INTERNAL;
+	if (!verifyImage( Image, &job.best )) {
+		freeEncodedImage( &job.best );
+		return PNG_ERROR_INTERNAL;
+	}
+	best = &optimizeCandidates[job.bestIndex];
+	snprintf( Report->best, sizeof(Report->best), "%s level %d%s", filterNames[best->filter], best->level,
+			best->strategy == Z_FILTERED ? " filtered" : best->strategy == Z_RLE ? " rle" : "" );
+	Report->optimizedBytes = job.best.length;
+	*Best = job.best;
+	return PNG_ERROR_NONE;
+}
+
+/*
+ * Recompress the image data of InName and, when OutName is not NULL, write
+ * the file with the smaller image data to it. The other chunks are copied
+ * as they are, a file that doesn't get smaller is copied unchanged.
+ * Returns a PNG_ERROR_* code
+ */
+int optimizeFile( const char *InName, const char *OutName, const OptimizeOptions *Options, int Quiet,
+		OptimizeReport *Report ) {
+	DecodedImage image;
+	EncodedImage best;
+	RewriteRules rules;
+	FileResult result;
+	struct stat output;
+	int errorCode;
+
+	memset( Report, 0, sizeof(*Report) );
+	if (OutName && isSameFile( InName, OutName ))
+		return PNG_ERROR_OUTPUT;
+	/*with an output the rewrite prints the chunks, they are shown once*/
+	if (!decodeImageFile( InName, Quiet || OutName, &image, &result )) {
+		freeDecodedImage( &image );
+		return result.errorCode ? result.errorCode : PNG_ERROR_DECODE;
+	}
+	Report->fileBytes = result.bytesRead;
+	Report->imageDataBytes = image.imageDataBytes;
+	errorCode = optimizeImage( &image.raw, Options, &best, Report );
+	freeDecodedImage( &image );
+	if (errorCode)
+		return errorCode;
+	Report->improved = best.length < Report->imageDataBytes;
+
+	if (OutName) {
+		initRewriteRules( &rules );
+		if (Report->improved)
+			rules.imageData = &best;
+		if (rewriteFile( InName, OutName, &rules, Quiet, &result ) && !stat( OutName, &output ))
+			Report->outputBytes = (uint64_t) output.st_size;
+		else if (!result.parsed)
+			errorCode = result.errorCode ? result.errorCode : PNG_ERROR_OUTPUT;
+	}
+	freeEncodedImage( &best );
+	return errorCode;
+}
@@ -0,0 +1,55 @@
+/*
+ * PNGOptimize.h
+ *
+ *  Recompress the image data of a file losslessly, the filter and deflate
+ *  settings are tried in parallel and the smallest result is kept
+ */
+
+#ifndef PNGOPTIMIZE_H_
+#define PNGOPTIMIZE_H_
+
+#include "PNGEncode.h"
+
+#define OPTIMIZE_DEFAULT_BUDGET	10.0 //seconds spent on the settings of a file
+#define OPTIMIZE_NAME_LENGTH	32
+
+/*
+ * Filter and deflate settings tried on an image
+ */
+struct optimizeCandidate {
+	unsigned int	filter; //FILTER_*
+	int				level;
+	int				strategy; //zlib strategy
+};
+
+typedef struct optimizeCandidate OptimizeCandidate;
+
+struct optimizeOptions {
+	double			timeBudget; //seconds, candidates not started by then are skipped
+	unsigned int	threads; //0 for all of them
+};
+
+typedef struct optimizeOptions OptimizeOptions;
+
+/*
+ * Outcome of one file
+ */
+struct optimizeReport {
+	uint64_t	fileBytes; //size of the input
+	uint64_t	imageDataBytes; //IDAT data of the input
+	uint64_t	optimizedBytes; //zlib stream of the best candidate
+	uint64_t	outputBytes; //size of the file written
+	size_t		tried; //candidates compressed
+	size_t		candidates;
+	int			improved; //the best candidate is smaller than the input
+	int			outOfTime; //candidates were skipped for the time budget
+	char		best[OPTIMIZE_NAME_LENGTH]; //settings of the best candidate
+};
+
+typedef struct optimizeReport OptimizeReport;
+
+void initOptimizeOptions(OptimizeOptions*);
+int optimizeImage(const RawImage*, const OptimizeOptions*, EncodedImage*, OptimizeReport*);
+int optimizeFile(const char*, const char*, const OptimizeOptions*, int, OptimizeReport*);
+
+#endif /* PNGOPTIMIZE_H_ */
@@ -1,19 +1,101 @@
+
 #include "PNGParser.h"
+#include "PNGReader.h"
+#include "PNGPipeline.h"
+#include "PNGThreads.h"
+#include "PNGAnimation.h"
+#include "PNGProfile.h"
+#include "PNGRewrite.h"
+#include "PNGSalvage.h"
+#include "PNGCarve.h"
+#include "PNGOptimize.h"
+#include "PNGRaster.h"
+#include "PNGLayout.h"
+#include "PNGHash.h"
+#include "PNGStats.h"
+#include "PNGWalk.h"
+#include "PNGCheckpoint.h"
+#include "PNGBudget.h"
+#include "PNGExport.h"
+#include "PNGLatency.h"
+#include <unistd.h>
+#include <time.h>
 
+/*
+ * Totals of a batch run
+ */
+struct batchStats {
+	size_t	files;
+	size_t	parsedFiles;
+	size_t	bytes;
+	size_t	imageBytes; //image data before and after -O
+	size_t	optimizedBytes;
+	LatencyHistogram	*latency; //LATENCY_STAGES histograms of -L, NULL when the files aren't timed
+	uint64_t	slowNanoseconds; //files that took longer have their chunk timings printed
+};
 
-int main( int argc, char *argv[] )
-{
+typedef struct batchStats BatchStats;
+
+/*
+ * What to do with each file besides validating the chunks
+ */
+struct parseOptions {
+	int		decode; //decode the image data on the pipeline
+	int		frames; //decode the frames of animated files
+	const char	*textKey; //print the text stored under this keyword
+	int		profile; //check the ICC profile through the profile cache
+	const char	*output; //write the file rewritten by rules, or the repaired file, here
+	int		salvage; //walk past damage instead of validating
+	int		carve; //the files are blobs to search for embedded PNG files
+	const char	*encode; //decode the image and encode it again to this file
+	EncodeOptions	encoder;
+	int		optimize; //recompress the image data losslessly
+	OptimizeOptions	optimizer;
+	const char	*raster; //decode the image into this memory-mapped file
+	uint32_t	tileSize; //tiles of the raster file, 0 for plain rows
+	int		layout; //decode into a buffer of the pixel layout, -o saves the buffer
+	PixelLayout	pixelLayout;
+	int		verifyLevel; //VERIFY_* of the validation
+	int		hash; //hash the pixels and group the files with the same pixels
+	int		statistics; //print the statistics of the pixels, check hIST and sBIT
+	int		recursive; //the arguments are directories to search for *.png files
+	const char	*checkpoint; //resume the parse from this file and save it there when the input ends early
+	double	follow; //seconds to wait for bytes appended to the input
+	const char	*columns; //write the metadata of the files as columns to this file
+	int		dumpColumns; //the files are -X exports to check and print
+	RewriteRules	rules;
+};
+
+typedef struct parseOptions ParseOptions;
+
+/*
+ * Work on a file that parsed cleanly which needs its data again, the
+ * payloads are read back from the file only here
+ */
+static int processParsedFile( const char *FileName, const PNGData *PNG, int Quiet, const ParseOptions *Options ) {
+	int errorCode = PNG_ERROR_NONE;
+	if (Options->frames)
+		errorCode = decodeFileFrames( FileName, PNG, Quiet );
+	if (!errorCode && Options->textKey)
+		errorCode = printFileText( FileName, PNG, Options->textKey, Quiet );
+	if (!errorCode && Options->profile)
+		errorCode = checkFileProfile( FileName, PNG, Quiet );
+	return errorCode;
+}
+
+/*
+ * Parse one file with blocking reads, the console output of the chunks is
+ * suppressed when Quiet is set
+ */
+static int parseFile( const char *FileName, int Quiet, const ParseOptions *Options, FileResult *Result ) {
 	int parsed = FALSE;
-	if (argc < 2) {
-		printf( "Usage: PNGParser <file_name>\n" );
-		return 0;
-	}
-	if (argc >= 3) {
-		printf( "Too Many Arguments - Only 2 Arguments Are Allowed\n" );
-		return -1;
-	}
+	Result->fileName = FileName;
+	Result->parsed = FALSE;
+	Result->errorCode = PNG_ERROR_NONE;
+	Result->bytesRead = 0;
+	Result->trace = startChunkTrace();
 	/*open the file in read mode*/
-	FILE *File = fopen(argv[1], "rb" );
+	FILE *File = fopen(FileName, "rb" );
 	if (File) {
 		/*Read the of fixed size into buffer*/
 		unsigned char *readBuffer = (unsigned char *) malloc(READ_BUFFER_SIZE);
@@ -21,12 +103,19 @@ int main( int argc, char *argv[] )
 			PNGData PNG;
 			/*Initialize the PNGData and process*/
 			if (initPNGProcess(&PNG)) {
+				PNG.chunkInfo.quiet = Quiet;
+				PNG.verifyLevel = Options->verifyLevel;
+				PNG.trace = Result->trace;
 				while (!feof(File))	{
 					size_t bytesRead = fread( readBuffer, 1, READ_BUFFER_SIZE, File );
 					if ((bytesRead != READ_BUFFER_SIZE ) && !feof(File)) {
-						printf( "\nCAN'T READ FILE: %s\n", argv[1]);
+						if (!Quiet)
+							printf( "\nCAN'T READ FILE: %s\n", FileName);
+						Result->errorCode = PNG_ERROR_IO;
+						parsed = FALSE;
 						break;
 					}
+					Result->bytesRead += bytesRead;
 					/*Process the buffer*/
 					if (processBuffer( &PNG, readBuffer, bytesRead)) {
 						parsed = TRUE;
@@ -40,24 +129,804 @@ int main( int argc, char *argv[] )
 					/*Process the last chunks*/
 					parsed = processFinish( &PNG );
 				}
+				if (parsed) {
+					Result->errorCode = processParsedFile( FileName, &PNG, Quiet, Options );
+					parsed = !Result->errorCode;
+				}
+				if (!Result->errorCode)
+					Result->errorCode = pngGetError( &PNG );
 				/*delete the buffer*/
-				freeChunkData(&PNG);
+				freePNGData(&PNG);
 			}
 
 			free(readBuffer);
 		}
 		else {
-			printf( "\nCAN'T ALLOCATE MEMORY: %u bytes\n", (unsigned int) READ_BUFFER_SIZE );
+			if (!Quiet)
+				printf( "\nCAN'T ALLOCATE MEMORY: %u bytes\n", (unsigned int) READ_BUFFER_SIZE );
+			Result->errorCode = PNG_ERROR_MEMORY;
 		}
 		fclose( File );
 	}
 	else {
-		printf( "Cannot open file %s\n", argv[1]);
+		if (!Quiet)
+			printf( "Cannot open file %s\n", FileName);
+		Result->errorCode = PNG_ERROR_IO;
+	}
+	Result->parsed = parsed;
+	finishChunkTrace( Result->trace );
+	return parsed;
+}
+
+/*
+ * Decode one file into a buffer of the pixel layout of the options and
+ * write the buffer to the output file of the options
+ */
+static int decodeLayoutFile( const char *FileName, int Quiet, const ParseOptions *Options, FileResult *Result ) {
+	LayoutTarget target;
+	int decoded = decodeToLayout( FileName, &Options->pixelLayout, NULL, 0, Quiet, &target, Result );
+	if (decoded && !Quiet)
+		printf( "DECODED %u x %u: %s %s, %u CHANNELS, ROW STRIDE %lu, PLANE STRIDE %lu, %lu BYTES\n",
+				target.header.width, target.header.height,
+				target.layout.arrangement == LAYOUT_PLANAR ? "PLANAR" : "INTERLEAVED",
+				target.layout.sampleType == SAMPLE_FLOAT ? "FLOAT" : "UINT8", target.layout.channelCount,
+				(unsigned long) target.layout.rowStride, (unsigned long) target.layout.planeStride,
+				(unsigned long) target.bufferSize );
+	if (decoded && Options->output) {
+		FILE *output = fopen( Options->output, "wb" );
+		if (!output || fwrite( target.buffer, 1, target.bufferSize, output ) != target.bufferSize) {
+			Result->errorCode = PNG_ERROR_OUTPUT;
+			decoded = FALSE;
+		}
+		if (output && fclose( output ))
+			decoded = FALSE;
+		if (!decoded) {
+			Result->errorCode = PNG_ERROR_OUTPUT;
+			remove( Options->output );
+			if (!Quiet)
+				printf( "%s\n", pngErrorString( PNG_ERROR_OUTPUT ) );
+		}
 	}
+	Result->parsed = decoded;
+	freeLayoutTarget( &target );
+	return decoded;
+}
+
+/*
+ * Layout for -l: 'i' or 'p' for interleaved or planar, '8' or 'f' for
+ * 8-bit or float samples and optionally the channels to take, "pf210"
+ */
+static int parseLayoutArgument( PixelLayout *Layout, const char *Argument ) {
+	size_t i;
+	if (strlen( Argument ) < 2 || strlen( Argument ) > 2 + LAYOUT_MAX_CHANNELS ||
+			!strchr( "ip", Argument[0] ) || !strchr( "8f", Argument[1] ))
+		return FALSE;
+	Layout->arrangement = Argument[0] == 'p' ? LAYOUT_PLANAR : LAYOUT_INTERLEAVED;
+	Layout->sampleType = Argument[1] == 'f' ? SAMPLE_FLOAT : SAMPLE_UINT8;
+	Layout->channelCount = (unsigned int) strlen( Argument + 2 );
+	for (i = 0; i < Layout->channelCount; i++) {
+		if (Argument[2 + i] < '0' || Argument[2 + i] >= '0' + LAYOUT_MAX_CHANNELS)
+			return FALSE;
+		Layout->channels[i] = (unsigned char) ( Argument[2 + i] - '0' );
+	}
+	return TRUE;
+}
+
+static const char *verifyLevelNames[] = { "full", "critical", "structure", "decode" };
+
+/*
+ * Level for -V, by its name
+ */
+static int parseVerifyLevel( const char *Argument ) {
+	int level;
+	for (level = VERIFY_FULL; level <= VERIFY_DECODE; level++) {
+		if (!strcmp( Argument, verifyLevelNames[level] ))
+			return level;
+	}
+	return -1;
+}
+
+/*
+ * Parse one file, decoding the image data as well when asked to
+ */
+static int processFile( const char *FileName, int Quiet, const ParseOptions *Options, FileResult *Result ) {
+	if (Options->layout)
+		return decodeLayoutFile( FileName, Quiet, Options, Result );
+	if (Options->raster)
+		return decodeToRaster( FileName, Options->raster, Options->tileSize ? RASTER_TILED : RASTER_RAW,
+				Options->tileSize, Quiet, Result );
+	if (Options->encode)
+		return encodeFile( FileName, Options->encode, &Options->encoder, Quiet, Result );
+	if (Options->output)
+		return rewriteFile( FileName, Options->output, &Options->rules, Quiet, Result );
+	if (Options->decode)
+		return decodeFilePipelined( FileName, Quiet, discardRow, NULL, Result );
+	return parseFile( FileName, Quiet, Options, Result );
+}
+
+/*
+ * Salvage one file and print what had to be repaired
+ */
+static void salvageAndReport( const char *FileName, const ParseOptions *Options, int Quiet, BatchStats *Stats ) {
+	SalvageReport report;
+	int errorCode = salvageFile( FileName, Options->output, Quiet, &report );
+	Stats->files++;
+	Stats->bytes += report.bytesRead;
+	if (errorCode) {
+		printf( "%s: %s\n", FileName, pngErrorString( errorCode ) );
+		return;
+	}
+	if (isSalvageClean( &report )) {
+		Stats->parsedFiles++;
+		printf( "%s: %lu CHUNKS, NO DAMAGE\n", FileName, (unsigned long) report.chunks );
+		return;
+	}
+	printf( "%s: %lu CHUNKS, %lu BAD CRC, %lu BAD LENGTH, %lu RESYNCS (%lu BYTES SKIPPED)%s%s%s\n", FileName,
+			(unsigned long) report.chunks, (unsigned long) report.badCrcChunks, (unsigned long) report.badLengthChunks,
+			(unsigned long) report.resyncs,
+			(unsigned long) report.skippedBytes, report.badSignature ? ", BAD SIGNATURE" : "",
+			report.truncated ? ", TRUNCATED" : "", report.missingIEND ? ", NO IEND" : "" );
+}
 
-	if(parsed)
+/*
+ * Search one blob for PNG files and print where they are
+ */
+static void carveAndReport( const char *FileName, int Quiet, BatchStats *Stats ) {
+	CarveResult result;
+	int errorCode = carveFile( FileName, Quiet, &result );
+	Stats->files++;
+	if (errorCode) {
+		printf( "%s: %s\n", FileName, pngErrorString( errorCode ) );
+		return;
+	}
+	Stats->parsedFiles += result.count;
+	Stats->bytes += result.bytes;
+	printf( "%s: %lu PNG FILES, %lu SIGNATURES\n", FileName, (unsigned long) result.count, (unsigned long) result.hits );
+	freeCarveResult( &result );
+}
+
+/*
+ * Recompress one file and print how much smaller its image data got
+ */
+static void optimizeAndReport( const char *FileName, const ParseOptions *Options, int Quiet, BatchStats *Stats ) {
+	OptimizeReport report;
+	int errorCode = optimizeFile( FileName, Options->output, &Options->optimizer, Quiet, &report );
+	uint64_t kept;
+	Stats->files++;
+	Stats->bytes += report.fileBytes;
+	if (errorCode) {
+		printf( "%s: %s\n", FileName, pngErrorString( errorCode ) );
+		return;
+	}
+	kept = report.improved ? report.optimizedBytes : report.imageDataBytes;
+	Stats->parsedFiles++;
+	Stats->imageBytes += report.imageDataBytes;
+	Stats->optimizedBytes += kept;
+	printf( "%s: IMAGE DATA %lu -> %lu BYTES (%.1lf%%), %s, %lu OF %lu SETTINGS%s\n", FileName,
+			(unsigned long) report.imageDataBytes, (unsigned long) kept,
+			report.imageDataBytes ? 100.0 * kept / report.imageDataBytes : 100.0,
+			report.improved ? report.best : "NO GAIN", (unsigned long) report.tried, (unsigned long) report.candidates,
+			report.outOfTime ? ", OUT OF TIME" : "" );
+}
+
+/*
+ * Hash the pixels of the files in parallel, print the hash of every file
+ * and then the files whose pixels are the same
+ */
+static void hashAndReport( char **FileNames, size_t Count, BatchStats *Stats ) {
+	FileHash *hashes = (FileHash*) calloc( Count, sizeof(FileHash) );
+	char text[2 * PIXEL_HASH_LENGTH + 1];
+	size_t i;
+	size_t first;
+
+	if (!hashes) {
+		printf( "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+		return;
+	}
+	hashFiles( FileNames, Count, 0, hashes );
+	for (i = 0; i < Count; i++) {
+		const FileResult *result = &hashes[i].result;
+		Stats->files++;
+		Stats->bytes += result->bytesRead;
+		if (!result->parsed) {
+			printf( "%s: %s\n", result->fileName, pngErrorString( result->errorCode ) );
+			continue;
+		}
+		Stats->parsedFiles++;
+		formatPixelHash( hashes[i].digest, text );
+		printf( "%s: %s %u x %u\n", result->fileName, text, hashes[i].width, hashes[i].height );
+	}
+
+	qsort( hashes, Count, sizeof(FileHash), compareFileHashes );
+	for (first = 0; first < Count && hashes[first].result.parsed; first = i) {
+		for (i = first + 1; i < Count && hashes[i].result.parsed &&
+				!memcmp( hashes[i].digest, hashes[first].digest, PIXEL_HASH_LENGTH ); i++)
+			;
+		if (i - first < 2)
+			continue;
+		formatPixelHash( hashes[first].digest, text );
+		printf( "SAME PIXELS %s:", text );
+		for (; first < i; first++)
+			printf( " %s", hashes[first].result.fileName );
+		printf( "\n" );
+	}
+	free( hashes );
+}
+
+/*
+ * Decode one file and print the statistics of its pixels
+ */
+static void statsAndReport( const char *FileName, int Quiet, BatchStats *Stats ) {
+	ImageStats *imageStats = (ImageStats*) malloc( sizeof(ImageStats) );
+	FileResult result;
+	unsigned int channel;
+
+	Stats->files++;
+	if (!imageStats) {
+		printf( "%s: %s\n", FileName, pngErrorString( PNG_ERROR_MEMORY ) );
+		return;
+	}
+	statsFile( FileName, Quiet, imageStats, &result );
+	Stats->bytes += result.bytesRead;
+	if (!result.parsed) {
+		printf( "%s: %s\n", FileName, pngErrorString( result.errorCode ) );
+	}
+	else {
+		const ImageHeader *header = &imageStats->header;
+		Stats->parsedFiles++;
+		printf( "%s: %u x %u, %u CHANNELS, %s\n", FileName, header->width, header->height, header->channels,
+				imageStats->opaque ? "OPAQUE" : "TRANSPARENT" );
+		for (channel = 0; channel < header->channels; channel++)
+			printf( "\tCHANNEL %u: MIN %u MAX %u MEAN %.2lf\n", channel, imageStats->minimum[channel],
+					imageStats->maximum[channel],
+					imageStats->pixels ? (double) imageStats->sum[channel] / imageStats->pixels : 0.0 );
+		if (header->colorType == 3)
+			printf( "\tPALETTE: %u OF %u ENTRIES USED\n", getPaletteEntriesUsed( imageStats ),
+					imageStats->paletteEntries );
+		if (imageStats->hasClaimedHistogram)
+			printf( "\thIST MATCHES THE PIXELS\n" );
+		if (imageStats->hasSignificantBits)
+			printf( "\tsBIT MATCHES THE PIXELS\n" );
+	}
+	freeImageStats( imageStats );
+	free( imageStats );
+}
+
+/*
+ * Parse a file that may still be growing, from where the last run stopped
+ */
+static void followAndReport( const char *FileName, const ParseOptions *Options, BatchStats *Stats ) {
+	FileResult result;
+	uint64_t offset;
+	int status = followFile( FileName, Options->checkpoint, Options->verifyLevel, Options->follow, FALSE,
+			&result, &offset );
+	Stats->files = 1;
+	Stats->bytes = result.bytesRead;
+	if (status == PNG_STATUS_DONE) {
+		Stats->parsedFiles = 1;
 		printf( "PARSING COMPLETED\n" );
+	}
+	else if (status == PNG_STATUS_NEED_MORE && Options->checkpoint) {
+		printf( "INCOMPLETE AT %lu BYTES, CHECKPOINT SAVED\n", (unsigned long) offset );
+	}
+	else if (status == PNG_STATUS_NEED_MORE) {
+		printf( "INCOMPLETE AT %lu BYTES\n", (unsigned long) offset );
+	}
+	else if (result.errorCode == PNG_ERROR_CHECKPOINT || result.errorCode == PNG_ERROR_IO) {
+		/*the parser reports its own errors*/
+		printf( "%s\n", pngErrorString( result.errorCode ) );
+	}
+}
 
-	return 0;
+/*
+ * Print the rows of an export file written by -X, after checking that its
+ * row groups and keyword dictionary hold together
+ */
+static void dumpAndReport( const char *FileName, BatchStats *Stats ) {
+	ExportTable table;
+	uint64_t rows = 0;
+	uint64_t count;
+	size_t group;
+	if (!mapExportTable( FileName, &table )) {
+		printf( "NOT AN EXPORT FILE: %s\n", FileName );
+		return;
+	}
+	if (!isValidExportDictionary( &table )) {
+		printf( "DAMAGED KEYWORD DICTIONARY: %s\n", FileName );
+		unmapExportTable( &table );
+		return;
+	}
+	for (group = 0; group < table.trailer->groups; group++) {
+		const uint32_t *nameOffsets, *textOffsets, *keys, *width, *height, *chunkCount;
+		const unsigned char *parsed, *errorCode, *bitDepth, *colorType;
+		const char *names;
+		const uint64_t *idatBytes;
+		uint64_t row, key;
+		if (!isValidExportGroup( &table, group )) {
+			printf( "DAMAGED ROW GROUP %lu: %s\n", (unsigned long) group, FileName );
+			unmapExportTable( &table );
+			return;
+		}
+		nameOffsets = (const uint32_t*) getExportColumn( &table, group, EXPORT_NAME_OFFSETS, &count );
+		names = (const char*) getExportColumn( &table, group, EXPORT_NAME_BYTES, &count );
+		parsed = (const unsigned char*) getExportColumn( &table, group, EXPORT_PARSED, &count );
+		errorCode = (const unsigned char*) getExportColumn( &table, group, EXPORT_ERROR, &count );
+		width = (const uint32_t*) getExportColumn( &table, group, EXPORT_WIDTH, &count );
+		height = (const uint32_t*) getExportColumn( &table, group, EXPORT_HEIGHT, &count );
+		bitDepth = (const unsigned char*) getExportColumn( &table, group, EXPORT_BIT_DEPTH, &count );
+		colorType = (const unsigned char*) getExportColumn( &table, group, EXPORT_COLOR_TYPE, &count );
+		chunkCount = (const uint32_t*) getExportColumn( &table, group, EXPORT_CHUNK_COUNT, &count );
+		idatBytes = (const uint64_t*) getExportColumn( &table, group, EXPORT_IDAT_BYTES, &count );
+		textOffsets = (const uint32_t*) getExportColumn( &table, group, EXPORT_TEXT_OFFSETS, &count );
+		keys = (const uint32_t*) getExportColumn( &table, group, EXPORT_TEXT_KEYS, &count );
+		for (row = 0; row < table.groups[group].rows; row++) {
+			int nameLength = (int) ( nameOffsets[row + 1] - nameOffsets[row] );
+			Stats->files++;
+			if (!parsed[row]) {
+				printf( "%.*s: %s\n", nameLength, names + nameOffsets[row], pngErrorString( errorCode[row] ) );
+				continue;
+			}
+			Stats->parsedFiles++;
+			printf( "%.*s: %u x %u, BIT DEPTH %u, COLOR TYPE %u, %u CHUNKS, %lu BYTES OF IMAGE DATA\n", nameLength,
+					names + nameOffsets[row], width[row], height[row], bitDepth[row], colorType[row], chunkCount[row],
+					(unsigned long) idatBytes[row] );
+			for (key = textOffsets[row]; key < textOffsets[row + 1]; key++)
+				printf( "\tTEXT: %s\n", getExportKeyword( &table, keys[key] ) );
+		}
+		rows += table.groups[group].rows;
+	}
+	if (rows == table.trailer->rows)
+		printf( "%lu ROWS IN %lu GROUPS, %lu KEYWORDS\n", (unsigned long) rows,
+				(unsigned long) table.trailer->groups, (unsigned long) table.trailer->dictionaryCount );
+	else
+		printf( "ROWS OF THE GROUPS DON'T ADD UP: %lu OF %lu\n", (unsigned long) rows,
+				(unsigned long) table.trailer->rows );
+	unmapExportTable( &table );
 }
 
+/*
+ * Only the chunks are checked, which the asynchronous reader can do
+ */
+static int isValidationOnly( const ParseOptions *Options ) {
+	return !Options->decode && !Options->frames && !Options->textKey && !Options->profile && !Options->output &&
+			!Options->encode && !Options->raster &&
+			!Options->layout && !Options->salvage && !Options->carve && !Options->optimize && !Options->hash &&
+			!Options->statistics && !Options->columns && !Options->dumpColumns;
+}
+
+/*
+ * Chunk for -T and -R, "keyword=text" or "type:file"
+ */
+static int addRuleArgument( RewriteRules *Rules, int Option, const char *Argument ) {
+	const char *separator = strchr( Argument, Option == 'T' ? '=' : ':' );
+	char type[CHUNK_TYPE_LENGTH + 1];
+	int added;
+	if (!separator)
+		return FALSE;
+	if (Option == 'T') {
+		/*tEXt data is the keyword, a null and the text*/
+		size_t keyLength = (size_t) ( separator - Argument );
+		if (keyLength < 1 || keyLength > TEXT_DATA_KEY_LENGTH_MAX)
+			return FALSE;
+		added = addInsertRule( Rules, "tEXt", (const unsigned char*) Argument, strlen( Argument ) );
+		if (added)
+			Rules->insert[Rules->insertCount - 1].data[keyLength] = 0;
+		return added;
+	}
+	else {
+		const unsigned char *data;
+		size_t size = 0;
+		if (separator - Argument != CHUNK_TYPE_LENGTH)
+			return FALSE;
+		memcpy( type, Argument, CHUNK_TYPE_LENGTH );
+		type[CHUNK_TYPE_LENGTH] = 0;
+		data = mapFile( separator + 1, &size );
+		added = addReplaceRule( Rules, type, data ? data : (const unsigned char*) "", size );
+		if (data)
+			unmapFile( data, size );
+		return added;
+	}
+}
+
+/*
+ * Add a file of a batch to the totals without printing it
+ */
+static void countResult( const FileResult *Result, void *Context ) {
+	BatchStats *stats = (BatchStats*) Context;
+	stats->files++;
+	stats->bytes += Result->bytesRead;
+	if (Result->parsed)
+		stats->parsedFiles++;
+}
+
+/*
+ * Add the timings of a traced file to the histograms of -L and print its
+ * chunks when it was slow
+ */
+static void recordFileLatency( const FileResult *Result, BatchStats *Stats ) {
+	const ChunkTrace *trace = Result->trace;
+	uint64_t elapsed;
+	if (!trace || !Stats->latency)
+		return;
+	elapsed = trace->end - trace->start;
+	recordLatency( &Stats->latency[LATENCY_STAGE_FILE], elapsed );
+	recordLatency( &Stats->latency[LATENCY_STAGE_PARSE], trace->parse );
+	recordLatency( &Stats->latency[LATENCY_STAGE_READ], elapsed > trace->parse ? elapsed - trace->parse : 0 );
+	if (elapsed >= Stats->slowNanoseconds)
+		printChunkTrace( Result->fileName, trace );
+}
+
+/*
+ * Print one line per file of a batch and add it to the totals
+ */
+static void printResult( const FileResult *Result, void *Context ) {
+	BatchStats *stats = (BatchStats*) Context;
+	stats->files++;
+	stats->bytes += Result->bytesRead;
+	if (Result->parsed) {
+		stats->parsedFiles++;
+		printf( "%s: PARSING COMPLETED\n", Result->fileName );
+	}
+	else {
+		printf( "%s: %s\n", Result->fileName, pngErrorString( Result->errorCode ) );
+	}
+	recordFileLatency( Result, stats );
+}
+
+static const char *latencyStageNames[] = { "FILE", "PARSE", "READ" };
+
+/*
+ * Percentiles of the histograms of -L
+ */
+static void printLatency( const LatencyHistogram *Latency ) {
+	int stage;
+	for (stage = 0; stage < LATENCY_STAGES; stage++) {
+		const LatencyHistogram *histogram = &Latency[stage];
+		printf( "LATENCY %s: P50 %.3lf ms, P99 %.3lf ms, P99.9 %.3lf ms, MAX %.3lf ms (%lu FILES)\n",
+				latencyStageNames[stage], getLatencyPercentile( histogram, 0.5 ) / 1e6,
+				getLatencyPercentile( histogram, 0.99 ) / 1e6, getLatencyPercentile( histogram, 0.999 ) / 1e6,
+				histogram->max / 1e6, (unsigned long) histogram->total );
+	}
+}
+
+static double getSeconds( void ) {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void printUsage( void ) {
+	printf( "Usage: PNGParser [options] <file_name> [file_name ...]\n" );
+	printf( "\t-d <depth>\tvalidate the files with <depth> asynchronous reads in flight\n" );
+	printf( "\t-w\t\tuse reader threads instead of io_uring for -d\n" );
+	printf( "\t-p\t\tdecode the image data, reading, inflate and unfilter on separate threads\n" );
+	printf( "\t-j <threads>\tthreads for the parallel work, default one per core\n" );
+	printf( "\t-a\t\tdecode every frame of animated files in parallel\n" );
+	printf( "\t-k <keyword>\tprint the tEXt, zTXt or iTXt text stored under <keyword>\n" );
+	printf( "\t-i\t\tinflate and check the embedded ICC profile, profiles seen before are shared\n" );
+	printf( "\t-o <file>\twrite the input rewritten to <file>, unchanged chunks are copied as they are\n" );
+	printf( "\t-s <type>\tleave out the ancillary chunks of <type> in -o\n" );
+	printf( "\t-T <key=text>\tadd a tEXt chunk after IHDR in -o\n" );
+	printf( "\t-R <type:file>\treplace the data of the chunks of <type> with the contents of <file> in -o\n" );
+	printf( "\t-S\t\tsalvage damaged files past bad CRCs and lost chunk boundaries, -o writes the repaired file\n" );
+	printf( "\t-c\t\tsearch the files for embedded PNG files and print their offsets and lengths\n" );
+	printf( "\t-e <file>\tdecode the image and encode it again to <file>, compressed on all threads\n" );
+	printf( "\t\t\tof the ancillary chunks only tRNS, gAMA, cHRM, sRGB and iCCP are kept\n" );
+	printf( "\t-z <level>\tzlib level of -e, 1-9\n" );
+	printf( "\t-O\t\trecompress the image data losslessly trying settings in parallel, -o writes the smallest file\n" );
+	printf( "\t-B <seconds>\ttime budget of -O per file\n" );
+	printf( "\t-m <file>\tdecode the image into <file> through a moving memory map, one row after the other\n" );
+	printf( "\t-g <size>\tlay out -m in tiles of <size> x <size> pixels, a multiple of 8\n" );
+	printf( "\t-l <layout>\tdecode into a buffer: i or p for interleaved or planar, 8 or f for 8-bit or float\n" );
+	printf( "\t\t\tsamples, then optionally the channels to take, as in pf210; -o saves the buffer\n" );
+	printf( "\t-A <bytes>\talignment of the rows and planes of -l, a power of two\n" );
+	printf( "\t-V <level>\tchecks of the validation: full, critical (CRC of the critical chunks only),\n" );
+	printf( "\t\t\tstructure (no CRC) or decode (full and the image data decoded), default full\n" );
+	printf( "\t-H\t\thash the decoded pixels of the files in parallel and list the files with the same pixels\n" );
+	printf( "\t-x\t\tprint the minimum, maximum and mean of every channel, the palette use and\n" );
+	printf( "\t\t\twhether the image is opaque, and check hIST and sBIT against the pixels\n" );
+	printf( "\t-C <file>\tresume the parse from the checkpoint <file>, and save it there when the input ends\n" );
+	printf( "\t\t\tbefore IEND; only the bytes after the checkpoint are read\n" );
+	printf( "\t-F <seconds>\twait for bytes appended to the input until it stops growing for <seconds>\n" );
+	printf( "\t-M <megabytes>\tmemory budget of all the parses, image data over it is checked without being held\n" );
+	printf( "\t-X <file>\twrite the header fields, gAMA, cHRM, pHYs, tIME, text keywords and chunk counts\n" );
+	printf( "\t\t\tof the files to <file> as columns a reader can map, nothing is printed per file\n" );
+	printf( "\t-u\t\tcheck the files written by -X and print their rows\n" );
+	printf( "\t-r\t\twork on the *.png files below the directories given, in the order they are on disk\n" );
+	printf( "\t-t\t\tprint the throughput of the run\n" );
+	printf( "\t-L <ms>\t\ttime the validation of every file, print the 50th, 99th and 99.9th percentiles\n" );
+	printf( "\t\t\tand the time spent on each run of chunks of the files that took <ms> or longer\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+	int parsed = FALSE;
+	unsigned int queueDepth = 0;
+	int readerBackend = 0;
+	int timing = FALSE;
+	double slowMilliseconds = -1;
+	int option;
+	ParseOptions options;
+	double startTime;
+	BatchStats stats;
+	char **files;
+	size_t fileCount;
+	char **listNames = NULL;
+	FileList list;
+	size_t i;
+
+	memset( &options, 0, sizeof(options) );
+	initEncodeOptions( &options.encoder );
+	initOptimizeOptions( &options.optimizer );
+	initPixelLayout( &options.pixelLayout );
+	while ((option = getopt( argc, argv, "d:wpj:ak:io:s:T:R:Scte:z:OB:m:g:l:A:V:HxrC:F:M:X:uL:" )) != -1) {
+		switch (option) {
+		case 'd':
+			queueDepth = (unsigned int) atoi( optarg );
+			break;
+		case 'w':
+			readerBackend = READER_BACKEND_THREADS;
+			break;
+		case 'p':
+			options.decode = TRUE;
+			break;
+		case 'j':
+			setThreadCount( (unsigned int) atoi( optarg ) );
+			break;
+		case 'a':
+			options.frames = TRUE;
+			break;
+		case 'k':
+			options.textKey = optarg;
+			break;
+		case 'i':
+			options.profile = TRUE;
+			break;
+		case 'o':
+			options.output = optarg;
+			break;
+		case 's':
+			if (!addStripRule( &options.rules, optarg )) {
+				printf( "INVALID REWRITE RULE: %s\n", optarg );
+				return -1;
+			}
+			break;
+		case 'T':
+		case 'R':
+			if (!addRuleArgument( &options.rules, option, optarg )) {
+				printf( "INVALID REWRITE RULE: %s\n", optarg );
+				return -1;
+			}
+			break;
+		case 'S':
+			options.salvage = TRUE;
+			break;
+		case 'c':
+			options.carve = TRUE;
+			break;
+		case 't':
+			timing = TRUE;
+			break;
+		case 'L':
+			slowMilliseconds = atof( optarg );
+			break;
+		case 'e':
+			options.encode = optarg;
+			break;
+		case 'z':
+			options.encoder.level = atoi( optarg );
+			break;
+		case 'O':
+			options.optimize = TRUE;
+			break;
+		case 'B':
+			options.optimizer.timeBudget = atof( optarg );
+			break;
+		case 'm':
+			options.raster = optarg;
+			break;
+		case 'l':
+			options.layout = TRUE;
+			if (!parseLayoutArgument( &options.pixelLayout, optarg )) {
+				printf( "INVALID LAYOUT: %s\n", optarg );
+				return -1;
+			}
+			break;
+		case 'A':
+			options.pixelLayout.alignment = (size_t) atol( optarg );
+			break;
+		case 'r':
+			options.recursive = TRUE;
+			break;
+		case 'C':
+			options.checkpoint = optarg;
+			break;
+		case 'F':
+			options.follow = atof( optarg );
+			break;
+		case 'X':
+			options.columns = optarg;
+			break;
+		case 'u':
+			options.dumpColumns = TRUE;
+			break;
+		case 'M':
+			setMemoryBudget( (size_t) ( atof( optarg ) * 1024 * 1024 ), BUDGET_WAIT_SECONDS );
+			break;
+		case 'x':
+			options.statistics = TRUE;
+			break;
+		case 'H':
+			options.hash = TRUE;
+			break;
+		case 'V':
+			options.verifyLevel = parseVerifyLevel( optarg );
+			if (options.verifyLevel < 0) {
+				printf( "INVALID VERIFY LEVEL: %s\n", optarg );
+				return -1;
+			}
+			break;
+		case 'g':
+			options.tileSize = (uint32_t) atoi( optarg );
+			if (!options.tileSize || options.tileSize % 8) {
+				printf( "INVALID TILE SIZE: %s\n", optarg );
+				return -1;
+			}
+			break;
+		default:
+			printUsage();
+			return -1;
+		}
+	}
+	/*-e and -m name their own output, -o would be left unwritten*/
+	if (options.output && ( options.encode || options.raster )) {
+		printf( "-o CAN'T BE COMBINED WITH %s\n", options.encode ? "-e" : "-m" );
+		return -1;
+	}
+	if (optind >= argc || ( ( options.output || options.encode || options.raster ) &&
+			( argc - optind != 1 || options.recursive ) ) ||
+			( ( options.checkpoint || options.follow > 0 ) &&
+			( argc - optind != 1 || options.recursive || queueDepth || !isValidationOnly( &options ) ) )) {
+		printUsage();
+		return 0;
+	}
+	files = argv + optind;
+	fileCount = (size_t) ( argc - optind );
+
+	memset( &stats, 0, sizeof(stats) );
+	if (slowMilliseconds >= 0) {
+		stats.latency = (LatencyHistogram*) calloc( LATENCY_STAGES, sizeof(LatencyHistogram) );
+		if (!stats.latency) {
+			printf( "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return -1;
+		}
+		stats.slowNanoseconds = (uint64_t) ( slowMilliseconds * 1e6 );
+		setChunkTracing( TRUE );
+	}
+	startTime = getSeconds();
+	initFileList( &list );
+	if (options.recursive) {
+		for (i = 0; i < fileCount; i++) {
+			if (!walkDirectory( &list, files[i] )) {
+				printf( "CAN'T READ DIRECTORY: %s\n", files[i] );
+				stats.files++;
+			}
+		}
+		/*counted as files that failed*/
+		stats.files += list.unreadable;
+		sortFileList( &list );
+		listNames = getListNames( &list );
+		if (!listNames) {
+			printf( "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			freeFileList( &list );
+			return -1;
+		}
+		files = listNames;
+		fileCount = list.count;
+	}
+	if (options.carve) {
+		for (i = 0; i < fileCount; i++)
+			carveAndReport( files[i], FALSE, &stats );
+	}
+	else if (options.optimize) {
+		for (i = 0; i < fileCount; i++)
+			optimizeAndReport( files[i], &options, fileCount > 1, &stats );
+		if (fileCount > 1)
+			printf( "IMAGE DATA: %lu -> %lu BYTES (%.1lf%%)\n", (unsigned long) stats.imageBytes,
+					(unsigned long) stats.optimizedBytes,
+					stats.imageBytes ? 100.0 * stats.optimizedBytes / stats.imageBytes : 100.0 );
+	}
+	else if (options.hash) {
+		hashAndReport( files, fileCount, &stats );
+	}
+	else if (options.statistics) {
+		for (i = 0; i < fileCount; i++)
+			statsAndReport( files[i], fileCount > 1, &stats );
+	}
+	else if (options.dumpColumns) {
+		for (i = 0; i < fileCount; i++)
+			dumpAndReport( files[i], &stats );
+	}
+	else if (options.columns) {
+		ExportWriter writer;
+		int exported = openExportWriter( &writer, options.columns );
+		if (exported) {
+			exported = exportFiles( files, fileCount, 0, options.verifyLevel, &writer, countResult, &stats );
+			exported = closeExportWriter( &writer ) && exported;
+		}
+		if (exported)
+			printf( "EXPORTED %lu FILES, %lu VALID\n", (unsigned long) stats.files, (unsigned long) stats.parsedFiles );
+		else
+			printf( "CAN'T WRITE FILE: %s\n", options.columns );
+	}
+	else if (options.checkpoint || options.follow > 0) {
+		followAndReport( files[0], &options, &stats );
+	}
+	else if (options.salvage) {
+		for (i = 0; i < fileCount; i++)
+			salvageAndReport( files[i], &options, fileCount > 1, &stats );
+	}
+	else if (queueDepth && isValidationOnly( &options )) {
+		/*Batch with overlapped reads*/
+		if (!processFilesAsync( files, fileCount, queueDepth, readerBackend, options.verifyLevel,
+				printResult, &stats ))
+			printf( "READER FAILED AFTER %lu OF %lu FILES\n", (unsigned long) stats.files, (unsigned long) fileCount );
+	}
+	else if (options.recursive && isValidationOnly( &options )) {
+		/*Tree in disk order, opened and read ahead of the parser threads*/
+		if (!processFileList( &list, 0, options.verifyLevel, printResult, &stats ))
+			printf( "CAN'T START THE PARSERS\n" );
+	}
+	else if (fileCount > 1) {
+		/*Batch with blocking reads*/
+		for (i = 0; i < fileCount; i++) {
+			FileResult result;
+			processFile( files[i], TRUE, &options, &result );
+			printResult( &result, &stats );
+			freeChunkTrace( result.trace );
+		}
+	}
+	else if (fileCount) {
+		FileResult result;
+		parsed = processFile( files[0], FALSE, &options, &result );
+		stats.files++;
+		stats.parsedFiles += parsed;
+		stats.bytes = result.bytesRead;
+		if(parsed)
+			printf( "PARSING COMPLETED\n" );
+		recordFileLatency( &result, &stats );
+		freeChunkTrace( result.trace );
+	}
+
+	if (timing) {
+		double elapsed = getSeconds() - startTime;
+		MemoryBudgetStats budgetStats;
+		if (elapsed <= 0)
+			elapsed = 1e-9;
+		printf( "FILES: %lu VALID: %lu BYTES: %lu TIME: %.3lf s (%.1lf files/s, %.1lf MB/s)\n",
+				(unsigned long) stats.files, (unsigned long) stats.parsedFiles, (unsigned long) stats.bytes,
+				elapsed, stats.files / elapsed, stats.bytes / elapsed / (1024.0 * 1024.0) );
+		if (isValidationOnly( &options ))
+			printf( "VERIFY LEVEL: %s\n", verifyLevelNames[options.verifyLevel] );
+		getMemoryBudgetStats( &budgetStats );
+		printf( "MEMORY: PEAK %lu BYTES, %lu WAITS (%.3lf s), %lu STREAMED CHUNKS, %lu REFUSED\n",
+				(unsigned long) budgetStats.peak, (unsigned long) budgetStats.waits, budgetStats.waitSeconds,
+				(unsigned long) budgetStats.streamed, (unsigned long) budgetStats.refused );
+		if (options.profile) {
+			ProfileCacheStats cacheStats;
+			getProfileCacheStats( &cacheStats );
+			printf( "ICC CACHE: %lu PROFILES %lu BYTES, %lu HITS OF %lu LOOKUPS (%.1lf%%)\n",
+					(unsigned long) cacheStats.profiles, (unsigned long) cacheStats.bytes,
+					(unsigned long) cacheStats.hits, (unsigned long) cacheStats.lookups,
+					cacheStats.lookups ? 100.0 * cacheStats.hits / cacheStats.lookups : 0.0 );
+		}
+	}
+	if (stats.latency && stats.latency[LATENCY_STAGE_FILE].total)
+		printLatency( stats.latency );
+	freeRewriteRules( &options.rules );
+	free( stats.latency );
+	free( listNames );
+	freeFileList( &list );
+
+	return 0;
+}
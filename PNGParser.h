@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include <limits.h>
 #include <string.h>
+#include <stdarg.h>
 
 #define TRUE 1
 #define FALSE 0
@@ -28,6 +29,43 @@ static const unsigned char pngHeader[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
 #define	PROCESS_CHUNK_HEADER 12
 #define	PROCESS_CHUNK_DATA 13
 #define	PROCESS_CHUNK_CRC 14
+#define	PROCESS_DONE 15
+#define	PROCESS_CHUNK_STREAM 16 //data only run through the CRC, over the memory budget
+
+/*Status returned by pngPush()*/
+#define PNG_STATUS_ERROR	-1
+#define PNG_STATUS_NEED_MORE	0
+#define PNG_STATUS_DONE		1
+
+/*Reason of the failure, returned by pngGetError()*/
+#define PNG_ERROR_NONE			0
+#define PNG_ERROR_SIGNATURE		1
+#define PNG_ERROR_CHUNK_LENGTH		2
+#define PNG_ERROR_MEMORY		3
+#define PNG_ERROR_CRC			4
+#define PNG_ERROR_CHUNK_TYPE		5
+#define PNG_ERROR_CHUNK_ORDER		6
+#define PNG_ERROR_UNKNOWN_CRITICAL	7
+#define PNG_ERROR_CHUNK_DATA		8
+#define PNG_ERROR_TRUNCATED		9
+#define PNG_ERROR_MISSING_IEND		10
+#define PNG_ERROR_PALETTE		11
+#define PNG_ERROR_INTERNAL		12
+#define PNG_ERROR_IO			13
+#define PNG_ERROR_DECODE		14
+#define PNG_ERROR_FILTER		15
+#define PNG_ERROR_IMAGE_SIZE		16
+#define PNG_ERROR_OUTPUT		17
+#define PNG_ERROR_PALETTE_INDEX		18
+#define PNG_ERROR_ADLER			19
+#define PNG_ERROR_ANIMATION		20
+#define PNG_ERROR_METADATA		21
+#define PNG_ERROR_PROFILE		22
+#define PNG_ERROR_HISTOGRAM		23
+#define PNG_ERROR_SIGNIFICANT_BITS	24
+#define PNG_ERROR_CHECKPOINT		25
+#define PNG_ERROR_BUDGET		26
+#define PNG_ERROR_LAYOUT		27
 
 #define CHUNK_TYPE_LENGTH	4
 #define IHDR_DATA_LENGTH	13
@@ -50,6 +88,32 @@ static const unsigned char pngHeader[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
 #define SBIT_TYPE_4_DATA_LENGTH		2
 #define SBIT_TYPE_6_DATA_LENGTH		4
 
+#define ACTL_DATA_LENGTH	8
+#define FCTL_DATA_LENGTH	26
+#define FDAT_SEQUENCE_LENGTH	4
+#define ZTXT_HEADER_LENGTH	1 //compression method
+#define ITXT_HEADER_LENGTH	2 //compression flag and method
+
+/*
+ * How much of a file processBuffer() checks, the cheaper levels are for
+ * files from a trusted source such as our own encoder.
+ * VERIFY_FULL: the CRC of every chunk, the chunk order and the contents of
+ *	the chunks known to the parser. A file that passes is intact as written.
+ * VERIFY_CRITICAL: as VERIFY_FULL but only IHDR, PLTE, IDAT and IEND have
+ *	their CRC checked, damage to an ancillary chunk goes unnoticed unless
+ *	it breaks the contents check of the chunk.
+ * VERIFY_STRUCTURE: no CRC at all, only the chunk lengths, the order and
+ *	the chunk contents. Corrupt image data is not noticed.
+ * VERIFY_DECODE: VERIFY_FULL and the image data is inflated and unfiltered
+ *	as well, with its Adler-32. A file that passes can be displayed.
+ */
+#define VERIFY_FULL			0
+#define VERIFY_CRITICAL		1
+#define VERIFY_STRUCTURE	2
+#define VERIFY_DECODE		3
+
+#define PRINT_BUFFER_SIZE	( 16 * 1024 ) //dump output written at once
+
 
 /*
  * Structure represents chunk type and its data
@@ -63,91 +127,163 @@ struct chunk {
 typedef struct chunk Chunk;
 
 /*
- * Structure to store available types of chunks and its color type
+ * Console output of the chunk dumps, formatted here and written in one piece
+ * instead of a printf for every byte
+ */
+struct printBuffer {
+	size_t	length;
+	char	data[PRINT_BUFFER_SIZE];
+};
+
+typedef struct printBuffer PrintBuffer;
+
+/*
+ * Structure to store available types of chunks and its color type,
+ * flags are bit fields so that many parsers can stay in flight at once
  */
 struct chunkInfo {
 	/*Critical Chunk Types*/
-	int IHDR; //Image Header
-	int IDAT; //Image Data
-	int PLTE; // Palltte
-	int IEND; //Image Trailer
+	unsigned int IHDR : 1; //Image Header
+	unsigned int IDAT : 1; //Image Data
+	unsigned int PLTE : 1; // Palltte
+	unsigned int IEND : 1; //Image Trailer
 
 	/*Ancillary Chunks*/
-	int TRNS; /* Transparency Info */
+	unsigned int TRNS : 1; /* Transparency Info */
 	/*Color Space Information*/
-	int ICCP; //Embedded ICC Profile
-	int CHRM; //Primary Chromaticities and white point
-	int GAMA; //image gamma
-	int SRGB; // standard RGB color Space
-	int SBIT; //significant Bits
+	unsigned int ICCP : 1; //Embedded ICC Profile
+	unsigned int CHRM : 1; //Primary Chromaticities and white point
+	unsigned int GAMA : 1; //image gamma
+	unsigned int SRGB : 1; // standard RGB color Space
+	unsigned int SBIT : 1; //significant Bits
 	/*Textual Information*/
-	int tEXt; //Textual Data
-	int zTXt; // Compressed Textual Data
+	unsigned int tEXt : 1; //Textual Data
+	unsigned int zTXt : 1; // Compressed Textual Data
 	/*Miscellanious Information*/
-	int BKGD; //background color
-	int HIST; //image histogram
-	int PHYS; // Physical pixel dimensions
-	int SPLT; // suggested paletter
+	unsigned int BKGD : 1; //background color
+	unsigned int HIST : 1; //image histogram
+	unsigned int PHYS : 1; // Physical pixel dimensions
+	unsigned int SPLT : 1; // suggested paletter
 	/*Timestamp Information*/
-	int TIME;
+	unsigned int TIME : 1;
+	/*Animation Information*/
+	unsigned int ACTL : 1; //Animation control
 
-	int lastChunkIEND; // last IEND
-	int lastChunkIDAT; //last IDAT
-	unsigned int colorType; //defined color types
+	unsigned int lastChunkIEND : 1; // last IEND
+	unsigned int lastChunkIDAT : 1; //last IDAT
+	unsigned int quiet : 1; // don't print anything to the console
+	uint32_t width; //image width from IHDR
+	uint32_t height; //image height from IHDR
+	unsigned char bitDepth; //bits per sample
+	unsigned char interlace; //interlace method
+	unsigned char colorType; //defined color types
+	unsigned char errorCode; //PNG_ERROR_* of the failure
+	struct printBuffer *output; //chunk dumps collected for one write, NULL until the first
 };
 
 typedef struct chunkInfo ChunkInfo;
 
 
 
+void reportError(ChunkInfo*, int, const char*, ...);
+void printInfo(const ChunkInfo*, const char*, ...);
+void printError(const ChunkInfo*, const char*);
 int isChunkType(const unsigned char*, const char*);
 int initChunkProcess( ChunkInfo*);
 int isChunkTypeValid( const unsigned char*);
 int processChunk( ChunkInfo*, const Chunk*);
 int processLastChunk(ChunkInfo*);
 
+struct pngData;
+struct animationIndex;
+struct metadataIndex;
+struct pngDecoder;
+struct chunkTrace;
+
+/*
+ * Called for every chunk that passed validation, the hook may take over the
+ * chunk data by setting chunkData of the PNGData to NULL
+ */
+typedef int (*ChunkHook)(struct pngData*, const Chunk*, void*);
+
 /*
  * Structure to store the all fields of PNG File
  */
 
 
 struct pngData {
-	int	State; //State of the processing of the file
-	unsigned char	chunkHeader[8]; //to store chunk header
-	unsigned char	chunkCRC[4]; //to store chunk CRC
 	size_t			chunkSize; //to store chunksize
 	unsigned char	*chunkData; //to store chunk data
 	size_t			bytesToCopy; // bytes to be copied to PNGData from file
 	size_t			bytesCopied; // bytes copied to PNGData from File
 	unsigned char	*bufferData; //buffer read from file
+	ChunkHook		chunkHook; //optional consumer of the chunks
+	void			*hookContext; //passed to chunkHook
+	uint64_t		fileOffset; //bytes of the file consumed so far
+	struct animationIndex	*animation; //frames of an APNG, NULL for still images
+	struct metadataIndex	*metadata; //text and ICC profile spans, NULL when there are none
+	int				verifyLevel; //VERIFY_*
+	int				memoryWait; //wait for memory over the budget instead of failing at once
+	struct pngDecoder	*decoder; //image data check of VERIFY_DECODE, NULL until IHDR
+	unsigned long	streamCrc; //running CRC of a chunk in PROCESS_CHUNK_STREAM
+	struct chunkTrace	*trace; //time spent on every chunk, NULL when the file isn't traced
+	unsigned char	chunkHeader[8]; //to store chunk header
+	unsigned char	chunkCRC[4]; //to store chunk CRC
 	ChunkInfo		chunkInfo;  // everything about chunk
+	unsigned char	State; //State of the processing of the file
 };
 
 typedef struct pngData PNGData;
 
+/*
+ * Result of one file of a batch
+ */
+struct fileResult {
+	const char	*fileName;
+	int			parsed; //TRUE when the file is a valid PNG
+	int			errorCode; //PNG_ERROR_* otherwise
+	size_t		bytesRead;
+	struct chunkTrace	*trace; //timings of the file, NULL when it isn't traced
+};
+
+typedef struct fileResult FileResult;
+
+typedef void (*FileResultCallback)(const FileResult*, void*);
+
 int initPNGProcess(PNGData*);
 int verifyAndProcessChunk(PNGData*);
 int processBuffer(PNGData* , const unsigned char*, size_t);
+int pngPush(PNGData*, const unsigned char*, size_t, size_t*);
+int pngGetError(const PNGData*);
+int getMemoryMode(const PNGData*);
+const char *pngErrorString(int);
 int processCopiedData(PNGData*);
 int processFinish(PNGData*);
-void processGenericChunk(const Chunk*);
+void processGenericChunk(ChunkInfo*, const Chunk*);
 int isValidChunkOrder(ChunkInfo*, const Chunk*);
+uint32_t getChunkCrc( const unsigned char*, const unsigned char*, size_t);
 int isValidCrc( const unsigned char*, const unsigned char*, size_t, uint32_t);
 
-int processIHDRChunk(const Chunk*, unsigned int*);
-int processIENDChunk(const Chunk*);
-int processTIMEChunk(const Chunk*);
-int processCHRMChunk(const Chunk*);
-int processGAMAChunk(const Chunk*);
-int processTEXTChunk(const Chunk*);
-int processBKGDChunk(const Chunk*, unsigned int);
-int processPHYSChunk(const Chunk*);
-
-int processPLTEChunk(const Chunk*);
-int processICCPChunk(const Chunk*);
-int processSRGBChunk(const Chunk*);
-int processSBITChunk(const Chunk*, unsigned int);
+int processIHDRChunk(ChunkInfo*, const Chunk*);
+int processIENDChunk(ChunkInfo*, const Chunk*);
+int processTIMEChunk(ChunkInfo*, const Chunk*);
+int processCHRMChunk(ChunkInfo*, const Chunk*);
+int processGAMAChunk(ChunkInfo*, const Chunk*);
+int processTEXTChunk(ChunkInfo*, const Chunk*);
+int processBKGDChunk(ChunkInfo*, const Chunk*);
+int processPHYSChunk(ChunkInfo*, const Chunk*);
+
+int processPLTEChunk(ChunkInfo*, const Chunk*);
+int processICCPChunk(ChunkInfo*, const Chunk*);
+int processSRGBChunk(ChunkInfo*, const Chunk*);
+int processSBITChunk(ChunkInfo*, const Chunk*);
+int processZTXTChunk(ChunkInfo*, const Chunk*);
+int processITXTChunk(ChunkInfo*, const Chunk*);
+int processACTLChunk(ChunkInfo*, const Chunk*);
+int processFCTLChunk(ChunkInfo*, const Chunk*);
+int processFDATChunk(ChunkInfo*, const Chunk*);
 void freeChunkData(PNGData*);
+void freePNGData(PNGData*);
 uint32_t getLastByte( const unsigned char*);
 uint16_t getLastWord(const unsigned char*);
 
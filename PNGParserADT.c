@@ -1,5 +1,11 @@
 #include "PNGParser.h"
 #include "crc.h"
+#include "PNGThreads.h"
+#include "PNGDecode.h"
+#include "PNGAnimation.h"
+#include "PNGMetadata.h"
+#include "PNGBudget.h"
+#include "PNGLatency.h"
 
 /*
  * Functon to check whether the given chunk contains valid characters or not
@@ -16,37 +22,286 @@ int isChunkTypeValid( const unsigned char *ChunkType ) {
 	return validCharacters;
 }
 
+/*
+ * Record why the parse failed and print the message unless the parser is quiet
+ */
+void reportError( ChunkInfo *cInfo, int ErrorCode, const char *Format, ... ) {
+	va_list args;
+	cInfo->errorCode = ErrorCode;
+	if (cInfo->quiet)
+		return;
+	va_start( args, Format );
+	vprintf( Format, args );
+	va_end( args );
+}
+
+/*
+ * Print the decoded chunk contents to the console
+ */
+void printInfo( const ChunkInfo *cInfo, const char *Format, ... ) {
+	va_list args;
+	if (cInfo->quiet)
+		return;
+	va_start( args, Format );
+	vprintf( Format, args );
+	va_end( args );
+}
+
+/*
+ * Print the reason a chunk was rejected
+ */
+void printError( const ChunkInfo *cInfo, const char *Message ) {
+	if (!cInfo->quiet)
+		fputs( Message, stderr );
+}
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static const char decimalPairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/*
+ * Write the collected dump to the console
+ */
+static void flushOutput( ChunkInfo *cInfo ) {
+	if (!cInfo->output || !cInfo->output->length)
+		return;
+	fwrite( cInfo->output->data, 1, cInfo->output->length, stdout );
+	cInfo->output->length = 0;
+}
+
+/*
+ * Room for Length more bytes of dump output, NULL when there is no buffer
+ * and the text has to be written directly
+ */
+static char *reserveOutput( ChunkInfo *cInfo, size_t Length ) {
+	if (!cInfo->output) {
+		cInfo->output = (PrintBuffer*) malloc( sizeof(PrintBuffer) );
+		if (!cInfo->output)
+			return NULL;
+		cInfo->output->length = 0;
+	}
+	if (Length > PRINT_BUFFER_SIZE)
+		return NULL;
+	if (cInfo->output->length + Length > PRINT_BUFFER_SIZE)
+		flushOutput( cInfo );
+	return cInfo->output->data + cInfo->output->length;
+}
+
+static void appendText( ChunkInfo *cInfo, const char *Text, size_t Length ) {
+	char *out = reserveOutput( cInfo, Length );
+	if (!out) {
+		flushOutput( cInfo );
+		fwrite( Text, 1, Length, stdout );
+		return;
+	}
+	memcpy( out, Text, Length );
+	cInfo->output->length += Length;
+}
+
+/*
+ * Two lower case hex digits as printed by %.2x
+ */
+static void appendHex( ChunkInfo *cInfo, unsigned char Value ) {
+	char *out = reserveOutput( cInfo, 2 );
+	if (!out) {
+		char digits[2] = { hexDigits[Value >> 4], hexDigits[Value & 15] };
+		appendText( cInfo, digits, 2 );
+		return;
+	}
+	out[0] = hexDigits[Value >> 4];
+	out[1] = hexDigits[Value & 15];
+	cInfo->output->length += 2;
+}
+
+/*
+ * Value as printed by %u, two digits at a time
+ */
+static void appendDecimal( ChunkInfo *cInfo, unsigned int Value ) {
+	char digits[10];
+	size_t start = sizeof(digits);
+	while (Value >= 100) {
+		unsigned int pair = ( Value % 100 ) * 2;
+		Value /= 100;
+		digits[--start] = decimalPairs[pair + 1];
+		digits[--start] = decimalPairs[pair];
+	}
+	if (Value >= 10) {
+		digits[--start] = decimalPairs[Value * 2 + 1];
+		digits[--start] = decimalPairs[Value * 2];
+	}
+	else {
+		digits[--start] = (char) ( '0' + Value );
+	}
+	appendText( cInfo, digits + start, sizeof(digits) - start );
+}
+
+/*
+ * Short description of an error code returned by pngGetError()
+ */
+const char *pngErrorString( int ErrorCode ) {
+	switch (ErrorCode) {
+	case PNG_ERROR_NONE:
+		return "NO ERROR";
+	case PNG_ERROR_SIGNATURE:
+		return "INVALID PNG SIGNATURE";
+	case PNG_ERROR_CHUNK_LENGTH:
+		return "INVALID CHUNK LENGTH";
+	case PNG_ERROR_MEMORY:
+		return "CAN'T ALLOCATE MEMORY";
+	case PNG_ERROR_CRC:
+		return "DATA CORRUPTED";
+	case PNG_ERROR_CHUNK_TYPE:
+		return "INVALID CHUNK TYPE";
+	case PNG_ERROR_CHUNK_ORDER:
+		return "INVALID CHUNK ORDER";
+	case PNG_ERROR_UNKNOWN_CRITICAL:
+		return "UNKNOWN CRITICAL CHUNK";
+	case PNG_ERROR_CHUNK_DATA:
+		return "INVALID CHUNK DATA";
+	case PNG_ERROR_TRUNCATED:
+		return "MISSING CHUNK HEADER";
+	case PNG_ERROR_MISSING_IEND:
+		return "IEND CHUNK SHOULD BE THE LAST CHUNK";
+	case PNG_ERROR_PALETTE:
+		return "PLTE CHUNK DOES NOT MATCH COLOR TYPE";
+	case PNG_ERROR_IO:
+		return "CAN'T READ FILE";
+	case PNG_ERROR_DECODE:
+		return "IMAGE DATA CORRUPTED";
+	case PNG_ERROR_FILTER:
+		return "INVALID FILTER TYPE";
+	case PNG_ERROR_IMAGE_SIZE:
+		return "IMAGE DATA SIZE MISMATCH";
+	case PNG_ERROR_OUTPUT:
+		return "CAN'T WRITE IMAGE";
+	case PNG_ERROR_PALETTE_INDEX:
+		return "PIXEL OUTSIDE THE PALETTE";
+	case PNG_ERROR_ADLER:
+		return "DATA CORRUPTED (ADLER-32)";
+	case PNG_ERROR_ANIMATION:
+		return "INVALID ANIMATION";
+	case PNG_ERROR_METADATA:
+		return "METADATA TOO LARGE";
+	case PNG_ERROR_PROFILE:
+		return "INVALID ICC PROFILE";
+	case PNG_ERROR_HISTOGRAM:
+		return "hIST DOES NOT MATCH THE PIXELS";
+	case PNG_ERROR_SIGNIFICANT_BITS:
+		return "sBIT DOES NOT MATCH THE PIXELS";
+	case PNG_ERROR_CHECKPOINT:
+		return "CAN'T CHECKPOINT OR RESUME THE PARSE";
+	case PNG_ERROR_BUDGET:
+		return "MEMORY BUDGET EXCEEDED";
+	case PNG_ERROR_LAYOUT:
+		return "PIXEL LAYOUT DOESN'T FIT THE IMAGE";
+	default:
+		return "INTERNAL ERROR";
+	}
+}
+
+/*
+ * Error code of the last failure, PNG_ERROR_NONE while the parse is healthy
+ */
+int pngGetError( const PNGData *PNG ) {
+	return PNG->chunkInfo.errorCode;
+}
+
+/*
+ * How the buffers of the parse are reserved against the memory budget
+ */
+int getMemoryMode( const PNGData *PNG ) {
+	return PNG->memoryWait ? BUDGET_WAIT : BUDGET_FAIL;
+}
+
 /*
  * Function to check CRC of the chunk
  */
-int isValidCrc( const unsigned char *ChunkType, const unsigned char *ChunkData, size_t ChunkSize, uint32_t ChunkCrc ) {
+uint32_t getChunkCrc( const unsigned char *ChunkType, const unsigned char *ChunkData, size_t ChunkSize ) {
 	unsigned long crc = update_crc( 0xffffffffL, ChunkType, CHUNK_TYPE_LENGTH );
+	if ( ChunkSize >= CRC_PARALLEL_THRESHOLD ) {
+		/*Huge chunks are checked in segments on all cores*/
+		return (uint32_t) crc_combine( crc ^ 0xffffffffL, crc_parallel( ChunkData, ChunkSize, getThreadCount() ), ChunkSize );
+	}
 	crc = update_crc( crc, ChunkData, (int) ChunkSize );
-	crc ^= 0xffffffffL;
-	return (crc == ChunkCrc);
+	return (uint32_t) ( crc ^ 0xffffffffL );
+}
+
+int isValidCrc( const unsigned char *ChunkType, const unsigned char *ChunkData, size_t ChunkSize, uint32_t ChunkCrc ) {
+	return getChunkCrc( ChunkType, ChunkData, ChunkSize ) == ChunkCrc;
+}
+
+/*
+ * Whether the verification level of the PNGData wants the CRC of a chunk,
+ * critical chunks have an upper case first letter
+ */
+static int isCrcChecked( const PNGData* PNG, const unsigned char *ChunkType ) {
+	switch ( PNG->verifyLevel ) {
+	case VERIFY_CRITICAL:
+		return !( ChunkType[0] & 0x20 );
+	case VERIFY_STRUCTURE:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
+/*
+ * Decode the image data of a VERIFY_DECODE parse, the rows are dropped
+ */
+static int verifyImageChunk( PNGData* PNG, const Chunk *chunk ) {
+	if ( !PNG->decoder ) {
+		PNG->decoder = (PNGDecoder*) malloc( sizeof( PNGDecoder ) );
+		if ( !PNG->decoder ) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return FALSE;
+		}
+		initDecoder( PNG->decoder, discardRow, NULL );
+		PNG->decoder->memoryMode = getMemoryMode( PNG );
+	}
+	if ( decodeChunk( PNG->decoder, chunk ) )
+		return TRUE;
+	reportError( &PNG->chunkInfo, PNG->decoder->errorCode, "%s\n", pngErrorString( PNG->decoder->errorCode ) );
+	return FALSE;
 }
 
 /*
  * Function to verify the type of chunk and CRC,
  *  If chunk type is valid and CRC is valid then it processes the chunk
  */
-
 int verifyAndProcessChunk( PNGData* PNG ) {
 	Chunk chunk;
 	int processed = FALSE;
 	const unsigned char *ChunkType = PNG->chunkHeader + 4;
-	if ( !isValidCrc( ChunkType, PNG->chunkData, PNG->chunkSize, getLastByte( PNG->chunkCRC ) ) ) {
-		printf( "DATA CORRUPTED\n" );
+	/*a streamed chunk has no data left, only its running CRC*/
+	int streamed = !PNG->chunkData && PNG->chunkSize;
+	if ( isCrcChecked( PNG, ChunkType ) && ( streamed ?
+			(uint32_t) ( PNG->streamCrc ^ 0xffffffffL ) != getLastByte( PNG->chunkCRC ) :
+			!isValidCrc( ChunkType, PNG->chunkData, PNG->chunkSize, getLastByte( PNG->chunkCRC ) ) ) ) {
+		reportError( &PNG->chunkInfo, PNG_ERROR_CRC, "DATA CORRUPTED\n" );
 		return processed;
 	}
 	if ( !isChunkTypeValid( ChunkType ) ) {
-		printf( "INVALID CHUNK TYPE\n" );
+		reportError( &PNG->chunkInfo, PNG_ERROR_CHUNK_TYPE, "INVALID CHUNK TYPE\n" );
 		return processed;
 	}
 	memcpy( chunk.chunkType, ChunkType, sizeof( chunk.chunkType ) );
 	chunk.Data = PNG->chunkData;
 	chunk.dataSize = PNG->chunkSize;
 	processed = processChunk( &PNG->chunkInfo, &chunk );
+	if ( processed )
+		processed = indexAnimationChunk( PNG, &chunk );
+	if ( processed )
+		processed = indexMetadataChunk( PNG, &chunk );
+	if ( processed && PNG->verifyLevel == VERIFY_DECODE )
+		processed = verifyImageChunk( PNG, &chunk );
+	if ( processed && PNG->chunkHook )
+		processed = PNG->chunkHook( PNG, &chunk, PNG->hookContext );
+	/*Chunk validators report their own message, the code is generic*/
+	if ( !processed && !PNG->chunkInfo.errorCode )
+		PNG->chunkInfo.errorCode = PNG_ERROR_CHUNK_DATA;
 	return processed;
 }
 
@@ -54,10 +309,68 @@ int verifyAndProcessChunk( PNGData* PNG ) {
  * chunkData from the PNGData structure will be deleted/NULL
  */
 void freeChunkData( PNGData* PNG ) {
+	if ( PNG->chunkData )
+		releaseMemory( PNG->chunkSize );
 	free( PNG->chunkData );
 	PNG->chunkData = NULL;
 }
 
+/*
+ * Everything the PNGData owns is deleted, to be called once the file is done
+ */
+void freePNGData( PNGData* PNG ) {
+	freeChunkData( PNG );
+	free( PNG->chunkInfo.output );
+	PNG->chunkInfo.output = NULL;
+	freeAnimationIndex( PNG->animation );
+	PNG->animation = NULL;
+	freeMetadataIndex( PNG->metadata );
+	PNG->metadata = NULL;
+	if ( PNG->decoder ) {
+		freeDecoder( PNG->decoder );
+		free( PNG->decoder );
+		PNG->decoder = NULL;
+	}
+}
+
+/*
+ * An IDAT whose data nobody looks at can be checked as it goes by, unless
+ * it is to be dumped, decoded or handed to a chunkHook
+ */
+static int isStreamable( const PNGData* PNG ) {
+	return isChunkType( PNG->chunkHeader + 4, "IDAT" ) && PNG->chunkInfo.quiet && !PNG->chunkHook &&
+			PNG->verifyLevel != VERIFY_DECODE;
+}
+
+/*
+ * Room for the data of the chunk whose header was just read, reserved
+ * against the memory budget. Over the budget an IDAT is streamed at once,
+ * any other chunk waits for memory, when memoryWait allows, and fails when
+ * none is freed in time
+ */
+static int allocateChunkData( PNGData* PNG ) {
+	int streamable = isStreamable( PNG );
+	int mode = streamable ? BUDGET_PROBE : getMemoryMode( PNG );
+	if ( !reserveMemory( PNG->chunkSize, mode ) ) {
+		if ( !streamable ) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_BUDGET, "MEMORY BUDGET EXCEEDED: %u bytes\n", (unsigned int)PNG->chunkSize );
+			return FALSE;
+		}
+		countStreamedChunk();
+		PNG->streamCrc = update_crc( 0xffffffffL, PNG->chunkHeader + 4, CHUNK_TYPE_LENGTH );
+		PNG->State = PROCESS_CHUNK_STREAM;
+		return TRUE;
+	}
+	PNG->chunkData = (unsigned char*) malloc( PNG->chunkSize );
+	if ( !PNG->chunkData) {
+		releaseMemory( PNG->chunkSize );
+		reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "CAN'T ALLOCATE MEMORY: %u bytes\n", (unsigned int)PNG->chunkSize );
+		return FALSE;
+	}
+	PNG->State = PROCESS_CHUNK_DATA;
+	return TRUE;
+}
+
 /*
  * Function to process the components of chunk layout
  */
@@ -66,7 +379,7 @@ int processCopiedData( PNGData* PNG ) {
 	/*Verifying whether it is PNG file or not*/
 	case PROCESS_PNG_HEADER:
 		if (memcmp( PNG->chunkHeader, pngHeader, sizeof( PNG->chunkHeader )))	{
-			printf( "INVALID PNG SIGNATURE\n" );
+			reportError( &PNG->chunkInfo, PNG_ERROR_SIGNATURE, "INVALID PNG SIGNATURE\n" );
 			return FALSE;
 		}
 		PNG->State = PROCESS_CHUNK_HEADER;
@@ -79,19 +392,17 @@ int processCopiedData( PNGData* PNG ) {
 		/* verifying chunk header*/
 	case PROCESS_CHUNK_HEADER:
 		PNG->chunkSize = getLastByte( PNG->chunkHeader );
+		if ( PNG->trace )
+			beginTracedChunk( PNG->trace, PNG->chunkHeader + 4, PNG->chunkSize,
+					PNG->fileOffset - sizeof( PNG->chunkHeader ) );
 		if ( PNG->chunkSize) {
 
 			if ( PNG->chunkSize > ( 1u << 31 ) - 1)	{
-				printf( "INVALID CHUNK LENGTH\n");
+				reportError( &PNG->chunkInfo, PNG_ERROR_CHUNK_LENGTH, "INVALID CHUNK LENGTH\n");
 				return FALSE;
 			}
-			PNG->chunkData = (unsigned char*) malloc( PNG->chunkSize );
-			if ( !PNG->chunkData) {
-				printf("CAN'T ALLOCATE MEMORY: %u bytes\n", (unsigned int)PNG->chunkSize );
+			if ( !allocateChunkData( PNG ) )
 				return FALSE;
-			}
-			PNG->State = PROCESS_CHUNK_DATA;
-
 			PNG->bytesToCopy = PNG->chunkSize;
 			PNG->bytesCopied = 0;
 			PNG->bufferData = PNG->chunkData;
@@ -100,6 +411,7 @@ int processCopiedData( PNGData* PNG ) {
 		// No need for a break here for this case, since the program has to process the data after the header
 
 		/*Prepare to process chunk data to validate CRC*/
+	case PROCESS_CHUNK_STREAM:
 	case PROCESS_CHUNK_DATA:
 		PNG->State = PROCESS_CHUNK_CRC;
 
@@ -112,6 +424,8 @@ int processCopiedData( PNGData* PNG ) {
 		if ( !verifyAndProcessChunk(PNG))
 			return FALSE;
 		freeChunkData( PNG );
+		if ( PNG->trace )
+			endTracedChunk( PNG->trace );
 		PNG->State = PROCESS_CHUNK_HEADER;
 
 		PNG->bytesToCopy = sizeof(PNG->chunkHeader);
@@ -120,7 +434,7 @@ int processCopiedData( PNGData* PNG ) {
 		break;
 
 	default:
-		printf( "INTERNAL ERROR\n" );
+		reportError( &PNG->chunkInfo, PNG_ERROR_INTERNAL, "INTERNAL ERROR\n" );
 		return FALSE;
 	}
 	return TRUE;
@@ -138,6 +452,16 @@ int initPNGProcess( PNGData* PNG ) {
 	PNG->bytesToCopy = sizeof(PNG->chunkHeader);
 	PNG->bytesCopied = 0;
 	PNG->bufferData = PNG->chunkHeader;
+	PNG->chunkHook = NULL;
+	PNG->hookContext = NULL;
+	PNG->fileOffset = 0;
+	PNG->animation = NULL;
+	PNG->metadata = NULL;
+	PNG->verifyLevel = VERIFY_FULL;
+	PNG->decoder = NULL;
+	PNG->streamCrc = 0;
+	PNG->memoryWait = TRUE;
+	PNG->trace = NULL;
 
 	PNG->chunkInfo.IHDR = FALSE;
 	PNG->chunkInfo.IDAT = FALSE;
@@ -152,46 +476,119 @@ int initPNGProcess( PNGData* PNG ) {
 	PNG->chunkInfo.TRNS = FALSE;
 	PNG->chunkInfo.PHYS = FALSE;
 	PNG->chunkInfo.TIME = FALSE;
+	PNG->chunkInfo.ACTL = FALSE;
 	PNG->chunkInfo.IEND = FALSE;
 	PNG->chunkInfo.lastChunkIEND = FALSE;
 	PNG->chunkInfo.lastChunkIDAT = FALSE;
+	PNG->chunkInfo.quiet = FALSE;
+	PNG->chunkInfo.width = 0;
+	PNG->chunkInfo.height = 0;
+	PNG->chunkInfo.bitDepth = 0;
+	PNG->chunkInfo.interlace = 0;
 	PNG->chunkInfo.colorType = 0;
+	PNG->chunkInfo.errorCode = PNG_ERROR_NONE;
+	PNG->chunkInfo.output = NULL;
 	return TRUE;
 }
 
+/*
+ * Copy as much of the buffer as the current state is waiting for,
+ * returns the number of bytes taken
+ */
+static size_t copyToPNGData( PNGData* PNG, const unsigned char *Data, size_t DataLength ) {
+	size_t BytesRequired = PNG->bytesToCopy - PNG->bytesCopied;
+	size_t BytesToCopy = ((DataLength < BytesRequired ) ? DataLength : BytesRequired);
+	if ( PNG->State != PROCESS_CHUNK_STREAM )
+		memcpy( PNG->bufferData + PNG->bytesCopied, Data, BytesToCopy );
+	else if ( isCrcChecked( PNG, PNG->chunkHeader + 4 ) )
+		PNG->streamCrc = update_crc( PNG->streamCrc, Data, (int) BytesToCopy );
+	PNG->bytesCopied += BytesToCopy;
+	PNG->fileOffset += BytesToCopy;
+	return BytesToCopy;
+}
+
 /*
  * read the Buffer into PNGData and then process
  */
 int processBuffer( PNGData* PNG, const unsigned char *Data, size_t DataLength ) {
 	size_t i = 0;
-	int processed = FALSE;
-	while (i < DataLength) {
-		size_t BytesAvailable = DataLength - i;
-		size_t BytesRequired = PNG->bytesToCopy - PNG->bytesCopied;
-		size_t BytesToCopy = ((BytesAvailable < BytesRequired ) ? BytesAvailable : BytesRequired);
-		memcpy( PNG->bufferData + PNG->bytesCopied, Data + i, BytesToCopy );
-		PNG->bytesCopied += BytesToCopy;
-		i += BytesToCopy;
-		if ( PNG->bytesCopied == PNG->bytesToCopy) {
+	int processed = TRUE;
+	if (PNG->trace)
+		resumeChunkTrace( PNG->trace );
+	while (processed && i < DataLength) {
+		i += copyToPNGData( PNG, Data + i, DataLength - i );
+		if ( PNG->bytesCopied == PNG->bytesToCopy)
 			processed = processCopiedData(PNG);
-			if(!processed)
-				return processed;
-		}
 	}
+	if (PNG->trace)
+		pauseChunkTrace( PNG->trace );
 	return processed;
 }
 
+/*
+ * pngPush() without the trace bookkeeping
+ */
+static int pushData( PNGData* PNG, const unsigned char *Data, size_t DataLength, size_t *Consumed ) {
+	size_t i = 0;
+	*Consumed = 0;
+	if (PNG->chunkInfo.errorCode)
+		return PNG_STATUS_ERROR;
+	if (PNG->State == PROCESS_DONE)
+		return PNG_STATUS_DONE;
+	while (i < DataLength) {
+		i += copyToPNGData( PNG, Data + i, DataLength - i );
+		if ( PNG->bytesCopied != PNG->bytesToCopy)
+			continue;
+		if (!processCopiedData(PNG)) {
+			*Consumed = i;
+			return PNG_STATUS_ERROR;
+		}
+		/*IEND has been processed, nothing after it belongs to this file*/
+		if (PNG->chunkInfo.lastChunkIEND && ( PNG->State == PROCESS_CHUNK_HEADER )) {
+			*Consumed = i;
+			if (!processFinish(PNG))
+				return PNG_STATUS_ERROR;
+			PNG->State = PROCESS_DONE;
+			return PNG_STATUS_DONE;
+		}
+	}
+	*Consumed = i;
+	return PNG_STATUS_NEED_MORE;
+}
+
+/*
+ * Push the next piece of a stream into the parser. Unlike processBuffer()
+ * it stops right after IEND and reports how many bytes were used, so one
+ * event loop can drive many streams at once.
+ * Returns PNG_STATUS_NEED_MORE, PNG_STATUS_DONE once the file is complete
+ * and valid, or PNG_STATUS_ERROR with the reason in pngGetError()
+ */
+int pngPush( PNGData* PNG, const unsigned char *Data, size_t DataLength, size_t *Consumed ) {
+	int status;
+	if (PNG->trace)
+		resumeChunkTrace( PNG->trace );
+	status = pushData( PNG, Data, DataLength, Consumed );
+	if (PNG->trace)
+		pauseChunkTrace( PNG->trace );
+	return status;
+}
+
 /*
  * Finish the Processing of the File
  */
 int processFinish( PNGData* PNG ) {
+	/*pngPush() has already checked the last chunks*/
+	if ( PNG->State == PROCESS_DONE )
+		return TRUE;
 	/*Process state should be waitingfor another chunk*/
 	if ( ( PNG->State != PROCESS_CHUNK_HEADER ) ||	PNG->bytesCopied) {
-		printf( "MISSING CHUNK HEADER\n" );
+		reportError( &PNG->chunkInfo, PNG_ERROR_TRUNCATED, "MISSING CHUNK HEADER\n" );
 		return FALSE;
 	}
 	/*Process Last chunk*/
-	return processLastChunk( &PNG->chunkInfo);
+	if ( !processLastChunk( &PNG->chunkInfo ) )
+		return FALSE;
+	return finishAnimationIndex( PNG );
 }
 
 /*
@@ -208,69 +605,89 @@ int isChunkType(const unsigned char *ChunkType, const char *ChunkString) {
  */
 int processChunk( ChunkInfo *cInfo, const Chunk *chunk ) {
 	if ( !isValidChunkOrder( cInfo, chunk )) {
-		printf( "INVALID CHUNK ORDER\n" );
+		reportError( cInfo, PNG_ERROR_CHUNK_ORDER, "INVALID CHUNK ORDER\n" );
 		return FALSE;
 	}
 
 	if (isChunkType(chunk->chunkType, "IHDR")) {
-		if (!processIHDRChunk(chunk, &cInfo->colorType))
+		if (!processIHDRChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "IDAT"))	{
-		processGenericChunk(chunk);
+		processGenericChunk(cInfo, chunk);
 	}
 	else if (isChunkType(chunk->chunkType, "IEND"))	{
-		if (!processIENDChunk(chunk))
+		if (!processIENDChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "tIME"))	{
-		if (!processTIMEChunk(chunk))
+		if (!processTIMEChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "cHRM"))	{
-		if (!processCHRMChunk(chunk))
+		if (!processCHRMChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "gAMA"))	{
-		if (!processGAMAChunk(chunk))
+		if (!processGAMAChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "tEXt"))	{
-		if (!processTEXTChunk(chunk))
+		if (!processTEXTChunk(cInfo, chunk))
+			return FALSE;
+	}
+	else if (isChunkType(chunk->chunkType, "zTXt"))	{
+		if (!processZTXTChunk(cInfo, chunk))
+			return FALSE;
+	}
+	else if (isChunkType(chunk->chunkType, "iTXt"))	{
+		if (!processITXTChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "bKGD"))	{
-		if (!processBKGDChunk(chunk, cInfo->colorType))
+		if (!processBKGDChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "pHYs")) {
-		if (!processPHYSChunk(chunk))
+		if (!processPHYSChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "PLTE"))	{
-		if (!processPLTEChunk(chunk))
+		if (!processPLTEChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "iCCP")) {
-		if (!processICCPChunk(chunk))
+		if (!processICCPChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "sRGB"))	{
-		if (!processSRGBChunk(chunk))
+		if (!processSRGBChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (isChunkType(chunk->chunkType, "sBIT")) {
-		if (!processSBITChunk(chunk, cInfo->colorType))
+		if (!processSBITChunk(cInfo, chunk))
+			return FALSE;
+	}
+	else if (isChunkType(chunk->chunkType, "acTL")) {
+		if (!processACTLChunk(cInfo, chunk))
+			return FALSE;
+	}
+	else if (isChunkType(chunk->chunkType, "fcTL")) {
+		if (!processFCTLChunk(cInfo, chunk))
+			return FALSE;
+	}
+	else if (isChunkType(chunk->chunkType, "fdAT")) {
+		if (!processFDATChunk(cInfo, chunk))
 			return FALSE;
 	}
 	else if (!(chunk->chunkType[0] & (1u << 5)))
 	{
 		/* unknown critical chunk */
-		printf("UNKNOWN CRITICAL CHUNK\n");
+		reportError(cInfo, PNG_ERROR_UNKNOWN_CRITICAL, "UNKNOWN CRITICAL CHUNK\n");
 		return FALSE;
 	}
 	else
-		processGenericChunk(chunk);
+		processGenericChunk(cInfo, chunk);
 
 	return TRUE;
 }
@@ -283,17 +700,17 @@ int processLastChunk( ChunkInfo *cInfo ) {
 	int processed = FALSE;
 	/* last chunk should be IEND */
 	if ( !cInfo->lastChunkIEND ) {
-		printf( "IEND CHUNK SHOULD BE THE LAST CHUNK\n" );
+		reportError( cInfo, PNG_ERROR_MISSING_IEND, "IEND CHUNK SHOULD BE THE LAST CHUNK\n" );
 		return processed;
 	}
 	/* colorType 3 required for PLTE chunk*/
 	if ((cInfo->colorType == 3) && !cInfo->PLTE) {
-		printf("PLTE CHUNK SHOULD HAVE COLOR TYPE 3\n");
+		reportError(cInfo, PNG_ERROR_PALETTE, "PLTE CHUNK SHOULD HAVE COLOR TYPE 3\n");
 		return processed;
 	}
 	/*ColorType 0 or 4 should not be there for PLTE chunk*/
 	if (((cInfo->colorType == 0) || (cInfo->colorType == 4)) && cInfo->PLTE) {
-		printf("PLTE CHUNK SHOULDN'T HAVE FOR COLOR TYPE 0 AND 4\n");
+		reportError(cInfo, PNG_ERROR_PALETTE, "PLTE CHUNK SHOULDN'T HAVE FOR COLOR TYPE 0 AND 4\n");
 		return processed;
 	}
 	processed = TRUE;
@@ -437,6 +854,18 @@ int isValidChunkOrder(ChunkInfo *cInfo, const Chunk *chunk) {
 			return FALSE;
 		}
 	}
+	else if (isChunkType(chunk->chunkType, "acTL"))	{
+		if (cInfo->IHDR == TRUE && cInfo->ACTL == FALSE && cInfo->IDAT == FALSE) {
+			cInfo->ACTL = TRUE;
+		}
+		else {
+			return FALSE;
+		}
+	}
+	else if (isChunkType(chunk->chunkType, "fdAT"))	{
+		if (cInfo->IHDR == FALSE || cInfo->IDAT == FALSE)
+			return FALSE;
+	}
 	else {
 		if (cInfo->IHDR == FALSE)
 			return FALSE;
@@ -444,10 +873,10 @@ int isValidChunkOrder(ChunkInfo *cInfo, const Chunk *chunk) {
 	return TRUE;
 }
 
-int processIENDChunk(const Chunk *chunk) {
+int processIENDChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	if (chunk->dataSize)
 	{
-		fputs("IEND CHUNK LENGTH SHOULD BE 0.\n", stderr);
+		printError(cInfo, "IEND CHUNK LENGTH SHOULD BE 0.\n");
 		return FALSE;
 	}
 	return TRUE;
@@ -456,28 +885,32 @@ int processIENDChunk(const Chunk *chunk) {
 /*
  * Process the generic chunk type and print
  */
-void processGenericChunk(const Chunk *chunk) {
+void processGenericChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	const size_t limitSize = 20;
 	int IsPrintLimit = chunk->dataSize > limitSize;
 	size_t PrintBytes = (IsPrintLimit ? limitSize : chunk->dataSize);
 	size_t i = 0;
 
-	printf("RAW DATA ");
-	for (; i < CHUNK_TYPE_LENGTH; i++)
-		printf("%c", chunk->chunkType[i]);
+	if (cInfo->quiet)
+		return;
+	appendText(cInfo, "RAW DATA ", 9);
+	appendText(cInfo, (const char *) chunk->chunkType, CHUNK_TYPE_LENGTH);
 	if (chunk->dataSize)
-		printf(":");
-	for (i = 0; i < PrintBytes; i++)
-		printf(" %.2x", chunk->Data[i]);
+		appendText(cInfo, ":", 1);
+	for (i = 0; i < PrintBytes; i++) {
+		appendText(cInfo, " ", 1);
+		appendHex(cInfo, chunk->Data[i]);
+	}
 	if (IsPrintLimit)
-		printf(" ...");
-	printf("\n");
+		appendText(cInfo, " ...", 4);
+	appendText(cInfo, "\n", 1);
+	flushOutput(cInfo);
 }
 
 /*
  * process chunk type IHDR
  */
-int processIHDRChunk(const Chunk *chunk, unsigned int *ColorTypePtr ) {
+int processIHDRChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	unsigned char bitDepth;
 	unsigned char colorType;
 	unsigned char compressionMethod;
@@ -487,14 +920,14 @@ int processIHDRChunk(const Chunk *chunk, unsigned int *ColorTypePtr ) {
 	unsigned int height;
 	const char* imgType;
 	if (chunk->dataSize != IHDR_DATA_LENGTH) {
-		fputs("IMAGE HEADER DISTORTED.\n", stderr);
+		printError(cInfo, "IMAGE HEADER DISTORTED.\n");
 		return FALSE;
 	}
 
 	width = getLastByte(chunk->Data);
 	height = getLastByte(chunk->Data + 4);
 	if (width == 0 || height == 0 || width > PNG_MAX_VALUE || height > PNG_MAX_VALUE) {
-		fputs("IMAGE RESOLUTION DISTORTED.\n", stderr);
+		printError(cInfo, "IMAGE RESOLUTION DISTORTED.\n");
 		return FALSE;
 	}
 	bitDepth = chunk->Data[8];
@@ -507,7 +940,7 @@ int processIHDRChunk(const Chunk *chunk, unsigned int *ColorTypePtr ) {
 	if (bitDepth != 0x01 && bitDepth != 0x02
 			&& bitDepth != 0x04 && bitDepth != 0x08
 			&& bitDepth != 0x10) {
-		fputs("BIT DEPTH INVALID.\n", stderr);
+		printError(cInfo, "BIT DEPTH INVALID.\n");
 		return FALSE;
 	}
 
@@ -515,7 +948,7 @@ int processIHDRChunk(const Chunk *chunk, unsigned int *ColorTypePtr ) {
 	if (colorType != 0x00 && colorType != 0x02
 			&& colorType != 0x03 && colorType != 0x04
 			&& colorType != 0x06) {
-		fputs("COLOR TYPE INVALID.\n", stderr);
+		printError(cInfo, "COLOR TYPE INVALID.\n");
 		return FALSE;
 	}
 
@@ -523,14 +956,14 @@ int processIHDRChunk(const Chunk *chunk, unsigned int *ColorTypePtr ) {
 	if (colorType == 0x02 || colorType == 0x04
 			|| colorType == 0x06) {
 		if (bitDepth != 0x08 && bitDepth != 0x10) {
-			fputs("BIT DEPTH INVALID FOR THIS COLOR TYPE.\n", stderr);
+			printError(cInfo, "BIT DEPTH INVALID FOR THIS COLOR TYPE.\n");
 			return FALSE;
 		}
 	}
 
 	if (colorType == 0x03) {
 		if (bitDepth == 0x10){
-			fputs("BIT DEPTH INVALID FOR THIS COLOR TYPE.\n", stderr);
+			printError(cInfo, "BIT DEPTH INVALID FOR THIS COLOR TYPE.\n");
 			return FALSE;
 		}
 	}
@@ -539,23 +972,23 @@ int processIHDRChunk(const Chunk *chunk, unsigned int *ColorTypePtr ) {
 
 
 	if (compressionMethod != 0x00) {
-		fputs("UNKNOWN COMPRESSION METHOD, ONLY 0 ALLOWED.\n", stderr);
+		printError(cInfo, "UNKNOWN COMPRESSION METHOD, ONLY 0 ALLOWED.\n");
 		return FALSE;
 	}
 
 
 	if (filterMethod != 0x00) {
-		fputs("UNKNOWN FILTER METHOD, ONLY 0 ALLOWED.\n", stderr);
+		printError(cInfo, "UNKNOWN FILTER METHOD, ONLY 0 ALLOWED.\n");
 		return FALSE;
 	}
 
 
 	if (interlaceMethod != 0x00 && interlaceMethod != 0x01) {
-		fputs("UNKNOWN INTERLACE METHOD, ONLY 0 AND 1 ARE ALLOWED.\n", stderr);
+		printError(cInfo, "UNKNOWN INTERLACE METHOD, ONLY 0 AND 1 ARE ALLOWED.\n");
 		return FALSE;
 	}
 
-	printf("SIZE OF IMAGE IS %u x %u PIXELS.\n", width, height);
+	printInfo(cInfo, "SIZE OF IMAGE IS %u x %u PIXELS.\n", width, height);
 
 	switch (colorType) {
 	case 0x00:
@@ -576,14 +1009,18 @@ int processIHDRChunk(const Chunk *chunk, unsigned int *ColorTypePtr ) {
 	default:
 		return FALSE;
 	}
-	printf("COLOR TYPE : %s\n", imgType);
-	*ColorTypePtr = colorType;
+	printInfo(cInfo, "COLOR TYPE : %s\n", imgType);
+	cInfo->colorType = colorType;
+	cInfo->width = width;
+	cInfo->height = height;
+	cInfo->bitDepth = bitDepth;
+	cInfo->interlace = interlaceMethod;
 	return TRUE;
 }
 /*
  * process chunk type tIME
  */
-int processTIMEChunk(const Chunk *chunk) {
+int processTIMEChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	unsigned int year;
 	unsigned int month;
 	unsigned int day;
@@ -592,7 +1029,7 @@ int processTIMEChunk(const Chunk *chunk) {
 	unsigned int second;
 
 	if (chunk->dataSize != TIME_DATA_LENGTH) {
-		fputs("tIME CHUNK LENGTH INVALID.\n", stderr);
+		printError(cInfo, "tIME CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 
@@ -607,17 +1044,17 @@ int processTIMEChunk(const Chunk *chunk) {
 			(hour > 23) ||
 			(minute > 59) ||
 			(second > 60)) {
-		fputs("INVALID TIME.\n", stderr);
+		printError(cInfo, "INVALID TIME.\n");
 		return FALSE;
 	}
 
-	printf("LAST MODIFIED TIME: %u.%u.%u %02u:%02u:%02u\n", day, month, year, hour, minute, second);
+	printInfo(cInfo, "LAST MODIFIED TIME: %u.%u.%u %02u:%02u:%02u\n", day, month, year, hour, minute, second);
 	return TRUE;
 }
 /*
  * process chunk type cHRM
  */
-int processCHRMChunk(const Chunk *chunk) {
+int processCHRMChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 
 	unsigned int white_x;
 	unsigned int white_y;
@@ -630,7 +1067,7 @@ int processCHRMChunk(const Chunk *chunk) {
 	const double scale = 100000.0;
 
 	if(chunk->dataSize != CHRM_DATA_LENGTH)	{
-		fputs("cHRM CHUNK LENGTH INVALID.\n",stderr);
+		printError(cInfo, "cHRM CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 
@@ -643,89 +1080,155 @@ int processCHRMChunk(const Chunk *chunk) {
 	blue_x=getLastByte(chunk->Data+24);
 	blue_y=getLastByte(chunk->Data+28);
 
-	printf("PRIMARY CHROMATICITIES:\n");
-	printf("\tWhite x is %.2lf White y is %.2lf\n", white_x / scale, white_y / scale);
-	printf("\tRed x is %.2lf Red y is %.2lf\n", red_x / scale, red_y / scale);
-	printf("\tGreen x is %.2lf Green y is %.2lf\n", green_x / scale, green_y / scale);
-	printf("\tBlue x is %.2lf Blue y is %.2lf\n", blue_x / scale, blue_y / scale);
+	printInfo(cInfo, "PRIMARY CHROMATICITIES:\n");
+	printInfo(cInfo, "\tWhite x is %.2lf White y is %.2lf\n", white_x / scale, white_y / scale);
+	printInfo(cInfo, "\tRed x is %.2lf Red y is %.2lf\n", red_x / scale, red_y / scale);
+	printInfo(cInfo, "\tGreen x is %.2lf Green y is %.2lf\n", green_x / scale, green_y / scale);
+	printInfo(cInfo, "\tBlue x is %.2lf Blue y is %.2lf\n", blue_x / scale, blue_y / scale);
 	return TRUE;
 }
 /*
  * process chunk type gAMA
  */
-int processGAMAChunk(const Chunk *chunk) {
+int processGAMAChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	unsigned int gama;
 	const double scale = 100000.0;
 	if(chunk->dataSize != GAMA_DATA_LENGTH)	{
-		fputs("gAMA CHUNK LENGTH INVALID.\n",stderr);
+		printError(cInfo, "gAMA CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 	gama = getLastByte(chunk->Data);
 	if (gama == 0 || gama > PNG_MAX_VALUE)	{
-		fputs("gAMA CHUNK VALUE INVALID.\n", stderr);
+		printError(cInfo, "gAMA CHUNK VALUE INVALID.\n");
 		return FALSE;
 	}
-	printf("gAMA: \n\t%.5lf\n", gama / scale);
+	printInfo(cInfo, "gAMA: \n\t%.5lf\n", gama / scale);
 	return TRUE;
 }
 /*
  * process chunk type tEXt
  */
-int processTEXTChunk(const Chunk *chunk) {
+int processTEXTChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 
 	unsigned int keyword_length;
 	const unsigned int null_length = 1;
 	unsigned int text_length;
-	unsigned int index;
 
 	const unsigned char *NullBytePtr = memchr(chunk->Data, 0x00, chunk->dataSize);
 	if (!NullBytePtr) {
-		fputs("tEXt CHUNK INVALID.\n", stderr);
+		printError(cInfo, "tEXt CHUNK INVALID.\n");
 		return FALSE;
 	}
 	keyword_length = NullBytePtr - chunk->Data;
 	text_length = chunk->dataSize - (keyword_length + null_length);
 	if (memchr(NullBytePtr + null_length, 0x00, text_length)) {
-		fputs("tEXt CHUNK INVALID.\n", stderr);
+		printError(cInfo, "tEXt CHUNK INVALID.\n");
 		return FALSE;
 	}
 
 	if(keyword_length > TEXT_DATA_KEY_LENGTH_MAX || keyword_length < 1) {
-		fputs("tEXt CHUNK LENGTH INVALID.\n",stderr);
+		printError(cInfo, "tEXt CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 
-	printf("%s: ",chunk->Data);
-	for (index = null_length + keyword_length; index < chunk->dataSize; index++)
-		printf("%c",chunk->Data[index]);
-	printf("\n");
+	if (cInfo->quiet)
+		return TRUE;
+	appendText(cInfo, (const char *) chunk->Data, keyword_length);
+	appendText(cInfo, ": ", 2);
+	appendText(cInfo, (const char *) NullBytePtr + null_length, text_length);
+	appendText(cInfo, "\n", 1);
+	flushOutput(cInfo);
+	return TRUE;
+}
+/*
+ * Keyword of a text chunk: 1 to 79 Latin-1 characters followed by a null
+ */
+static const unsigned char *getTextKeywordEnd(const Chunk *chunk) {
+	const unsigned char *NullBytePtr = memchr(chunk->Data, 0x00, chunk->dataSize);
+	if (!NullBytePtr || NullBytePtr == chunk->Data ||
+			NullBytePtr - chunk->Data > TEXT_DATA_KEY_LENGTH_MAX)
+		return NULL;
+	return NullBytePtr;
+}
+/*
+ * process chunk type zTXt, the text stays compressed until it is asked for
+ */
+int processZTXTChunk(ChunkInfo *cInfo, const Chunk *chunk) {
+	const unsigned char *NullBytePtr = getTextKeywordEnd(chunk);
+	unsigned int compressed_length;
+	if (!NullBytePtr) {
+		printError(cInfo, "zTXt CHUNK INVALID.\n");
+		return FALSE;
+	}
+	compressed_length = chunk->dataSize - (NullBytePtr + 1 - chunk->Data);
+	if (compressed_length <= ZTXT_HEADER_LENGTH) {
+		printError(cInfo, "zTXt DATA LENGTH INVALID.\n");
+		return FALSE;
+	}
+	if (NullBytePtr[1] != 0) {
+		printError(cInfo, "zTXt DATA COMPRESSION METHOD INVALID.\n");
+		return FALSE;
+	}
+	printInfo(cInfo, "%s: COMPRESSED TEXT %u BYTES\n", chunk->Data, compressed_length - ZTXT_HEADER_LENGTH);
+	return TRUE;
+}
+/*
+ * process chunk type iTXt
+ */
+int processITXTChunk(ChunkInfo *cInfo, const Chunk *chunk) {
+	const unsigned char *NullBytePtr = getTextKeywordEnd(chunk);
+	const unsigned char *End = chunk->Data + chunk->dataSize;
+	const unsigned char *Language;
+	const unsigned char *Translated;
+	const unsigned char *Text;
+	if (!NullBytePtr || End - NullBytePtr <= ITXT_HEADER_LENGTH) {
+		printError(cInfo, "iTXt CHUNK INVALID.\n");
+		return FALSE;
+	}
+	if (NullBytePtr[1] > 1 || NullBytePtr[2] != 0) {
+		printError(cInfo, "iTXt DATA COMPRESSION METHOD INVALID.\n");
+		return FALSE;
+	}
+	Language = NullBytePtr + 1 + ITXT_HEADER_LENGTH;
+	Translated = memchr(Language, 0x00, End - Language);
+	Text = Translated ? memchr(Translated + 1, 0x00, End - Translated - 1) : NULL;
+	if (!Text) {
+		printError(cInfo, "iTXt CHUNK INVALID.\n");
+		return FALSE;
+	}
+	Text++;
+	if (NullBytePtr[1])
+		printInfo(cInfo, "%s: COMPRESSED TEXT %u BYTES\n", chunk->Data, (unsigned int) (End - Text));
+	else
+		printInfo(cInfo, "%s: %.*s\n", chunk->Data, (int) (End - Text), (const char *) Text);
 	return TRUE;
 }
 /*
  * process chunk type bKGD
  */
-int processBKGDChunk(const Chunk *chunk, unsigned int ColorType) {
+int processBKGDChunk(ChunkInfo *cInfo, const Chunk *chunk) {
+	unsigned int ColorType = cInfo->colorType;
 
 	if (((ColorType == 0 || ColorType == 4) && (chunk->dataSize != BKGD_TYPE_0_AND_4_DATA_LENGTH)) ||
 			((ColorType == 2 || ColorType == 6) && (chunk->dataSize != BKGD_TYPE_2_AND_6_DATA_LENGTH)) ||
 			((ColorType == 3) && (chunk->dataSize != BKGD_TYPE_3_DATA_LENGTH)))	{
-		fputs("bKGD CHUNK LENGTH INVALID.\n", stderr);
+		printError(cInfo, "bKGD CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 
 	if (chunk->dataSize == BKGD_TYPE_0_AND_4_DATA_LENGTH) {
 		unsigned int greyScale = getLastWord(chunk->Data);
-		printf("BACKGROUND:\n\tGrey Scale:%u\n",greyScale);
+		printInfo(cInfo, "BACKGROUND:\n\tGrey Scale:%u\n",greyScale);
 	}
 	else if (chunk->dataSize == BKGD_TYPE_2_AND_6_DATA_LENGTH) {
 		unsigned int Red = getLastWord(chunk->Data);
 		unsigned int Green = getLastWord(chunk->Data + 2);
 		unsigned int Blue = getLastWord(chunk->Data + 4);
-		printf("BACKGROUND:\n\tRed:%u\n\tGreen:%u\n\tBlue:%u\n",Red,Green,Blue);
+		printInfo(cInfo, "BACKGROUND:\n\tRed:%u\n\tGreen:%u\n\tBlue:%u\n",Red,Green,Blue);
 	}
 	else if (chunk->dataSize == BKGD_TYPE_3_DATA_LENGTH) {
 		unsigned int Palette_index = chunk->Data[0];
-		printf("BACKGROUND:\n\tPalette index:%u\n",Palette_index);
+		printInfo(cInfo, "BACKGROUND:\n\tPalette index:%u\n",Palette_index);
 	}
 	return TRUE;
 
@@ -733,60 +1236,68 @@ int processBKGDChunk(const Chunk *chunk, unsigned int ColorType) {
 /*
  * process chunk type pHYs
  */
-int processPHYSChunk(const Chunk *chunk) {
+int processPHYSChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	unsigned int x;
 	unsigned int y;
 	unsigned int unit;
 
 	if (chunk->dataSize != PHY_DATA_LENGTH)	{
-		fputs("pHYs CHUNK LENGTH INVALID.\n", stderr);
+		printError(cInfo, "pHYs CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 
 	x = getLastByte(chunk->Data);
 	y = getLastByte(chunk->Data+4);
 	if (x > PNG_MAX_VALUE || y > PNG_MAX_VALUE) {
-		fputs("pHYs CHUNK DATA INVALID.\n", stderr);
+		printError(cInfo, "pHYs CHUNK DATA INVALID.\n");
 		return FALSE;
 	}
 
 	unit = chunk->Data[8];
 	if ((unit != 1) && (unit != 0))	{
-		fputs("pHYs CHUNK DATA INVALID.\n", stderr);
+		printError(cInfo, "pHYs CHUNK DATA INVALID.\n");
 		return FALSE;
 	}
 
 	if (unit == 1)
-		printf("PHYSIC:\n\tPixels per units in x axis %u\n\tPixels per units in y axis %u\n\tUnit value is the metre\n",x,y);
+		printInfo(cInfo, "PHYSIC:\n\tPixels per units in x axis %u\n\tPixels per units in y axis %u\n\tUnit value is the metre\n",x,y);
 	else
-		printf("Physic:\n\tPixels per units in x axis %u\n\tPixels per units in y axis %u\n\tUnit value unknown\n",x,y);
+		printInfo(cInfo, "Physic:\n\tPixels per units in x axis %u\n\tPixels per units in y axis %u\n\tUnit value unknown\n",x,y);
 
 	return TRUE;
 }
 /*
  * process chunk type PLTE
  */
-int processPLTEChunk(const Chunk *chunk) {
+int processPLTEChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	unsigned int index;
 	unsigned int size = chunk->dataSize / 3;
 
 	if ((chunk->dataSize == 0 ) || ((chunk->dataSize % 3) != 0) || ((chunk->dataSize / 3) > PLTE_DATA_LENGTH)) {
-		fputs("PLTE CHUNK LENGTH INVALID.\n", stderr);
+		printError(cInfo, "PLTE CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
-	printf("PLTE data:\n");
+	if (cInfo->quiet)
+		return TRUE;
+	appendText(cInfo, "PLTE data:\n", 11);
 	for(index = 0; index < size; index++){
-		unsigned int r = chunk->Data[0 + index * 3];
-		unsigned int g = chunk->Data[1 + index * 3];
-		unsigned int b = chunk->Data[2 + index * 3];
-		printf("PALETTE INDEX %u:\tR:\t%u\tG:\t%u\tB:\t%u\n",(unsigned int)index,r,g,b);
-	}
+		appendText(cInfo, "PALETTE INDEX ", 14);
+		appendDecimal(cInfo, index);
+		appendText(cInfo, ":\tR:\t", 5);
+		appendDecimal(cInfo, chunk->Data[0 + index * 3]);
+		appendText(cInfo, "\tG:\t", 4);
+		appendDecimal(cInfo, chunk->Data[1 + index * 3]);
+		appendText(cInfo, "\tB:\t", 4);
+		appendDecimal(cInfo, chunk->Data[2 + index * 3]);
+		appendText(cInfo, "\n", 1);
+	}
+	flushOutput(cInfo);
 	return TRUE;
 }
 /*
  * process chunk type iCCP
  */
-int processICCPChunk(const Chunk *chunk) {
+int processICCPChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	unsigned int profile_name_length;
 	unsigned int index;
 	unsigned int compressed_length;
@@ -794,33 +1305,33 @@ int processICCPChunk(const Chunk *chunk) {
 	unsigned int compression_method;
 	const unsigned char *NullBytePtr = memchr(chunk->Data, 0x00, chunk->dataSize);
 	if (!NullBytePtr) {
-		fputs("iCCP CHUNK INVALID.\n", stderr);
+		printError(cInfo, "iCCP CHUNK INVALID.\n");
 		return FALSE;
 	}
 	profile_name_length = NullBytePtr - chunk->Data;
 	if ((profile_name_length < 1) || (profile_name_length > 79)) {
-		fputs("iCCP PROFILE NAME LENGTH INVALID.\n", stderr);
+		printError(cInfo, "iCCP PROFILE NAME LENGTH INVALID.\n");
 		return FALSE;
 	}
 
 	for (index = 0; index < profile_name_length; index++) {
 		if (((32 <= chunk->Data[index]) && (chunk->Data[index] <= 126)) || ((161 <= chunk->Data[index]))) {}
 		else{
-			fputs("iCCP PROFILE TEXT INVALID.\n", stderr);
+			printError(cInfo, "iCCP PROFILE TEXT INVALID.\n");
 			return FALSE;
 		}
 	}
 
 
 	if ((chunk->Data[0] == ' ') || (chunk->Data[profile_name_length - 1] == ' ')) {
-		fputs("iCCP PROFILE TEXT INVALID.\n", stderr);
+		printError(cInfo, "iCCP PROFILE TEXT INVALID.\n");
 		return FALSE;
 	}
 
 
 	for (index = 0; index < profile_name_length - 1; index++) {
 		if ((chunk->Data[index] == ' ') && (chunk->Data[index+1] == ' ')) {
-			fputs("iCCP PROFILE TEXT INVALID.\n", stderr);
+			printError(cInfo, "iCCP PROFILE TEXT INVALID.\n");
 			return FALSE;
 		}
 	}
@@ -828,58 +1339,66 @@ int processICCPChunk(const Chunk *chunk) {
 	compressed_data = chunk->Data + profile_name_length + 1;
 	compressed_length = chunk->dataSize - (profile_name_length + 1);
 	if (compressed_length < 1) {
-		fputs("iCCP DATA LENGTH INVALID.\n", stderr);
+		printError(cInfo, "iCCP DATA LENGTH INVALID.\n");
 		return FALSE;
 	}
 	compression_method = chunk->Data[profile_name_length + 1];
 	if (compression_method != 0) {
-		fputs("iCCP DATA COMPRESSION METHOD INVALID.\n", stderr);
+		printError(cInfo, "iCCP DATA COMPRESSION METHOD INVALID.\n");
 		return FALSE;
 	}
 
-	printf("iCCP DATA:\n");
+	/*the profile is only inflated on request, a quiet scan skips the dump*/
+	if (cInfo->quiet)
+		return TRUE;
+	appendText(cInfo, "iCCP DATA:\n", 11);
 
-	printf("\tPROFILE NAME:%s\n", chunk->Data);
+	appendText(cInfo, "\tPROFILE NAME:", 14);
+	appendText(cInfo, (const char *) chunk->Data, profile_name_length);
+	appendText(cInfo, "\n", 1);
 
-	printf("\tCOMPRESSION METHOD (0=zlib):%u\n",compression_method);
+	appendText(cInfo, "\tCOMPRESSION METHOD (0=zlib):", 29);
+	appendDecimal(cInfo, compression_method);
+	appendText(cInfo, "\n", 1);
 
-	printf("\tCOMPRESSED DATA:\n\t\t\t");
+	appendText(cInfo, "\tCOMPRESSED DATA:\n\t\t\t", 21);
 	for(index = 1; index < compressed_length; index++) {
-		printf("%.2x",compressed_data[index] );
-		if(index != 0 && index % 15 == 0)
-			printf("\n\t\t\t");
+		appendHex(cInfo, compressed_data[index]);
+		if(index % 15 == 0)
+			appendText(cInfo, "\n\t\t\t", 4);
 		else
-			printf(" ");
+			appendText(cInfo, " ", 1);
 	}
-	printf("\n");
+	appendText(cInfo, "\n", 1);
+	flushOutput(cInfo);
 	return TRUE;
 }
 /*
  * process chunk type sRGB
  */
-int processSRGBChunk(const Chunk *chunk) {
+int processSRGBChunk(ChunkInfo *cInfo, const Chunk *chunk) {
 	unsigned int intent;
 
 	if (chunk->dataSize != SRGB_DATA_LENGTH) {
-		fputs("sRGB CHUNK LENGTH INVALID.\n", stderr);
+		printError(cInfo, "sRGB CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 	intent = chunk->Data[0];
 	switch(intent) {
 	case 0:
-		printf("sRGB: Perceptual\n");
+		printInfo(cInfo, "sRGB: Perceptual\n");
 		break;
 	case 1:
-		printf("sRGB: Relative colorimetric\n");
+		printInfo(cInfo, "sRGB: Relative colorimetric\n");
 		break;
 	case 2:
-		printf("sRGB: Saturation\n");
+		printInfo(cInfo, "sRGB: Saturation\n");
 		break;
 	case 3:
-		printf("sRGB: Absolute colorimetric\n");
+		printInfo(cInfo, "sRGB: Absolute colorimetric\n");
 		break;
 	default:
-		fputs("sRGB VALUE INVALID.\n", stderr);
+		printError(cInfo, "sRGB VALUE INVALID.\n");
 		return FALSE;
 		break;
 	}
@@ -888,7 +1407,8 @@ int processSRGBChunk(const Chunk *chunk) {
 /*
  * process chunk type sBIT
  */
-int processSBITChunk(const Chunk *chunk, unsigned int ColorType) {
+int processSBITChunk(ChunkInfo *cInfo, const Chunk *chunk) {
+	unsigned int ColorType = cInfo->colorType;
 	unsigned int greyscale;
 	unsigned int r;
 	unsigned int g;
@@ -898,32 +1418,32 @@ int processSBITChunk(const Chunk *chunk, unsigned int ColorType) {
 			((ColorType == 2 || ColorType == 3) && (chunk->dataSize != SBIT_TYPE_2_AND_3_DATA_LENGTH)) ||
 			((ColorType == 4) && (chunk->dataSize != SBIT_TYPE_4_DATA_LENGTH)) ||
 			((ColorType == 6) && (chunk->dataSize != SBIT_TYPE_6_DATA_LENGTH)))	{
-		fputs("sBIT CHUNK LENGTH INVALID.\n", stderr);
+		printError(cInfo, "sBIT CHUNK LENGTH INVALID.\n");
 		return FALSE;
 	}
 
 	switch(chunk->dataSize){
 	case SBIT_TYPE_0_DATA_LENGTH:
 		greyscale = chunk->Data[0];
-		printf("sBIT:\n\tGREY SCALE %u\n",greyscale);
+		printInfo(cInfo, "sBIT:\n\tGREY SCALE %u\n",greyscale);
 		break;
 	case SBIT_TYPE_2_AND_3_DATA_LENGTH:
 		r = chunk->Data[0];
 		g = chunk->Data[1];
 		b = chunk->Data[2];
-		printf("sBIT:\n\tR: %u\tG: %u\tB: %u\n",r,g,b);
+		printInfo(cInfo, "sBIT:\n\tR: %u\tG: %u\tB: %u\n",r,g,b);
 		break;
 	case SBIT_TYPE_4_DATA_LENGTH:
 		greyscale = chunk->Data[0];
 		alpha = chunk->Data[1];
-		printf("sBIT:\n\tGREY SCALE: %u\tAlpha: %u\n",greyscale,alpha);
+		printInfo(cInfo, "sBIT:\n\tGREY SCALE: %u\tAlpha: %u\n",greyscale,alpha);
 		break;
 	case SBIT_TYPE_6_DATA_LENGTH:
 		r = chunk->Data[0];
 		g = chunk->Data[1];
 		b = chunk->Data[2];
 		alpha = chunk->Data[3];
-		printf("sBIT:\n\tR: %u\tG: %u\tB: %u\tAlpha: %u\n",r,g,b,alpha);
+		printInfo(cInfo, "sBIT:\n\tR: %u\tG: %u\tB: %u\tAlpha: %u\n",r,g,b,alpha);
 		break;
 	default:
 		return FALSE;
@@ -931,6 +1451,79 @@ int processSBITChunk(const Chunk *chunk, unsigned int ColorType) {
 	return TRUE;
 }
 
+/*
+ * process chunk type acTL
+ */
+int processACTLChunk(ChunkInfo *cInfo, const Chunk *chunk) {
+	unsigned int frames;
+	unsigned int plays;
+	if (chunk->dataSize != ACTL_DATA_LENGTH) {
+		printError(cInfo, "acTL CHUNK LENGTH INVALID.\n");
+		return FALSE;
+	}
+	frames = getLastByte(chunk->Data);
+	plays = getLastByte(chunk->Data + 4);
+	if (frames == 0 || frames > PNG_MAX_VALUE || plays > PNG_MAX_VALUE) {
+		printError(cInfo, "acTL CHUNK DATA INVALID.\n");
+		return FALSE;
+	}
+	printInfo(cInfo, "ANIMATION:\n\tFrames: %u\n\tPlays: %u\n", frames, plays);
+	return TRUE;
+}
+/*
+ * process chunk type fcTL
+ */
+int processFCTLChunk(ChunkInfo *cInfo, const Chunk *chunk) {
+	unsigned int sequence;
+	unsigned int width;
+	unsigned int height;
+	unsigned int x;
+	unsigned int y;
+	unsigned int delayNum;
+	unsigned int delayDen;
+	unsigned int disposeOp;
+	unsigned int blendOp;
+
+	if (chunk->dataSize != FCTL_DATA_LENGTH) {
+		printError(cInfo, "fcTL CHUNK LENGTH INVALID.\n");
+		return FALSE;
+	}
+	sequence = getLastByte(chunk->Data);
+	width = getLastByte(chunk->Data + 4);
+	height = getLastByte(chunk->Data + 8);
+	x = getLastByte(chunk->Data + 12);
+	y = getLastByte(chunk->Data + 16);
+	delayNum = getLastWord(chunk->Data + 20);
+	delayDen = getLastWord(chunk->Data + 22);
+	disposeOp = chunk->Data[24];
+	blendOp = chunk->Data[25];
+	if (width == 0 || height == 0 ||
+			(uint64_t) x + width > cInfo->width ||
+			(uint64_t) y + height > cInfo->height) {
+		printError(cInfo, "fcTL FRAME REGION INVALID.\n");
+		return FALSE;
+	}
+	if (disposeOp > 2 || blendOp > 1) {
+		printError(cInfo, "fcTL CHUNK DATA INVALID.\n");
+		return FALSE;
+	}
+	printInfo(cInfo, "FRAME CONTROL %u:\n\t%u x %u at %u, %u\n\tDelay %u/%u\n\tDispose %u Blend %u\n",
+			sequence, width, height, x, y, delayNum, delayDen ? delayDen : 100, disposeOp, blendOp);
+	return TRUE;
+}
+/*
+ * process chunk type fdAT
+ */
+int processFDATChunk(ChunkInfo *cInfo, const Chunk *chunk) {
+	if (chunk->dataSize <= FDAT_SEQUENCE_LENGTH) {
+		printError(cInfo, "fdAT CHUNK LENGTH INVALID.\n");
+		return FALSE;
+	}
+	printInfo(cInfo, "FRAME DATA %u: %u BYTES\n", (unsigned int) getLastByte(chunk->Data),
+			(unsigned int) (chunk->dataSize - FDAT_SEQUENCE_LENGTH));
+	return TRUE;
+}
+
 /*
  * To get the last byte of the Integer
  */
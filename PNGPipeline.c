@@ -0,0 +1,288 @@
+#include "PNGPipeline.h"
+#include "PNGBudget.h"
+#include <sched.h>
+
+/*
+ * Hand a block to the next stage, waits while the ring is full
+ */
+int pushBlock( PNGPipeline *Pipeline, BlockRing *Ring, unsigned char *Data, size_t Size ) {
+	unsigned int tail = Ring->tail;
+	while (tail - __atomic_load_n( &Ring->head, __ATOMIC_ACQUIRE ) == PIPELINE_RING_SIZE) {
+		if (__atomic_load_n( &Pipeline->stopped, __ATOMIC_ACQUIRE ))
+			return FALSE;
+		sched_yield();
+	}
+	Ring->slots[tail & ( PIPELINE_RING_SIZE - 1 )].data = Data;
+	Ring->slots[tail & ( PIPELINE_RING_SIZE - 1 )].size = Size;
+	__atomic_store_n( &Ring->tail, tail + 1, __ATOMIC_RELEASE );
+	return TRUE;
+}
+
+/*
+ * Take the next block from the previous stage, waits while the ring is empty
+ */
+int popBlock( PNGPipeline *Pipeline, BlockRing *Ring, PipelineBlock *Block ) {
+	unsigned int head = Ring->head;
+	while (head == __atomic_load_n( &Ring->tail, __ATOMIC_ACQUIRE )) {
+		if (__atomic_load_n( &Pipeline->stopped, __ATOMIC_ACQUIRE ))
+			return FALSE;
+		sched_yield();
+	}
+	*Block = Ring->slots[head & ( PIPELINE_RING_SIZE - 1 )];
+	__atomic_store_n( &Ring->head, head + 1, __ATOMIC_RELEASE );
+	return TRUE;
+}
+
+/*
+ * Record the first failure and make every stage give up
+ */
+void stopPipeline( PNGPipeline *Pipeline, int ErrorCode ) {
+	int expected = PNG_ERROR_NONE;
+	__atomic_compare_exchange_n( &Pipeline->errorCode, &expected, ErrorCode, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE );
+	__atomic_store_n( &Pipeline->stopped, TRUE, __ATOMIC_RELEASE );
+}
+
+/*
+ * Every block holds its size of the memory budget: the IDAT data taken
+ * over from the parser and the inflated pieces alike
+ */
+static void freeBlock( PipelineBlock *Block ) {
+	if (Block->data)
+		releaseMemory( Block->size );
+	free( Block->data );
+}
+
+/*
+ * Free whatever a stopped pipeline left in a ring
+ */
+static void drainRing( BlockRing *Ring ) {
+	while (Ring->head != Ring->tail) {
+		freeBlock( &Ring->slots[Ring->head & ( PIPELINE_RING_SIZE - 1 )] );
+		Ring->head++;
+	}
+}
+
+static int pushInflated( void *Context, const unsigned char *Data, size_t DataLength ) {
+	PNGPipeline *pipeline = (PNGPipeline*) Context;
+	PipelineBlock block;
+	/*an empty block would read as the end of the stream*/
+	if (!DataLength)
+		return TRUE;
+	if (!reserveMemory( DataLength, BUDGET_WAIT )) {
+		stopPipeline( pipeline, PNG_ERROR_BUDGET );
+		return FALSE;
+	}
+	block.data = (unsigned char*) malloc( DataLength );
+	block.size = DataLength;
+	if (!block.data) {
+		releaseMemory( DataLength );
+		stopPipeline( pipeline, PNG_ERROR_MEMORY );
+		return FALSE;
+	}
+	memcpy( block.data, Data, DataLength );
+	if (!pushBlock( pipeline, &pipeline->inflated, block.data, DataLength )) {
+		freeBlock( &block );
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Second stage: inflate the IDAT payloads
+ */
+static void *inflateStage( void *Context ) {
+	PNGPipeline *pipeline = (PNGPipeline*) Context;
+	PNGInflater inflater;
+	PipelineBlock block;
+
+	if (!initInflater( &inflater, BUDGET_WAIT )) {
+		stopPipeline( pipeline, inflater.errorCode ? inflater.errorCode : PNG_ERROR_MEMORY );
+		freeInflater( &inflater );
+		return NULL;
+	}
+	while (popBlock( pipeline, &pipeline->compressed, &block )) {
+		int inflated;
+		if (!block.data) {
+			if (!inflater.finished)
+				stopPipeline( pipeline, PNG_ERROR_DECODE );
+			else
+				pushBlock( pipeline, &pipeline->inflated, NULL, 0 );
+			break;
+		}
+		inflated = inflateData( &inflater, block.data, block.size, pushInflated, pipeline );
+		freeBlock( &block );
+		if (!inflated) {
+			stopPipeline( pipeline, inflater.errorCode );
+			break;
+		}
+	}
+	freeInflater( &inflater );
+	return NULL;
+}
+
+/*
+ * Last stage: reverse the filters and deliver the rows
+ */
+static void *unfilterStage( void *Context ) {
+	PNGPipeline *pipeline = (PNGPipeline*) Context;
+	PNGUnfilter unfilter;
+	PipelineBlock block;
+	int initialised = FALSE;
+
+	memset( &unfilter, 0, sizeof(unfilter) );
+	while (popBlock( pipeline, &pipeline->inflated, &block )) {
+		int unfiltered;
+		if (!initialised) {
+			/*The header was written before the first IDAT was queued*/
+			initialised = TRUE;
+			if (!initUnfilter( &unfilter, &pipeline->header, pipeline->sink, pipeline->sinkContext, BUDGET_WAIT )) {
+				freeBlock( &block );
+				stopPipeline( pipeline, unfilter.errorCode ? unfilter.errorCode : PNG_ERROR_MEMORY );
+				break;
+			}
+			unfilter.paletteEntries = pipeline->paletteEntries;
+		}
+		if (!block.data) {
+			if (!unfilter.finished)
+				stopPipeline( pipeline, PNG_ERROR_IMAGE_SIZE );
+			break;
+		}
+		unfiltered = unfilterData( &unfilter, block.data, block.size );
+		freeBlock( &block );
+		if (!unfiltered) {
+			stopPipeline( pipeline, unfilter.errorCode );
+			break;
+		}
+	}
+	freeUnfilter( &unfilter );
+	return NULL;
+}
+
+/*
+ * chunkHook of the first stage: the parser has checked the CRC, the IDAT
+ * data is passed on without a copy
+ */
+int pipelineChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	PNGPipeline *pipeline = (PNGPipeline*) Context;
+	if (__atomic_load_n( &pipeline->stopped, __ATOMIC_ACQUIRE )) {
+		reportError( &PNG->chunkInfo, pipeline->errorCode, "%s\n", pngErrorString( pipeline->errorCode ) );
+		return FALSE;
+	}
+	if (isChunkType( chunk->chunkType, "IHDR" )) {
+		if (!readImageHeader( &pipeline->header, chunk )) {
+			reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+			return FALSE;
+		}
+	}
+	else if (isChunkType( chunk->chunkType, "PLTE" )) {
+		pipeline->paletteEntries = (unsigned int) ( chunk->dataSize / 3 );
+	}
+	else if (isChunkType( chunk->chunkType, "IDAT" )) {
+		/*an empty IDAT is valid, but NULL data is the end of the stream*/
+		if (!PNG->chunkSize)
+			return TRUE;
+		if (!pushBlock( pipeline, &pipeline->compressed, PNG->chunkData, PNG->chunkSize )) {
+			reportError( &PNG->chunkInfo, pipeline->errorCode, "%s\n", pngErrorString( pipeline->errorCode ) );
+			return FALSE;
+		}
+		PNG->chunkData = NULL;
+	}
+	else if (isChunkType( chunk->chunkType, "IEND" )) {
+		if (!pushBlock( pipeline, &pipeline->compressed, NULL, 0 )) {
+			reportError( &PNG->chunkInfo, pipeline->errorCode, "%s\n", pngErrorString( pipeline->errorCode ) );
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * First stage: read the file and verify the chunks while the other stages run
+ */
+static int parseIntoPipeline( PNGPipeline *Pipeline, FILE *File, const char *FileName, int Quiet,
+		unsigned char *ReadBuffer, FileResult *Result ) {
+	PNGData PNG;
+	int parsed = TRUE;
+
+	initPNGProcess( &PNG );
+	PNG.chunkInfo.quiet = Quiet;
+	PNG.chunkHook = pipelineChunkHook;
+	PNG.hookContext = Pipeline;
+	while (parsed && !feof( File )) {
+		size_t bytesRead = fread( ReadBuffer, 1, READ_BUFFER_SIZE, File );
+		if (( bytesRead != READ_BUFFER_SIZE ) && !feof( File )) {
+			reportError( &PNG.chunkInfo, PNG_ERROR_IO, "\nCAN'T READ FILE: %s\n", FileName );
+			parsed = FALSE;
+			break;
+		}
+		Result->bytesRead += bytesRead;
+		parsed = processBuffer( &PNG, ReadBuffer, bytesRead );
+	}
+	if (parsed)
+		parsed = processFinish( &PNG );
+	freePNGData( &PNG );
+	if (!parsed)
+		stopPipeline( Pipeline, pngGetError( &PNG ) );
+
+	pthread_join( Pipeline->inflateThread, NULL );
+	pthread_join( Pipeline->unfilterThread, NULL );
+	Result->errorCode = pngGetError( &PNG );
+	if (!Result->errorCode && Pipeline->errorCode) {
+		/*A later stage failed after the last chunk was read*/
+		reportError( &PNG.chunkInfo, Pipeline->errorCode, "%s\n", pngErrorString( Pipeline->errorCode ) );
+		Result->errorCode = Pipeline->errorCode;
+		parsed = FALSE;
+	}
+	drainRing( &Pipeline->compressed );
+	drainRing( &Pipeline->inflated );
+	return parsed;
+}
+
+/*
+ * Decode one file on three threads: this one reads and verifies the chunks,
+ * the others inflate and unfilter. Rows are delivered to the sink from the
+ * unfilter thread
+ */
+int decodeFilePipelined( const char *FileName, int Quiet, RowSink Sink, void *Context, FileResult *Result ) {
+	PNGPipeline *pipeline;
+	unsigned char *readBuffer;
+	FILE *File;
+
+	Result->fileName = FileName;
+	Result->trace = NULL;
+	Result->parsed = FALSE;
+	Result->errorCode = PNG_ERROR_NONE;
+	Result->bytesRead = 0;
+	File = fopen( FileName, "rb" );
+	if (!File) {
+		if (!Quiet)
+			printf( "Cannot open file %s\n", FileName );
+		Result->errorCode = PNG_ERROR_IO;
+		return FALSE;
+	}
+	readBuffer = (unsigned char*) malloc( READ_BUFFER_SIZE );
+	pipeline = (PNGPipeline*) calloc( 1, sizeof(PNGPipeline) );
+	if (readBuffer && pipeline) {
+		pipeline->sink = Sink;
+		pipeline->sinkContext = Context;
+		if (pthread_create( &pipeline->inflateThread, NULL, inflateStage, pipeline )) {
+			Result->errorCode = PNG_ERROR_INTERNAL;
+		}
+		else if (pthread_create( &pipeline->unfilterThread, NULL, unfilterStage, pipeline )) {
+			stopPipeline( pipeline, PNG_ERROR_INTERNAL );
+			pthread_join( pipeline->inflateThread, NULL );
+			drainRing( &pipeline->compressed );
+			Result->errorCode = PNG_ERROR_INTERNAL;
+		}
+		else {
+			Result->parsed = parseIntoPipeline( pipeline, File, FileName, Quiet, readBuffer, Result );
+		}
+	}
+	else {
+		Result->errorCode = PNG_ERROR_MEMORY;
+	}
+	free( readBuffer );
+	free( pipeline );
+	fclose( File );
+	return Result->parsed;
+}
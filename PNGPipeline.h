@@ -0,0 +1,62 @@
+/*
+ * PNGPipeline.h
+ *
+ *  Decode a single image with reading/CRC, inflate and unfilter running
+ *  on separate threads
+ */
+
+#ifndef PNGPIPELINE_H_
+#define PNGPIPELINE_H_
+
+#include "PNGDecode.h"
+#include <pthread.h>
+
+#define PIPELINE_RING_SIZE	64	//power of 2
+#define CACHE_LINE_SIZE		64
+
+/*
+ * Piece of data handed from one stage to the next, NULL data ends the stream
+ */
+struct pipelineBlock {
+	unsigned char	*data;
+	size_t			size;
+};
+
+typedef struct pipelineBlock PipelineBlock;
+
+/*
+ * Lock free ring with exactly one producer and one consumer thread
+ */
+struct blockRing {
+	PipelineBlock	slots[PIPELINE_RING_SIZE];
+	unsigned int	head __attribute__((aligned(CACHE_LINE_SIZE))); //next slot to read, owned by the consumer
+	unsigned int	tail __attribute__((aligned(CACHE_LINE_SIZE))); //next slot to write, owned by the producer
+};
+
+typedef struct blockRing BlockRing;
+
+/*
+ * State shared by the three stages
+ */
+struct pngPipeline {
+	BlockRing		compressed; //IDAT payloads, reader to inflater
+	BlockRing		inflated; //scanlines, inflater to unfilter
+	ImageHeader		header; //written by the reader before the first IDAT
+	unsigned int	paletteEntries; //of PLTE, written like the header
+	RowSink			sink;
+	void			*sinkContext;
+	int				errorCode; //first failure of any stage
+	int				stopped; //set on failure, every stage gives up
+	pthread_t		inflateThread;
+	pthread_t		unfilterThread;
+};
+
+typedef struct pngPipeline PNGPipeline;
+
+int pushBlock(PNGPipeline*, BlockRing*, unsigned char*, size_t);
+int popBlock(PNGPipeline*, BlockRing*, PipelineBlock*);
+void stopPipeline(PNGPipeline*, int);
+int pipelineChunkHook(PNGData*, const Chunk*, void*);
+int decodeFilePipelined(const char*, int, RowSink, void*, FileResult*);
+
+#endif /* PNGPIPELINE_H_ */
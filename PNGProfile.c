@@ -0,0 +1,229 @@
+#include "PNGProfile.h"
+#include "PNGReader.h"
+#include "PNGBudget.h"
+#include "crc.h"
+
+/*
+ * Process wide cache, the buckets hold chains of profiles with the same
+ * low key bits
+ */
+static IccProfile *profileBuckets[PROFILE_CACHE_BUCKETS];
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static ProfileCacheStats profileStats;
+
+static void getSignature( char *Signature, const unsigned char *Data ) {
+	memcpy( Signature, Data, 4 );
+	Signature[4] = 0;
+}
+
+/*
+ * Check the header of an inflated profile and fill in its fields
+ */
+int parseProfile( IccProfile *Profile ) {
+	const unsigned char *data = Profile->data;
+	if (Profile->size < ICC_HEADER_LENGTH + ICC_TAG_COUNT_LENGTH ||
+			getLastByte( data ) != Profile->size ||
+			memcmp( data + ICC_SIGNATURE_OFFSET, "acsp", 4 ))
+		return FALSE;
+	getSignature( Profile->cmm, data + 4 );
+	Profile->version = getLastByte( data + 8 );
+	getSignature( Profile->deviceClass, data + 12 );
+	getSignature( Profile->colorSpace, data + 16 );
+	getSignature( Profile->connectionSpace, data + 20 );
+	Profile->tagCount = getLastByte( data + ICC_HEADER_LENGTH );
+	/*every tag table entry is 12 bytes*/
+	if (Profile->tagCount > ( Profile->size - ICC_HEADER_LENGTH - ICC_TAG_COUNT_LENGTH ) / 12)
+		return FALSE;
+	return TRUE;
+}
+
+/*
+ * Free a profile and give its payloads back to the memory budget, a cached
+ * one only when the cache is cleared
+ */
+static void freeProfile( IccProfile *Profile ) {
+	freeMetadata( Profile->data, Profile->size );
+	free( Profile->compressed );
+	releaseMemory( Profile->compressedLength );
+	free( Profile );
+}
+
+static size_t getProfileBytes( const IccProfile *Profile ) {
+	return Profile->size + Profile->compressedLength + sizeof(IccProfile);
+}
+
+/*
+ * Cached profile of a compressed payload, called with the lock held
+ */
+static IccProfile *findCachedProfile( unsigned long Key, const unsigned char *Compressed, size_t Length ) {
+	IccProfile *profile = profileBuckets[Key & ( PROFILE_CACHE_BUCKETS - 1 )];
+	for (; profile; profile = profile->next) {
+		if (profile->key == Key && profile->compressedLength == Length &&
+				!memcmp( profile->compressed, Compressed, Length ))
+			return profile;
+	}
+	return NULL;
+}
+
+/*
+ * Inflate and parse a profile that is not in the cache yet, both payloads
+ * reserved against the memory budget in MemoryMode
+ */
+static int loadProfile( unsigned long Key, const unsigned char *Compressed, size_t Length, int MemoryMode,
+		IccProfile **Profile ) {
+	IccProfile *profile = (IccProfile*) calloc( 1, sizeof(IccProfile) );
+	int errorCode;
+	if (!profile)
+		return PNG_ERROR_MEMORY;
+	errorCode = inflateMetadata( Compressed, Length, METADATA_INFLATE_LIMIT, MemoryMode, &profile->data, &profile->size );
+	if (!errorCode && !parseProfile( profile ))
+		errorCode = PNG_ERROR_PROFILE;
+	if (!errorCode && !reserveMemory( Length, MemoryMode ))
+		errorCode = PNG_ERROR_BUDGET;
+	if (!errorCode) {
+		profile->compressedLength = Length;
+		profile->compressed = (unsigned char*) malloc( Length );
+		if (!profile->compressed)
+			errorCode = PNG_ERROR_MEMORY;
+	}
+	if (errorCode) {
+		freeProfile( profile );
+		return errorCode;
+	}
+	memcpy( profile->compressed, Compressed, Length );
+	profile->key = Key;
+	profile->refCount = 1;
+	*Profile = profile;
+	return PNG_ERROR_NONE;
+}
+
+/*
+ * Shared, parsed profile of the zlib payload of an iCCP chunk. The same
+ * payload seen in another file is only hashed and compared. Returns a
+ * PNG_ERROR_* code, the profile is valid until releaseProfile(). A profile
+ * that isn't cached yet is reserved against the memory budget in MemoryMode,
+ * the cached ones keep their reservations until clearProfileCache()
+ */
+int acquireProfile( const unsigned char *Compressed, size_t Length, int MemoryMode, const IccProfile **Profile ) {
+	unsigned long key;
+	IccProfile *profile;
+	IccProfile *loaded;
+	int errorCode;
+
+	if (Length > INT_MAX)
+		return PNG_ERROR_METADATA;
+	key = crc( Compressed, (int) Length );
+	pthread_mutex_lock( &profileLock );
+	profileStats.lookups++;
+	profile = findCachedProfile( key, Compressed, Length );
+	if (profile) {
+		profileStats.hits++;
+		profile->refCount++;
+	}
+	pthread_mutex_unlock( &profileLock );
+	if (profile) {
+		*Profile = profile;
+		return PNG_ERROR_NONE;
+	}
+
+	/*inflate without the lock, another thread may add the same profile meanwhile*/
+	errorCode = loadProfile( key, Compressed, Length, MemoryMode, &loaded );
+	if (errorCode)
+		return errorCode;
+	pthread_mutex_lock( &profileLock );
+	profile = findCachedProfile( key, Compressed, Length );
+	if (profile) {
+		profile->refCount++;
+	}
+	else {
+		profile = loaded;
+		loaded = NULL;
+		if (profileStats.bytes + getProfileBytes( profile ) <= PROFILE_CACHE_MAX_BYTES) {
+			profile->cached = TRUE;
+			profile->next = profileBuckets[key & ( PROFILE_CACHE_BUCKETS - 1 )];
+			profileBuckets[key & ( PROFILE_CACHE_BUCKETS - 1 )] = profile;
+			profileStats.profiles++;
+			profileStats.bytes += getProfileBytes( profile );
+		}
+	}
+	pthread_mutex_unlock( &profileLock );
+	if (loaded)
+		freeProfile( loaded );
+	*Profile = profile;
+	return PNG_ERROR_NONE;
+}
+
+/*
+ * Drop a reference, cached profiles stay until clearProfileCache()
+ */
+void releaseProfile( const IccProfile *Profile ) {
+	IccProfile *profile = (IccProfile*) Profile;
+	int unused;
+	if (!profile)
+		return;
+	pthread_mutex_lock( &profileLock );
+	unused = --profile->refCount == 0 && !profile->cached;
+	pthread_mutex_unlock( &profileLock );
+	if (unused)
+		freeProfile( profile );
+}
+
+void getProfileCacheStats( ProfileCacheStats *Stats ) {
+	pthread_mutex_lock( &profileLock );
+	*Stats = profileStats;
+	pthread_mutex_unlock( &profileLock );
+}
+
+/*
+ * Free the cached profiles, none may still be acquired
+ */
+void clearProfileCache( void ) {
+	unsigned int i;
+	pthread_mutex_lock( &profileLock );
+	for (i = 0; i < PROFILE_CACHE_BUCKETS; i++) {
+		while (profileBuckets[i]) {
+			IccProfile *profile = profileBuckets[i];
+			profileBuckets[i] = profile->next;
+			freeProfile( profile );
+		}
+	}
+	memset( &profileStats, 0, sizeof(profileStats) );
+	pthread_mutex_unlock( &profileLock );
+}
+
+/*
+ * Validate the ICC profile of a parsed file through the cache and print
+ * its header unless Quiet. Returns a PNG_ERROR_* code
+ */
+int checkFileProfile( const char *FileName, const PNGData *PNG, int Quiet ) {
+	const MetadataEntry *entry = findProfile( PNG->metadata );
+	const IccProfile *profile;
+	const unsigned char *fileData;
+	size_t fileSize;
+	int errorCode;
+
+	if (!entry) {
+		if (!Quiet)
+			printf( "ICC PROFILE: NOT FOUND\n" );
+		return PNG_ERROR_NONE;
+	}
+	fileData = mapFile( FileName, &fileSize );
+	if (!fileData)
+		return PNG_ERROR_IO;
+	if (entry->offset > fileSize || entry->length > fileSize - entry->offset)
+		errorCode = PNG_ERROR_TRUNCATED;
+	else
+		errorCode = acquireProfile( fileData + entry->offset, entry->length, getMemoryMode( PNG ), &profile );
+	unmapFile( fileData, fileSize );
+	if (errorCode) {
+		if (!Quiet)
+			printf( "ICC PROFILE %s: %s\n", entry->keyword, pngErrorString( errorCode ) );
+		return errorCode;
+	}
+	if (!Quiet)
+		printf( "ICC PROFILE %s:\n\tSize: %lu\n\tVersion: %u.%u\n\tClass: %s\n\tColor space: %s\n\tPCS: %s\n\tTags: %u\n",
+				entry->keyword, (unsigned long) profile->size, profile->version >> 24, ( profile->version >> 20 ) & 0xf,
+				profile->deviceClass, profile->colorSpace, profile->connectionSpace, profile->tagCount );
+	releaseProfile( profile );
+	return PNG_ERROR_NONE;
+}
@@ -0,0 +1,65 @@
+/*
+ * PNGProfile.h
+ *
+ *  ICC profiles of iCCP chunks, inflated and parsed once per process and
+ *  shared between files
+ */
+
+#ifndef PNGPROFILE_H_
+#define PNGPROFILE_H_
+
+#include "PNGMetadata.h"
+#include <pthread.h>
+
+#define ICC_HEADER_LENGTH	128
+#define ICC_TAG_COUNT_LENGTH	4
+#define ICC_SIGNATURE_OFFSET	36
+
+#define PROFILE_CACHE_BUCKETS	256 //power of 2
+#define PROFILE_CACHE_MAX_BYTES	( 64 * 1024 * 1024 ) //profiles past this are not kept
+
+/*
+ * Inflated profile and the fields of its header. Shared read only, every
+ * acquireProfile() is matched by a releaseProfile()
+ */
+struct iccProfile {
+	unsigned char	*data; //inflated profile
+	size_t			size;
+	uint32_t		version;
+	char			cmm[5]; //four character signatures, null terminated
+	char			deviceClass[5];
+	char			colorSpace[5];
+	char			connectionSpace[5];
+	uint32_t		tagCount;
+
+	/*cache bookkeeping*/
+	unsigned long	key; //CRC-32 of the compressed payload
+	unsigned char	*compressed; //to tell colliding keys apart
+	size_t			compressedLength;
+	unsigned int	refCount;
+	int				cached; //FALSE when the cache was full, freed on the last release
+	struct iccProfile	*next;
+};
+
+typedef struct iccProfile IccProfile;
+
+/*
+ * Counters of the process wide cache
+ */
+struct profileCacheStats {
+	size_t	lookups;
+	size_t	hits;
+	size_t	profiles;
+	size_t	bytes; //inflated and compressed copies held
+};
+
+typedef struct profileCacheStats ProfileCacheStats;
+
+int parseProfile(IccProfile*);
+int acquireProfile(const unsigned char*, size_t, int, const IccProfile**);
+void releaseProfile(const IccProfile*);
+void getProfileCacheStats(ProfileCacheStats*);
+void clearProfileCache(void);
+int checkFileProfile(const char*, const PNGData*, int);
+
+#endif /* PNGPROFILE_H_ */
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include "PNGRaster.h"
+#include "PNGReader.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ * Decode of decodeToRaster(), the output is opened with the first row
+ */
+struct rasterDecode {
+	PNGDecoder		decoder;
+	RasterOutput	output;
+	const char		*fileName;
+	int				layout;
+	uint32_t		tileSize;
+	int				opened;
+	int				errorCode;
+	int				progress; //print progress lines
+	uint32_t		nextProgress; //rows written at the next progress line
+};
+
+typedef struct rasterDecode RasterDecode;
+
+/*
+ * Write the window back in the background and unmap it
+ */
+static int releaseWindow( RasterOutput *Output ) {
+	int released = TRUE;
+	if (!Output->window)
+		return TRUE;
+	/*start the writeback now so the disk sees one sequential stream*/
+	sync_file_range( Output->fd, (off_t) Output->windowOffset, (off_t) Output->windowLength, SYNC_FILE_RANGE_WRITE );
+	if (munmap( Output->window, Output->windowLength ))
+		released = FALSE;
+	Output->window = NULL;
+	return released;
+}
+
+/*
+ * Map the band that holds Row
+ */
+static int mapBand( RasterOutput *Output, uint32_t Band ) {
+	uint64_t start = (uint64_t) Band * Output->bandBytes;
+	uint64_t length = Output->size - start < Output->bandBytes ? Output->size - start : Output->bandBytes;
+	uint64_t pageSize = (uint64_t) sysconf( _SC_PAGESIZE );
+	void *window;
+
+	if (!releaseWindow( Output ))
+		return FALSE;
+	Output->windowOffset = start - start % pageSize;
+	Output->windowStart = (size_t) ( start - Output->windowOffset );
+	Output->windowLength = (size_t) ( length + Output->windowStart );
+	window = mmap( NULL, Output->windowLength, PROT_READ | PROT_WRITE, MAP_SHARED, Output->fd, (off_t) Output->windowOffset );
+	if (window == MAP_FAILED)
+		return FALSE;
+	madvise( window, Output->windowLength, MADV_SEQUENTIAL );
+	Output->window = (unsigned char*) window;
+	Output->band = Band;
+	return TRUE;
+}
+
+/*
+ * Create FileName at its full size for an image of Header. Tiles must be a
+ * multiple of 8 pixels wide so that tile rows are whole bytes, the tiles
+ * at the right and bottom edges are padded with zeros
+ */
+int openRasterOutput( RasterOutput *Output, const char *FileName, const ImageHeader *Header, int Layout,
+		uint32_t TileSize ) {
+	memset( Output, 0, sizeof(*Output) );
+	Output->fd = -1;
+	Output->header = *Header;
+	Output->layout = Layout;
+	if (Layout == RASTER_TILED) {
+		uint64_t tilesDown;
+		if (!TileSize || TileSize % 8)
+			return PNG_ERROR_INTERNAL;
+		Output->tileSize = TileSize;
+		Output->tileRowBytes = (size_t) TileSize * Header->bitsPerPixel / 8;
+		Output->tilesAcross = (uint32_t) ( ( (uint64_t) Header->width + TileSize - 1 ) / TileSize );
+		tilesDown = ( (uint64_t) Header->height + TileSize - 1 ) / TileSize;
+		Output->bandRows = TileSize;
+		Output->bandBytes = (uint64_t) Output->tilesAcross * TileSize * Output->tileRowBytes;
+		Output->size = Output->bandBytes * tilesDown;
+	}
+	else {
+		Output->bandRows = (uint32_t) ( RASTER_WINDOW_BYTES / ( Header->rowBytes ? Header->rowBytes : 1 ) );
+		if (!Output->bandRows)
+			Output->bandRows = 1;
+		Output->bandBytes = (uint64_t) Output->bandRows * Header->rowBytes;
+		Output->size = (uint64_t) Header->rowBytes * Header->height;
+	}
+	if (Output->bandBytes > SIZE_MAX / 2)
+		return PNG_ERROR_IMAGE_SIZE;
+	Output->band = UINT32_MAX;
+	Output->fd = open( FileName, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+	if (Output->fd < 0)
+		return PNG_ERROR_OUTPUT;
+	/*the file is sized up front, the pages not written stay holes of zeros*/
+	if (ftruncate( Output->fd, (off_t) Output->size )) {
+		close( Output->fd );
+		Output->fd = -1;
+		return PNG_ERROR_OUTPUT;
+	}
+	return PNG_ERROR_NONE;
+}
+
+/*
+ * Store an unfiltered row, the rows must come from top to bottom
+ */
+int writeRasterRow( RasterOutput *Output, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	uint32_t band = Row / Output->bandRows;
+	uint32_t bandRow = Row % Output->bandRows;
+	unsigned char *bandData;
+
+	if (Row >= Output->header.height || Length != Output->header.rowBytes)
+		return FALSE;
+	if (band != Output->band && !mapBand( Output, band ))
+		return FALSE;
+	bandData = Output->window + Output->windowStart;
+	if (Output->layout == RASTER_TILED) {
+		size_t tileBytes = (size_t) Output->tileSize * Output->tileRowBytes;
+		uint32_t tile;
+		for (tile = 0; tile < Output->tilesAcross; tile++) {
+			size_t start = (size_t) tile * Output->tileRowBytes;
+			size_t length = Length - start < Output->tileRowBytes ? Length - start : Output->tileRowBytes;
+			memcpy( bandData + tile * tileBytes + bandRow * Output->tileRowBytes, Data + start, length );
+		}
+	}
+	else {
+		memcpy( bandData + (size_t) bandRow * Output->header.rowBytes, Data, Length );
+	}
+	Output->rowsWritten++;
+	return TRUE;
+}
+
+/*
+ * Unmap the last window and close the file, returns a PNG_ERROR_* code
+ */
+int closeRasterOutput( RasterOutput *Output ) {
+	int errorCode = PNG_ERROR_NONE;
+	if (Output->fd < 0)
+		return PNG_ERROR_NONE;
+	if (!releaseWindow( Output ))
+		errorCode = PNG_ERROR_OUTPUT;
+	if (close( Output->fd ))
+		errorCode = PNG_ERROR_OUTPUT;
+	Output->fd = -1;
+	return errorCode;
+}
+
+/*
+ * Print a progress line whenever another RASTER_PROGRESS_STEPS-th of the
+ * rows has been written
+ */
+static void printProgress( RasterDecode *Decode ) {
+	uint32_t height = Decode->decoder.header.height;
+	uint32_t rows = (uint32_t) Decode->output.rowsWritten;
+	if (rows < Decode->nextProgress)
+		return;
+	Decode->nextProgress = rows + height / RASTER_PROGRESS_STEPS + 1;
+	printf( "PROGRESS: %u OF %u ROWS (%.0lf%%)\n", rows, height, height ? 100.0 * rows / height : 100.0 );
+}
+
+static int rasterRowSink( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	RasterDecode *decode = (RasterDecode*) Context;
+	if (!decode->opened) {
+		decode->errorCode = openRasterOutput( &decode->output, decode->fileName, &decode->decoder.header,
+				decode->layout, decode->tileSize );
+		if (decode->errorCode)
+			return FALSE;
+		decode->opened = TRUE;
+	}
+	if (writeRasterRow( &decode->output, Row, Data, Length )) {
+		if (decode->progress)
+			printProgress( decode );
+		return TRUE;
+	}
+	decode->errorCode = PNG_ERROR_OUTPUT;
+	return FALSE;
+}
+
+/*
+ * chunkHook of decodeToRaster()
+ */
+static int rasterChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	RasterDecode *decode = (RasterDecode*) Context;
+	if (decodeChunk( &decode->decoder, chunk ))
+		return TRUE;
+	if (!decode->errorCode)
+		decode->errorCode = decode->decoder.errorCode;
+	reportError( &PNG->chunkInfo, decode->errorCode, "%s\n", pngErrorString( decode->errorCode ) );
+	return FALSE;
+}
+
+/*
+ * Decode InName into OutName in the given RASTER_* layout. Resident memory
+ * stays at one window of the output however large the image is, except
+ * for interlaced images which the unfilter has to assemble whole first.
+ * OutName is removed again when the decode fails
+ */
+int decodeToRaster( const char *InName, const char *OutName, int Layout, uint32_t TileSize, int Quiet,
+		FileResult *Result ) {
+	RasterDecode decode;
+	int parsed;
+
+	Result->fileName = InName;
+	Result->trace = NULL;
+	Result->parsed = FALSE;
+	Result->errorCode = PNG_ERROR_NONE;
+	Result->bytesRead = 0;
+	if (isSameFile( InName, OutName )) {
+		if (!Quiet)
+			printf( "OUTPUT IS THE INPUT FILE: %s\n", OutName );
+		Result->errorCode = PNG_ERROR_OUTPUT;
+		return FALSE;
+	}
+
+	memset( &decode, 0, sizeof(decode) );
+	decode.output.fd = -1;
+	decode.fileName = OutName;
+	decode.layout = Layout;
+	decode.tileSize = TileSize;
+	decode.progress = !Quiet;
+	initDecoder( &decode.decoder, rasterRowSink, &decode );
+	parsed = parseFileWithHook( InName, Quiet, VERIFY_FULL, rasterChunkHook, &decode, Result );
+	if (closeRasterOutput( &decode.output ) && parsed) {
+		if (!Quiet)
+			printf( "%s\n", pngErrorString( PNG_ERROR_OUTPUT ) );
+		Result->errorCode = PNG_ERROR_OUTPUT;
+		Result->parsed = parsed = FALSE;
+	}
+	if (!parsed && decode.opened)
+		unlink( OutName );
+	if (parsed && !Quiet)
+		printf( "WROTE %s: %u x %u, %u BITS PER PIXEL, %s, %lu BYTES\n", OutName, decode.output.header.width,
+				decode.output.header.height, decode.output.header.bitsPerPixel,
+				Layout == RASTER_TILED ? "TILED" : "RAW", (unsigned long) decode.output.size );
+	freeDecoder( &decode.decoder );
+	return parsed;
+}
@@ -0,0 +1,50 @@
+/*
+ * PNGRaster.h
+ *
+ *  Decode into a memory-mapped output file, for images too large to hold
+ *  in memory once decoded
+ */
+
+#ifndef PNGRASTER_H_
+#define PNGRASTER_H_
+
+#include "PNGDecode.h"
+
+#define RASTER_RAW		0 //the rows one after the other
+#define RASTER_TILED	1 //square tiles in row order, each tile row after row
+
+#define RASTER_WINDOW_BYTES	( 64 * 1024 * 1024 ) //output mapped at once by the raw layout
+#define RASTER_DEFAULT_TILE	256
+#define RASTER_PROGRESS_STEPS	20 //progress lines over the rows of an image
+
+/*
+ * Output file written through a window that moves down the image. A band
+ * of rows is contiguous in the file in both layouts, only the band being
+ * written is mapped
+ */
+struct rasterOutput {
+	ImageHeader		header;
+	int				layout; //RASTER_*
+	uint32_t		tileSize; //pixels on a side of a tile
+	size_t			tileRowBytes; //bytes of a row within a tile
+	uint32_t		tilesAcross;
+	int				fd;
+	uint64_t		size; //bytes of the output file
+	uint32_t		bandRows;
+	uint64_t		bandBytes;
+	uint32_t		band; //band mapped in the window
+	unsigned char	*window;
+	uint64_t		windowOffset; //page aligned file offset of the window
+	size_t			windowLength;
+	size_t			windowStart; //offset of the band within the window
+	uint64_t		rowsWritten;
+};
+
+typedef struct rasterOutput RasterOutput;
+
+int openRasterOutput(RasterOutput*, const char*, const ImageHeader*, int, uint32_t);
+int writeRasterRow(RasterOutput*, uint32_t, const unsigned char*, size_t);
+int closeRasterOutput(RasterOutput*);
+int decodeToRaster(const char*, const char*, int, uint32_t, int, FileResult*);
+
+#endif /* PNGRASTER_H_ */
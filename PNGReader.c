@@ -0,0 +1,506 @@
+#include "PNGReader.h"
+#include "PNGLatency.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * Per file state of the batch, one PNG parser for every open file
+ */
+struct fileSlot {
+	ReadRequest		request;
+	PNGData			PNG;
+	FileResult		result;
+	unsigned char	*buffer;
+	int				verifyLevel; //VERIFY_* of the files
+};
+
+typedef struct fileSlot FileSlot;
+
+static int uringSetup( unsigned int Entries, struct io_uring_params *Params ) {
+	return (int) syscall( __NR_io_uring_setup, Entries, Params );
+}
+
+static int uringEnter( int RingFd, unsigned int ToSubmit, unsigned int MinComplete, unsigned int Flags ) {
+	return (int) syscall( __NR_io_uring_enter, RingFd, ToSubmit, MinComplete, Flags, NULL, 0 );
+}
+
+/*
+ * Map the submission and completion rings of a new io_uring instance
+ */
+static int initUring( FileReader *Reader ) {
+	struct io_uring_params params;
+	unsigned char *sq;
+	unsigned char *cq;
+
+	memset( &params, 0, sizeof(params) );
+	Reader->ringFd = uringSetup( Reader->queueDepth, &params );
+	if (Reader->ringFd < 0)
+		return FALSE;
+
+	Reader->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	Reader->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (Reader->cqRingSize > Reader->sqRingSize)
+			Reader->sqRingSize = Reader->cqRingSize;
+		Reader->cqRingSize = Reader->sqRingSize;
+	}
+	Reader->sqRing = mmap( NULL, Reader->sqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, Reader->ringFd, IORING_OFF_SQ_RING );
+	if (Reader->sqRing == MAP_FAILED) {
+		Reader->sqRing = NULL;
+		return FALSE;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		Reader->cqRing = Reader->sqRing;
+	}
+	else {
+		Reader->cqRing = mmap( NULL, Reader->cqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, Reader->ringFd, IORING_OFF_CQ_RING );
+		if (Reader->cqRing == MAP_FAILED) {
+			Reader->cqRing = NULL;
+			return FALSE;
+		}
+	}
+	Reader->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	Reader->sqes = mmap( NULL, Reader->sqesSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, Reader->ringFd, IORING_OFF_SQES );
+	if (Reader->sqes == MAP_FAILED) {
+		Reader->sqes = NULL;
+		return FALSE;
+	}
+
+	sq = (unsigned char*) Reader->sqRing;
+	cq = (unsigned char*) Reader->cqRing;
+	Reader->sqHead = (unsigned int*) (sq + params.sq_off.head);
+	Reader->sqTail = (unsigned int*) (sq + params.sq_off.tail);
+	Reader->sqMask = (unsigned int*) (sq + params.sq_off.ring_mask);
+	Reader->sqArray = (unsigned int*) (sq + params.sq_off.array);
+	Reader->cqHead = (unsigned int*) (cq + params.cq_off.head);
+	Reader->cqTail = (unsigned int*) (cq + params.cq_off.tail);
+	Reader->cqMask = (unsigned int*) (cq + params.cq_off.ring_mask);
+	Reader->cqes = cq + params.cq_off.cqes;
+	return TRUE;
+}
+
+static void freeUring( FileReader *Reader ) {
+	if (Reader->sqes)
+		munmap( Reader->sqes, Reader->sqesSize );
+	if (Reader->cqRing && Reader->cqRing != Reader->sqRing)
+		munmap( Reader->cqRing, Reader->cqRingSize );
+	if (Reader->sqRing)
+		munmap( Reader->sqRing, Reader->sqRingSize );
+	if (Reader->ringFd >= 0)
+		close( Reader->ringFd );
+	Reader->sqes = Reader->cqRing = Reader->sqRing = NULL;
+	Reader->ringFd = -1;
+}
+
+/*
+ * Worker of the thread backend: take a request, pread() it, hand it back
+ */
+static void *readerThread( void *Context ) {
+	FileReader *Reader = (FileReader*) Context;
+	pthread_mutex_lock( &Reader->lock );
+	for (;;) {
+		ReadRequest *request;
+		while (!Reader->pending && !Reader->stopping)
+			pthread_cond_wait( &Reader->submitted, &Reader->lock );
+		if (!Reader->pending)
+			break;
+		request = Reader->pending;
+		Reader->pending = request->next;
+		if (!Reader->pending)
+			Reader->pendingTail = NULL;
+		pthread_mutex_unlock( &Reader->lock );
+
+		do {
+			request->result = pread( request->fd, request->iov.iov_base, request->iov.iov_len, request->offset );
+		} while (request->result < 0 && errno == EINTR);
+		if (request->result < 0)
+			request->result = -errno;
+
+		pthread_mutex_lock( &Reader->lock );
+		request->next = Reader->done;
+		Reader->done = request;
+		pthread_cond_signal( &Reader->completed );
+	}
+	pthread_mutex_unlock( &Reader->lock );
+	return NULL;
+}
+
+static int initReaderThreads( FileReader *Reader ) {
+	unsigned int i;
+	Reader->pending = Reader->pendingTail = Reader->done = NULL;
+	Reader->stopping = FALSE;
+	Reader->threadCount = 0;
+	Reader->threads = (pthread_t*) malloc( Reader->queueDepth * sizeof(pthread_t) );
+	if (!Reader->threads)
+		return FALSE;
+	pthread_mutex_init( &Reader->lock, NULL );
+	pthread_cond_init( &Reader->submitted, NULL );
+	pthread_cond_init( &Reader->completed, NULL );
+	for (i = 0; i < Reader->queueDepth; i++) {
+		if (pthread_create( &Reader->threads[i], NULL, readerThread, Reader ))
+			break;
+		Reader->threadCount++;
+	}
+	return Reader->threadCount != 0;
+}
+
+/*
+ * Initialize the reader with the given number of reads in flight.
+ * Backend 0 picks io_uring and falls back to threads if it is unavailable
+ */
+int initFileReader( FileReader *Reader, unsigned int QueueDepth, int Backend ) {
+	memset( Reader, 0, sizeof(*Reader) );
+	Reader->ringFd = -1;
+	if (QueueDepth < 1)
+		QueueDepth = 1;
+	if (QueueDepth > READER_MAX_QUEUE_DEPTH)
+		QueueDepth = READER_MAX_QUEUE_DEPTH;
+	Reader->queueDepth = QueueDepth;
+
+	if (Backend != READER_BACKEND_THREADS) {
+		if (initUring( Reader )) {
+			Reader->backend = READER_BACKEND_URING;
+			return TRUE;
+		}
+		freeUring( Reader );
+		if (Backend == READER_BACKEND_URING)
+			return FALSE;
+	}
+	Reader->backend = READER_BACKEND_THREADS;
+	return initReaderThreads( Reader );
+}
+
+/*
+ * Queue a read, it is only guaranteed to be started by the next waitRead()
+ */
+int submitRead( FileReader *Reader, ReadRequest *Request ) {
+	if (Reader->inFlight >= Reader->queueDepth)
+		return FALSE;
+	if (Reader->backend == READER_BACKEND_URING) {
+		unsigned int tail = *Reader->sqTail;
+		unsigned int index = tail & *Reader->sqMask;
+		struct io_uring_sqe *sqe = (struct io_uring_sqe*) Reader->sqes + index;
+		memset( sqe, 0, sizeof(*sqe) );
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = Request->fd;
+		sqe->addr = (unsigned long) &Request->iov;
+		sqe->len = 1;
+		sqe->off = (unsigned long long) Request->offset;
+		sqe->user_data = (unsigned long long) (uintptr_t) Request;
+		Reader->sqArray[index] = index;
+		__atomic_store_n( Reader->sqTail, tail + 1, __ATOMIC_RELEASE );
+		Reader->toSubmit++;
+	}
+	else {
+		Request->next = NULL;
+		pthread_mutex_lock( &Reader->lock );
+		if (Reader->pendingTail)
+			Reader->pendingTail->next = Request;
+		else
+			Reader->pending = Request;
+		Reader->pendingTail = Request;
+		pthread_cond_signal( &Reader->submitted );
+		pthread_mutex_unlock( &Reader->lock );
+	}
+	Reader->inFlight++;
+	return TRUE;
+}
+
+/*
+ * Submit everything queued and block until one read has completed,
+ * returns NULL when nothing is in flight or io_uring failed, the reads
+ * still in flight are then lost
+ */
+ReadRequest *waitRead( FileReader *Reader ) {
+	ReadRequest *request = NULL;
+	int submitted;
+	if (!Reader->inFlight)
+		return NULL;
+	if (Reader->backend == READER_BACKEND_URING) {
+		for (;;) {
+			unsigned int head = __atomic_load_n( Reader->cqHead, __ATOMIC_ACQUIRE );
+			if (head != __atomic_load_n( Reader->cqTail, __ATOMIC_ACQUIRE )) {
+				struct io_uring_cqe *cqe = (struct io_uring_cqe*) Reader->cqes + (head & *Reader->cqMask);
+				request = (ReadRequest*) (uintptr_t) cqe->user_data;
+				request->result = cqe->res;
+				__atomic_store_n( Reader->cqHead, head + 1, __ATOMIC_RELEASE );
+				break;
+			}
+			submitted = uringEnter( Reader->ringFd, Reader->toSubmit, 1, IORING_ENTER_GETEVENTS );
+			if (submitted < 0) {
+				if (errno != EINTR)
+					return NULL;
+			}
+			else {
+				/*the kernel may take fewer entries than were queued*/
+				Reader->toSubmit -= (unsigned int) submitted;
+			}
+		}
+	}
+	else {
+		pthread_mutex_lock( &Reader->lock );
+		while (!Reader->done)
+			pthread_cond_wait( &Reader->completed, &Reader->lock );
+		request = Reader->done;
+		Reader->done = request->next;
+		pthread_mutex_unlock( &Reader->lock );
+	}
+	Reader->inFlight--;
+	return request;
+}
+
+void freeFileReader( FileReader *Reader ) {
+	unsigned int i;
+	if (Reader->backend == READER_BACKEND_URING) {
+		freeUring( Reader );
+	}
+	else if (Reader->backend == READER_BACKEND_THREADS) {
+		pthread_mutex_lock( &Reader->lock );
+		Reader->stopping = TRUE;
+		pthread_cond_broadcast( &Reader->submitted );
+		pthread_mutex_unlock( &Reader->lock );
+		for (i = 0; i < Reader->threadCount; i++)
+			pthread_join( Reader->threads[i], NULL );
+		free( Reader->threads );
+		pthread_mutex_destroy( &Reader->lock );
+		pthread_cond_destroy( &Reader->submitted );
+		pthread_cond_destroy( &Reader->completed );
+	}
+	Reader->backend = 0;
+}
+
+/*
+ * Close the file of a slot and report it, the slot is then free
+ */
+static void finishSlot( FileSlot *Slot, FileResultCallback Callback, void *Context ) {
+	close( Slot->request.fd );
+	Slot->request.fd = -1;
+	freePNGData( &Slot->PNG );
+	finishChunkTrace( Slot->result.trace );
+	Callback( &Slot->result, Context );
+	freeChunkTrace( Slot->result.trace );
+}
+
+/*
+ * Open the next file of the batch in the slot and queue its first read,
+ * files which can't be opened are reported straight away
+ */
+static int startNextFile( FileReader *Reader, FileSlot *Slot, char **FileNames, size_t Count,
+		size_t *NextFile, FileResultCallback Callback, void *Context ) {
+	while (*NextFile < Count) {
+		const char *name = FileNames[(*NextFile)++];
+		Slot->result.fileName = name;
+		Slot->result.parsed = FALSE;
+		Slot->result.errorCode = PNG_ERROR_NONE;
+		Slot->result.bytesRead = 0;
+		Slot->result.trace = startChunkTrace();
+		Slot->request.fd = open( name, O_RDONLY );
+		if (Slot->request.fd < 0) {
+			Slot->result.errorCode = PNG_ERROR_IO;
+			finishChunkTrace( Slot->result.trace );
+			Callback( &Slot->result, Context );
+			freeChunkTrace( Slot->result.trace );
+			continue;
+		}
+		initPNGProcess( &Slot->PNG );
+		Slot->PNG.chunkInfo.quiet = TRUE;
+		Slot->PNG.verifyLevel = Slot->verifyLevel;
+		Slot->PNG.trace = Slot->result.trace;
+		/*every slot is parsed on this thread, a wait would stall the slots holding the memory*/
+		Slot->PNG.memoryWait = FALSE;
+		Slot->request.offset = 0;
+		Slot->request.iov.iov_base = Slot->buffer;
+		Slot->request.iov.iov_len = READ_BUFFER_SIZE;
+		Slot->request.userData = Slot;
+		if (submitRead( Reader, &Slot->request ))
+			return TRUE;
+		Slot->result.errorCode = PNG_ERROR_IO;
+		finishSlot( Slot, Callback, Context );
+	}
+	return FALSE;
+}
+
+/*
+ * Completed read of a slot: feed it to the parser and queue the next one,
+ * returns FALSE once the file is finished
+ */
+static int continueFile( FileReader *Reader, FileSlot *Slot ) {
+	ReadRequest *request = &Slot->request;
+	if (request->result < 0) {
+		Slot->result.errorCode = PNG_ERROR_IO;
+		return FALSE;
+	}
+	if (request->result == 0) {
+		Slot->result.parsed = processFinish( &Slot->PNG );
+		Slot->result.errorCode = pngGetError( &Slot->PNG );
+		return FALSE;
+	}
+	Slot->result.bytesRead += (size_t) request->result;
+	if (!processBuffer( &Slot->PNG, Slot->buffer, (size_t) request->result )) {
+		Slot->result.errorCode = pngGetError( &Slot->PNG );
+		return FALSE;
+	}
+	request->offset += request->result;
+	return submitRead( Reader, request );
+}
+
+/*
+ * Validate a batch of files with up to QueueDepth reads in flight, parsing
+ * each buffer as soon as its read completes. The callback is invoked once
+ * per file, in completion order. The files are checked to VerifyLevel.
+ * Returns FALSE when not every file could be started or the reads failed,
+ * the files being read then are reported with PNG_ERROR_IO
+ */
+int processFilesAsync( char **FileNames, size_t Count, unsigned int QueueDepth, int Backend, int VerifyLevel,
+		FileResultCallback Callback, void *Context ) {
+	FileReader reader;
+	FileSlot *slots;
+	size_t nextFile = 0;
+	unsigned int i;
+	int failed;
+
+	if (!initFileReader( &reader, QueueDepth, Backend ))
+		return FALSE;
+	slots = (FileSlot*) calloc( reader.queueDepth, sizeof(FileSlot) );
+	if (!slots) {
+		freeFileReader( &reader );
+		return FALSE;
+	}
+	for (i = 0; i < reader.queueDepth; i++)
+		slots[i].request.fd = -1;
+	for (i = 0; i < reader.queueDepth; i++) {
+		slots[i].buffer = (unsigned char*) malloc( READ_BUFFER_SIZE );
+		if (!slots[i].buffer)
+			break;
+		slots[i].verifyLevel = VerifyLevel;
+		if (!startNextFile( &reader, &slots[i], FileNames, Count, &nextFile, Callback, Context ))
+			break;
+	}
+
+	for (;;) {
+		ReadRequest *request = waitRead( &reader );
+		FileSlot *slot;
+		if (!request)
+			break;
+		slot = (FileSlot*) request->userData;
+		if (continueFile( &reader, slot ))
+			continue;
+		finishSlot( slot, Callback, Context );
+		startNextFile( &reader, slot, FileNames, Count, &nextFile, Callback, Context );
+	}
+
+	/*reads left in flight mean io_uring failed, the ring is closed before their buffers are freed*/
+	failed = reader.inFlight != 0;
+	freeFileReader( &reader );
+	for (i = 0; i < reader.queueDepth; i++) {
+		if (slots[i].request.fd >= 0) {
+			slots[i].result.errorCode = PNG_ERROR_IO;
+			finishSlot( &slots[i], Callback, Context );
+		}
+		free( slots[i].buffer );
+	}
+	free( slots );
+	return !failed && nextFile == Count;
+}
+
+/*
+ * Map a whole file read only, for the parts of a parsed file that are only
+ * read again on request. Returns NULL for empty or unreadable files
+ */
+const unsigned char *mapFile( const char *FileName, size_t *Size ) {
+	struct stat fileStat;
+	void *data;
+	int fd = open( FileName, O_RDONLY );
+	if (fd < 0)
+		return NULL;
+	if (fstat( fd, &fileStat ) || fileStat.st_size <= 0) {
+		close( fd );
+		return NULL;
+	}
+	data = mmap( NULL, (size_t) fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if (data == MAP_FAILED)
+		return NULL;
+	*Size = (size_t) fileStat.st_size;
+	return (const unsigned char*) data;
+}
+
+void unmapFile( const unsigned char *Data, size_t Size ) {
+	munmap( (void*) Data, Size );
+}
+
+/*
+ * Whether OutName is InName, under the same or another name. Writing it
+ * would truncate the input before it is read
+ */
+int isSameFile( const char *InName, const char *OutName ) {
+	struct stat in;
+	struct stat out;
+	if (stat( InName, &in ) || stat( OutName, &out ))
+		return FALSE;
+	return in.st_dev == out.st_dev && in.st_ino == out.st_ino;
+}
+
+/*
+ * Parse FileName with blocking reads for a mode that consumes its chunks,
+ * Hook receives every chunk that passed its checks. Result is filled in
+ * either way
+ */
+int parseFileWithHook( const char *FileName, int Quiet, int VerifyLevel, ChunkHook Hook, void *Context,
+		FileResult *Result ) {
+	PNGData PNG;
+	unsigned char *readBuffer;
+	FILE *File;
+	int parsed = TRUE;
+
+	Result->fileName = FileName;
+	Result->trace = NULL;
+	Result->parsed = FALSE;
+	Result->errorCode = PNG_ERROR_NONE;
+	Result->bytesRead = 0;
+	File = fopen( FileName, "rb" );
+	if (!File) {
+		if (!Quiet)
+			printf( "Cannot open file %s\n", FileName );
+		Result->errorCode = PNG_ERROR_IO;
+		return FALSE;
+	}
+	readBuffer = (unsigned char*) malloc( READ_BUFFER_SIZE );
+	if (!readBuffer) {
+		fclose( File );
+		Result->errorCode = PNG_ERROR_MEMORY;
+		return FALSE;
+	}
+
+	initPNGProcess( &PNG );
+	PNG.chunkInfo.quiet = Quiet;
+	PNG.verifyLevel = VerifyLevel;
+	PNG.chunkHook = Hook;
+	PNG.hookContext = Context;
+	while (parsed && !feof( File )) {
+		size_t bytesRead = fread( readBuffer, 1, READ_BUFFER_SIZE, File );
+		if (( bytesRead != READ_BUFFER_SIZE ) && !feof( File )) {
+			reportError( &PNG.chunkInfo, PNG_ERROR_IO, "\nCAN'T READ FILE: %s\n", FileName );
+			parsed = FALSE;
+			break;
+		}
+		Result->bytesRead += bytesRead;
+		parsed = processBuffer( &PNG, readBuffer, bytesRead );
+	}
+	if (parsed)
+		parsed = processFinish( &PNG );
+	Result->errorCode = pngGetError( &PNG );
+	Result->parsed = parsed;
+	freePNGData( &PNG );
+	free( readBuffer );
+	fclose( File );
+	return parsed;
+}
@@ -0,0 +1,87 @@
+/*
+ * PNGReader.h
+ *
+ *  Asynchronous file reads for batch validation
+ */
+
+#ifndef PNGREADER_H_
+#define PNGREADER_H_
+
+#include "PNGParser.h"
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#define READER_BACKEND_URING	1
+#define READER_BACKEND_THREADS	2
+
+#define READER_MAX_QUEUE_DEPTH	256
+
+/*
+ * One outstanding read
+ */
+struct readRequest {
+	int				fd; //file to read from
+	off_t			offset; //position in the file
+	struct iovec	iov; //destination buffer
+	ssize_t			result; //bytes read or -errno
+	void			*userData; //owner of the request
+	struct readRequest	*next; //queue link for the thread backend
+};
+
+typedef struct readRequest ReadRequest;
+
+/*
+ * Read queue, backed by io_uring when the kernel allows it and by a pool
+ * of pread() threads otherwise
+ */
+struct fileReader {
+	int				backend; //READER_BACKEND_*
+	unsigned int	queueDepth; //maximum reads in flight
+	unsigned int	inFlight; //reads submitted and not yet completed
+
+	/*io_uring*/
+	int				ringFd;
+	unsigned int	toSubmit; //queued but not yet passed to the kernel
+	void			*sqRing;
+	size_t			sqRingSize;
+	void			*cqRing;
+	size_t			cqRingSize;
+	void			*sqes;
+	size_t			sqesSize;
+	unsigned int	*sqHead;
+	unsigned int	*sqTail;
+	unsigned int	*sqMask;
+	unsigned int	*sqArray;
+	unsigned int	*cqHead;
+	unsigned int	*cqTail;
+	unsigned int	*cqMask;
+	void			*cqes;
+
+	/*pread() threads*/
+	pthread_t		*threads;
+	unsigned int	threadCount;
+	pthread_mutex_t	lock;
+	pthread_cond_t	submitted;
+	pthread_cond_t	completed;
+	ReadRequest		*pending;
+	ReadRequest		*pendingTail;
+	ReadRequest		*done;
+	int				stopping;
+};
+
+typedef struct fileReader FileReader;
+
+int initFileReader(FileReader*, unsigned int, int);
+int submitRead(FileReader*, ReadRequest*);
+ReadRequest *waitRead(FileReader*);
+void freeFileReader(FileReader*);
+
+int processFilesAsync(char**, size_t, unsigned int, int, int, FileResultCallback, void*);
+
+const unsigned char *mapFile(const char*, size_t*);
+void unmapFile(const unsigned char*, size_t);
+int isSameFile(const char*, const char*);
+int parseFileWithHook(const char*, int, int, ChunkHook, void*, FileResult*);
+
+#endif /* PNGREADER_H_ */
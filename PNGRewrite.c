@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include "PNGRewrite.h"
+#include "crc.h"
+#include "PNGReader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+void initRewriteRules( RewriteRules *Rules ) {
+	memset( Rules, 0, sizeof(*Rules) );
+}
+
+/*
+ * Only ancillary chunks may be changed, the image itself stays as validated
+ */
+static int isAncillaryType( const char *Type ) {
+	if (strlen( Type ) != CHUNK_TYPE_LENGTH || !isChunkTypeValid( (const unsigned char*) Type ))
+		return FALSE;
+	return ( Type[0] & ( 1u << 5 ) ) != 0;
+}
+
+int addStripRule( RewriteRules *Rules, const char *Type ) {
+	if (Rules->stripCount == REWRITE_MAX_RULES || !isAncillaryType( Type ))
+		return FALSE;
+	memcpy( Rules->strip[Rules->stripCount++], Type, CHUNK_TYPE_LENGTH );
+	return TRUE;
+}
+
+static int setRewriteChunk( RewriteChunk *Chunk, const char *Type, const unsigned char *Data, size_t Length ) {
+	if (!isAncillaryType( Type ) || Length > PNG_MAX_VALUE)
+		return FALSE;
+	Chunk->data = (unsigned char*) malloc( Length ? Length : 1 );
+	if (!Chunk->data)
+		return FALSE;
+	memcpy( Chunk->type, Type, CHUNK_TYPE_LENGTH );
+	memcpy( Chunk->data, Data, Length );
+	Chunk->length = Length;
+	return TRUE;
+}
+
+int addInsertRule( RewriteRules *Rules, const char *Type, const unsigned char *Data, size_t Length ) {
+	if (Rules->insertCount == REWRITE_MAX_RULES ||
+			!setRewriteChunk( &Rules->insert[Rules->insertCount], Type, Data, Length ))
+		return FALSE;
+	Rules->insertCount++;
+	return TRUE;
+}
+
+int addReplaceRule( RewriteRules *Rules, const char *Type, const unsigned char *Data, size_t Length ) {
+	if (Rules->replaceCount == REWRITE_MAX_RULES ||
+			!setRewriteChunk( &Rules->replace[Rules->replaceCount], Type, Data, Length ))
+		return FALSE;
+	Rules->replaceCount++;
+	return TRUE;
+}
+
+void freeRewriteRules( RewriteRules *Rules ) {
+	size_t i;
+	for (i = 0; i < Rules->insertCount; i++)
+		free( Rules->insert[i].data );
+	for (i = 0; i < Rules->replaceCount; i++)
+		free( Rules->replace[i].data );
+	initRewriteRules( Rules );
+}
+
+static int writeAll( int Fd, const unsigned char *Data, size_t Length ) {
+	while (Length) {
+		ssize_t written = write( Fd, Data, Length );
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		Data += written;
+		Length -= (size_t) written;
+	}
+	return TRUE;
+}
+
+/*
+ * Copy through user space when the kernel can't copy between the files
+ */
+static int copyRangeBuffered( PNGRewriter *Rewriter, uint64_t Offset, uint64_t Length ) {
+	unsigned char *buffer = (unsigned char*) malloc( REWRITE_COPY_BUFFER_SIZE );
+	int copied = buffer != NULL;
+	while (copied && Length) {
+		size_t size = Length < REWRITE_COPY_BUFFER_SIZE ? (size_t) Length : REWRITE_COPY_BUFFER_SIZE;
+		ssize_t bytesRead = pread( Rewriter->inFd, buffer, size, (off_t) Offset );
+		if (bytesRead <= 0) {
+			copied = bytesRead < 0 && errno == EINTR;
+			continue;
+		}
+		copied = writeAll( Rewriter->outFd, buffer, (size_t) bytesRead );
+		Offset += (uint64_t) bytesRead;
+		Length -= (uint64_t) bytesRead;
+	}
+	free( buffer );
+	return copied;
+}
+
+/*
+ * Write the kept bytes, the kernel copies them without passing through
+ * this process where the file systems allow it
+ */
+static int flushPending( PNGRewriter *Rewriter ) {
+	off_t offset = (off_t) Rewriter->pendingStart;
+	uint64_t length = Rewriter->pendingEnd - Rewriter->pendingStart;
+
+	Rewriter->pendingStart = Rewriter->pendingEnd;
+	Rewriter->bytesWritten += length;
+	while (length && !Rewriter->copyFallback) {
+		ssize_t copied = copy_file_range( Rewriter->inFd, &offset, Rewriter->outFd, NULL, (size_t) length, 0 );
+		if (copied > 0) {
+			length -= (uint64_t) copied;
+		}
+		else if (copied < 0 && errno == EINTR) {
+			continue;
+		}
+		else if (copied < 0 && ( errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+				errno == EOPNOTSUPP || errno == EBADF )) {
+			Rewriter->copyFallback = TRUE;
+		}
+		else {
+			return FALSE;
+		}
+	}
+	if (length)
+		return copyRangeBuffered( Rewriter, (uint64_t) offset, length );
+	return TRUE;
+}
+
+/*
+ * Write a new chunk with its CRC
+ */
+static int writeChunk( PNGRewriter *Rewriter, const RewriteChunk *Chunk ) {
+	unsigned char header[8];
+	unsigned char crcBytes[4];
+	unsigned long chunkCrc = update_crc( 0xffffffffL, Chunk->type, CHUNK_TYPE_LENGTH );
+	chunkCrc = update_crc( chunkCrc, Chunk->data, (int) Chunk->length ) ^ 0xffffffffL;
+	header[0] = (unsigned char) ( Chunk->length >> 24 );
+	header[1] = (unsigned char) ( Chunk->length >> 16 );
+	header[2] = (unsigned char) ( Chunk->length >> 8 );
+	header[3] = (unsigned char) Chunk->length;
+	memcpy( header + 4, Chunk->type, CHUNK_TYPE_LENGTH );
+	crcBytes[0] = (unsigned char) ( chunkCrc >> 24 );
+	crcBytes[1] = (unsigned char) ( chunkCrc >> 16 );
+	crcBytes[2] = (unsigned char) ( chunkCrc >> 8 );
+	crcBytes[3] = (unsigned char) chunkCrc;
+	if (!flushPending( Rewriter ) ||
+			!writeAll( Rewriter->outFd, header, sizeof(header) ) ||
+			!writeAll( Rewriter->outFd, Chunk->data, Chunk->length ) ||
+			!writeAll( Rewriter->outFd, crcBytes, sizeof(crcBytes) ))
+		return FALSE;
+	Rewriter->bytesWritten += sizeof(header) + Chunk->length + sizeof(crcBytes);
+	return TRUE;
+}
+
+static int writeOutput( void *Context, const unsigned char *Data, size_t Length ) {
+	PNGRewriter *rewriter = (PNGRewriter*) Context;
+	rewriter->bytesWritten += Length;
+	return writeAll( rewriter->outFd, Data, Length );
+}
+
+/*
+ * chunkHook of a rewrite: the chunk has been validated, decide whether its
+ * bytes in the input go to the output
+ */
+int rewriteChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	PNGRewriter *rewriter = (PNGRewriter*) Context;
+	const RewriteRules *rules = rewriter->rules;
+	/*the CRC of the chunk has just been read*/
+	uint64_t chunkEnd = PNG->fileOffset;
+	uint64_t chunkStart = chunkEnd - sizeof(PNG->chunkCRC) - chunk->dataSize - sizeof(PNG->chunkHeader);
+	const RewriteChunk *replacement = NULL;
+	unsigned char header[IHDR_DATA_LENGTH];
+	RewriteChunk deinterlaced;
+	int written = TRUE;
+	size_t i;
+
+	for (i = 0; i < rules->stripCount; i++) {
+		if (!memcmp( chunk->chunkType, rules->strip[i], CHUNK_TYPE_LENGTH ))
+			return TRUE;
+	}
+	for (i = 0; i < rules->replaceCount && !replacement; i++) {
+		if (!memcmp( chunk->chunkType, rules->replace[i].type, CHUNK_TYPE_LENGTH ))
+			replacement = &rules->replace[i];
+	}
+	if (rules->imageData && isChunkType( chunk->chunkType, "IHDR" ) && chunk->Data[12]) {
+		/*the new image data is not interlaced*/
+		memcpy( header, chunk->Data, sizeof(header) );
+		header[12] = 0;
+		memcpy( deinterlaced.type, chunk->chunkType, CHUNK_TYPE_LENGTH );
+		deinterlaced.data = header;
+		deinterlaced.length = sizeof(header);
+		replacement = &deinterlaced;
+	}
+
+	if (rules->imageData && isChunkType( chunk->chunkType, "IDAT" )) {
+		/*the first IDAT makes room for the new image data, the others are left out*/
+		if (!rewriter->imageDataWritten) {
+			written = flushPending( rewriter ) && writeImageChunks( rules->imageData, writeOutput, rewriter );
+			rewriter->imageDataWritten = TRUE;
+			rewriter->pendingStart = rewriter->pendingEnd = chunkEnd;
+		}
+	}
+	else if (replacement) {
+		written = writeChunk( rewriter, replacement );
+		rewriter->pendingStart = rewriter->pendingEnd = chunkEnd;
+	}
+	else {
+		/*stripped chunks leave a gap, the kept bytes before it are written first*/
+		if (rewriter->pendingEnd != chunkStart) {
+			written = flushPending( rewriter );
+			rewriter->pendingStart = chunkStart;
+		}
+		rewriter->pendingEnd = chunkEnd;
+	}
+	if (written && isChunkType( chunk->chunkType, "IHDR" )) {
+		for (i = 0; written && i < rules->insertCount; i++)
+			written = writeChunk( rewriter, &rules->insert[i] );
+	}
+	if (!written) {
+		rewriter->errorCode = PNG_ERROR_OUTPUT;
+		reportError( &PNG->chunkInfo, PNG_ERROR_OUTPUT, "%s\n", pngErrorString( PNG_ERROR_OUTPUT ) );
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Parse InName and write the rewritten file to OutName, which is removed
+ * again when the input is not a valid PNG. OutName must not be InName
+ */
+int rewriteFile( const char *InName, const char *OutName, const RewriteRules *Rules, int Quiet, FileResult *Result ) {
+	PNGRewriter rewriter;
+	int written;
+
+	Result->fileName = InName;
+	Result->trace = NULL;
+	Result->parsed = FALSE;
+	Result->errorCode = PNG_ERROR_NONE;
+	Result->bytesRead = 0;
+	if (isSameFile( InName, OutName )) {
+		if (!Quiet)
+			printf( "OUTPUT IS THE INPUT FILE: %s\n", OutName );
+		Result->errorCode = PNG_ERROR_OUTPUT;
+		return FALSE;
+	}
+	memset( &rewriter, 0, sizeof(rewriter) );
+	rewriter.rules = Rules;
+	/*the kept ranges are copied from a descriptor of their own*/
+	rewriter.inFd = open( InName, O_RDONLY );
+	if (rewriter.inFd < 0) {
+		if (!Quiet)
+			printf( "Cannot open file %s\n", InName );
+		Result->errorCode = PNG_ERROR_IO;
+		return FALSE;
+	}
+	rewriter.outFd = open( OutName, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+	if (rewriter.outFd < 0) {
+		if (!Quiet)
+			printf( "Cannot create file %s\n", OutName );
+		close( rewriter.inFd );
+		Result->errorCode = PNG_ERROR_OUTPUT;
+		return FALSE;
+	}
+
+	/*the signature is kept, it is the start of the first range*/
+	rewriter.pendingEnd = sizeof(pngHeader);
+	written = parseFileWithHook( InName, Quiet, VERIFY_FULL, rewriteChunkHook, &rewriter, Result ) &&
+			flushPending( &rewriter );
+	if (close( rewriter.outFd ))
+		written = FALSE;
+	close( rewriter.inFd );
+	if (Result->parsed && !written) {
+		if (!Quiet)
+			printf( "%s\n", pngErrorString( PNG_ERROR_OUTPUT ) );
+		Result->errorCode = PNG_ERROR_OUTPUT;
+		Result->parsed = FALSE;
+	}
+	if (!Result->parsed)
+		unlink( OutName );
+	else if (!Quiet)
+		printf( "WROTE %s: %lu BYTES\n", OutName, (unsigned long) rewriter.bytesWritten );
+	return Result->parsed;
+}
@@ -0,0 +1,70 @@
+/*
+ * PNGRewrite.h
+ *
+ *  Write a copy of a file with chunks stripped, inserted or replaced. Kept
+ *  chunks are copied verbatim, only new chunks get a CRC computed
+ */
+
+#ifndef PNGREWRITE_H_
+#define PNGREWRITE_H_
+
+#include "PNGEncode.h"
+
+#define REWRITE_MAX_RULES	32
+#define REWRITE_COPY_BUFFER_SIZE	( 256 * 1024 ) //without copy_file_range()
+
+/*
+ * Chunk written by the rewriter
+ */
+struct rewriteChunk {
+	unsigned char	type[CHUNK_TYPE_LENGTH];
+	unsigned char	*data;
+	size_t			length;
+};
+
+typedef struct rewriteChunk RewriteChunk;
+
+/*
+ * What to change, inserted chunks are written right after IHDR and a
+ * replacement takes the place of every chunk of its type. New image data
+ * takes the place of the IDAT chunks, and the image is no longer interlaced
+ */
+struct rewriteRules {
+	unsigned char	strip[REWRITE_MAX_RULES][CHUNK_TYPE_LENGTH];
+	size_t			stripCount;
+	RewriteChunk	insert[REWRITE_MAX_RULES];
+	size_t			insertCount;
+	RewriteChunk	replace[REWRITE_MAX_RULES];
+	size_t			replaceCount;
+	const EncodedImage	*imageData;
+};
+
+typedef struct rewriteRules RewriteRules;
+
+/*
+ * State of one rewrite, the kept bytes not yet written form one range
+ */
+struct pngRewriter {
+	const RewriteRules	*rules;
+	int				inFd;
+	int				outFd;
+	uint64_t		pendingStart; //input range still to be copied
+	uint64_t		pendingEnd;
+	uint64_t		bytesWritten;
+	int				copyFallback; //copy_file_range() is not usable for these files
+	int				imageDataWritten;
+	int				errorCode;
+};
+
+typedef struct pngRewriter PNGRewriter;
+
+void initRewriteRules(RewriteRules*);
+int addStripRule(RewriteRules*, const char*);
+int addInsertRule(RewriteRules*, const char*, const unsigned char*, size_t);
+int addReplaceRule(RewriteRules*, const char*, const unsigned char*, size_t);
+void freeRewriteRules(RewriteRules*);
+
+int rewriteChunkHook(PNGData*, const Chunk*, void*);
+int rewriteFile(const char*, const char*, const RewriteRules*, int, FileResult*);
+
+#endif /* PNGREWRITE_H_ */
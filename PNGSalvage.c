@@ -0,0 +1,278 @@
+#include "PNGSalvage.h"
+#include "PNGReader.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SALVAGE_SIMD 1
+#endif
+
+#define CHUNK_HEADER_LENGTH	8 //length and type
+#define CHUNK_CRC_LENGTH	4
+#define CHUNK_OVERHEAD	( CHUNK_HEADER_LENGTH + CHUNK_CRC_LENGTH )
+
+static int isLetter( unsigned char Character ) {
+	Character |= 0x20;
+	return Character >= 'a' && Character <= 'z';
+}
+
+#ifdef SALVAGE_SIMD
+/*
+ * Bit i set when byte i of the 16 is an ASCII letter
+ */
+static unsigned int getLetterMask( const unsigned char *Data ) {
+	__m128i bytes = _mm_or_si128( _mm_loadu_si128( (const __m128i*) Data ), _mm_set1_epi8( 0x20 ) );
+	/*bytes above 0x7f are negative and fail the first compare*/
+	__m128i letters = _mm_and_si128( _mm_cmpgt_epi8( bytes, _mm_set1_epi8( 'a' - 1 ) ),
+			_mm_cmplt_epi8( bytes, _mm_set1_epi8( 'z' + 1 ) ) );
+	return (unsigned int) _mm_movemask_epi8( letters );
+}
+#endif
+
+/*
+ * First position from From on where four letters, a possible chunk type,
+ * start. Returns Size when there is none
+ */
+size_t findChunkType( const unsigned char *Data, size_t Size, size_t From ) {
+	size_t i = From;
+#ifdef SALVAGE_SIMD
+	/*16 positions at a time, a run needs the masks at the next three bytes too*/
+	for (; i + 16 + 3 <= Size; i += 16) {
+		unsigned int runs = getLetterMask( Data + i ) & getLetterMask( Data + i + 1 ) &
+				getLetterMask( Data + i + 2 ) & getLetterMask( Data + i + 3 );
+		if (runs)
+			return i + (size_t) __builtin_ctz( runs );
+	}
+#endif
+	for (; i + CHUNK_TYPE_LENGTH <= Size; i++) {
+		if (isLetter( Data[i] ) && isLetter( Data[i + 1] ) && isLetter( Data[i + 2] ) && isLetter( Data[i + 3] ))
+			return i;
+	}
+	return Size;
+}
+
+/*
+ * Length and type that could start a chunk, the reserved bit of the type
+ * must be clear
+ */
+static int isPlausibleHeader( const unsigned char *Data, size_t Size, size_t Offset ) {
+	if (Offset > Size || Size - Offset < CHUNK_HEADER_LENGTH)
+		return FALSE;
+	return getLastByte( Data + Offset ) <= PNG_MAX_VALUE &&
+			isChunkTypeValid( Data + Offset + 4 ) &&
+			!( Data[Offset + 6] & ( 1u << 5 ) );
+}
+
+static int hasValidCrc( const unsigned char *Data, size_t Offset, size_t Length ) {
+	return isValidCrc( Data + Offset + 4, Data + Offset + 8, Length, getLastByte( Data + Offset + 8 + Length ) );
+}
+
+static int writeBytes( FILE *Output, const unsigned char *Data, size_t Length, SalvageReport *Report ) {
+	if (!Output)
+		return TRUE;
+	Report->bytesWritten += Length;
+	return fwrite( Data, 1, Length, Output ) == Length;
+}
+
+/*
+ * Chunk with a fresh CRC, Length may be shorter than the original length
+ */
+static int writeRepairedChunk( FILE *Output, const unsigned char *Type, const unsigned char *Data, size_t Length,
+		SalvageReport *Report ) {
+	unsigned char field[4];
+	uint32_t crc = getChunkCrc( Type, Data, Length );
+	int written;
+	field[0] = (unsigned char) ( Length >> 24 );
+	field[1] = (unsigned char) ( Length >> 16 );
+	field[2] = (unsigned char) ( Length >> 8 );
+	field[3] = (unsigned char) Length;
+	written = writeBytes( Output, field, sizeof(field), Report ) &&
+			writeBytes( Output, Type, CHUNK_TYPE_LENGTH, Report ) &&
+			writeBytes( Output, Data, Length, Report );
+	field[0] = (unsigned char) ( crc >> 24 );
+	field[1] = (unsigned char) ( crc >> 16 );
+	field[2] = (unsigned char) ( crc >> 8 );
+	field[3] = (unsigned char) crc;
+	return written && writeBytes( Output, field, sizeof(field), Report );
+}
+
+/*
+ * Next offset from From on that holds a chunk: a plausible header whose
+ * chunk ends where another plausible header starts, or whose CRC matches.
+ * An IDAT cut off by the end of the file counts too
+ */
+static size_t findNextChunk( const unsigned char *Data, size_t Size, size_t From ) {
+	size_t type = From + 4;
+	while (( type = findChunkType( Data, Size, type ) ) < Size) {
+		size_t offset = type - 4;
+		if (isPlausibleHeader( Data, Size, offset )) {
+			size_t length = getLastByte( Data + offset );
+			if (Size - offset < CHUNK_OVERHEAD || length > Size - offset - CHUNK_OVERHEAD) {
+				if (isChunkType( Data + type, "IDAT" ))
+					return offset;
+			}
+			else if (offset + CHUNK_OVERHEAD + length == Size ||
+					isPlausibleHeader( Data, Size, offset + CHUNK_OVERHEAD + length ) ||
+					hasValidCrc( Data, offset, length )) {
+				return offset;
+			}
+		}
+		type++;
+	}
+	return Size;
+}
+
+/*
+ * A damaged length is restored when the next chunk starts right after a
+ * CRC that matches the data up to it
+ */
+static int repairLength( const unsigned char *Data, size_t Size, size_t Offset, size_t *Length ) {
+	size_t next = findNextChunk( Data, Size, Offset + 1 );
+	if (next == Size || next - Offset < CHUNK_OVERHEAD ||
+			!hasValidCrc( Data, Offset, next - Offset - CHUNK_OVERHEAD ))
+		return FALSE;
+	*Length = next - Offset - CHUNK_OVERHEAD;
+	return TRUE;
+}
+
+/*
+ * Walk the chunks of a file in memory, going on past damage, and write the
+ * repaired file to Output when it is not NULL. Intact chunks are copied as
+ * they are, damaged ones get a new CRC. Returns FALSE only when the output
+ * can't be written
+ */
+int salvageBuffer( const unsigned char *Data, size_t Size, FILE *Output, int Quiet, SalvageReport *Report ) {
+	size_t offset = sizeof(pngHeader);
+	int written = TRUE;
+	int ended = FALSE;
+
+	memset( Report, 0, sizeof(*Report) );
+	Report->bytesRead = Size;
+	if (Size < sizeof(pngHeader) || memcmp( Data, pngHeader, sizeof(pngHeader) )) {
+		Report->badSignature = TRUE;
+		if (!Quiet)
+			printf( "INVALID PNG SIGNATURE\n" );
+	}
+	written = writeBytes( Output, pngHeader, sizeof(pngHeader), Report );
+
+	while (written && !ended && offset < Size) {
+		size_t length;
+		size_t available;
+		if (!isPlausibleHeader( Data, Size, offset )) {
+			size_t next = findNextChunk( Data, Size, offset );
+			if (next == Size && Size - offset < CHUNK_OVERHEAD) {
+				/*a few bytes too short for any chunk, the file was cut*/
+				Report->truncated = TRUE;
+				break;
+			}
+			Report->resyncs++;
+			Report->skippedBytes += next - offset;
+			if (!Quiet)
+				printf( "SKIPPED %lu BYTES AT %lu\n", (unsigned long) ( next - offset ), (unsigned long) offset );
+			offset = next;
+			continue;
+		}
+		length = getLastByte( Data + offset );
+		available = Size - offset - CHUNK_HEADER_LENGTH;
+		if (( available < (uint64_t) length + CHUNK_CRC_LENGTH ||
+				( offset + CHUNK_OVERHEAD + length != Size && !hasValidCrc( Data, offset, length ) &&
+				!isPlausibleHeader( Data, Size, offset + CHUNK_OVERHEAD + length ) ) ) &&
+				repairLength( Data, Size, offset, &length )) {
+			Report->badLengthChunks++;
+			if (!Quiet)
+				printf( "BAD LENGTH IN %.4s AT %lu\n", (const char*) Data + offset + 4, (unsigned long) offset );
+			written = writeRepairedChunk( Output, Data + offset + 4, Data + offset + 8, length, Report );
+		}
+		else if (available < (uint64_t) length + CHUNK_CRC_LENGTH) {
+			/*the file ends inside this chunk, image data is kept as far as it goes*/
+			Report->truncated = TRUE;
+			if (isChunkType( Data + offset + 4, "IDAT" ) && available) {
+				if (available > length)
+					available = length;
+				written = writeRepairedChunk( Output, Data + offset + 4, Data + offset + 8, available, Report );
+				Report->chunks++;
+			}
+			if (!Quiet)
+				printf( "TRUNCATED %.4s AT %lu\n", (const char*) Data + offset + 4, (unsigned long) offset );
+			break;
+		}
+		else if (hasValidCrc( Data, offset, length )) {
+			written = writeBytes( Output, Data + offset, CHUNK_OVERHEAD + length, Report );
+		}
+		else if (offset + CHUNK_OVERHEAD + length == Size ||
+				isPlausibleHeader( Data, Size, offset + CHUNK_OVERHEAD + length )) {
+			/*the boundary holds, the data or the CRC itself is damaged*/
+			Report->badCrcChunks++;
+			if (!Quiet)
+				printf( "BAD CRC IN %.4s AT %lu\n", (const char*) Data + offset + 4, (unsigned long) offset );
+			written = writeRepairedChunk( Output, Data + offset + 4, Data + offset + 8, length, Report );
+		}
+		else {
+			/*the length is damaged, look for the next chunk from inside this one*/
+			size_t next = findNextChunk( Data, Size, offset + 1 );
+			Report->resyncs++;
+			Report->skippedBytes += next - offset;
+			if (!Quiet)
+				printf( "SKIPPED %lu BYTES AT %lu\n", (unsigned long) ( next - offset ), (unsigned long) offset );
+			offset = next;
+			continue;
+		}
+		Report->chunks++;
+		ended = isChunkType( Data + offset + 4, "IEND" );
+		offset += CHUNK_OVERHEAD + length;
+	}
+
+	if (ended) {
+		Report->trailingBytes = Size - offset;
+	}
+	else if (written) {
+		static const unsigned char iend[] = { 'I', 'E', 'N', 'D' };
+		Report->missingIEND = TRUE;
+		if (!Quiet)
+			printf( "MISSING IEND\n" );
+		written = writeRepairedChunk( Output, iend, iend, 0, Report );
+	}
+	return written;
+}
+
+/*
+ * Nothing had to be repaired
+ */
+int isSalvageClean( const SalvageReport *Report ) {
+	return !Report->badSignature && !Report->badCrcChunks && !Report->badLengthChunks && !Report->resyncs &&
+			!Report->truncated && !Report->missingIEND;
+}
+
+/*
+ * Salvage a file, writing the repaired copy to OutName unless it is NULL.
+ * OutName must not be FileName. Returns a PNG_ERROR_* code for files that can't be read or written
+ */
+int salvageFile( const char *FileName, const char *OutName, int Quiet, SalvageReport *Report ) {
+	size_t size;
+	const unsigned char *data = mapFile( FileName, &size );
+	FILE *output = NULL;
+	int errorCode = PNG_ERROR_NONE;
+
+	memset( Report, 0, sizeof(*Report) );
+	if (!data)
+		return PNG_ERROR_IO;
+	/*the input is still mapped, truncating it would fault the reads*/
+	if (OutName && isSameFile( FileName, OutName )) {
+		unmapFile( data, size );
+		return PNG_ERROR_OUTPUT;
+	}
+	if (OutName) {
+		output = fopen( OutName, "wb" );
+		if (!output) {
+			unmapFile( data, size );
+			return PNG_ERROR_OUTPUT;
+		}
+	}
+	if (!salvageBuffer( data, size, output, Quiet, Report ))
+		errorCode = PNG_ERROR_OUTPUT;
+	if (output && fclose( output ))
+		errorCode = PNG_ERROR_OUTPUT;
+	if (errorCode && OutName)
+		remove( OutName );
+	unmapFile( data, size );
+	return errorCode;
+}
@@ -0,0 +1,37 @@
+/*
+ * PNGSalvage.h
+ *
+ *  Walk damaged files past bad CRCs and broken chunk headers, and write a
+ *  repaired copy
+ */
+
+#ifndef PNGSALVAGE_H_
+#define PNGSALVAGE_H_
+
+#include "PNGParser.h"
+
+/*
+ * What the salvage found in one file
+ */
+struct salvageReport {
+	size_t		chunks; //chunks recovered
+	size_t		badCrcChunks; //kept with a recomputed CRC
+	size_t		badLengthChunks; //length restored from the CRC and the next chunk
+	size_t		resyncs; //times the walk lost a chunk boundary
+	uint64_t	skippedBytes; //bytes between a lost boundary and the next chunk
+	uint64_t	trailingBytes; //after IEND
+	uint64_t	bytesRead;
+	uint64_t	bytesWritten;
+	int			badSignature;
+	int			truncated; //the file ends inside a chunk
+	int			missingIEND;
+};
+
+typedef struct salvageReport SalvageReport;
+
+size_t findChunkType(const unsigned char*, size_t, size_t);
+int salvageBuffer(const unsigned char*, size_t, FILE*, int, SalvageReport*);
+int salvageFile(const char*, const char*, int, SalvageReport*);
+int isSalvageClean(const SalvageReport*);
+
+#endif /* PNGSALVAGE_H_ */
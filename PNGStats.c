@@ -0,0 +1,406 @@
+#include "PNGStats.h"
+#include "PNGReader.h"
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define STATS_SIMD 1
+#endif
+
+/*
+ * Decode of statsFile()
+ */
+struct statsDecode {
+	PNGDecoder		decoder;
+	ImageStats		*stats;
+};
+
+typedef struct statsDecode StatsDecode;
+
+/*
+ * Rows are passed on to Sink, which may be NULL, once they are counted
+ */
+void initImageStats( ImageStats *Stats, RowSink Sink, void *Context ) {
+	memset( Stats, 0, sizeof(*Stats) );
+	Stats->sink = Sink;
+	Stats->sinkContext = Context;
+}
+
+static uint16_t readUint16( const unsigned char *Data ) {
+	return (uint16_t) ( ( Data[0] << 8 ) | Data[1] );
+}
+
+/*
+ * Record IHDR and the chunks that make claims about the pixels, to be
+ * called for every chunk before the image data
+ */
+int addStatsChunk( ImageStats *Stats, const Chunk *chunk ) {
+	if (isChunkType( chunk->chunkType, "IHDR" )) {
+		unsigned int channel;
+		if (!readImageHeader( &Stats->header, chunk ))
+			return FALSE;
+		for (channel = 0; channel < STATS_MAX_CHANNELS; channel++)
+			Stats->minimum[channel] = UINT32_MAX;
+		Stats->opaque = TRUE;
+		if (Stats->header.bitDepth < 8) {
+			Stats->samples = (unsigned char*) malloc( Stats->header.width );
+			if (!Stats->samples)
+				return FALSE;
+		}
+		Stats->hasHeader = TRUE;
+	}
+	else if (isChunkType( chunk->chunkType, "PLTE" )) {
+		Stats->paletteEntries = (unsigned int) ( chunk->dataSize / 3 );
+		memcpy( Stats->palette, chunk->Data, Stats->paletteEntries * 3 );
+	}
+	else if (isChunkType( chunk->chunkType, "tRNS" )) {
+		if (Stats->header.colorType == 3 && chunk->dataSize <= PLTE_DATA_LENGTH) {
+			Stats->transparencyLength = (unsigned int) chunk->dataSize;
+			memcpy( Stats->transparency, chunk->Data, chunk->dataSize );
+		}
+		else if (( Stats->header.colorType == 0 && chunk->dataSize == 2 ) ||
+				( Stats->header.colorType == 2 && chunk->dataSize == 6 )) {
+			unsigned int i;
+			for (i = 0; i < chunk->dataSize / 2; i++)
+				Stats->transparentKey[i] = readUint16( chunk->Data + 2 * i );
+			Stats->hasTransparentKey = TRUE;
+		}
+	}
+	else if (isChunkType( chunk->chunkType, "hIST" )) {
+		unsigned int i;
+		Stats->claimedHistogramLength = (unsigned int) ( chunk->dataSize / 2 );
+		if (Stats->claimedHistogramLength > PLTE_DATA_LENGTH)
+			Stats->claimedHistogramLength = PLTE_DATA_LENGTH;
+		for (i = 0; i < Stats->claimedHistogramLength; i++)
+			Stats->claimedHistogram[i] = readUint16( chunk->Data + 2 * i );
+		Stats->hasClaimedHistogram = TRUE;
+	}
+	else if (isChunkType( chunk->chunkType, "sBIT" )) {
+		size_t length = chunk->dataSize < STATS_MAX_CHANNELS ? chunk->dataSize : STATS_MAX_CHANNELS;
+		memcpy( Stats->significantBits, chunk->Data, length );
+		Stats->hasSignificantBits = TRUE;
+	}
+	return TRUE;
+}
+
+/*
+ * Samples of 1, 2 or 4 bits one per byte, the leftmost first
+ */
+static void unpackSamples( const unsigned char *Source, unsigned char *Target, size_t Count, unsigned int BitDepth ) {
+	unsigned int mask = ( 1u << BitDepth ) - 1;
+	size_t i;
+	for (i = 0; i < Count; i++) {
+		size_t bit = i * BitDepth;
+		Target[i] = (unsigned char) ( ( Source[bit / 8] >> ( 8 - BitDepth - bit % 8 ) ) & mask );
+	}
+}
+
+/*
+ * Histograms of 8-bit samples, the minimum, maximum and sum come from the
+ * histograms once the image is done
+ */
+static void countSamples( ImageStats *Stats, const unsigned char *Data, uint32_t Pixels, unsigned int Channels ) {
+	uint32_t i;
+	switch (Channels) {
+	case 1:
+		for (i = 0; i < Pixels; i++)
+			Stats->histogram[0][Data[i]]++;
+		break;
+	case 2:
+		for (i = 0; i < Pixels; i++, Data += 2) {
+			Stats->histogram[0][Data[0]]++;
+			Stats->histogram[1][Data[1]]++;
+		}
+		break;
+	case 3:
+		for (i = 0; i < Pixels; i++, Data += 3) {
+			Stats->histogram[0][Data[0]]++;
+			Stats->histogram[1][Data[1]]++;
+			Stats->histogram[2][Data[2]]++;
+		}
+		break;
+	default:
+		for (i = 0; i < Pixels; i++, Data += 4) {
+			Stats->histogram[0][Data[0]]++;
+			Stats->histogram[1][Data[1]]++;
+			Stats->histogram[2][Data[2]]++;
+			Stats->histogram[3][Data[3]]++;
+		}
+		break;
+	}
+}
+
+static void addWideSample( ImageStats *Stats, unsigned int Channel, uint32_t Value ) {
+	if (Value < Stats->minimum[Channel])
+		Stats->minimum[Channel] = Value;
+	if (Value > Stats->maximum[Channel])
+		Stats->maximum[Channel] = Value;
+	Stats->sum[Channel] += Value;
+}
+
+#ifdef STATS_SIMD
+/*
+ * Add the 32-bit lane sums of Period vectors to the channel sums, lane j
+ * of vector v holds sample 8 * v + j of a group
+ */
+static void flushWideSums( ImageStats *Stats, __m128i *SumLow, __m128i *SumHigh, unsigned int Period,
+		unsigned int Channels ) {
+	uint32_t lanes[8];
+	unsigned int v, j;
+	for (v = 0; v < Period; v++) {
+		_mm_storeu_si128( (__m128i*) lanes, SumLow[v] );
+		_mm_storeu_si128( (__m128i*) ( lanes + 4 ), SumHigh[v] );
+		for (j = 0; j < 8; j++)
+			Stats->sum[( 8 * v + j ) % Channels] += lanes[j];
+		SumLow[v] = SumHigh[v] = _mm_setzero_si128();
+	}
+}
+#endif
+
+/*
+ * Minimum, maximum and sum of big endian 16-bit samples, a group of
+ * vectors covers whole pixels so every lane always sees the same channel
+ */
+static void accumulateWide( ImageStats *Stats, const unsigned char *Data, size_t Samples, unsigned int Channels ) {
+	size_t i = 0;
+#ifdef STATS_SIMD
+	const unsigned int period = Channels == 3 ? 3 : 1;
+	const size_t group = 8 * period;
+	const __m128i bias = _mm_set1_epi16( (short) 0x8000 );
+	const __m128i zero = _mm_setzero_si128();
+	__m128i low[3], high[3], sumLow[3], sumHigh[3];
+	uint16_t lanes[8];
+	size_t groups = 0;
+	unsigned int v, j;
+
+	for (v = 0; v < period; v++) {
+		low[v] = _mm_set1_epi16( 0x7fff );
+		high[v] = bias;
+		sumLow[v] = sumHigh[v] = zero;
+	}
+	for (; i + group <= Samples; i += group) {
+		for (v = 0; v < period; v++) {
+			__m128i x = _mm_loadu_si128( (const __m128i*) ( Data + 2 * ( i + 8 * v ) ) );
+			__m128i biased;
+			x = _mm_or_si128( _mm_slli_epi16( x, 8 ), _mm_srli_epi16( x, 8 ) );
+			/*signed compares of the samples moved down by 0x8000 order them as unsigned*/
+			biased = _mm_xor_si128( x, bias );
+			low[v] = _mm_min_epi16( low[v], biased );
+			high[v] = _mm_max_epi16( high[v], biased );
+			sumLow[v] = _mm_add_epi32( sumLow[v], _mm_unpacklo_epi16( x, zero ) );
+			sumHigh[v] = _mm_add_epi32( sumHigh[v], _mm_unpackhi_epi16( x, zero ) );
+		}
+		/*a 32-bit lane holds 65536 samples of 16 bits*/
+		if (++groups == 65536) {
+			flushWideSums( Stats, sumLow, sumHigh, period, Channels );
+			groups = 0;
+		}
+	}
+	flushWideSums( Stats, sumLow, sumHigh, period, Channels );
+	if (i) {
+		for (v = 0; v < period; v++) {
+			_mm_storeu_si128( (__m128i*) lanes, _mm_xor_si128( low[v], bias ) );
+			for (j = 0; j < 8; j++) {
+				if (lanes[j] < Stats->minimum[( 8 * v + j ) % Channels])
+					Stats->minimum[( 8 * v + j ) % Channels] = lanes[j];
+			}
+			_mm_storeu_si128( (__m128i*) lanes, _mm_xor_si128( high[v], bias ) );
+			for (j = 0; j < 8; j++) {
+				if (lanes[j] > Stats->maximum[( 8 * v + j ) % Channels])
+					Stats->maximum[( 8 * v + j ) % Channels] = lanes[j];
+			}
+		}
+	}
+#endif
+	for (; i < Samples; i++)
+		addWideSample( Stats, (unsigned int) ( i % Channels ), readUint16( Data + 2 * i ) );
+}
+
+/*
+ * Whether a pixel of a greyscale or truecolour row matches the tRNS colour
+ */
+static int hasTransparentPixel( const ImageStats *Stats, const unsigned char *Data ) {
+	const ImageHeader *header = &Stats->header;
+	uint32_t x;
+	unsigned int channel;
+	for (x = 0; x < header->width; x++) {
+		for (channel = 0; channel < header->channels; channel++) {
+			size_t sample = (size_t) x * header->channels + channel;
+			uint16_t value = header->bitDepth == 16 ? readUint16( Data + 2 * sample ) : Data[sample];
+			if (value != Stats->transparentKey[channel])
+				break;
+		}
+		if (channel == header->channels)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/*
+ * RowSink that counts a row and passes it on
+ */
+int statsRowSink( void *Context, uint32_t Row, const unsigned char *Data, size_t Length ) {
+	ImageStats *stats = (ImageStats*) Context;
+	const ImageHeader *header = &stats->header;
+	const unsigned char *samples = Data;
+
+	if (header->bitDepth < 8) {
+		unpackSamples( Data, stats->samples, header->width, header->bitDepth );
+		samples = stats->samples;
+	}
+	if (header->bitDepth == 16) {
+		size_t count = (size_t) header->width * header->channels;
+		size_t i;
+		accumulateWide( stats, Data, count, header->channels );
+		for (i = 0; i < count; i++)
+			stats->histogram[i % header->channels][Data[2 * i]]++;
+	}
+	else {
+		countSamples( stats, samples, header->width, header->channels );
+	}
+	if (stats->hasTransparentKey && stats->opaque && hasTransparentPixel( stats, samples ))
+		stats->opaque = FALSE;
+	stats->pixels += header->width;
+	return !stats->sink || stats->sink( stats->sinkContext, Row, Data, Length );
+}
+
+/*
+ * Palette entries that at least one pixel uses, the decoder rejects
+ * indices past the palette
+ */
+unsigned int getPaletteEntriesUsed( const ImageStats *Stats ) {
+	unsigned int used = 0;
+	unsigned int i;
+	for (i = 0; i < Stats->paletteEntries; i++)
+		used += Stats->histogram[0][i] != 0;
+	return used;
+}
+
+static unsigned int countDistinct( const uint64_t *Histogram ) {
+	unsigned int distinct = 0;
+	unsigned int i;
+	for (i = 0; i < STATS_HISTOGRAM_BINS; i++)
+		distinct += Histogram[i] != 0;
+	return distinct;
+}
+
+/*
+ * A hIST entry is zero exactly when no pixel uses the palette entry, there
+ * is one entry for every palette entry
+ */
+static int isHistogramValid( const ImageStats *Stats ) {
+	unsigned int i;
+	if (Stats->claimedHistogramLength != Stats->paletteEntries)
+		return FALSE;
+	for (i = 0; i < Stats->paletteEntries; i++) {
+		if (!Stats->claimedHistogram[i] != !Stats->histogram[0][i])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Samples with n significant bits can only take 2^n values however they
+ * were scaled up to the bit depth. Palette images claim it for the palette
+ * entries, 16-bit samples are only checked down to their high byte
+ */
+static int areSignificantBitsValid( const ImageStats *Stats ) {
+	const ImageHeader *header = &Stats->header;
+	unsigned int channel;
+	if (header->colorType == 3) {
+		for (channel = 0; channel < 3; channel++) {
+			uint64_t values[STATS_HISTOGRAM_BINS];
+			unsigned int i;
+			if (Stats->significantBits[channel] >= 8)
+				continue;
+			memset( values, 0, sizeof(values) );
+			for (i = 0; i < Stats->paletteEntries; i++)
+				values[Stats->palette[3 * i + channel]] = 1;
+			if (countDistinct( values ) > 1u << Stats->significantBits[channel])
+				return FALSE;
+		}
+		return TRUE;
+	}
+	for (channel = 0; channel < header->channels; channel++) {
+		if (Stats->significantBits[channel] >= 8 || Stats->significantBits[channel] >= header->bitDepth)
+			continue;
+		if (countDistinct( Stats->histogram[channel] ) > 1u << Stats->significantBits[channel])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * Complete the statistics once every row is in and check hIST and sBIT,
+ * returns FALSE when either of them doesn't agree with the pixels
+ */
+int finishImageStats( ImageStats *Stats ) {
+	const ImageHeader *header = &Stats->header;
+	unsigned int channel;
+	if (header->bitDepth <= 8) {
+		for (channel = 0; channel < header->channels; channel++) {
+			uint32_t value;
+			for (value = 0; value < STATS_HISTOGRAM_BINS; value++) {
+				if (!Stats->histogram[channel][value])
+					continue;
+				if (value < Stats->minimum[channel])
+					Stats->minimum[channel] = value;
+				Stats->maximum[channel] = value;
+				Stats->sum[channel] += Stats->histogram[channel][value] * value;
+			}
+		}
+	}
+	if (header->colorType == 4 || header->colorType == 6)
+		Stats->opaque = Stats->minimum[header->channels - 1] == ( 1u << header->bitDepth ) - 1;
+	else if (header->colorType == 3) {
+		unsigned int i;
+		for (i = 0; i < Stats->transparencyLength; i++) {
+			if (Stats->transparency[i] != 0xff && Stats->histogram[0][i])
+				Stats->opaque = FALSE;
+		}
+	}
+	Stats->histogramValid = !Stats->hasClaimedHistogram || isHistogramValid( Stats );
+	Stats->significantBitsValid = !Stats->hasSignificantBits || areSignificantBitsValid( Stats );
+	return Stats->histogramValid && Stats->significantBitsValid;
+}
+
+void freeImageStats( ImageStats *Stats ) {
+	free( Stats->samples );
+	Stats->samples = NULL;
+}
+
+/*
+ * chunkHook of statsFile()
+ */
+static int statsChunkHook( PNGData *PNG, const Chunk *chunk, void *Context ) {
+	StatsDecode *decode = (StatsDecode*) Context;
+	if (!addStatsChunk( decode->stats, chunk )) {
+		reportError( &PNG->chunkInfo, PNG_ERROR_MEMORY, "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+		return FALSE;
+	}
+	if (decodeChunk( &decode->decoder, chunk ))
+		return TRUE;
+	reportError( &PNG->chunkInfo, decode->decoder.errorCode, "%s\n", pngErrorString( decode->decoder.errorCode ) );
+	return FALSE;
+}
+
+/*
+ * Decode FileName once and gather the statistics of its pixels in Stats,
+ * which must be freed with freeImageStats() either way. A file whose hIST
+ * or sBIT doesn't agree with its pixels fails without printing, that is
+ * left to the caller
+ */
+int statsFile( const char *FileName, int Quiet, ImageStats *Stats, FileResult *Result ) {
+	StatsDecode decode;
+
+	initImageStats( Stats, NULL, NULL );
+	decode.stats = Stats;
+	initDecoder( &decode.decoder, statsRowSink, Stats );
+	if (parseFileWithHook( FileName, Quiet, VERIFY_FULL, statsChunkHook, &decode, Result ) &&
+			!finishImageStats( Stats )) {
+		Result->errorCode = Stats->histogramValid ? PNG_ERROR_SIGNIFICANT_BITS : PNG_ERROR_HISTOGRAM;
+		Result->parsed = FALSE;
+	}
+	freeDecoder( &decode.decoder );
+	return Result->parsed;
+}
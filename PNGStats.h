@@ -0,0 +1,62 @@
+/*
+ * PNGStats.h
+ *
+ *  Statistics of the decoded pixels gathered while the rows are decoded,
+ *  and the checks of the hIST and sBIT chunks against them
+ */
+
+#ifndef PNGSTATS_H_
+#define PNGSTATS_H_
+
+#include "PNGDecode.h"
+
+#define STATS_MAX_CHANNELS	4
+#define STATS_HISTOGRAM_BINS	256
+
+/*
+ * Pixels of one image. Samples of 16 bits fall into the histogram bin of
+ * their high byte, the samples of indexed images are the palette indexes so
+ * their histogram counts the use of every palette entry
+ */
+struct imageStats {
+	ImageHeader		header;
+	int				hasHeader;
+	uint32_t		minimum[STATS_MAX_CHANNELS];
+	uint32_t		maximum[STATS_MAX_CHANNELS];
+	uint64_t		sum[STATS_MAX_CHANNELS];
+	uint64_t		pixels;
+	uint64_t		histogram[STATS_MAX_CHANNELS][STATS_HISTOGRAM_BINS];
+	int				opaque; //no pixel is even partly transparent
+
+	/*claims of the file checked by finishImageStats()*/
+	unsigned char	palette[3 * PLTE_DATA_LENGTH];
+	unsigned int	paletteEntries;
+	unsigned char	transparency[PLTE_DATA_LENGTH]; //tRNS of indexed images
+	unsigned int	transparencyLength;
+	uint16_t		transparentKey[3]; //tRNS of greyscale and truecolour images
+	int				hasTransparentKey;
+	uint16_t		claimedHistogram[PLTE_DATA_LENGTH]; //hIST
+	unsigned int	claimedHistogramLength;
+	int				hasClaimedHistogram;
+	unsigned char	significantBits[STATS_MAX_CHANNELS]; //sBIT
+	int				hasSignificantBits;
+	int				histogramValid; //hIST agrees with the pixels
+	int				significantBitsValid; //sBIT agrees with the pixels
+
+	/*rows passed on after they were counted*/
+	RowSink			sink;
+	void			*sinkContext;
+	unsigned char	*samples; //a row of low bit depth unpacked
+};
+
+typedef struct imageStats ImageStats;
+
+void initImageStats(ImageStats*, RowSink, void*);
+int addStatsChunk(ImageStats*, const Chunk*);
+int statsRowSink(void*, uint32_t, const unsigned char*, size_t);
+int finishImageStats(ImageStats*);
+unsigned int getPaletteEntriesUsed(const ImageStats*);
+void freeImageStats(ImageStats*);
+int statsFile(const char*, int, ImageStats*, FileResult*);
+
+#endif /* PNGSTATS_H_ */
@@ -0,0 +1,71 @@
+#include "PNGThreads.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/*Threads used by the parallel code paths, 0 means one per online core*/
+static unsigned int threadCount = 0;
+
+/*
+ * Work shared by the threads of one parallelFor() call
+ */
+struct parallelWork {
+	ParallelTask	task;
+	void			*context;
+	size_t			count;
+	size_t			next; //next index to hand out
+};
+
+typedef struct parallelWork ParallelWork;
+
+void setThreadCount( unsigned int Threads ) {
+	threadCount = ( Threads > MAX_WORKER_THREADS ) ? MAX_WORKER_THREADS : Threads;
+}
+
+unsigned int getThreadCount( void ) {
+	long cores;
+	if (threadCount)
+		return threadCount;
+	cores = sysconf( _SC_NPROCESSORS_ONLN );
+	if (cores < 1)
+		return 1;
+	return ( cores > MAX_WORKER_THREADS ) ? MAX_WORKER_THREADS : (unsigned int) cores;
+}
+
+static void *parallelWorker( void *Context ) {
+	ParallelWork *work = (ParallelWork*) Context;
+	for (;;) {
+		size_t index = __atomic_fetch_add( &work->next, 1, __ATOMIC_RELAXED );
+		if (index >= work->count)
+			break;
+		work->task( work->context, index );
+	}
+	return NULL;
+}
+
+/*
+ * Call Task for every index below Count on up to Threads threads, the
+ * calling thread takes part. Returns when all of them are done
+ */
+void parallelFor( size_t Count, unsigned int Threads, ParallelTask Task, void *Context ) {
+	pthread_t threads[MAX_WORKER_THREADS];
+	unsigned int started = 0;
+	unsigned int i;
+	ParallelWork work;
+
+	work.task = Task;
+	work.context = Context;
+	work.count = Count;
+	work.next = 0;
+	if (Threads > MAX_WORKER_THREADS)
+		Threads = MAX_WORKER_THREADS;
+	if (Threads > Count)
+		Threads = (unsigned int) Count;
+	for (i = 1; i < Threads; i++) {
+		if (pthread_create( &threads[started], NULL, parallelWorker, &work ))
+			break;
+		started++;
+	}
+	parallelWorker( &work );
+	for (i = 0; i < started; i++)
+		pthread_join( threads[i], NULL );
+}
@@ -0,0 +1,23 @@
+/*
+ * PNGThreads.h
+ *
+ *  Run independent pieces of work on several cores
+ */
+
+#ifndef PNGTHREADS_H_
+#define PNGTHREADS_H_
+
+#include <stddef.h>
+
+#define MAX_WORKER_THREADS	256
+
+/*
+ * Work item of parallelFor(), called once for every index
+ */
+typedef void (*ParallelTask)(void*, size_t);
+
+void setThreadCount(unsigned int);
+unsigned int getThreadCount(void);
+void parallelFor(size_t, unsigned int, ParallelTask, void*);
+
+#endif /* PNGTHREADS_H_ */
@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+#include "PNGWalk.h"
+#include "PNGThreads.h"
+#include "PNGLatency.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/*
+ * Record of getdents64(), glibc doesn't declare it
+ */
+struct linuxDirent64 {
+	uint64_t		d_ino;
+	int64_t			d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char			d_name[];
+};
+
+/*
+ * File of the queue of processFileList(), opened and read ahead
+ */
+struct walkItem {
+	size_t	index;
+	int		fd;
+};
+
+typedef struct walkItem WalkItem;
+
+/*
+ * Bounded queue between the thread opening the files and the parsers
+ */
+struct walkQueue {
+	const FileList		*list;
+	int					verifyLevel;
+	FileResultCallback	callback;
+	void				*context;
+	pthread_mutex_t		lock;
+	pthread_cond_t		notEmpty;
+	pthread_cond_t		notFull;
+	WalkItem			items[WALK_QUEUE_DEPTH];
+	size_t				head;
+	size_t				length;
+	int					done; //every file has been queued
+	pthread_mutex_t		resultLock; //the callback is called by one parser at a time
+};
+
+typedef struct walkQueue WalkQueue;
+
+void initFileList( FileList *List ) {
+	memset( List, 0, sizeof(*List) );
+}
+
+static int isPNGName( const char *Name ) {
+	size_t length = strlen( Name );
+	return length >= 4 && !strcasecmp( Name + length - 4, ".png" );
+}
+
+/*
+ * Append Directory/Name to the list
+ */
+static int addFile( FileList *List, const char *Directory, size_t DirectoryLength, const char *Name, uint64_t Inode ) {
+	size_t nameLength = strlen( Name );
+	size_t required = DirectoryLength + 1 + nameLength + 1;
+	char *path;
+
+	if (List->namesLength + required > List->namesCapacity) {
+		size_t capacity = List->namesCapacity ? 2 * List->namesCapacity : 64 * 1024;
+		char *names;
+		while (capacity < List->namesLength + required)
+			capacity *= 2;
+		names = (char*) realloc( List->names, capacity );
+		if (!names)
+			return FALSE;
+		List->names = names;
+		List->namesCapacity = capacity;
+	}
+	if (List->count == List->capacity) {
+		size_t capacity = List->capacity ? 2 * List->capacity : 1024;
+		WalkEntry *entries = (WalkEntry*) realloc( List->entries, capacity * sizeof(WalkEntry) );
+		if (!entries)
+			return FALSE;
+		List->entries = entries;
+		List->capacity = capacity;
+	}
+	path = List->names + List->namesLength;
+	if (DirectoryLength) {
+		memcpy( path, Directory, DirectoryLength );
+		path[DirectoryLength] = '/';
+		memcpy( path + DirectoryLength + 1, Name, nameLength + 1 );
+	}
+	else {
+		memcpy( path, Name, nameLength + 1 );
+		required--;
+	}
+	List->entries[List->count].inode = Inode;
+	List->entries[List->count].name = List->namesLength;
+	List->count++;
+	List->namesLength += required;
+	return TRUE;
+}
+
+/*
+ * Print an entry of the walk that can't be read, with the reason in errno,
+ * and count it so that the totals show it as a failure
+ */
+static void reportUnreadable( FileList *List, const char *Path, const char *Name ) {
+	int error = errno;
+	printf( "CAN'T READ: %s%s%s (%s)\n", Path, Name ? "/" : "", Name ? Name : "", strerror( error ) );
+	List->unreadable++;
+}
+
+/*
+ * Read the directory open as DirectoryFd, named Path, and the directories
+ * below it. The inode numbers come with the entries so no file is stat()ed
+ * unless the file system doesn't report the entry types
+ */
+static int walkAt( FileList *List, int DirectoryFd, char *Path, size_t PathLength ) {
+	char *buffer = (char*) malloc( WALK_DIRENT_BUFFER );
+	int walked = TRUE;
+	long bytes;
+
+	if (!buffer) {
+		close( DirectoryFd );
+		return FALSE;
+	}
+	List->directories++;
+	while (walked && ( bytes = syscall( SYS_getdents64, DirectoryFd, buffer, WALK_DIRENT_BUFFER ) ) > 0) {
+		long offset;
+		for (offset = 0; walked && offset < bytes;) {
+			struct linuxDirent64 *entry = (struct linuxDirent64*) ( buffer + offset );
+			unsigned char type = entry->d_type;
+			offset += entry->d_reclen;
+			if (!strcmp( entry->d_name, "." ) || !strcmp( entry->d_name, ".." ))
+				continue;
+			if (type == DT_UNKNOWN) {
+				struct stat status;
+				if (fstatat( DirectoryFd, entry->d_name, &status, AT_SYMLINK_NOFOLLOW )) {
+					reportUnreadable( List, Path, entry->d_name );
+					continue;
+				}
+				type = S_ISDIR( status.st_mode ) ? DT_DIR : S_ISREG( status.st_mode ) ? DT_REG : DT_UNKNOWN;
+			}
+			if (type == DT_REG && isPNGName( entry->d_name )) {
+				walked = addFile( List, Path, PathLength, entry->d_name, entry->d_ino );
+			}
+			else if (type == DT_DIR) {
+				size_t nameLength = strlen( entry->d_name );
+				int fd;
+				if (PathLength + 1 + nameLength >= PATH_MAX) {
+					errno = ENAMETOOLONG;
+					reportUnreadable( List, Path, entry->d_name );
+					continue;
+				}
+				fd = openat( DirectoryFd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+				if (fd < 0) {
+					reportUnreadable( List, Path, entry->d_name );
+					continue;
+				}
+				Path[PathLength] = '/';
+				memcpy( Path + PathLength + 1, entry->d_name, nameLength + 1 );
+				walked = walkAt( List, fd, Path, PathLength + 1 + nameLength );
+				Path[PathLength] = 0;
+			}
+		}
+	}
+	if (walked && bytes < 0)
+		reportUnreadable( List, Path, NULL );
+	free( buffer );
+	close( DirectoryFd );
+	return walked;
+}
+
+/*
+ * Add the *.png files below Root to List, Root may be a file itself.
+ * Returns FALSE when Root can't be read or memory runs out, the entries
+ * below it that can't be read are printed and counted in List->unreadable
+ */
+int walkDirectory( FileList *List, const char *Root ) {
+	char path[PATH_MAX];
+	size_t length = strlen( Root );
+	struct stat status;
+	int fd;
+
+	if (stat( Root, &status ))
+		return FALSE;
+	if (!S_ISDIR( status.st_mode ))
+		return addFile( List, NULL, 0, Root, (uint64_t) status.st_ino );
+	if (length >= PATH_MAX)
+		return FALSE;
+	while (length > 1 && Root[length - 1] == '/')
+		length--;
+	memcpy( path, Root, length );
+	path[length] = 0;
+	fd = open( path, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+	if (fd < 0)
+		return FALSE;
+	return walkAt( List, fd, path, length );
+}
+
+static int compareInodes( const void *First, const void *Second ) {
+	uint64_t first = ( (const WalkEntry*) First )->inode;
+	uint64_t second = ( (const WalkEntry*) Second )->inode;
+	return first < second ? -1 : first > second;
+}
+
+/*
+ * Order the files by inode, which most file systems allocate close to where
+ * the data goes, so the reads move across the disk in one direction
+ */
+void sortFileList( FileList *List ) {
+	qsort( List->entries, List->count, sizeof(WalkEntry), compareInodes );
+}
+
+const char *getListName( const FileList *List, size_t Index ) {
+	return List->names + List->entries[Index].name;
+}
+
+/*
+ * Pointers to the names in list order for the functions taking an array,
+ * valid while the list is, free() it when done
+ */
+char **getListNames( const FileList *List ) {
+	char **names = (char**) malloc( ( List->count ? List->count : 1 ) * sizeof(char*) );
+	size_t i;
+	if (!names)
+		return NULL;
+	for (i = 0; i < List->count; i++)
+		names[i] = List->names + List->entries[i].name;
+	return names;
+}
+
+void freeFileList( FileList *List ) {
+	free( List->names );
+	free( List->entries );
+	initFileList( List );
+}
+
+static void reportResult( WalkQueue *Queue, const FileResult *Result ) {
+	pthread_mutex_lock( &Queue->resultLock );
+	Queue->callback( Result, Queue->context );
+	pthread_mutex_unlock( &Queue->resultLock );
+}
+
+/*
+ * Parse one open file with blocking reads, its pages should already be on
+ * their way into the page cache
+ */
+static void parseQueuedFile( WalkQueue *Queue, const WalkItem *Item, unsigned char *Buffer ) {
+	FileResult result;
+	PNGData PNG;
+	int parsed = TRUE;
+	ssize_t bytesRead;
+
+	result.fileName = getListName( Queue->list, Item->index );
+	result.errorCode = PNG_ERROR_NONE;
+	result.bytesRead = 0;
+	/*timed from here, the wait in the queue is readahead*/
+	result.trace = startChunkTrace();
+	initPNGProcess( &PNG );
+	PNG.chunkInfo.quiet = TRUE;
+	PNG.verifyLevel = Queue->verifyLevel;
+	PNG.trace = result.trace;
+	while (parsed && ( bytesRead = read( Item->fd, Buffer, READ_BUFFER_SIZE ) ) > 0) {
+		result.bytesRead += (size_t) bytesRead;
+		parsed = processBuffer( &PNG, Buffer, (size_t) bytesRead );
+	}
+	if (parsed && bytesRead < 0) {
+		reportError( &PNG.chunkInfo, PNG_ERROR_IO, "%s\n", pngErrorString( PNG_ERROR_IO ) );
+		parsed = FALSE;
+	}
+	if (parsed)
+		parsed = processFinish( &PNG );
+	result.parsed = parsed;
+	result.errorCode = pngGetError( &PNG );
+	freePNGData( &PNG );
+	close( Item->fd );
+	finishChunkTrace( result.trace );
+	reportResult( Queue, &result );
+	freeChunkTrace( result.trace );
+}
+
+static void *parserThread( void *Context ) {
+	WalkQueue *queue = (WalkQueue*) Context;
+	unsigned char *buffer = (unsigned char*) malloc( READ_BUFFER_SIZE );
+	for (;;) {
+		WalkItem item;
+		pthread_mutex_lock( &queue->lock );
+		while (!queue->length && !queue->done)
+			pthread_cond_wait( &queue->notEmpty, &queue->lock );
+		if (!queue->length) {
+			pthread_mutex_unlock( &queue->lock );
+			break;
+		}
+		item = queue->items[queue->head];
+		queue->head = ( queue->head + 1 ) % WALK_QUEUE_DEPTH;
+		queue->length--;
+		pthread_cond_signal( &queue->notFull );
+		pthread_mutex_unlock( &queue->lock );
+
+		if (buffer) {
+			parseQueuedFile( queue, &item, buffer );
+		}
+		else {
+			FileResult result;
+			result.fileName = getListName( queue->list, item.index );
+			result.trace = NULL;
+			result.parsed = FALSE;
+			result.errorCode = PNG_ERROR_MEMORY;
+			result.bytesRead = 0;
+			close( item.fd );
+			reportResult( queue, &result );
+		}
+	}
+	free( buffer );
+	return NULL;
+}
+
+/*
+ * Validate the files of List in list order on Threads parser threads. The
+ * calling thread opens the files and starts their readahead, staying at
+ * most WALK_QUEUE_DEPTH files ahead of the parsers. The callback is invoked
+ * once per file, from one thread at a time
+ */
+int processFileList( const FileList *List, unsigned int Threads, int VerifyLevel, FileResultCallback Callback,
+		void *Context ) {
+	pthread_t threads[MAX_WORKER_THREADS];
+	unsigned int started = 0;
+	WalkQueue queue;
+	size_t i;
+
+	if (!Threads)
+		Threads = getThreadCount();
+	if (Threads > MAX_WORKER_THREADS)
+		Threads = MAX_WORKER_THREADS;
+	memset( &queue, 0, sizeof(queue) );
+	queue.list = List;
+	queue.verifyLevel = VerifyLevel;
+	queue.callback = Callback;
+	queue.context = Context;
+	pthread_mutex_init( &queue.lock, NULL );
+	pthread_mutex_init( &queue.resultLock, NULL );
+	pthread_cond_init( &queue.notEmpty, NULL );
+	pthread_cond_init( &queue.notFull, NULL );
+	for (; started < Threads; started++) {
+		if (pthread_create( &threads[started], NULL, parserThread, &queue ))
+			break;
+	}
+	if (!started) {
+		pthread_mutex_destroy( &queue.lock );
+		pthread_mutex_destroy( &queue.resultLock );
+		pthread_cond_destroy( &queue.notEmpty );
+		pthread_cond_destroy( &queue.notFull );
+		return FALSE;
+	}
+
+	for (i = 0; i < List->count; i++) {
+		WalkItem item;
+		item.index = i;
+		item.fd = open( getListName( List, i ), O_RDONLY | O_CLOEXEC );
+		if (item.fd < 0) {
+			FileResult result;
+			result.fileName = getListName( List, i );
+			result.trace = NULL;
+			result.parsed = FALSE;
+			result.errorCode = PNG_ERROR_IO;
+			result.bytesRead = 0;
+			reportResult( &queue, &result );
+			continue;
+		}
+		/*the kernel reads the file in the background while it waits in the queue*/
+		posix_fadvise( item.fd, 0, WALK_READAHEAD_BYTES, POSIX_FADV_WILLNEED );
+		posix_fadvise( item.fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+		pthread_mutex_lock( &queue.lock );
+		while (queue.length == WALK_QUEUE_DEPTH)
+			pthread_cond_wait( &queue.notFull, &queue.lock );
+		queue.items[( queue.head + queue.length ) % WALK_QUEUE_DEPTH] = item;
+		queue.length++;
+		pthread_cond_signal( &queue.notEmpty );
+		pthread_mutex_unlock( &queue.lock );
+	}
+	pthread_mutex_lock( &queue.lock );
+	queue.done = TRUE;
+	pthread_cond_broadcast( &queue.notEmpty );
+	pthread_mutex_unlock( &queue.lock );
+
+	while (started)
+		pthread_join( threads[--started], NULL );
+	pthread_mutex_destroy( &queue.lock );
+	pthread_mutex_destroy( &queue.resultLock );
+	pthread_cond_destroy( &queue.notEmpty );
+	pthread_cond_destroy( &queue.notFull );
+	return TRUE;
+}
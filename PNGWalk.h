@@ -0,0 +1,49 @@
+/*
+ * PNGWalk.h
+ *
+ *  Collect the PNG files of directory trees and validate them in the order
+ *  they are stored on disk, reading ahead of the parsers
+ */
+
+#ifndef PNGWALK_H_
+#define PNGWALK_H_
+
+#include "PNGParser.h"
+
+#define WALK_DIRENT_BUFFER	( 64 * 1024 ) //getdents64() buffer of a directory
+#define WALK_QUEUE_DEPTH	64 //files opened and read ahead of the parsers
+#define WALK_READAHEAD_BYTES	( 4 * 1024 * 1024 ) //of a file as it is queued
+
+/*
+ * File found by walkDirectory(), the name is an offset into the names of
+ * the list so that millions of files take few allocations
+ */
+struct walkEntry {
+	uint64_t	inode;
+	size_t		name;
+};
+
+typedef struct walkEntry WalkEntry;
+
+struct fileList {
+	char		*names; //the paths one after the other, null terminated
+	size_t		namesLength;
+	size_t		namesCapacity;
+	WalkEntry	*entries;
+	size_t		count;
+	size_t		capacity;
+	size_t		directories; //directories read
+	size_t		unreadable; //entries that couldn't be opened or stat()ed, reported as they were met
+};
+
+typedef struct fileList FileList;
+
+void initFileList(FileList*);
+int walkDirectory(FileList*, const char*);
+void sortFileList(FileList*);
+const char *getListName(const FileList*, size_t);
+char **getListNames(const FileList*);
+void freeFileList(FileList*);
+int processFileList(const FileList*, unsigned int, int, FileResultCallback, void*);
+
+#endif /* PNGWALK_H_ */
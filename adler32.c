@@ -0,0 +1,167 @@
+
+/* Adler-32 of the zlib stream (RFC 1950) with SSSE3 and AVX2 versions
+    picked at run time. The running value starts at 1. */
+
+#include "adler32.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ADLER_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Plain version, also used for the tails of the vector versions. */
+unsigned long adler32_scalar(unsigned long adler, const unsigned char *buf, size_t len)
+{
+    unsigned long s1 = adler & 0xffff;
+    unsigned long s2 = (adler >> 16) & 0xffff;
+
+    while (len) {
+        size_t n = (len < ADLER_NMAX) ? len : ADLER_NMAX;
+
+        len -= n;
+        while (n--) {
+            s1 += *buf++;
+            s2 += s1;
+        }
+        s1 %= ADLER_BASE;
+        s2 %= ADLER_BASE;
+    }
+    return (s2 << 16) | s1;
+}
+
+#ifdef ADLER_SIMD
+
+#define ADLER_BLOCK 32
+
+/* Each 32 byte block adds sum(buf) to s1 and sum((32 - i) * buf[i]) plus
+    32 * s1 to s2. The per byte weights come from maddubs, the byte sums
+    from sad against zero. */
+__attribute__((target("ssse3")))
+static unsigned long adler32_ssse3(unsigned long adler, const unsigned char *buf, size_t len)
+{
+    unsigned long s1 = adler & 0xffff;
+    unsigned long s2 = (adler >> 16) & 0xffff;
+    size_t blocks = len / ADLER_BLOCK;
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    len -= blocks * ADLER_BLOCK;
+    while (blocks) {
+        size_t n = ADLER_NMAX / ADLER_BLOCK;
+        __m128i v_ps, v_s1, v_s2, sum;
+
+        if (n > blocks)
+            n = blocks;
+        blocks -= n;
+        v_ps = _mm_set_epi32(0, 0, 0, (int) (s1 * n));
+        v_s2 = _mm_set_epi32(0, 0, 0, (int) s2);
+        v_s1 = _mm_setzero_si128();
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *) buf);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *) (buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            buf += ADLER_BLOCK;
+        } while (--n);
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        sum = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        s1 += (unsigned int) _mm_cvtsi128_si32(sum);
+        sum = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        s2 = (unsigned int) _mm_cvtsi128_si32(sum);
+        s1 %= ADLER_BASE;
+        s2 %= ADLER_BASE;
+    }
+    return adler32_scalar((s2 << 16) | s1, buf, len);
+}
+
+/* Same as adler32_ssse3() with the whole block in one register. */
+__attribute__((target("avx2")))
+static unsigned long adler32_avx2(unsigned long adler, const unsigned char *buf, size_t len)
+{
+    unsigned long s1 = adler & 0xffff;
+    unsigned long s2 = (adler >> 16) & 0xffff;
+    size_t blocks = len / ADLER_BLOCK;
+    const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+            16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+
+    len -= blocks * ADLER_BLOCK;
+    while (blocks) {
+        size_t n = ADLER_NMAX / ADLER_BLOCK;
+        __m256i v_ps, v_s1, v_s2;
+        __m128i sum;
+
+        if (n > blocks)
+            n = blocks;
+        blocks -= n;
+        v_ps = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, (int) (s1 * n));
+        v_s2 = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, (int) s2);
+        v_s1 = _mm256_setzero_si256();
+        do {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i *) buf);
+
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+            v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+            buf += ADLER_BLOCK;
+        } while (--n);
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+
+        sum = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        s1 += (unsigned int) _mm_cvtsi128_si32(sum);
+        sum = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        s2 = (unsigned int) _mm_cvtsi128_si32(sum);
+        s1 %= ADLER_BASE;
+        s2 %= ADLER_BASE;
+    }
+    return adler32_scalar((s2 << 16) | s1, buf, len);
+}
+
+typedef unsigned long (*adler32_function)(unsigned long, const unsigned char *, size_t);
+
+/* Pick the widest version the CPU supports, on the first call. */
+static unsigned long adler32_dispatch(unsigned long adler, const unsigned char *buf, size_t len);
+
+static adler32_function adler32_selected = adler32_dispatch;
+
+static unsigned long adler32_dispatch(unsigned long adler, const unsigned char *buf, size_t len)
+{
+    adler32_function selected = adler32_scalar;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        selected = adler32_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        selected = adler32_ssse3;
+    __atomic_store_n(&adler32_selected, selected, __ATOMIC_RELAXED);
+    return selected(adler, buf, len);
+}
+
+/* Update a running Adler-32 with the bytes buf[0..len-1]. */
+unsigned long update_adler32(unsigned long adler, const unsigned char *buf, size_t len)
+{
+    return __atomic_load_n(&adler32_selected, __ATOMIC_RELAXED)(adler, buf, len);
+}
+
+#else
+
+unsigned long update_adler32(unsigned long adler, const unsigned char *buf, size_t len)
+{
+    return adler32_scalar(adler, buf, len);
+}
+
+#endif
@@ -0,0 +1,9 @@
+
+#include <stddef.h>
+
+/* Largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
+#define ADLER_BASE	65521
+#define ADLER_NMAX	5552
+
+unsigned long adler32_scalar(unsigned long adler, const unsigned char *buf, size_t len);
+unsigned long update_adler32(unsigned long adler, const unsigned char *buf, size_t len);
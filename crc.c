@@ -1,13 +1,17 @@
 
-/* This file is copied from http://www.w3.org/TR/PNG/#D-CRCAppendix */
+/* The table driven CRC is copied from http://www.w3.org/TR/PNG/#D-CRCAppendix,
+    crc_combine() uses the GF(2) matrix method of zlib's crc32_combine() */
 
 #include "crc.h"
+#include "PNGThreads.h"
+#include <pthread.h>
 
 /* Table of CRCs of all 8-bit messages. */
 unsigned long crc_table[256];
 
-/* Flag: has the table been computed? Initially false. */
-int crc_table_computed = 0;
+/* Files are checked on several threads, the first CRC fills the table
+    for all of them. */
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
 
 /* Make the table for a fast CRC. */
 void make_crc_table(void)
@@ -25,7 +29,6 @@ void make_crc_table(void)
         }
         crc_table[n] = c;
     }
-    crc_table_computed = 1;
 }
   
 
@@ -40,8 +43,7 @@ unsigned long update_crc(unsigned long crc, const unsigned char *buf,
     unsigned long c = crc;
     int n;
    
-    if (!crc_table_computed)
-        make_crc_table();
+    pthread_once(&crc_table_once, make_crc_table);
     for (n = 0; n < len; n++) {
         c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
     }
@@ -54,3 +56,120 @@ unsigned long crc(const unsigned char *buf, int len)
     return update_crc(0xffffffffL, buf, len) ^ 0xffffffffL;
 }
 
+
+
+/* Multiply the 32x32 GF(2) matrix mat by the vector vec. */
+static unsigned long gf2_matrix_times(const unsigned long *mat, unsigned long vec)
+{
+    unsigned long sum = 0;
+
+    while (vec) {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+/* square = mat * mat */
+static void gf2_matrix_square(unsigned long *square, const unsigned long *mat)
+{
+    int n;
+
+    for (n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Return the CRC of the concatenation of two buffers, given crc1 of the
+    first, crc2 of the second and the length of the second. Appending
+    len2 zero bits is applied to crc1 by repeated squaring of the operator
+    for one zero bit, so the cost is O(log len2). */
+unsigned long crc_combine(unsigned long crc1, unsigned long crc2, size_t len2)
+{
+    unsigned long even[32];    /* even-power-of-two zeros operator */
+    unsigned long odd[32];     /* odd-power-of-two zeros operator */
+    unsigned long row;
+    int n;
+
+    if (len2 == 0)
+        return crc1;
+
+    /* put operator for one zero bit in odd */
+    odd[0] = 0xedb88320L;
+    row = 1;
+    for (n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    /* put operator for two zero bits in even */
+    gf2_matrix_square(even, odd);
+
+    /* put operator for four zero bits in odd */
+    gf2_matrix_square(odd, even);
+
+    /* apply len2 zeros to crc1 (first square will put the operator for one
+       zero byte, eight zero bits, in even) */
+    do {
+        gf2_matrix_square(even, odd);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0)
+            break;
+
+        gf2_matrix_square(odd, even);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times(odd, crc1);
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+/* One segment of crc_parallel() */
+struct crc_segment {
+    const unsigned char *buf;
+    size_t len;
+    unsigned long crc;
+};
+
+static void crc_segment_task(void *context, size_t index)
+{
+    struct crc_segment *segment = (struct crc_segment *) context + index;
+
+    segment->crc = crc(segment->buf, (int) segment->len);
+}
+
+/* Return the CRC of the bytes buf[0..len-1], computed in segments on up
+    to threads cores and merged with crc_combine(). The result is the same
+    as crc(buf, len). */
+unsigned long crc_parallel(const unsigned char *buf, size_t len, unsigned int threads)
+{
+    struct crc_segment segment[CRC_MAX_SEGMENTS];
+    size_t count, segment_len, n;
+    unsigned long c;
+
+    if (threads < 2 || len < 2 * CRC_MIN_SEGMENT)
+        return crc(buf, (int) len);
+    count = len / CRC_MIN_SEGMENT;
+    if (count > threads)
+        count = threads;
+    if (count > CRC_MAX_SEGMENTS)
+        count = CRC_MAX_SEGMENTS;
+    segment_len = len / count;
+
+    for (n = 0; n < count; n++) {
+        segment[n].buf = buf + n * segment_len;
+        segment[n].len = (n == count - 1) ? len - n * segment_len : segment_len;
+    }
+    /* build the table before the threads share it */
+    pthread_once(&crc_table_once, make_crc_table);
+    parallelFor(count, threads, crc_segment_task, segment);
+
+    c = segment[0].crc;
+    for (n = 1; n < count; n++)
+        c = crc_combine(c, segment[n].crc, segment[n].len);
+    return c;
+}
@@ -1,5 +1,13 @@
 
+#include <stddef.h>
+
+/* Chunks at least this large are checked with crc_parallel() */
+#define CRC_PARALLEL_THRESHOLD	( 4 * 1024 * 1024 )
+#define CRC_MIN_SEGMENT		( 1024 * 1024 )
+#define CRC_MAX_SEGMENTS	64
+
 void make_crc_table(void);
 unsigned long update_crc(unsigned long crc, const unsigned char *buf, int len);
 unsigned long crc(const unsigned char *buf, int len);
-
+unsigned long crc_combine(unsigned long crc1, unsigned long crc2, size_t len2);
+unsigned long crc_parallel(const unsigned char *buf, size_t len, unsigned int threads);
@@ -0,0 +1,271 @@
+/*
+ * PNGPushLoad.c
+ *
+ *  Load test of pngPush(): one file is sent over many local socketpairs at
+ *  once and every stream is parsed from a single epoll loop, the way an
+ *  upload server would drive its connections.
+ *
+ *  Built from the top of the tree with the parser sources but its main(),
+ *  and the libraries of the parser:
+ *	gcc -O2 -o PNGPushLoad tools/PNGPushLoad.c $(ls *.c | grep -v '^PNGParser.c$') -lpthread -lz
+ *  Usage: PNGPushLoad <file_name> [streams] [slice bytes]
+ */
+
+#include "../PNGParser.h"
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define LOAD_STREAMS		1000 //streams by default
+#define LOAD_SLICE		1400 //bytes of one write by default, about a network packet
+#define LOAD_READ_SIZE		( 16 * 1024 )
+#define LOAD_EVENTS		256 //epoll events taken at once
+
+/*
+ * One upload, the sending end writes the file in slices and the receiving
+ * end pushes what arrives into the parser
+ */
+struct loadStream {
+	PNGData		PNG;
+	int			sendFd;
+	int			receiveFd;
+	size_t		sent; //bytes of the file written
+	int			finished;
+};
+
+typedef struct loadStream LoadStream;
+
+/*
+ * Totals of the run
+ */
+struct loadStats {
+	size_t	streams;
+	size_t	finished;
+	size_t	parsed;
+	size_t	failed;
+	size_t	bytes; //pushed into the parsers
+	size_t	pushes; //calls of pngPush()
+};
+
+typedef struct loadStats LoadStats;
+
+/*
+ * The whole file in memory, every stream sends the same bytes
+ */
+static unsigned char *readWholeFile( const char *FileName, size_t *Size ) {
+	unsigned char *data;
+	long length;
+	FILE *File = fopen( FileName, "rb" );
+	if (!File)
+		return NULL;
+	if (fseek( File, 0, SEEK_END ) || ( length = ftell( File ) ) < 0 || fseek( File, 0, SEEK_SET )) {
+		fclose( File );
+		return NULL;
+	}
+	data = (unsigned char*) malloc( length ? (size_t) length : 1 );
+	if (data && fread( data, 1, (size_t) length, File ) != (size_t) length) {
+		free( data );
+		data = NULL;
+	}
+	fclose( File );
+	*Size = (size_t) length;
+	return data;
+}
+
+static double getSeconds( void ) {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Two descriptors per stream and the epoll one must fit in the limit
+ */
+static int raiseFileLimit( size_t Streams ) {
+	struct rlimit limit;
+	rlim_t needed = (rlim_t) ( 2 * Streams + 16 );
+	if (getrlimit( RLIMIT_NOFILE, &limit ))
+		return FALSE;
+	if (limit.rlim_cur >= needed)
+		return TRUE;
+	if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed)
+		return FALSE;
+	limit.rlim_cur = needed;
+	return !setrlimit( RLIMIT_NOFILE, &limit );
+}
+
+/*
+ * The event of a descriptor carries the stream and which end it is
+ */
+static int watchStream( int Epoll, int Fd, uint32_t Events, size_t Index, int Sending ) {
+	struct epoll_event event;
+	event.events = Events;
+	event.data.u64 = ( (uint64_t) Index << 1 ) | (uint64_t) Sending;
+	return !epoll_ctl( Epoll, EPOLL_CTL_ADD, Fd, &event );
+}
+
+static int openStream( LoadStream *Stream, int Epoll, size_t Index ) {
+	int fds[2];
+	memset( Stream, 0, sizeof(*Stream) );
+	if (socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds ))
+		return FALSE;
+	Stream->sendFd = fds[0];
+	Stream->receiveFd = fds[1];
+	initPNGProcess( &Stream->PNG );
+	Stream->PNG.chunkInfo.quiet = TRUE;
+	return watchStream( Epoll, Stream->sendFd, EPOLLOUT, Index, TRUE ) &&
+			watchStream( Epoll, Stream->receiveFd, EPOLLIN, Index, FALSE );
+}
+
+/*
+ * The result of a stream is known, both ends are closed
+ */
+static void finishStream( LoadStream *Stream, int Parsed, LoadStats *Stats ) {
+	if (Stream->finished)
+		return;
+	Stream->finished = TRUE;
+	Stats->finished++;
+	if (Parsed)
+		Stats->parsed++;
+	else
+		Stats->failed++;
+	if (Stream->sendFd >= 0)
+		close( Stream->sendFd );
+	close( Stream->receiveFd );
+	Stream->sendFd = -1;
+	Stream->receiveFd = -1;
+	freePNGData( &Stream->PNG );
+}
+
+/*
+ * Write the next slices of the file until the socket is full, the sending
+ * end is closed once everything is out
+ */
+static void sendSlices( LoadStream *Stream, const unsigned char *File, size_t FileSize, size_t Slice ) {
+	while (Stream->sent < FileSize) {
+		size_t length = FileSize - Stream->sent < Slice ? FileSize - Stream->sent : Slice;
+		ssize_t written = write( Stream->sendFd, File + Stream->sent, length );
+		if (written <= 0)
+			return;
+		Stream->sent += (size_t) written;
+	}
+	close( Stream->sendFd );
+	Stream->sendFd = -1;
+}
+
+/*
+ * Push everything that arrived into the parser; the end of the stream
+ * before IEND is a truncated upload
+ */
+static void receiveData( LoadStream *Stream, unsigned char *Buffer, LoadStats *Stats ) {
+	for (;;) {
+		ssize_t received = read( Stream->receiveFd, Buffer, LOAD_READ_SIZE );
+		size_t consumed;
+		int status;
+		if (received < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ))
+			return;
+		if (received <= 0) {
+			finishStream( Stream, FALSE, Stats );
+			return;
+		}
+		status = pngPush( &Stream->PNG, Buffer, (size_t) received, &consumed );
+		Stats->pushes++;
+		Stats->bytes += consumed;
+		if (status != PNG_STATUS_NEED_MORE) {
+			finishStream( Stream, status == PNG_STATUS_DONE, Stats );
+			return;
+		}
+	}
+}
+
+int main( int argc, char *argv[] )
+{
+	unsigned char *file;
+	size_t fileSize;
+	size_t streamCount = LOAD_STREAMS;
+	size_t slice = LOAD_SLICE;
+	LoadStream *streams;
+	LoadStats stats;
+	struct epoll_event events[LOAD_EVENTS];
+	unsigned char buffer[LOAD_READ_SIZE];
+	double startTime, elapsed;
+	int epoll;
+	size_t i;
+
+	if (argc < 2) {
+		printf( "Usage: PNGPushLoad <file_name> [streams] [slice bytes]\n" );
+		return 0;
+	}
+	if (argc > 2)
+		streamCount = (size_t) atol( argv[2] );
+	if (argc > 3)
+		slice = (size_t) atol( argv[3] );
+	if (!streamCount || !slice) {
+		printf( "INVALID STREAMS OR SLICE\n" );
+		return -1;
+	}
+	file = readWholeFile( argv[1], &fileSize );
+	if (!file) {
+		printf( "Cannot open file %s\n", argv[1] );
+		return -1;
+	}
+	if (!raiseFileLimit( streamCount )) {
+		printf( "TOO MANY STREAMS FOR THE FILE DESCRIPTOR LIMIT: %lu\n", (unsigned long) streamCount );
+		free( file );
+		return -1;
+	}
+	streams = (LoadStream*) calloc( streamCount, sizeof(LoadStream) );
+	epoll = epoll_create1( 0 );
+	if (!streams || epoll < 0) {
+		printf( "%s\n", pngErrorString( PNG_ERROR_MEMORY ) );
+		free( streams );
+		free( file );
+		return -1;
+	}
+
+	memset( &stats, 0, sizeof(stats) );
+	startTime = getSeconds();
+	for (i = 0; i < streamCount; i++) {
+		if (!openStream( &streams[i], epoll, i )) {
+			printf( "CAN'T OPEN STREAM %lu\n", (unsigned long) i );
+			break;
+		}
+		stats.streams++;
+	}
+	while (stats.finished < stats.streams) {
+		int count = epoll_wait( epoll, events, LOAD_EVENTS, -1 );
+		int e;
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			break;
+		for (e = 0; e < count; e++) {
+			LoadStream *stream = &streams[events[e].data.u64 >> 1];
+			if (stream->finished)
+				continue;
+			if (events[e].data.u64 & 1)
+				sendSlices( stream, file, fileSize, slice );
+			else
+				receiveData( stream, buffer, &stats );
+		}
+	}
+	elapsed = getSeconds() - startTime;
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+
+	printf( "STREAMS: %lu PARSED: %lu FAILED: %lu\n", (unsigned long) stats.streams, (unsigned long) stats.parsed,
+			(unsigned long) stats.failed );
+	printf( "PUSHED: %lu BYTES IN %lu CALLS, %.3lf s (%.1lf streams/s, %.1lf MB/s)\n", (unsigned long) stats.bytes,
+			(unsigned long) stats.pushes, elapsed, stats.finished / elapsed,
+			stats.bytes / elapsed / (1024.0 * 1024.0) );
+	printf( "STATE: %lu BYTES PER STREAM\n", (unsigned long) sizeof(PNGData) );
+	for (i = 0; i < stats.streams; i++)
+		finishStream( &streams[i], FALSE, &stats );
+	close( epoll );
+	free( streams );
+	free( file );
+	return 0;
+}